@@ -0,0 +1,262 @@
+/* AES-128 CBC decryption, see aes.h */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "aes.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AES_HAVE_AESNI
+#include <wmmintrin.h>
+#endif
+#if defined(__aarch64__)
+#define AES_HAVE_ARMV8
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_AES
+#define HWCAP_AES (1 << 3)
+#endif
+#endif
+
+static uint8_t sbox[256], invSbox[256];
+static uint8_t mul9[256], mul11[256], mul13[256], mul14[256]; /* for InvMixColumns */
+static void (*cbcDecryptFunction)(const aes128_key *key, const uint8_t *iv, const uint8_t *in, uint8_t *out, int nBlocks);
+static void (*prepareDecryptKeyFunction)(aes128_key *key);
+static const char *backendName = "none";
+
+/*********************************************************************/
+/* portable implementation */
+
+static uint8_t xtime(uint8_t x) {
+	return (uint8_t)((x<<1) ^ ((x & 0x80) ? 0x1b : 0));
+}
+
+static uint8_t gfMul(uint8_t a, uint8_t b) {
+	uint8_t r=0;
+	while (b) {
+		if (b & 1) r ^= a;
+		a = xtime(a);
+		b >>= 1;
+	}
+	return r;
+}
+
+/* The S-box is calculated instead of typed in: multiplicative inverse in GF(2^8)
+   followed by the affine transformation. */
+static void buildSboxes(void) {
+	uint8_t p=1, q=1, x;
+	do {
+		/* p runs through all nonzero elements (multiply by 3), q through their inverses (divide by 3) */
+		p = p ^ xtime(p);
+		q ^= q << 1;
+		q ^= q << 2;
+		q ^= q << 4;
+		if (q & 0x80) q ^= 0x09;
+		x = q ^ (uint8_t)((q<<1)|(q>>7)) ^ (uint8_t)((q<<2)|(q>>6)) ^ (uint8_t)((q<<3)|(q>>5)) ^ (uint8_t)((q<<4)|(q>>4));
+		sbox[p] = x ^ 0x63;
+	} while (p != 1);
+	sbox[0] = 0x63;
+	for (p=0; ; p++) {
+		invSbox[sbox[p]] = p;
+		mul9[p] = gfMul(p, 9);
+		mul11[p] = gfMul(p, 11);
+		mul13[p] = gfMul(p, 13);
+		mul14[p] = gfMul(p, 14);
+		if (p==255) break;
+	}
+}
+
+static void expandKey(uint8_t *rk, const uint8_t *keyBytes) {
+	uint8_t rcon=1, t[4], tmp;
+	int i;
+	memcpy(rk, keyBytes, AES128_KEY_SIZE);
+	for (i=AES128_KEY_SIZE; i<(AES128_ROUNDS+1)*AES_BLOCK_SIZE; i+=4) {
+		memcpy(t, rk+i-4, 4);
+		if ((i % AES128_KEY_SIZE)==0) {
+			tmp = t[0];
+			t[0] = sbox[t[1]] ^ rcon;
+			t[1] = sbox[t[2]];
+			t[2] = sbox[t[3]];
+			t[3] = sbox[tmp];
+			rcon = xtime(rcon);
+		}
+		rk[i+0] = rk[i-16+0] ^ t[0];
+		rk[i+1] = rk[i-16+1] ^ t[1];
+		rk[i+2] = rk[i-16+2] ^ t[2];
+		rk[i+3] = rk[i-16+3] ^ t[3];
+	}
+}
+
+static void decryptBlockPortable(const uint8_t *rk, uint8_t *s) {
+	uint8_t t[16];
+	int round, i, c;
+	for (i=0; i<16; i++) s[i] ^= rk[AES128_ROUNDS*16+i];
+	for (round=AES128_ROUNDS-1; ; round--) {
+		/* InvShiftRows and InvSubBytes. The state is column major: s[4*column+row]. */
+		for (c=0; c<4; c++) {
+			t[4*c+0] = invSbox[s[4*c+0]];
+			t[4*c+1] = invSbox[s[4*((c+3)&3)+1]];
+			t[4*c+2] = invSbox[s[4*((c+2)&3)+2]];
+			t[4*c+3] = invSbox[s[4*((c+1)&3)+3]];
+		}
+		for (i=0; i<16; i++) t[i] ^= rk[round*16+i];
+		if (round==0) {
+			memcpy(s, t, 16);
+			break;
+		}
+		/* InvMixColumns */
+		for (c=0; c<4; c++) {
+			uint8_t a0=t[4*c], a1=t[4*c+1], a2=t[4*c+2], a3=t[4*c+3];
+			s[4*c+0] = mul14[a0] ^ mul11[a1] ^ mul13[a2] ^ mul9[a3];
+			s[4*c+1] = mul9[a0] ^ mul14[a1] ^ mul11[a2] ^ mul13[a3];
+			s[4*c+2] = mul13[a0] ^ mul9[a1] ^ mul14[a2] ^ mul11[a3];
+			s[4*c+3] = mul11[a0] ^ mul13[a1] ^ mul9[a2] ^ mul14[a3];
+		}
+	}
+}
+
+static void cbcDecryptPortable(const aes128_key *key, const uint8_t *iv, const uint8_t *in, uint8_t *out, int nBlocks) {
+	uint8_t chain[16], block[16], cipher[16];
+	int n, i;
+	memcpy(chain, iv, 16);
+	for (n=0; n<nBlocks; n++) {
+		memcpy(cipher, in+16*n, 16);
+		memcpy(block, cipher, 16);
+		decryptBlockPortable(key->ek, block);
+		for (i=0; i<16; i++) out[16*n+i] = block[i] ^ chain[i];
+		memcpy(chain, cipher, 16);
+	}
+}
+
+static void prepareDecryptKeyPortable(aes128_key *key) {
+	(void)key; /* the portable code uses the encryption round keys in reverse order */
+}
+
+/*********************************************************************/
+/* AES-NI */
+#ifdef AES_HAVE_AESNI
+__attribute__((target("aes,sse2")))
+static void prepareDecryptKeyAesni(aes128_key *key) {
+	int i;
+	/* equivalent inverse cipher: reversed order, InvMixColumns on the middle round keys */
+	_mm_store_si128((__m128i *)key->dk, _mm_load_si128((const __m128i *)(key->ek + 16*AES128_ROUNDS)));
+	for (i=1; i<AES128_ROUNDS; i++) {
+		_mm_store_si128((__m128i *)(key->dk + 16*i), _mm_aesimc_si128(_mm_load_si128((const __m128i *)(key->ek + 16*(AES128_ROUNDS-i)))));
+	}
+	_mm_store_si128((__m128i *)(key->dk + 16*AES128_ROUNDS), _mm_load_si128((const __m128i *)key->ek));
+}
+
+__attribute__((target("aes,sse2")))
+static void cbcDecryptAesni(const aes128_key *key, const uint8_t *iv, const uint8_t *in, uint8_t *out, int nBlocks) {
+	__m128i rk[AES128_ROUNDS+1];
+	__m128i chain = _mm_loadu_si128((const __m128i *)iv);
+	int n, r;
+	for (r=0; r<=AES128_ROUNDS; r++) rk[r] = _mm_load_si128((const __m128i *)(key->dk + 16*r));
+	/* CBC decryption has no dependency between the blocks, so four blocks
+	   go through the pipeline at the same time. */
+	for (n=0; n+4<=nBlocks; n+=4) {
+		__m128i c0 = _mm_loadu_si128((const __m128i *)(in+16*n));
+		__m128i c1 = _mm_loadu_si128((const __m128i *)(in+16*n+16));
+		__m128i c2 = _mm_loadu_si128((const __m128i *)(in+16*n+32));
+		__m128i c3 = _mm_loadu_si128((const __m128i *)(in+16*n+48));
+		__m128i b0 = _mm_xor_si128(c0, rk[0]);
+		__m128i b1 = _mm_xor_si128(c1, rk[0]);
+		__m128i b2 = _mm_xor_si128(c2, rk[0]);
+		__m128i b3 = _mm_xor_si128(c3, rk[0]);
+		for (r=1; r<AES128_ROUNDS; r++) {
+			b0 = _mm_aesdec_si128(b0, rk[r]);
+			b1 = _mm_aesdec_si128(b1, rk[r]);
+			b2 = _mm_aesdec_si128(b2, rk[r]);
+			b3 = _mm_aesdec_si128(b3, rk[r]);
+		}
+		b0 = _mm_xor_si128(_mm_aesdeclast_si128(b0, rk[AES128_ROUNDS]), chain);
+		b1 = _mm_xor_si128(_mm_aesdeclast_si128(b1, rk[AES128_ROUNDS]), c0);
+		b2 = _mm_xor_si128(_mm_aesdeclast_si128(b2, rk[AES128_ROUNDS]), c1);
+		b3 = _mm_xor_si128(_mm_aesdeclast_si128(b3, rk[AES128_ROUNDS]), c2);
+		_mm_storeu_si128((__m128i *)(out+16*n), b0);
+		_mm_storeu_si128((__m128i *)(out+16*n+16), b1);
+		_mm_storeu_si128((__m128i *)(out+16*n+32), b2);
+		_mm_storeu_si128((__m128i *)(out+16*n+48), b3);
+		chain = c3;
+	}
+	for (; n<nBlocks; n++) {
+		__m128i c = _mm_loadu_si128((const __m128i *)(in+16*n));
+		__m128i b = _mm_xor_si128(c, rk[0]);
+		for (r=1; r<AES128_ROUNDS; r++) b = _mm_aesdec_si128(b, rk[r]);
+		b = _mm_xor_si128(_mm_aesdeclast_si128(b, rk[AES128_ROUNDS]), chain);
+		_mm_storeu_si128((__m128i *)(out+16*n), b);
+		chain = c;
+	}
+}
+#endif
+
+/*********************************************************************/
+/* ARMv8 crypto extension */
+#ifdef AES_HAVE_ARMV8
+__attribute__((target("+crypto")))
+static void prepareDecryptKeyArmv8(aes128_key *key) {
+	int i;
+	vst1q_u8(key->dk, vld1q_u8(key->ek + 16*AES128_ROUNDS));
+	for (i=1; i<AES128_ROUNDS; i++) {
+		vst1q_u8(key->dk + 16*i, vaesimcq_u8(vld1q_u8(key->ek + 16*(AES128_ROUNDS-i))));
+	}
+	vst1q_u8(key->dk + 16*AES128_ROUNDS, vld1q_u8(key->ek));
+}
+
+__attribute__((target("+crypto")))
+static void cbcDecryptArmv8(const aes128_key *key, const uint8_t *iv, const uint8_t *in, uint8_t *out, int nBlocks) {
+	uint8x16_t rk[AES128_ROUNDS+1];
+	uint8x16_t chain = vld1q_u8(iv);
+	int n, r;
+	for (r=0; r<=AES128_ROUNDS; r++) rk[r] = vld1q_u8(key->dk + 16*r);
+	for (n=0; n<nBlocks; n++) {
+		uint8x16_t c = vld1q_u8(in+16*n);
+		uint8x16_t b = c;
+		/* vaesdq does AddRoundKey first, then InvShiftRows and InvSubBytes */
+		for (r=0; r<AES128_ROUNDS-1; r++) b = vaesimcq_u8(vaesdq_u8(b, rk[r]));
+		b = vaesdq_u8(b, rk[AES128_ROUNDS-1]);
+		b = veorq_u8(veorq_u8(b, rk[AES128_ROUNDS]), chain);
+		vst1q_u8(out+16*n, b);
+		chain = c;
+	}
+}
+#endif
+
+/*********************************************************************/
+
+void aesInit(void) {
+	buildSboxes();
+	cbcDecryptFunction = cbcDecryptPortable;
+	prepareDecryptKeyFunction = prepareDecryptKeyPortable;
+	backendName = "portable";
+#ifdef AES_HAVE_AESNI
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("aes")) {
+		cbcDecryptFunction = cbcDecryptAesni;
+		prepareDecryptKeyFunction = prepareDecryptKeyAesni;
+		backendName = "AES-NI";
+	}
+#endif
+#ifdef AES_HAVE_ARMV8
+	/* not every ARMv8 core has it, e.g. the Cortex-A72 of the Raspberry Pi 4 */
+	if (getauxval(AT_HWCAP) & HWCAP_AES) {
+		cbcDecryptFunction = cbcDecryptArmv8;
+		prepareDecryptKeyFunction = prepareDecryptKeyArmv8;
+		backendName = "ARMv8 crypto";
+	}
+#endif
+}
+
+const char *aesBackendName(void) {
+	return backendName;
+}
+
+void aesSetDecryptKey(aes128_key *key, const uint8_t *keyBytes) {
+	expandKey(key->ek, keyBytes);
+	prepareDecryptKeyFunction(key);
+}
+
+void aesCbcDecrypt(const aes128_key *key, const uint8_t *iv, const uint8_t *in, uint8_t *out, int nBlocks) {
+	cbcDecryptFunction(key, iv, in, out, nBlocks);
+}
@@ -0,0 +1,31 @@
+/* AES-128 decryption (CBC), for the encrypted HomePlug payloads
+ *
+ * Three implementations, selected at runtime by aesInit():
+ *   - AES-NI on x86, if the CPU has it
+ *   - ARMv8 crypto extension on aarch64, if the CPU has it
+ *   - portable C, byte oriented, as fallback
+ * The key schedule is prepared once per key (aesSetDecryptKey), so the
+ * caller should keep it, see the key schedule cache in encpayload.c.
+ */
+
+#ifndef AES_HEADER
+#define AES_HEADER
+
+#include <stdint.h>
+
+#define AES_BLOCK_SIZE 16
+#define AES128_KEY_SIZE 16
+#define AES128_ROUNDS 10
+
+typedef struct aes128_key {
+	uint8_t ek[(AES128_ROUNDS+1)*AES_BLOCK_SIZE] __attribute__((aligned(16))); /* encryption round keys */
+	uint8_t dk[(AES128_ROUNDS+1)*AES_BLOCK_SIZE] __attribute__((aligned(16))); /* for the hardware: equivalent inverse cipher */
+} aes128_key;
+
+void aesInit(void);
+const char *aesBackendName(void);
+void aesSetDecryptKey(aes128_key *key, const uint8_t *keyBytes);
+/* Decrypts nBlocks blocks in CBC mode. in and out may be the same buffer. */
+void aesCbcDecrypt(const aes128_key *key, const uint8_t *iv, const uint8_t *in, uint8_t *out, int nBlocks);
+
+#endif
@@ -0,0 +1,193 @@
+/* Reading of pcap and pcapng capture files, see capreader.h */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "capreader.h"
+#include "capture.h"
+
+static uint32_t rd32(const capture_file *f, const uint8_t *p) {
+	uint32_t v = p[0] | (p[1]<<8) | (p[2]<<16) | ((uint32_t)p[3]<<24);
+	return f->swapped ? __builtin_bswap32(v) : v;
+}
+
+static uint16_t rd16(const capture_file *f, const uint8_t *p) {
+	uint16_t v = p[0] | (p[1]<<8);
+	return f->swapped ? __builtin_bswap16(v) : v;
+}
+
+static uint64_t ticksToNs(uint64_t ticks, uint8_t tsresol) {
+	uint64_t scale = 1;
+	int i, v = tsresol & 0x7f;
+	if (tsresol & 0x80) {
+		/* negative power of two */
+		return (ticks >> v) * 1000000000ull + (((ticks & ((1ull<<v)-1)) * 1000000000ull) >> v);
+	}
+	if (v <= 9) {
+		for (i=v; i<9; i++) scale *= 10;
+		return ticks * scale;
+	}
+	for (i=9; i<v; i++) scale *= 10;
+	return ticks / scale;
+}
+
+int captureReaderOpen(capture_file *f, const char *name) {
+	struct stat st;
+	uint32_t magic;
+	int fd;
+	memset(f, 0, sizeof(*f));
+	f->name = name;
+	fd = open(name, O_RDONLY);
+	if (fd<0) {
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+		return -1;
+	}
+	if ((fstat(fd, &st)<0) || (st.st_size < 24)) {
+		fprintf(stderr, "%s: too short\n", name);
+		close(fd);
+		return -1;
+	}
+	f->size = st.st_size;
+	f->data = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (f->data == MAP_FAILED) {
+		fprintf(stderr, "%s: mmap failed: %s\n", name, strerror(errno));
+		return -1;
+	}
+	madvise((void *)f->data, f->size, MADV_SEQUENTIAL);
+	magic = f->data[0] | (f->data[1]<<8) | (f->data[2]<<16) | ((uint32_t)f->data[3]<<24);
+	if ((magic == PCAP_MAGIC_USEC) || (magic == PCAP_MAGIC_NSEC)) {
+		f->format = CAPREADER_FORMAT_PCAP;
+		f->nsec = (magic == PCAP_MAGIC_NSEC);
+	} else if ((magic == __builtin_bswap32(PCAP_MAGIC_USEC)) || (magic == __builtin_bswap32(PCAP_MAGIC_NSEC))) {
+		f->format = CAPREADER_FORMAT_PCAP;
+		f->swapped = 1;
+		f->nsec = (magic == __builtin_bswap32(PCAP_MAGIC_NSEC));
+	} else if (magic == PCAPNG_SHB) {
+		f->format = CAPREADER_FORMAT_PCAPNG;
+		f->swapped = (rd32(f, f->data+8) != PCAPNG_BYTEORDER_MAGIC);
+	} else {
+		fprintf(stderr, "%s: neither pcap nor pcapng\n", name);
+		munmap((void *)f->data, f->size);
+		return -1;
+	}
+	if (f->format == CAPREADER_FORMAT_PCAP) f->pcapLinktype = rd32(f, f->data+20);
+	return 0;
+}
+
+static void parseInterfaceBlock(capture_file *f, const uint8_t *body, uint32_t bodyLen) {
+	uint32_t pos = 8;
+	int i = f->nInterfaces;
+	if ((i >= CAPREADER_MAX_INTERFACES) || (bodyLen < 8)) return;
+	f->ifLinktype[i] = rd16(f, body);
+	f->ifTsresol[i] = 6; /* default microseconds */
+	while (pos+4 <= bodyLen) {
+		uint16_t code = rd16(f, body+pos);
+		uint16_t len = rd16(f, body+pos+2);
+		if (code == 0) break;
+		if ((code == PCAPNG_OPT_IF_TSRESOL) && (len == 1) && (pos+5 <= bodyLen)) f->ifTsresol[i] = body[pos+4];
+		pos += 4 + ((len+3) & ~3u);
+	}
+	f->nInterfaces++;
+}
+
+int captureReaderNext(capture_file *f, capture_cursor *c, int indexing, const uint8_t **frame, uint32_t *capLen, uint64_t *tsNs, uint16_t *linktype) {
+	const uint8_t *p = f->data + c->offset;
+	size_t remaining = f->size - c->offset;
+	if (f->format == CAPREADER_FORMAT_PCAP) {
+		uint32_t len, frac;
+		if (c->offset == 0) {
+			c->offset = sizeof(pcap_file_header);
+			return 0;
+		}
+		if (remaining < sizeof(pcap_record_header)) return -1;
+		len = rd32(f, p+8);
+		if ((len > CAPREADER_MAX_RECORD_LEN) || (len > remaining - sizeof(pcap_record_header))) {
+			f->corrupt = 1;
+			return -1;
+		}
+		frac = rd32(f, p+4);
+		*tsNs = (uint64_t)rd32(f, p) * 1000000000ull + (f->nsec ? frac : (uint64_t)frac*1000);
+		*frame = p + sizeof(pcap_record_header);
+		*capLen = len;
+		*linktype = f->pcapLinktype;
+		c->offset += sizeof(pcap_record_header) + len;
+		return 1;
+	} else {
+		uint32_t type, blockLen, ifId;
+		if (remaining < 12) return -1;
+		type = rd32(f, p);
+		blockLen = rd32(f, p+4);
+		if ((blockLen < 12) || (blockLen & 3) || (blockLen > remaining)) {
+			f->corrupt = 1;
+			return -1;
+		}
+		c->offset += blockLen;
+		switch (type) {
+			case PCAPNG_SHB:
+				if (p != f->data) {
+					c->section++;
+					if (indexing && (f->nSections < CAPREADER_MAX_SECTIONS)) f->sectionIfBase[f->nSections++] = f->nInterfaces;
+				} else if (indexing) {
+					f->nSections = 1;
+					f->sectionIfBase[0] = 0;
+				}
+				return 0;
+			case PCAPNG_IDB:
+				if (indexing) parseInterfaceBlock(f, p+8, blockLen-12);
+				return 0;
+			case PCAPNG_EPB:
+			case PCAPNG_PB:
+				if (blockLen < 32) return 0;
+				if (type == PCAPNG_EPB) {
+					ifId = rd32(f, p+8);
+				} else {
+					ifId = rd16(f, p+8);
+				}
+				if (c->section < f->nSections) ifId += f->sectionIfBase[c->section];
+				if (ifId >= (uint32_t)f->nInterfaces) return 0;
+				*capLen = rd32(f, p+20);
+				if (*capLen > blockLen-32) {
+					f->corrupt = 1;
+					return -1;
+				}
+				*tsNs = ticksToNs(((uint64_t)rd32(f, p+12)<<32) | rd32(f, p+16), f->ifTsresol[ifId]);
+				*frame = p+28;
+				*linktype = f->ifLinktype[ifId];
+				return 1;
+			case PCAPNG_SPB:
+				if (blockLen < 16) return 0;
+				ifId = (c->section < f->nSections) ? f->sectionIfBase[c->section] : 0;
+				if (ifId >= (uint32_t)f->nInterfaces) return 0;
+				*capLen = rd32(f, p+8);
+				if (*capLen > blockLen-16) *capLen = blockLen-16;
+				*tsNs = 0; /* no timestamp, the caller keeps the last one */
+				*frame = p+12;
+				*linktype = f->ifLinktype[ifId];
+				return 1;
+		}
+		return 0;
+	}
+}
+
+void captureReaderClose(capture_file *f) {
+	munmap((void *)f->data, f->size);
+}
+
+void captureReaderScanInterfaces(capture_file *f) {
+	capture_cursor c = { 0, 0 };
+	const uint8_t *frame;
+	uint32_t capLen;
+	uint64_t tsNs;
+	uint16_t linktype;
+	if (f->format != CAPREADER_FORMAT_PCAPNG) return;
+	/* the interface blocks come before the packets which use them */
+	while (captureReaderNext(f, &c, 1, &frame, &capLen, &tsNs, &linktype) == 0);
+	/* sections later in the file are found by the full indexing only */
+}
@@ -0,0 +1,69 @@
+/* Reading of pcap and pcapng capture files
+ *
+ * The file is memory-mapped, and the records are read directly from the mapping,
+ * without copying. Supports classic pcap (micro- and nanoseconds, both byte
+ * orders) and pcapng (enhanced, simple and obsolete packet blocks, several
+ * interfaces with their own timestamp resolution, several sections).
+ * Several threads may read the same file with their own cursors, once the
+ * interface table is complete (captureReaderScanInterfaces, or an indexing pass).
+ */
+
+#ifndef CAPREADER_HEADER
+#define CAPREADER_HEADER
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CAPREADER_MAX_INTERFACES 64
+#define CAPREADER_MAX_SECTIONS 64
+#define CAPREADER_MAX_RECORD_LEN (256*1024)
+
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_BYTEORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_IDB 1
+#define PCAPNG_PB 2 /* obsolete packet block */
+#define PCAPNG_SPB 3
+#define PCAPNG_EPB 6
+#define PCAPNG_OPT_IF_TSRESOL 9
+
+enum { CAPREADER_FORMAT_PCAP, CAPREADER_FORMAT_PCAPNG };
+
+typedef struct index_point {
+	size_t offset;
+	int section;
+	uint64_t tsNs; /* of the first frame at or after the offset */
+} index_point;
+
+typedef struct capture_file {
+	const char *name;
+	const uint8_t *data;
+	size_t size;
+	int format;
+	int swapped; /* written on a machine with other byte order. For pcapng, the first section decides. */
+	int nsec;    /* pcap: nanosecond timestamps */
+	uint32_t pcapLinktype;
+	int nInterfaces;
+	uint8_t ifTsresol[CAPREADER_MAX_INTERFACES];
+	uint16_t ifLinktype[CAPREADER_MAX_INTERFACES];
+	int nSections;
+	int sectionIfBase[CAPREADER_MAX_SECTIONS];
+	index_point *points; /* optional, filled by the user, e.g. plc_analyzer */
+	int nPoints;
+	int corrupt;
+} capture_file;
+
+typedef struct capture_cursor {
+	size_t offset;
+	int section;
+} capture_cursor;
+
+int captureReaderOpen(capture_file *f, const char *name);
+void captureReaderClose(capture_file *f);
+/* Reads the record at the cursor and advances it. Returns 1 for a frame, 0 for
+   a block without frame, -1 at the end of the file or if it is corrupt. The
+   interface and section tables are only filled while indexing. */
+int captureReaderNext(capture_file *f, capture_cursor *c, int indexing, const uint8_t **frame, uint32_t *capLen, uint64_t *tsNs, uint16_t *linktype);
+/* Fills the interface table of a pcapng file, for reading from the middle of the file. */
+void captureReaderScanInterfaces(capture_file *f);
+
+#endif
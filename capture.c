@@ -0,0 +1,61 @@
+/* Raw capture output, see capture.h */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "capture.h"
+#include "uring.h"
+
+int captureActive;
+uint32_t nCapturedFrames;
+uint64_t captureOffset, captureLastRecordOffset;
+static FILE *hCaptureFile;
+static int captureWriter = -1; /* io_uring writer, or -1 for stdio */
+
+static void captureOutput(const void *data, unsigned len) {
+	if (captureWriter >= 0) {
+		uringWrite(captureWriter, data, len);
+	} else {
+		fwrite(data, 1, len, hCaptureFile);
+	}
+}
+
+int captureOpen(const char *fileName) {
+	pcap_file_header fh;
+	hCaptureFile = fopen(fileName, "wb");
+	if (!hCaptureFile) return -1;
+	captureWriter = uringWriterOpen(fileno(hCaptureFile));
+	memset(&fh, 0, sizeof(fh));
+	fh.magic = PCAP_MAGIC_USEC;
+	fh.versionMajor = 2;
+	fh.versionMinor = 4;
+	fh.snaplen = PCAP_SNAPLEN;
+	fh.linktype = PCAP_LINKTYPE_ETHERNET;
+	captureOutput(&fh, sizeof(fh));
+	captureOffset = sizeof(fh);
+	captureActive = 1;
+	return 0;
+}
+
+void captureWriteFrame(const unsigned char *frame, int len, const struct timespec *ts) {
+	pcap_record_header rh;
+	if (!captureActive) return;
+	if (len > PCAP_SNAPLEN) len = PCAP_SNAPLEN;
+	rh.tsSec = ts->tv_sec;
+	rh.tsFrac = ts->tv_nsec / 1000;
+	rh.capLen = len;
+	rh.origLen = len;
+	captureOutput(&rh, sizeof(rh));
+	captureOutput(frame, len);
+	captureLastRecordOffset = captureOffset;
+	captureOffset += sizeof(rh) + len;
+	nCapturedFrames++;
+}
+
+void captureClose(void) {
+	if (!captureActive) return;
+	captureActive = 0;
+	/* With io_uring, the pending data is written in uringExit(), so this
+	   must be called after uringExit(). */
+	fclose(hCaptureFile);
+}
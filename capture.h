@@ -0,0 +1,46 @@
+/* Raw capture output
+ *
+ * Writes all received frames into a pcap file (classic libpcap format,
+ * microsecond timestamps, link type Ethernet), which can be opened with
+ * wireshark. If the io_uring backend is active, the data goes through a
+ * queued writer, otherwise through stdio.
+ */
+
+#ifndef CAPTURE_HEADER
+#define CAPTURE_HEADER
+
+#include <stdint.h>
+#include <time.h>
+
+#define PCAP_MAGIC_USEC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAP_LINKTYPE_ETHERNET 1
+#define PCAP_SNAPLEN 65535
+
+typedef struct pcap_file_header {
+	uint32_t magic;
+	uint16_t versionMajor;
+	uint16_t versionMinor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+} pcap_file_header;
+
+typedef struct pcap_record_header {
+	uint32_t tsSec;
+	uint32_t tsFrac; /* microseconds or nanoseconds, depending on the magic */
+	uint32_t capLen;
+	uint32_t origLen;
+} pcap_record_header;
+
+extern int captureActive;
+extern uint32_t nCapturedFrames;
+extern uint64_t captureOffset; /* file size so far */
+extern uint64_t captureLastRecordOffset; /* where the last frame was written, for the session index */
+
+int captureOpen(const char *fileName);
+void captureWriteFrame(const unsigned char *frame, int len, const struct timespec *ts);
+void captureClose(void);
+
+#endif
@@ -0,0 +1,52 @@
+/* Time source of the timers, see clock.h */
+
+#include <stdint.h>
+#include <time.h>
+
+#include "clock.h"
+
+int clockVirtualActive;
+static uint64_t virtualNs;
+
+uint64_t clockMonotonicNs(void) {
+	struct timespec ts;
+	if (clockVirtualActive) return virtualNs;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+uint64_t clockMonotonicMs(void) {
+	return clockMonotonicNs() / 1000000;
+}
+
+void clockRealtime(struct timespec *ts) {
+	if (clockVirtualActive) {
+		ts->tv_sec = CLOCK_VIRTUAL_EPOCH_S + virtualNs / 1000000000ull;
+		ts->tv_nsec = virtualNs % 1000000000ull;
+		return;
+	}
+	clock_gettime(CLOCK_REALTIME, ts);
+}
+
+uint32_t clockUnixTime(void) {
+	struct timespec ts;
+	clockRealtime(&ts);
+	return ts.tv_sec;
+}
+
+int64_t clockMonotonicToRealtimeNs(void) {
+	struct timespec tsReal, tsMono;
+	if (clockVirtualActive) return (int64_t)CLOCK_VIRTUAL_EPOCH_S*1000000000ll;
+	clock_gettime(CLOCK_REALTIME, &tsReal);
+	clock_gettime(CLOCK_MONOTONIC, &tsMono);
+	return ((int64_t)tsReal.tv_sec - tsMono.tv_sec)*1000000000ll + (tsReal.tv_nsec - tsMono.tv_nsec);
+}
+
+void clockStartVirtual(uint64_t startMs) {
+	virtualNs = startMs * 1000000ull;
+	clockVirtualActive = 1;
+}
+
+void clockAdvanceMs(uint32_t ms) {
+	virtualNs += (uint64_t)ms * 1000000ull;
+}
@@ -0,0 +1,35 @@
+/* Time source of the timers
+ *
+ * The timeouts and rate limits take their time from here: the SLAC session
+ * supervision, the request/response API, the transmit scheduler and the ages in
+ * the station table. Normally this is CLOCK_MONOTONIC and CLOCK_REALTIME.
+ * The simulation (-S, slacsim.c) switches to a virtual clock. It stands still
+ * until clockAdvanceMs() is called, so the timeouts run in fast-forward, and each
+ * run with the same seed gives the same result. The virtual realtime is a fixed
+ * epoch plus the virtual monotonic time.
+ * The measurements of real durations (trace, loop monitor, pipeline latency,
+ * replay timing) keep using the real clocks.
+ */
+
+#ifndef CLOCK_HEADER
+#define CLOCK_HEADER
+
+#include <stdint.h>
+#include <time.h>
+
+#define CLOCK_VIRTUAL_EPOCH_S 1800000000u /* realtime of the virtual monotonic time 0 */
+
+extern int clockVirtualActive;
+
+uint64_t clockMonotonicNs(void);
+uint64_t clockMonotonicMs(void);
+void clockRealtime(struct timespec *ts);
+uint32_t clockUnixTime(void); /* seconds, like time(NULL) */
+/* to convert the monotonic times of the SLAC sessions into unix time */
+int64_t clockMonotonicToRealtimeNs(void);
+
+/* From now on, the time only moves with clockAdvanceMs(). */
+void clockStartVirtual(uint64_t startMs);
+void clockAdvanceMs(uint32_t ms);
+
+#endif
@@ -0,0 +1,161 @@
+/* Decryption of CM_ENCRYPTED_PAYLOAD.IND, see encpayload.h */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <arpa/inet.h>
+
+#include "encpayload.h"
+#include "aes.h"
+#include "stations.h"
+
+/* after the embedded MME: CRC-32, PID, PRN, PMN. The last byte is the RFLEN. */
+#define ENC_TRAILER_LEN (4+1+2+1)
+
+int encPayloadActive;
+uint32_t nEncPayloads, nEncDecrypted, nEncNoKey, nEncUnsupportedPeks, nEncMalformed;
+
+static uint8_t learnedKeys[ENCPAYLOAD_LEARNED_KEYS][SLAC_NMK_LEN];
+static int nLearnedKeys, nextLearnedKey;
+
+typedef struct schedule_entry {
+	uint8_t inUse;
+	uint8_t nmk[SLAC_NMK_LEN];
+	aes128_key key;
+} schedule_entry;
+static schedule_entry scheduleCache[ENCPAYLOAD_SCHEDULE_CACHE];
+static int nextSchedule;
+
+static uint32_t crcTable[256];
+static uint8_t plain[ETH_FRAME_LEN+AES_BLOCK_SIZE];
+
+static void buildCrcTable(void) {
+	uint32_t c, n;
+	int k;
+	for (n=0; n<256; n++) {
+		c = n;
+		for (k=0; k<8; k++) c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+		crcTable[n] = c;
+	}
+}
+
+static uint32_t crc32(const uint8_t *p, int len) {
+	uint32_t c = 0xFFFFFFFFu;
+	while (len--) c = crcTable[(c ^ *p++) & 0xff] ^ (c >> 8);
+	return c ^ 0xFFFFFFFFu;
+}
+
+void encPayloadInit(void) {
+	aesInit();
+	buildCrcTable();
+	encPayloadActive = 1;
+}
+
+const char *encPayloadBackendName(void) {
+	return aesBackendName();
+}
+
+void encPayloadLearnKey(const uint8_t *nmk) {
+	int i;
+	for (i=0; i<nLearnedKeys; i++) {
+		if (memcmp(learnedKeys[i], nmk, SLAC_NMK_LEN)==0) return;
+	}
+	memcpy(learnedKeys[nextLearnedKey], nmk, SLAC_NMK_LEN);
+	nextLearnedKey = (nextLearnedKey+1) % ENCPAYLOAD_LEARNED_KEYS;
+	if (nLearnedKeys < ENCPAYLOAD_LEARNED_KEYS) nLearnedKeys++;
+}
+
+static const aes128_key *getSchedule(const uint8_t *nmk) {
+	schedule_entry *e;
+	int i;
+	for (i=0; i<ENCPAYLOAD_SCHEDULE_CACHE; i++) {
+		if (scheduleCache[i].inUse && (memcmp(scheduleCache[i].nmk, nmk, SLAC_NMK_LEN)==0)) return &scheduleCache[i].key;
+	}
+	e = &scheduleCache[nextSchedule];
+	nextSchedule = (nextSchedule+1) % ENCPAYLOAD_SCHEDULE_CACHE;
+	e->inUse = 1;
+	memcpy(e->nmk, nmk, SLAC_NMK_LEN);
+	aesSetDecryptKey(&e->key, nmk);
+	return &e->key;
+}
+
+/* Checks the decrypted (or plain) payload. The frame may have ethernet padding at
+   the end, so we do not know the length of the encrypted part exactly. We try the
+   lengths which fit to LEN, the RFLEN in the last byte tells which one is right. */
+static int extractMme(const uint8_t *p, int avail, int mmeLen, int *mmeOffset) {
+	int total, rfLen;
+	uint32_t crc;
+	for (total=AES_BLOCK_SIZE; total<=avail; total+=AES_BLOCK_SIZE) {
+		if (total < mmeLen+ENC_TRAILER_LEN+1) continue;
+		rfLen = p[total-1];
+		if (rfLen > 15) continue;
+		if (rfLen+mmeLen+ENC_TRAILER_LEN+1 > total) continue;
+		if (rfLen+mmeLen+ENC_TRAILER_LEN+1 <= total-AES_BLOCK_SIZE) break; /* too much padding, would be shorter */
+		crc = p[rfLen+mmeLen] | (p[rfLen+mmeLen+1]<<8) | (p[rfLen+mmeLen+2]<<16) | ((uint32_t)p[rfLen+mmeLen+3]<<24);
+		if (crc == crc32(p+rfLen, mmeLen)) {
+			*mmeOffset = rfLen;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* Writes the embedded MME as ethernet frame. The MME may start with the ethernet
+   header (ODA, OSA, type), or directly with the MMV. */
+static int composeFrame(const unsigned char *frame, const uint8_t *mme, int mmeLen, unsigned char *out, int outSize) {
+	if ((mmeLen >= (int)sizeof(struct ethhdr)) && (mme[12]==(ETH_P_HPAV>>8)) && (mme[13]==(ETH_P_HPAV & 0xff))) {
+		if (mmeLen > outSize) return -1;
+		memcpy(out, mme, mmeLen);
+		return mmeLen;
+	}
+	if ((int)sizeof(struct ethhdr)+mmeLen > outSize) return -1;
+	memcpy(out, frame, sizeof(struct ethhdr));
+	memcpy(out+sizeof(struct ethhdr), mme, mmeLen);
+	return sizeof(struct ethhdr)+mmeLen;
+}
+
+int encPayloadDecrypt(const unsigned char *frame, int len, unsigned char *out, int outSize) {
+	const cm_encrypted_payload_indicate *ep = (const cm_encrypted_payload_indicate *)frame;
+	const uint8_t *candidates[2+ENCPAYLOAD_LEARNED_KEYS];
+	station_entry *sta;
+	int nCandidates=0, i, avail, nBlocks, mmeLen, mmeOffset;
+	nEncPayloads++;
+	if (len < (int)offsetof(cm_encrypted_payload_indicate, PAYLOAD)) {
+		nEncMalformed++;
+		return -1;
+	}
+	avail = len - offsetof(cm_encrypted_payload_indicate, PAYLOAD);
+	if (avail > (int)sizeof(plain)) avail = sizeof(plain);
+	mmeLen = LE16TOH(ep->LEN);
+	if (ep->PEKS == HOMEPLUG_PEKS_NONE) {
+		/* same structure, only without encryption */
+		if (extractMme(ep->PAYLOAD, avail, mmeLen, &mmeOffset)<0) {
+			nEncMalformed++;
+			return -1;
+		}
+		nEncDecrypted++;
+		return composeFrame(frame, ep->PAYLOAD+mmeOffset, mmeLen, out, outSize);
+	}
+	if (ep->PEKS != HOMEPLUG_PEKS_NMK) {
+		nEncUnsupportedPeks++; /* DAK or TEK, we do not know them */
+		return -1;
+	}
+	/* the candidates: the NMK of the sender, of the receiver, and the learned ones */
+	sta = stationLookup(ep->ethernet.h_source);
+	if (sta && (sta->flags & STA_FLAG_HAS_KEY)) candidates[nCandidates++] = sta->NMK;
+	sta = stationLookup(ep->ethernet.h_dest);
+	if (sta && (sta->flags & STA_FLAG_HAS_KEY)) candidates[nCandidates++] = sta->NMK;
+	for (i=0; i<nLearnedKeys; i++) candidates[nCandidates++] = learnedKeys[(nextLearnedKey-1-i+ENCPAYLOAD_LEARNED_KEYS) % ENCPAYLOAD_LEARNED_KEYS];
+	nBlocks = avail / AES_BLOCK_SIZE;
+	for (i=0; i<nCandidates; i++) {
+		if ((i>0) && (memcmp(candidates[i], candidates[i-1], SLAC_NMK_LEN)==0)) continue;
+		aesCbcDecrypt(getSchedule(candidates[i]), ep->IV, ep->PAYLOAD, plain, nBlocks);
+		if (extractMme(plain, nBlocks*AES_BLOCK_SIZE, mmeLen, &mmeOffset)==0) {
+			nEncDecrypted++;
+			return composeFrame(frame, plain+mmeOffset, mmeLen, out, outSize);
+		}
+	}
+	nEncNoKey++;
+	return -1;
+}
@@ -0,0 +1,34 @@
+/* Decryption of CM_ENCRYPTED_PAYLOAD.IND
+ *
+ * The HomePlug stations may send an MME encrypted with the NMK of the network
+ * (PEKS=NMK), e.g. during the association. For our own vehicles and chargers we
+ * know the NMK from the SLAC match, so we can look into these messages.
+ *
+ * Key candidates are the NMKs of the source and destination in the station
+ * table, and the last learned NMKs. The right key is found by the CRC-32 of the
+ * embedded MME. The expanded AES key schedules are cached, so that a key which
+ * is used again costs only the decryption itself.
+ */
+
+#ifndef ENCPAYLOAD_HEADER
+#define ENCPAYLOAD_HEADER
+
+#include <stdint.h>
+#include <netinet/if_ether.h>
+#include "plc_homeplug.h"
+
+#define ENCPAYLOAD_LEARNED_KEYS 8
+#define ENCPAYLOAD_SCHEDULE_CACHE 16
+
+extern int encPayloadActive;
+extern uint32_t nEncPayloads, nEncDecrypted, nEncNoKey, nEncUnsupportedPeks, nEncMalformed;
+
+void encPayloadInit(void);
+const char *encPayloadBackendName(void);
+/* Remembers an NMK as candidate, e.g. from CM_SLAC_MATCH.CNF */
+void encPayloadLearnKey(const uint8_t *nmk);
+/* Decrypts the CM_ENCRYPTED_PAYLOAD.IND frame. The embedded MME is written into out,
+   as complete ethernet frame. Returns its length, or -1 if it could not be decrypted. */
+int encPayloadDecrypt(const unsigned char *frame, int len, unsigned char *out, int outSize);
+
+#endif
@@ -0,0 +1,298 @@
+/* Decoded-event streaming over a Unix domain socket, see eventstream.h */
+
+#define _GNU_SOURCE /* for accept4() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/if_ether.h>
+
+#include "plc_homeplug.h"
+#include "eventstream.h"
+
+typedef struct event_subscriber {
+	int fd; /* -1 if the slot is free */
+	unsigned char queue[EVENTSTREAM_QUEUE_SIZE];
+	uint32_t head, tail; /* free running, head-tail is the fill level */
+	uint16_t filter[EVENTSTREAM_MAX_FILTER];
+	int nFilter; /* 0 means: all MMTYPEs */
+	char cmdLine[100];
+	int cmdLen;
+	uint32_t nDropped;
+} event_subscriber;
+
+int nEventSubscribers;
+uint32_t nEventsSent, nEventsDropped;
+static int listenFd = -1;
+static char socketPath[108];
+static event_subscriber subscribers[EVENTSTREAM_MAX_SUBSCRIBERS];
+
+int eventStreamOpen(const char *path) {
+	struct sockaddr_un addr;
+	int i;
+	for (i=0; i<EVENTSTREAM_MAX_SUBSCRIBERS; i++) subscribers[i].fd = -1;
+	listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (listenFd<0) return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+	strncpy(socketPath, path, sizeof(socketPath)-1);
+	unlink(path); /* a left-over from an earlier run */
+	if ((bind(listenFd, (struct sockaddr *)&addr, sizeof(addr))<0) || (listen(listenFd, 4)<0)) {
+		close(listenFd);
+		listenFd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+static void closeSubscriber(event_subscriber *sub) {
+	close(sub->fd);
+	sub->fd = -1;
+	nEventSubscribers--;
+}
+
+static void acceptSubscriber(void) {
+	int fd, i;
+	fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK);
+	if (fd<0) return;
+	for (i=0; i<EVENTSTREAM_MAX_SUBSCRIBERS; i++) {
+		if (subscribers[i].fd<0) {
+			event_subscriber *sub = &subscribers[i];
+			sub->fd = fd;
+			sub->head = sub->tail = 0;
+			sub->nFilter = 0;
+			sub->cmdLen = 0;
+			sub->nDropped = 0;
+			nEventSubscribers++;
+			return;
+		}
+	}
+	close(fd); /* no free slot */
+}
+
+static void handleCommand(event_subscriber *sub, char *line) {
+	char *p;
+	if (strncmp(line, "filter", 6)!=0) return;
+	sub->nFilter = 0;
+	p = line+6;
+	while (*p && (sub->nFilter<EVENTSTREAM_MAX_FILTER)) {
+		char *end;
+		unsigned long v = strtoul(p, &end, 16);
+		if (end==p) break;
+		sub->filter[sub->nFilter++] = v & 0xfffc;
+		p = end;
+	}
+}
+
+static void readCommands(event_subscriber *sub) {
+	char buf[256];
+	int n, i;
+	n = recv(sub->fd, buf, sizeof(buf), MSG_DONTWAIT);
+	if (n==0 || ((n<0) && (errno!=EAGAIN) && (errno!=EINTR))) {
+		closeSubscriber(sub);
+		return;
+	}
+	for (i=0; i<n; i++) {
+		if ((buf[i]=='\n') || (buf[i]=='\r')) {
+			sub->cmdLine[sub->cmdLen] = 0;
+			handleCommand(sub, sub->cmdLine);
+			sub->cmdLen = 0;
+		} else if (sub->cmdLen < (int)sizeof(sub->cmdLine)-1) {
+			sub->cmdLine[sub->cmdLen++] = buf[i];
+		}
+	}
+}
+
+static void sendQueue(event_subscriber *sub) {
+	while (sub->head != sub->tail) {
+		uint32_t start = sub->tail % EVENTSTREAM_QUEUE_SIZE;
+		uint32_t n = sub->head - sub->tail;
+		int r;
+		if (start + n > EVENTSTREAM_QUEUE_SIZE) n = EVENTSTREAM_QUEUE_SIZE - start; /* up to the wrap */
+		r = send(sub->fd, sub->queue + start, n, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (r<0) {
+			if ((errno!=EAGAIN) && (errno!=EINTR)) closeSubscriber(sub);
+			return;
+		}
+		sub->tail += r;
+		if ((uint32_t)r<n) return; /* socket buffer full */
+	}
+}
+
+void eventStreamService(void) {
+	struct pollfd fds[1+EVENTSTREAM_MAX_SUBSCRIBERS];
+	int idx[1+EVENTSTREAM_MAX_SUBSCRIBERS];
+	int n=0, i;
+	if (listenFd<0) return;
+	fds[n].fd = listenFd;
+	fds[n].events = POLLIN;
+	idx[n++] = -1;
+	for (i=0; i<EVENTSTREAM_MAX_SUBSCRIBERS; i++) {
+		if (subscribers[i].fd<0) continue;
+		fds[n].fd = subscribers[i].fd;
+		fds[n].events = POLLIN | ((subscribers[i].head!=subscribers[i].tail) ? POLLOUT : 0);
+		idx[n++] = i;
+	}
+	if (poll(fds, n, 0)<=0) return;
+	for (i=0; i<n; i++) {
+		event_subscriber *sub;
+		if (!fds[i].revents) continue;
+		if (idx[i]<0) {
+			acceptSubscriber();
+			continue;
+		}
+		sub = &subscribers[idx[i]];
+		if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) readCommands(sub);
+		if ((sub->fd>=0) && (fds[i].revents & POLLOUT)) sendQueue(sub);
+	}
+}
+
+void eventStreamClose(void) {
+	int i;
+	if (listenFd<0) return;
+	for (i=0; i<EVENTSTREAM_MAX_SUBSCRIBERS; i++) {
+		if (subscribers[i].fd>=0) {
+			sendQueue(&subscribers[i]); /* last try, without waiting */
+			closeSubscriber(&subscribers[i]);
+		}
+	}
+	close(listenFd);
+	listenFd = -1;
+	unlink(socketPath);
+}
+
+static int filterMatches(event_subscriber *sub, int mmtype) {
+	int i;
+	if ((mmtype<0) || (sub->nFilter==0)) return 1;
+	for (i=0; i<sub->nFilter; i++) {
+		if (sub->filter[i]==(mmtype & 0xfffc)) return 1;
+	}
+	return 0;
+}
+
+/* Puts the record into the queues of all subscribers which want it. All or nothing per subscriber. */
+static void enqueue(const char *record, int len, int mmtype) {
+	int i;
+	for (i=0; i<EVENTSTREAM_MAX_SUBSCRIBERS; i++) {
+		event_subscriber *sub = &subscribers[i];
+		uint32_t k, start;
+		if ((sub->fd<0) || !filterMatches(sub, mmtype)) continue;
+		if (EVENTSTREAM_QUEUE_SIZE - (sub->head - sub->tail) < (uint32_t)len) {
+			sub->nDropped++;
+			nEventsDropped++;
+			continue;
+		}
+		start = sub->head % EVENTSTREAM_QUEUE_SIZE;
+		k = EVENTSTREAM_QUEUE_SIZE - start;
+		if (k > (uint32_t)len) k = len;
+		memcpy(sub->queue + start, record, k);
+		memcpy(sub->queue, record + k, len - k);
+		sub->head += len;
+		nEventsSent++;
+	}
+}
+
+static int formatTime(char *s) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return sprintf(s, "{\"t\":%ld.%06ld", (long)ts.tv_sec, ts.tv_nsec/1000);
+}
+
+static int formatMac(char *s, const uint8_t *m) {
+	return sprintf(s, "\"%02x:%02x:%02x:%02x:%02x:%02x\"", m[0], m[1], m[2], m[3], m[4], m[5]);
+}
+
+void eventStreamEmitMme(const unsigned char *frame, int len, const char *name) {
+	const struct ethhdr *eh = (const struct ethhdr *)frame;
+	const struct homeplug_hdr *hph = (const struct homeplug_hdr *)(frame+sizeof(struct ethhdr));
+	char s[300];
+	int n;
+	uint16_t mmtype;
+	if (nEventSubscribers==0) return;
+	mmtype = LE16TOH(hph->MMTYPE);
+	n = formatTime(s);
+	n += sprintf(s+n, ",\"ev\":\"mme\",\"src\":");
+	n += formatMac(s+n, eh->h_source);
+	n += sprintf(s+n, ",\"dst\":");
+	n += formatMac(s+n, eh->h_dest);
+	n += sprintf(s+n, ",\"mmtype\":\"0x%04x\",\"name\":\"%.60s\",\"len\":%d}\n", mmtype, name, len);
+	enqueue(s, n, mmtype);
+}
+
+void eventStreamEmitSlac(const uint8_t *pevMac, const uint8_t *evseMac, const char *fromState, const char *toState, uint32_t nSounds) {
+	char s[300];
+	int n;
+	if (nEventSubscribers==0) return;
+	n = formatTime(s);
+	n += sprintf(s+n, ",\"ev\":\"slac\",\"pev\":");
+	n += formatMac(s+n, pevMac);
+	n += sprintf(s+n, ",\"evse\":");
+	n += formatMac(s+n, evseMac);
+	n += sprintf(s+n, ",\"from\":\"%s\",\"to\":\"%s\",\"sounds\":%u}\n", fromState, toState, nSounds);
+	enqueue(s, n, -1);
+}
+
+void eventStreamEmitSetKey(const uint8_t *srcMac, uint8_t result) {
+	char s[200];
+	int n;
+	if (nEventSubscribers==0) return;
+	n = formatTime(s);
+	n += sprintf(s+n, ",\"ev\":\"setkey\",\"src\":");
+	n += formatMac(s+n, srcMac);
+	n += sprintf(s+n, ",\"result\":%d}\n", result);
+	enqueue(s, n, -1);
+}
+
+void eventStreamEmitPhyRate(const uint8_t *modemMac, const uint8_t *peerMac, uint16_t txRate, uint16_t rxRate) {
+	char s[200];
+	int n;
+	if (nEventSubscribers==0) return;
+	n = formatTime(s);
+	n += sprintf(s+n, ",\"ev\":\"phyrate\",\"modem\":");
+	n += formatMac(s+n, modemMac);
+	n += sprintf(s+n, ",\"peer\":");
+	n += formatMac(s+n, peerMac);
+	n += sprintf(s+n, ",\"tx\":%u,\"rx\":%u}\n", txRate, rxRate);
+	enqueue(s, n, -1);
+}
+
+void eventStreamEmitV2g(const uint8_t *pevMac, const uint8_t *evseMac, const char *msg, const uint8_t *sessionId, int sessionIdLen) {
+	char s[300];
+	int n, i;
+	if (nEventSubscribers==0) return;
+	n = formatTime(s);
+	n += sprintf(s+n, ",\"ev\":\"v2g\",\"pev\":");
+	n += formatMac(s+n, pevMac);
+	n += sprintf(s+n, ",\"evse\":");
+	n += formatMac(s+n, evseMac);
+	n += sprintf(s+n, ",\"msg\":\"%.60s\",\"sessionid\":\"", msg);
+	for (i=0; (i<sessionIdLen) && (i<8); i++) n += sprintf(s+n, "%02x", sessionId[i]);
+	n += sprintf(s+n, "\"}\n");
+	enqueue(s, n, -1);
+}
+
+void eventStreamPrintStatus(void (*printFunction)(char *s)) {
+	char s[200];
+	int i;
+	if (listenFd<0) {
+		printFunction("event stream not active");
+		return;
+	}
+	sprintf(s, "event stream: %d subscribers, %u events sent, %u dropped", nEventSubscribers, nEventsSent, nEventsDropped);
+	printFunction(s);
+	for (i=0; i<EVENTSTREAM_MAX_SUBSCRIBERS; i++) {
+		event_subscriber *sub = &subscribers[i];
+		if (sub->fd<0) continue;
+		sprintf(s, "  subscriber %d: queued %u bytes, dropped %u, filter %d MMTYPEs",
+			i, sub->head - sub->tail, sub->nDropped, sub->nFilter);
+		printFunction(s);
+	}
+}
@@ -0,0 +1,43 @@
+/* Decoded-event streaming over a Unix domain socket
+ *
+ * Tools like the charge-session dashboard connect to the Unix socket and get
+ * one JSON line per event, instead of parsing the log.txt:
+ *   {"t":1642999999.123456,"ev":"mme","src":"..","dst":"..","mmtype":"0x607d","name":"CM_SLAC_MATCH.CNF","len":60}
+ *   {"t":...,"ev":"slac","pev":"..","evse":"..","from":"MATCH_REQ","to":"MATCHED","sounds":10}
+ *   {"t":...,"ev":"setkey","src":"..","result":0}
+ *   {"t":...,"ev":"v2g","pev":"..","evse":"..","msg":"SessionSetupReq","sessionid":"0000000000000000"}
+ *   {"t":...,"ev":"phyrate","modem":"..","peer":"..","tx":123,"rx":110}
+ * A subscriber may send a line "filter 6064 607c" to get only the MME events
+ * of these MMTYPEs (the REQ/CNF/IND/RSP bits are ignored), and "filter" to get
+ * all again. The slac, setkey, v2g and phyrate events are always sent.
+ *
+ * Each subscriber has a bounded queue. If a subscriber does not read fast enough,
+ * the events which do not fit are dropped and counted. The receive loop is never
+ * blocked by a subscriber.
+ */
+
+#ifndef EVENTSTREAM_HEADER
+#define EVENTSTREAM_HEADER
+
+#include <stdint.h>
+
+#define EVENTSTREAM_DEFAULT_PATH "/tmp/plctool.sock"
+#define EVENTSTREAM_MAX_SUBSCRIBERS 8
+#define EVENTSTREAM_QUEUE_SIZE (64*1024) /* bytes per subscriber */
+#define EVENTSTREAM_MAX_FILTER 16
+
+extern int nEventSubscribers; /* cheap check for the receive path: no subscribers, no formatting */
+extern uint32_t nEventsSent, nEventsDropped;
+
+int eventStreamOpen(const char *path);
+void eventStreamService(void); /* accept, read commands, send queued data. Never blocks. */
+void eventStreamClose(void);
+
+void eventStreamEmitMme(const unsigned char *frame, int len, const char *name);
+void eventStreamEmitSlac(const uint8_t *pevMac, const uint8_t *evseMac, const char *fromState, const char *toState, uint32_t nSounds);
+void eventStreamEmitSetKey(const uint8_t *srcMac, uint8_t result);
+void eventStreamEmitV2g(const uint8_t *pevMac, const uint8_t *evseMac, const char *msg, const uint8_t *sessionId, int sessionIdLen);
+void eventStreamEmitPhyRate(const uint8_t *modemMac, const uint8_t *peerMac, uint16_t txRate, uint16_t rxRate);
+void eventStreamPrintStatus(void (*printFunction)(char *s));
+
+#endif
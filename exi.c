@@ -0,0 +1,244 @@
+/* Minimal streaming EXI decoder for the V2G messages, see exi.h
+ *
+ * Notes on the grammars (EXI 1.0, schema-informed, strict=false):
+ *   - Each grammar state with n declared productions uses an event code of
+ *     ceil(log2(n+1)) bits, because non-strict grammars have an additional
+ *     second-level production. So even "the only possible element" costs one bit.
+ *   - Simple-type elements: SE (event code), CH (1 bit), value, EE (1 bit).
+ *   - unsigned integer: groups of 7 bits, LSB group first, bit 7 is the continuation flag.
+ *   - string: unsigned length+2 followed by the characters as unsigned integers;
+ *     0 = local string table hit, 1 = global string table hit.
+ * Example: 80 98 02 00 00 00 00 00 00 00 00 11 D0 ... is an ISO SessionSetupReq
+ * with SessionID 00 00 00 00 00 00 00 00.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "exi.h"
+
+typedef struct exi_bitstream {
+	const uint8_t *data;
+	int len; /* in bytes */
+	int bitPos;
+	int error;
+} exi_bitstream;
+
+/* event codes of the root element, from the global element lists of the schemas */
+#define EXI_ROOT_BITS 7
+#define EXI_ROOT_ISO1_V2G_MESSAGE 76
+#define EXI_ROOT_DIN_V2G_MESSAGE 77
+#define EXI_APPHAND_ROOT_BITS 2
+#define EXI_BODY_BITS 6
+
+static const char *iso1BodyNames[] = {
+	"AuthorizationReq", "AuthorizationRes", "BodyElement", "CableCheckReq", "CableCheckRes",
+	"CertificateInstallationReq", "CertificateInstallationRes", "CertificateUpdateReq", "CertificateUpdateRes",
+	"ChargeParameterDiscoveryReq", "ChargeParameterDiscoveryRes", "ChargingStatusReq", "ChargingStatusRes",
+	"CurrentDemandReq", "CurrentDemandRes", "MeteringReceiptReq", "MeteringReceiptRes",
+	"PaymentDetailsReq", "PaymentDetailsRes", "PaymentServiceSelectionReq", "PaymentServiceSelectionRes",
+	"PowerDeliveryReq", "PowerDeliveryRes", "PreChargeReq", "PreChargeRes",
+	"ServiceDetailReq", "ServiceDetailRes", "ServiceDiscoveryReq", "ServiceDiscoveryRes",
+	"SessionSetupReq", "SessionSetupRes", "SessionStopReq", "SessionStopRes",
+	"WeldingDetectionReq", "WeldingDetectionRes"
+};
+
+static const char *dinBodyNames[] = {
+	"BodyElement", "CableCheckReq", "CableCheckRes",
+	"CertificateInstallationReq", "CertificateInstallationRes", "CertificateUpdateReq", "CertificateUpdateRes",
+	"ChargeParameterDiscoveryReq", "ChargeParameterDiscoveryRes", "ChargingStatusReq", "ChargingStatusRes",
+	"ContractAuthenticationReq", "ContractAuthenticationRes", "CurrentDemandReq", "CurrentDemandRes",
+	"MeteringReceiptReq", "MeteringReceiptRes", "PaymentDetailsReq", "PaymentDetailsRes",
+	"PowerDeliveryReq", "PowerDeliveryRes", "PreChargeReq", "PreChargeRes",
+	"ServiceDetailReq", "ServiceDetailRes", "ServiceDiscoveryReq", "ServiceDiscoveryRes",
+	"ServicePaymentSelectionReq", "ServicePaymentSelectionRes",
+	"SessionSetupReq", "SessionSetupRes", "SessionStopReq", "SessionStopRes",
+	"WeldingDetectionReq", "WeldingDetectionRes"
+};
+
+#define NUMBER_OF(a) ((int)(sizeof(a)/sizeof(a[0])))
+
+static uint32_t readBits(exi_bitstream *bs, int n) {
+	uint32_t v = 0;
+	while (n-- > 0) {
+		int byteIndex = bs->bitPos >> 3;
+		if (byteIndex >= bs->len) {
+			bs->error = 1;
+			return 0;
+		}
+		v = (v << 1) | ((bs->data[byteIndex] >> (7 - (bs->bitPos & 7))) & 1);
+		bs->bitPos++;
+	}
+	return v;
+}
+
+static uint32_t readUInt(exi_bitstream *bs) {
+	uint32_t v = 0, b;
+	int shift = 0;
+	do {
+		b = readBits(bs, 8);
+		if (shift < 32) v |= (b & 0x7f) << shift;
+		shift += 7;
+	} while ((b & 0x80) && !bs->error);
+	return v;
+}
+
+static int bitsFor(int n) { /* number of bits to encode the values 0..n-1 */
+	int bits = 0;
+	while ((1 << bits) < n) bits++;
+	return bits;
+}
+
+/* SE(x) for a state with exactly one declared production, and the CH of a simple element */
+static void expectEvent(exi_bitstream *bs, int bits, uint32_t code) {
+	if (readBits(bs, bits) != code) bs->error = 1;
+}
+
+static void decodeAppHandReq(exi_bitstream *bs, exi_decoded *r) {
+	int more = 1;
+	r->kind = EXI_DECODED_APPHAND_REQ;
+	r->nAppProtocols = 0;
+	expectEvent(bs, 1, 0); /* SE(AppProtocol) */
+	while (more && !bs->error) {
+		exi_app_protocol tmp;
+		exi_app_protocol *ap = (r->nAppProtocols < EXI_MAX_APP_PROTOCOLS) ? &r->appProtocol[r->nAppProtocols] : &tmp;
+		uint32_t l, i, c;
+		memset(ap, 0, sizeof(*ap));
+		/* ProtocolNamespace, anyURI */
+		expectEvent(bs, 1, 0); /* SE */
+		expectEvent(bs, 1, 0); /* CH */
+		l = readUInt(bs);
+		if (l < 2) {
+			/* string table hit: same namespace as an earlier entry. Local and global table
+			   are equal, because this is the only string value in the message. */
+			int n = r->nAppProtocols < EXI_MAX_APP_PROTOCOLS ? r->nAppProtocols : EXI_MAX_APP_PROTOCOLS;
+			uint32_t idx = readBits(bs, bitsFor(n));
+			if ((int)idx < n) memcpy(ap->protocolNamespace, r->appProtocol[idx].protocolNamespace, EXI_MAX_NAMESPACE_LEN);
+		} else {
+			for (i = 0; i < l - 2; i++) {
+				c = readUInt(bs);
+				if (i < EXI_MAX_NAMESPACE_LEN - 1) ap->protocolNamespace[i] = (c < 128) ? (char)c : '?';
+				if (bs->error) break;
+			}
+		}
+		expectEvent(bs, 1, 0); /* EE */
+		/* VersionNumberMajor, unsignedInt */
+		expectEvent(bs, 1, 0);
+		expectEvent(bs, 1, 0);
+		ap->versionMajor = readUInt(bs);
+		expectEvent(bs, 1, 0);
+		/* VersionNumberMinor, unsignedInt */
+		expectEvent(bs, 1, 0);
+		expectEvent(bs, 1, 0);
+		ap->versionMinor = readUInt(bs);
+		expectEvent(bs, 1, 0);
+		/* SchemaID, unsignedByte */
+		expectEvent(bs, 1, 0);
+		expectEvent(bs, 1, 0);
+		ap->schemaId = readBits(bs, 8);
+		expectEvent(bs, 1, 0);
+		/* Priority, 1..20 */
+		expectEvent(bs, 1, 0);
+		expectEvent(bs, 1, 0);
+		ap->priority = readBits(bs, 5) + 1;
+		expectEvent(bs, 1, 0);
+		expectEvent(bs, 1, 0); /* EE(AppProtocol) */
+		if (bs->error) break;
+		if (r->nAppProtocols < EXI_MAX_APP_PROTOCOLS) r->nAppProtocols++;
+		/* next AppProtocol (0) or end of supportedAppProtocolReq (1) */
+		more = (readBits(bs, 2) == 0);
+	}
+}
+
+static void decodeAppHandRes(exi_bitstream *bs, exi_decoded *r) {
+	r->kind = EXI_DECODED_APPHAND_RES;
+	expectEvent(bs, 1, 0); /* SE(ResponseCode) */
+	expectEvent(bs, 1, 0); /* CH */
+	r->responseCode = readBits(bs, 2); /* enumeration with 3 values */
+	expectEvent(bs, 1, 0); /* EE */
+	r->schemaIdPresent = (readBits(bs, 2) == 0); /* SE(SchemaID) or EE */
+	if (r->schemaIdPresent) {
+		expectEvent(bs, 1, 0); /* CH */
+		r->schemaId = readBits(bs, 8);
+	}
+}
+
+static void decodeV2gMessage(exi_bitstream *bs, exi_decoded *r) {
+	uint32_t code, idLen, i;
+	r->kind = EXI_DECODED_V2G_MESSAGE;
+	r->bodyType = -1;
+	r->name = "V2G_Message";
+	expectEvent(bs, 1, 0); /* SE(Header) */
+	expectEvent(bs, 1, 0); /* SE(SessionID) */
+	expectEvent(bs, 1, 0); /* CH, hexBinary */
+	idLen = readUInt(bs);
+	if (idLen > EXI_MAX_SESSIONID_LEN) { /* the schema allows 8 bytes */
+		bs->error = 1;
+		return;
+	}
+	for (i = 0; i < idLen; i++) r->sessionId[i] = readBits(bs, 8);
+	r->sessionIdLen = idLen;
+	expectEvent(bs, 1, 0); /* EE(SessionID) */
+	/* Notification (0), Signature (1), EE(Header) (2) */
+	code = readBits(bs, 2);
+	if (bs->error) return;
+	if (code != 2) {
+		r->name = "V2G_Message with Notification/Signature"; /* not needed so far */
+		return;
+	}
+	expectEvent(bs, 1, 0); /* SE(Body) */
+	code = readBits(bs, EXI_BODY_BITS);
+	if (bs->error) return;
+	r->bodyType = code;
+	if (r->schema == EXI_SCHEMA_DIN) {
+		r->name = ((int)code < NUMBER_OF(dinBodyNames)) ? dinBodyNames[code] : "unknown body";
+	} else {
+		r->name = ((int)code < NUMBER_OF(iso1BodyNames)) ? iso1BodyNames[code] : "unknown body";
+	}
+}
+
+int exiDecode(const uint8_t *data, int len, int isAppHandshake, int schemaHint, exi_decoded *result) {
+	exi_bitstream bs;
+	uint32_t code;
+	memset(result, 0, sizeof(*result));
+	result->kind = EXI_DECODED_NOTHING;
+	bs.data = data;
+	bs.len = len;
+	bs.bitPos = 0;
+	bs.error = 0;
+	if ((len >= 4) && (memcmp(data, "$EXI", 4) == 0)) bs.bitPos = 32; /* optional cookie */
+	/* header: distinguishing bits 10, no options, final version 1 */
+	if (readBits(&bs, 8) != 0x80) return -1;
+	if (isAppHandshake) {
+		code = readBits(&bs, EXI_APPHAND_ROOT_BITS);
+		if (code == 0) {
+			decodeAppHandReq(&bs, result);
+		} else if (code == 1) {
+			decodeAppHandRes(&bs, result);
+		} else {
+			return -2;
+		}
+	} else {
+		code = readBits(&bs, EXI_ROOT_BITS);
+		if (code == EXI_ROOT_ISO1_V2G_MESSAGE) {
+			result->schema = EXI_SCHEMA_ISO1;
+		} else if (code == EXI_ROOT_DIN_V2G_MESSAGE) {
+			result->schema = EXI_SCHEMA_DIN;
+		} else {
+			return -2;
+		}
+		if (schemaHint != EXI_SCHEMA_UNKNOWN) result->schema = schemaHint;
+		decodeV2gMessage(&bs, result);
+	}
+	return bs.error ? -3 : 0;
+}
+
+const char *exiAppHandResponseCodeName(uint8_t code) {
+	switch (code) {
+		case 0: return "OK_SuccessfulNegotiation";
+		case 1: return "OK_SuccessfulNegotiationWithMinorDeviation";
+		case 2: return "Failed_NoNegotiation";
+	}
+	return "???";
+}
@@ -0,0 +1,63 @@
+/* Minimal streaming EXI decoder for the V2G messages
+ *
+ * This is not a general EXI decoder. It walks the schema-informed grammars of
+ * ISO15118-2 / DIN70121 (EXI default options, non-strict, bit-packed) only as far
+ * as needed for fault analysis:
+ *   - supportedAppProtocolReq: the offered protocol namespaces, versions, SchemaIDs
+ *   - supportedAppProtocolRes: ResponseCode and selected SchemaID
+ *   - V2G_Message (ISO15118-2:2013 and DIN70121): SessionID and the message type of the body
+ * It works directly on the received bytes, without any allocation, and stops
+ * at the first element which it does not need.
+ */
+
+#ifndef EXI_HEADER
+#define EXI_HEADER
+
+#include <stdint.h>
+
+#define EXI_MAX_APP_PROTOCOLS 5
+#define EXI_MAX_NAMESPACE_LEN 64
+#define EXI_MAX_SESSIONID_LEN 8
+
+enum {
+	EXI_SCHEMA_UNKNOWN,
+	EXI_SCHEMA_ISO1, /* urn:iso:15118:2:2013:MsgDef */
+	EXI_SCHEMA_DIN   /* urn:din:70121:2012:MsgDef */
+};
+
+typedef struct exi_app_protocol {
+	char protocolNamespace[EXI_MAX_NAMESPACE_LEN];
+	uint32_t versionMajor, versionMinor;
+	uint8_t schemaId;
+	uint8_t priority;
+} exi_app_protocol;
+
+typedef struct exi_decoded {
+	enum {
+		EXI_DECODED_NOTHING,
+		EXI_DECODED_APPHAND_REQ,
+		EXI_DECODED_APPHAND_RES,
+		EXI_DECODED_V2G_MESSAGE
+	} kind;
+	/* supportedAppProtocolReq */
+	int nAppProtocols;
+	exi_app_protocol appProtocol[EXI_MAX_APP_PROTOCOLS];
+	/* supportedAppProtocolRes */
+	uint8_t responseCode;
+	int schemaIdPresent;
+	uint8_t schemaId;
+	/* V2G_Message */
+	int schema; /* EXI_SCHEMA_... */
+	uint8_t sessionId[EXI_MAX_SESSIONID_LEN];
+	uint8_t sessionIdLen; /* 0..EXI_MAX_SESSIONID_LEN, a longer one is a decode error */
+	int bodyType; /* the event code of the body element, -1 if not decoded */
+	const char *name; /* name of the message, e.g. "SessionSetupReq" */
+} exi_decoded;
+
+/* Decodes an EXI document. isAppHandshake selects the grammar of the
+   supportedAppProtocol messages, otherwise the V2G_Message is expected.
+   Returns 0 on success, negative if the stream could not be decoded. */
+int exiDecode(const uint8_t *data, int len, int isAppHandshake, int schemaHint, exi_decoded *result);
+const char *exiAppHandResponseCodeName(uint8_t code);
+
+#endif
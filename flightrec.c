@@ -0,0 +1,206 @@
+/* In-memory flight recorder, see flightrec.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "flightrec.h"
+
+/* Each record in the ring: header, then the frame, padded to 8 bytes. A header with
+   len==WRAP_MARKER (or less than a header of space at the end) means: continue at offset 0. */
+typedef struct flightrec_record {
+	uint64_t tsNs; /* CLOCK_REALTIME in nanoseconds */
+	uint32_t len;
+	uint32_t reserved;
+} flightrec_record;
+
+#define WRAP_MARKER 0xFFFFFFFFu
+#define RECORD_SIZE(len) ((sizeof(flightrec_record) + (len) + 7) & ~7u)
+
+int flightRecorderActive;
+uint32_t nFlightRecFrames, nFlightRecEvicted, nFlightRecDumps;
+
+static unsigned char *ring;
+static uint32_t ringSize;
+static uint32_t head, tail; /* write position and oldest record */
+static uint32_t nRecords;
+static uint64_t windowNs;
+static int enabledTriggers;
+static int dumpRequested;
+static char dumpReason[32];
+static time_t lastDumpTime;
+static char dumpFileName[100];
+
+int flightRecorderInit(uint32_t sizeBytes, uint32_t windowSeconds, int triggerMask) {
+	ringSize = sizeBytes & ~7u;
+	ring = malloc(ringSize);
+	if (!ring) return -1;
+	head = tail = nRecords = 0;
+	windowNs = (uint64_t)windowSeconds * 1000000000ull;
+	enabledTriggers = triggerMask;
+	flightRecorderActive = 1;
+	return 0;
+}
+
+static flightrec_record *recordAt(uint32_t offset) {
+	return (flightrec_record *)(ring + offset);
+}
+
+static int isWrapAt(uint32_t offset) {
+	return (ringSize - offset < sizeof(flightrec_record)) || (recordAt(offset)->len == WRAP_MARKER);
+}
+
+/* Removes the oldest record. */
+static void evictOldest(void) {
+	if (isWrapAt(tail)) {
+		tail = 0;
+		return;
+	}
+	tail += RECORD_SIZE(recordAt(tail)->len);
+	nRecords--;
+	nFlightRecEvicted++;
+	if (nRecords == 0) head = tail = 0;
+}
+
+void flightRecorderRecord(const unsigned char *frame, int len, const struct timespec *ts) {
+	uint32_t need;
+	uint64_t tsNs;
+	flightrec_record *r;
+	if (!flightRecorderActive || (len <= 0)) return;
+	if ((uint32_t)len > ringSize / 4) len = ringSize / 4; /* truncate giant frames */
+	tsNs = (uint64_t)ts->tv_sec * 1000000000ull + ts->tv_nsec;
+	/* drop what is older than the time window */
+	while (nRecords && windowNs) {
+		if (isWrapAt(tail)) {
+			tail = 0;
+			continue;
+		}
+		if (tsNs - recordAt(tail)->tsNs <= windowNs) break;
+		evictOldest();
+	}
+	need = RECORD_SIZE(len);
+	for (;;) {
+		if (nRecords == 0) {
+			head = tail = 0;
+			break;
+		}
+		if (head > tail) { /* head==tail with records means: completely full */
+			if (ringSize - head >= need) break;
+			if (tail > need) {
+				/* does not fit at the end: mark the wrap and continue at the beginning */
+				if (ringSize - head >= sizeof(flightrec_record)) recordAt(head)->len = WRAP_MARKER;
+				head = 0;
+				continue;
+			}
+		} else {
+			if (tail - head >= need) break;
+		}
+		evictOldest();
+	}
+	r = recordAt(head);
+	r->tsNs = tsNs;
+	r->len = len;
+	r->reserved = 0;
+	memcpy(ring + head + sizeof(flightrec_record), frame, len);
+	head += need;
+	nRecords++;
+	nFlightRecFrames++;
+}
+
+void flightRecorderTrigger(int source, const char *reason) {
+	if (!flightRecorderActive || !(enabledTriggers & source) || dumpRequested) return;
+	dumpRequested = 1;
+	strncpy(dumpReason, reason, sizeof(dumpReason) - 1);
+}
+
+/*********************************************************************/
+/* pcapng output, see https://www.ietf.org/archive/id/draft-tuexen-opsawg-pcapng-03.html */
+
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPT_ENDOFOPT 0
+#define PCAPNG_OPT_IF_TSRESOL 9
+
+static void writeU32(FILE *f, uint32_t v) {
+	fwrite(&v, 4, 1, f);
+}
+
+static void writeSectionHeader(FILE *f) {
+	writeU32(f, PCAPNG_SHB);
+	writeU32(f, 28);
+	writeU32(f, PCAPNG_BYTE_ORDER_MAGIC);
+	writeU32(f, 1); /* version 1.0 */
+	writeU32(f, 0xFFFFFFFF); /* section length unknown, 64 bit */
+	writeU32(f, 0xFFFFFFFF);
+	writeU32(f, 28);
+}
+
+static void writeInterfaceDescription(FILE *f) {
+	uint8_t tsresol[4] = { 9, 0, 0, 0 }; /* nanoseconds, plus padding */
+	writeU32(f, PCAPNG_IDB);
+	writeU32(f, 32);
+	writeU32(f, 1 | (0 << 16)); /* link type ethernet, reserved */
+	writeU32(f, 65535); /* snap length */
+	writeU32(f, PCAPNG_OPT_IF_TSRESOL | (1 << 16));
+	fwrite(tsresol, 1, 4, f);
+	writeU32(f, PCAPNG_OPT_ENDOFOPT);
+	writeU32(f, 32);
+}
+
+static void writeEnhancedPacket(FILE *f, const flightrec_record *r) {
+	static const uint8_t padding[4];
+	uint32_t padded = (r->len + 3) & ~3u;
+	uint32_t blockLen = 32 + padded;
+	writeU32(f, PCAPNG_EPB);
+	writeU32(f, blockLen);
+	writeU32(f, 0); /* interface id */
+	writeU32(f, (uint32_t)(r->tsNs >> 32));
+	writeU32(f, (uint32_t)r->tsNs);
+	writeU32(f, r->len); /* captured length */
+	writeU32(f, r->len); /* original length */
+	fwrite((const unsigned char *)r + sizeof(flightrec_record), 1, r->len, f);
+	fwrite(padding, 1, padded - r->len, f);
+	writeU32(f, blockLen);
+}
+
+const char *flightRecorderService(void) {
+	FILE *f;
+	time_t now;
+	struct tm tmNow;
+	uint32_t pos, n;
+	if (!dumpRequested) return NULL;
+	dumpRequested = 0;
+	now = time(NULL);
+	if (now - lastDumpTime < FLIGHTREC_MIN_DUMP_INTERVAL_S) return NULL;
+	lastDumpTime = now;
+	localtime_r(&now, &tmNow);
+	snprintf(dumpFileName, sizeof(dumpFileName), "flightrec_%04d%02d%02d_%02d%02d%02d_%s.pcapng",
+		tmNow.tm_year + 1900, tmNow.tm_mon + 1, tmNow.tm_mday, tmNow.tm_hour, tmNow.tm_min, tmNow.tm_sec, dumpReason);
+	f = fopen(dumpFileName, "wb");
+	if (!f) return NULL;
+	writeSectionHeader(f);
+	writeInterfaceDescription(f);
+	pos = tail;
+	for (n = 0; n < nRecords; ) {
+		if (isWrapAt(pos)) {
+			pos = 0;
+			continue;
+		}
+		writeEnhancedPacket(f, recordAt(pos));
+		pos += RECORD_SIZE(recordAt(pos)->len);
+		n++;
+	}
+	fclose(f);
+	nFlightRecDumps++;
+	return dumpFileName;
+}
+
+void flightRecorderExit(void) {
+	free(ring);
+	ring = NULL;
+	flightRecorderActive = 0;
+}
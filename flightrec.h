@@ -0,0 +1,39 @@
+/* In-memory flight recorder
+ *
+ * Keeps the last frames (limited by memory size and by time window) in a
+ * circular buffer, which is allocated once at startup. Recording a frame is
+ * only a memcpy, there is no allocation per frame and no disk access.
+ * When a trigger fires (negative set-key/get-key result, SLAC timeout, key 'd'),
+ * the content of the buffer is written into a pcapng file
+ * flightrec_<date>_<time>_<reason>.pcapng. So we have the full history of a rare
+ * failure, without writing all frames to disk all day.
+ */
+
+#ifndef FLIGHTREC_HEADER
+#define FLIGHTREC_HEADER
+
+#include <stdint.h>
+#include <time.h>
+
+#define FLIGHTREC_DEFAULT_SIZE_MB 4
+#define FLIGHTREC_DEFAULT_WINDOW_S 60
+#define FLIGHTREC_MIN_DUMP_INTERVAL_S 1 /* avoid dump storms if many sessions fail at once */
+
+/* the trigger sources, can be enabled individually */
+#define FLIGHTREC_TRIGGER_RESULT_FAIL 0x01
+#define FLIGHTREC_TRIGGER_SLAC_TIMEOUT 0x02
+#define FLIGHTREC_TRIGGER_KEY 0x04
+#define FLIGHTREC_TRIGGER_ALL 0x07
+
+extern int flightRecorderActive;
+extern uint32_t nFlightRecFrames, nFlightRecEvicted, nFlightRecDumps;
+
+int flightRecorderInit(uint32_t sizeBytes, uint32_t windowSeconds, int triggerMask);
+void flightRecorderRecord(const unsigned char *frame, int len, const struct timespec *ts);
+/* Requests a dump. The dump itself is done in flightRecorderService(). */
+void flightRecorderTrigger(int source, const char *reason);
+/* Performs a requested dump. Returns the file name, or NULL if nothing was dumped. */
+const char *flightRecorderService(void);
+void flightRecorderExit(void);
+
+#endif
@@ -0,0 +1,255 @@
+/* Zero-downtime restart, see handoff.h */
+
+#define _GNU_SOURCE /* accept4 */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/types.h>
+
+#include "handoff.h"
+
+typedef struct handoff_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nFds;
+	uint32_t snapshotLen;
+} handoff_header;
+
+#define HANDOFF_ACK 'A'
+
+int handoffListening;
+uint32_t nHandoffRejected;
+
+static int listenFd = -1;
+
+/* abstract namespace: no file, it is gone with the process */
+static socklen_t makeAddress(struct sockaddr_un *addr, const char *ifName) {
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "%s%s", HANDOFF_NAME_PREFIX, ifName);
+	return offsetof(struct sockaddr_un, sun_path) + 1 + strlen(addr->sun_path + 1);
+}
+
+int handoffListen(const char *ifName) {
+	struct sockaddr_un addr;
+	socklen_t len = makeAddress(&addr, ifName);
+	listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listenFd < 0) return -1;
+	if ((bind(listenFd, (struct sockaddr *)&addr, len) < 0) || (listen(listenFd, 1) < 0)) {
+		close(listenFd);
+		listenFd = -1;
+		return -1;
+	}
+	handoffListening = 1;
+	return 0;
+}
+
+void handoffClose(void) {
+	if (listenFd >= 0) close(listenFd);
+	listenFd = -1;
+	handoffListening = 0;
+}
+
+/* root, or the user which we run as */
+static int peerIsTrusted(int conn) {
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) return 0;
+	return (cred.uid == 0) || (cred.uid == geteuid());
+}
+
+int handoffAccept(void) {
+	int conn;
+	if (listenFd < 0) return -1;
+	conn = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+	if (conn < 0) return -1;
+	if (!peerIsTrusted(conn)) {
+		nHandoffRejected++;
+		close(conn);
+		errno = EPERM;
+		return -1;
+	}
+	/* one handover at a time; the name is free for the new instance */
+	handoffClose();
+	return conn;
+}
+
+static int writeAll(int fd, const unsigned char *p, uint32_t len) {
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int readAll(int fd, unsigned char *p, uint32_t len) {
+	while (len > 0) {
+		ssize_t n = read(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		if (n == 0) return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int waitReadable(int fd, int timeoutMs) {
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	return poll(&pfd, 1, timeoutMs) > 0;
+}
+
+int handoffSend(int conn, const int *fds, int nFds, const handoff_buffer *snapshot) {
+	handoff_header h;
+	struct msghdr msg;
+	struct iovec iov;
+	union {
+		char buf[CMSG_SPACE(HANDOFF_MAX_FDS * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct cmsghdr *cmsg;
+	unsigned char ack = 0;
+	int r = -1;
+	struct timeval tv = { HANDOFF_TIMEOUT_MS / 1000, (HANDOFF_TIMEOUT_MS % 1000) * 1000 };
+	if ((nFds < 1) || (nFds > HANDOFF_MAX_FDS)) goto done;
+	setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	h.magic = HANDOFF_MAGIC;
+	h.version = HANDOFF_VERSION;
+	h.nFds = nFds;
+	h.snapshotLen = snapshot->len;
+	iov.iov_base = &h;
+	iov.iov_len = sizeof(h);
+	memset(&msg, 0, sizeof(msg));
+	memset(&control, 0, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = CMSG_SPACE(nFds * sizeof(int));
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(nFds * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, nFds * sizeof(int));
+	if (sendmsg(conn, &msg, MSG_NOSIGNAL) != sizeof(h)) goto done;
+	if (writeAll(conn, snapshot->data, snapshot->len) < 0) goto done;
+	/* the new instance has restored the state */
+	if (!waitReadable(conn, HANDOFF_TIMEOUT_MS)) goto done;
+	if ((read(conn, &ack, 1) == 1) && (ack == HANDOFF_ACK)) r = 0;
+done:
+	close(conn);
+	return r;
+}
+
+int handoffConnect(const char *ifName, int *fds, int *nFds, handoff_buffer *snapshot) {
+	struct sockaddr_un addr;
+	socklen_t addrLen = makeAddress(&addr, ifName);
+	handoff_header h;
+	struct msghdr msg;
+	struct iovec iov;
+	union {
+		char buf[CMSG_SPACE(HANDOFF_MAX_FDS * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct cmsghdr *cmsg;
+	int conn, i;
+	*nFds = 0;
+	memset(snapshot, 0, sizeof(*snapshot));
+	conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (conn < 0) return -1;
+	if (connect(conn, (struct sockaddr *)&addr, addrLen) < 0) goto fail;
+	/* somebody else could have taken the name, and would give us its keys */
+	if (!peerIsTrusted(conn)) {
+		nHandoffRejected++;
+		errno = EPERM;
+		goto fail;
+	}
+	/* the old instance answers from its main loop, within milliseconds */
+	if (!waitReadable(conn, HANDOFF_TIMEOUT_MS)) goto fail;
+	iov.iov_base = &h;
+	iov.iov_len = sizeof(h);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	if (recvmsg(conn, &msg, MSG_CMSG_CLOEXEC) != sizeof(h)) goto fail;
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)) {
+			int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			if (n > HANDOFF_MAX_FDS) n = HANDOFF_MAX_FDS;
+			memcpy(fds, CMSG_DATA(cmsg), n * sizeof(int));
+			*nFds = n;
+		}
+	}
+	if ((h.magic != HANDOFF_MAGIC) || (h.version != HANDOFF_VERSION) || (h.nFds != (uint32_t)*nFds) ||
+	    (h.snapshotLen > HANDOFF_MAX_SNAPSHOT) || (msg.msg_flags & MSG_CTRUNC)) goto fail;
+	snapshot->data = malloc(h.snapshotLen ? h.snapshotLen : 1);
+	if (!snapshot->data) goto fail;
+	snapshot->len = snapshot->size = h.snapshotLen;
+	if (readAll(conn, snapshot->data, h.snapshotLen) < 0) goto fail;
+	return conn;
+fail:
+	for (i=0; i<*nFds; i++) close(fds[i]);
+	*nFds = 0;
+	free(snapshot->data);
+	memset(snapshot, 0, sizeof(*snapshot));
+	close(conn);
+	return -1;
+}
+
+int handoffAcknowledge(int conn) {
+	unsigned char ack = HANDOFF_ACK;
+	int r = (write(conn, &ack, 1) == 1) ? 0 : -1;
+	close(conn);
+	return r;
+}
+
+/*********************************************************************/
+/* Snapshot records */
+
+int handoffPutRecord(handoff_buffer *b, uint16_t type, const void *data, uint32_t len) {
+	uint32_t need = b->len + sizeof(type) + sizeof(len) + len;
+	if (need > HANDOFF_MAX_SNAPSHOT) return -1;
+	if (need > b->size) {
+		uint32_t size = b->size ? b->size : 4096;
+		unsigned char *p;
+		while (size < need) size *= 2;
+		p = realloc(b->data, size);
+		if (!p) return -1;
+		b->data = p;
+		b->size = size;
+	}
+	memcpy(b->data + b->len, &type, sizeof(type));
+	memcpy(b->data + b->len + sizeof(type), &len, sizeof(len));
+	if (len) memcpy(b->data + b->len + sizeof(type) + sizeof(len), data, len);
+	b->len = need;
+	return 0;
+}
+
+int handoffNextRecord(const handoff_buffer *b, uint32_t *pos, uint16_t *type, const unsigned char **data, uint32_t *len) {
+	uint32_t p = *pos;
+	if (p + sizeof(*type) + sizeof(*len) > b->len) return 0;
+	memcpy(type, b->data + p, sizeof(*type));
+	memcpy(len, b->data + p + sizeof(*type), sizeof(*len));
+	p += sizeof(*type) + sizeof(*len);
+	if ((*len > b->len - p) || (*type == HANDOFF_REC_END)) return 0;
+	*data = b->data + p;
+	*pos = p + *len;
+	return 1;
+}
@@ -0,0 +1,68 @@
+/* Zero-downtime restart: handover of the sockets and the state to a new instance
+ *
+ * The running instance listens on a Unix socket in the abstract namespace,
+ * "listen_to_eth.<interface>". A new instance, started with -H, connects to it.
+ * The old instance stops taking frames out of the receive socket, handles the
+ * frames which it has taken already (pipeline, io_uring), and sends
+ *   - the header with its receive and transmit socket, as SCM_RIGHTS,
+ *   - a snapshot of the state: keys, SLAC sessions, stations.
+ * The new instance restores the state, acknowledges, and continues on the same
+ * receive socket. The frames which arrive in between wait in the socket buffer,
+ * so none is lost and none is handled twice. After the acknowledge the old
+ * instance ends; without it, the old instance continues.
+ * The snapshot is a sequence of records: type (2 bytes), length (4 bytes), data,
+ * in host byte order, since both instances run on the same machine.
+ * The abstract name has no file permissions, and the raw sockets and the keys
+ * must not go to any local process: both sides check the peer (SO_PEERCRED),
+ * only root or the same effective user is accepted.
+ */
+
+#ifndef HANDOFF_HEADER
+#define HANDOFF_HEADER
+
+#include <stdint.h>
+
+#define HANDOFF_NAME_PREFIX "listen_to_eth."
+#define HANDOFF_MAGIC 0x4c54454fu /* "LTEO" */
+#define HANDOFF_VERSION 1
+#define HANDOFF_MAX_FDS 4
+#define HANDOFF_MAX_SNAPSHOT (4*1024*1024)
+#define HANDOFF_TIMEOUT_MS 2000
+
+/* the records of the snapshot */
+enum {
+	HANDOFF_REC_KEYS = 1,   /* NMK, NID and EVSE MAC of the last match */
+	HANDOFF_REC_SLAC,       /* the SLAC sessions */
+	HANDOFF_REC_STATIONS,   /* the station table, in the format of stations.bin */
+	HANDOFF_REC_END
+};
+
+typedef struct handoff_buffer {
+	unsigned char *data;
+	uint32_t len, size;
+} handoff_buffer;
+
+extern int handoffListening;
+extern uint32_t nHandoffRejected; /* connections of other users */
+
+/* Old instance: listens for a new instance. Returns -1 if the name is in use. */
+int handoffListen(const char *ifName);
+/* The connection of a new instance, or -1. Non-blocking, stops listening on success.
+   A peer of another user is closed, and listening goes on. */
+int handoffAccept(void);
+/* Sends the sockets and the snapshot, and waits for the acknowledge. Returns 0 if
+   the new instance has taken over. Closes the connection. */
+int handoffSend(int conn, const int *fds, int nFds, const handoff_buffer *snapshot);
+void handoffClose(void);
+
+/* New instance: takes the sockets and the snapshot over. Returns the connection,
+   for the acknowledge, or -1. The snapshot is allocated, to be freed by the caller. */
+int handoffConnect(const char *ifName, int *fds, int *nFds, handoff_buffer *snapshot);
+int handoffAcknowledge(int conn);
+
+/* Building and reading the snapshot */
+int handoffPutRecord(handoff_buffer *b, uint16_t type, const void *data, uint32_t len);
+/* Returns 1 and the next record, or 0 at the end or if the snapshot is broken. */
+int handoffNextRecord(const handoff_buffer *b, uint32_t *pos, uint16_t *type, const unsigned char **data, uint32_t *len);
+
+#endif
@@ -0,0 +1,74 @@
+/* Key cache with pre-serialized CM_SET_KEY.REQ frames, see keycache.h */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "keycache.h"
+#include "stations.h" /* macToKey */
+#include "plccore.h"
+
+typedef char setkey_length_check[(sizeof(cm_set_key_request) == PLCCORE_SET_KEY_REQ_LEN) ? 1 : -1];
+
+static keycache_entry keyCache[KEYCACHE_SIZE];
+static cm_set_key_request setKeyTemplate;
+static uint32_t useCounter;
+uint32_t nKeyCacheHits, nKeyCacheMisses, nKeyCacheNmkChanges;
+
+void keyCacheInit(const uint8_t *ownMac, const uint8_t *destMac) {
+	static const uint8_t zero[SLAC_NMK_LEN];
+	memset(keyCache, 0, sizeof(keyCache));
+	/* the encoder of the core, NID and NMK are patched per entry */
+	plcCoreEncodeSetKey((uint8_t *)&setKeyTemplate, sizeof(setKeyTemplate), ownMac, destMac, zero, zero);
+}
+
+static uint32_t keyCacheHash(uint64_t mac, const uint8_t *nid) {
+	uint64_t key = mac;
+	int i;
+	for (i=0; i<SLAC_NID_LEN; i++) key = (key<<5) ^ (key>>59) ^ nid[i];
+	return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & (KEYCACHE_SIZE-1);
+}
+
+const cm_set_key_request *keyCacheSetKeyFrame(const uint8_t *evseMac, const uint8_t *nid, const uint8_t *nmk) {
+	uint64_t mac = macToKey(evseMac);
+	uint32_t i = keyCacheHash(mac, nid);
+	uint32_t n;
+	keycache_entry *e, *victim = NULL;
+	useCounter++;
+	for (n=0; n<KEYCACHE_MAX_PROBE; n++) {
+		e = &keyCache[(i+n) & (KEYCACHE_SIZE-1)];
+		if (e->inUse && (e->evseMac==mac) && (memcmp(e->NID, nid, SLAC_NID_LEN)==0)) {
+			/* hit: usually the NMK is the same, then the frame is ready as it is */
+			nKeyCacheHits++;
+			if (memcmp(e->frame.NEWKEY, nmk, SLAC_NMK_LEN)!=0) {
+				memcpy(e->frame.NEWKEY, nmk, SLAC_NMK_LEN);
+				nKeyCacheNmkChanges++;
+			}
+			e->nUsed++;
+			e->lastUsed = useCounter;
+			return &e->frame;
+		}
+		if (!victim || (victim->inUse && (!e->inUse || (e->lastUsed < victim->lastUsed)))) victim = e;
+	}
+	/* miss: build the entry from the template */
+	nKeyCacheMisses++;
+	e = victim;
+	e->evseMac = mac;
+	e->inUse = 1;
+	memcpy(e->NID, nid, SLAC_NID_LEN);
+	e->nUsed = 1;
+	e->lastUsed = useCounter;
+	e->frame = setKeyTemplate;
+	memcpy(e->frame.NID, nid, SLAC_NID_LEN);
+	memcpy(e->frame.NEWKEY, nmk, SLAC_NMK_LEN);
+	return &e->frame;
+}
+
+void keyCachePrintStatus(void (*printFunction)(char *s)) {
+	char s[200];
+	int i, n=0;
+	for (i=0; i<KEYCACHE_SIZE; i++) if (keyCache[i].inUse) n++;
+	sprintf(s, "key cache: %d entries, %u hits, %u misses, %u NMK changes",
+		n, nKeyCacheHits, nKeyCacheMisses, nKeyCacheNmkChanges);
+	printFunction(s);
+}
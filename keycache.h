@@ -0,0 +1,42 @@
+/* Key cache with pre-serialized CM_SET_KEY.REQ frames
+ *
+ * For each EVSE (MAC) and network (NID) which we have seen in a CM_SLAC_MATCH.CNF,
+ * we keep a complete CM_SET_KEY.REQ frame, ready to send. When the match
+ * confirmation arrives, the reaction is only: find the entry, patch the NMK if it
+ * changed, and send. All the logging is done after the frame is on the wire.
+ *
+ * Same organization as the station table: open addressing with linear probing in
+ * static memory. If the table is full, the least recently used entry of the probe
+ * sequence is overwritten, it is only a cache.
+ */
+
+#ifndef KEYCACHE_HEADER
+#define KEYCACHE_HEADER
+
+#include <stdint.h>
+#include <netinet/if_ether.h>
+#include "plc_homeplug.h"
+
+/* Number of slots. Must be a power of two. */
+#define KEYCACHE_SIZE 64
+#define KEYCACHE_MAX_PROBE 8
+
+typedef struct keycache_entry {
+	uint64_t evseMac; /* 48 bit MAC in the lower bits */
+	uint8_t inUse;
+	uint8_t NID[SLAC_NID_LEN];
+	uint32_t nUsed;
+	uint32_t lastUsed; /* counter value of the last use, for the replacement */
+	cm_set_key_request frame; /* the complete frame, as it goes on the wire */
+} keycache_entry;
+
+extern uint32_t nKeyCacheHits, nKeyCacheMisses, nKeyCacheNmkChanges;
+
+/* To be called once the own MAC is known. Builds the template, from which all
+   entries are created. Clears the cache. */
+void keyCacheInit(const uint8_t *ownMac, const uint8_t *destMac);
+/* Returns the ready-to-send frame for this EVSE and NID, with the given NMK. */
+const cm_set_key_request *keyCacheSetKeyFrame(const uint8_t *evseMac, const uint8_t *nid, const uint8_t *nmk);
+void keyCachePrintStatus(void (*printFunction)(char *s));
+
+#endif
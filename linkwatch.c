@@ -0,0 +1,165 @@
+/* Interface hot-plug, see linkwatch.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "linkwatch.h"
+
+#define NETLINK_BUFFER_SIZE 16384
+
+int linkWatchActive;
+uint32_t nLinkDown, nLinkUp, nLinkIndexChanges, nLinkResyncs;
+uint32_t nLinkGaps;
+uint64_t linkGapTotalMs, linkGapMaxMs, linkLastGapMs;
+
+static int netlinkFd = -1;
+static int ioctlFd = -1;
+static link_state state;
+static uint64_t downSinceMs;
+static unsigned char buffer[NETLINK_BUFFER_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+
+const link_state *linkWatchState(void) {
+	return &state;
+}
+
+/* Takes the new state, returns the LINKWATCH_ flags, and does the gap accounting. */
+static int update(int ifindex, int up, const uint8_t *mac, uint64_t nowMs) {
+	int changes = 0;
+	if (ifindex == 0) up = 0;
+	if (ifindex != state.ifindex) {
+		changes |= LINKWATCH_INDEX;
+		if (ifindex) nLinkIndexChanges++;
+		state.ifindex = ifindex;
+	}
+	if (mac && memcmp(mac, state.mac, ETH_ALEN)) {
+		changes |= LINKWATCH_MAC;
+		memcpy(state.mac, mac, ETH_ALEN);
+	}
+	if (up != state.up) {
+		state.up = up;
+		if (up) {
+			changes |= LINKWATCH_UP;
+			nLinkUp++;
+			nLinkGaps++;
+			linkLastGapMs = nowMs - downSinceMs;
+			linkGapTotalMs += linkLastGapMs;
+			if (linkLastGapMs > linkGapMaxMs) linkGapMaxMs = linkLastGapMs;
+		} else {
+			changes |= LINKWATCH_DOWN;
+			nLinkDown++;
+			downSinceMs = nowMs;
+		}
+	}
+	return changes;
+}
+
+/* The state with ioctl(), at the start and after a netlink overflow */
+static int resync(uint64_t nowMs) {
+	struct ifreq ifr;
+	uint8_t mac[ETH_ALEN];
+	int ifindex = 0, up = 0;
+	memset(&ifr, 0, sizeof(ifr));
+	memcpy(ifr.ifr_name, state.name, IFNAMSIZ);
+	if (ioctl(ioctlFd, SIOCGIFINDEX, &ifr) == 0) ifindex = ifr.ifr_ifindex;
+	if (ifindex && (ioctl(ioctlFd, SIOCGIFFLAGS, &ifr) == 0)) {
+		up = (ifr.ifr_flags & IFF_UP) && (ifr.ifr_flags & IFF_RUNNING);
+	}
+	if (ifindex && (ioctl(ioctlFd, SIOCGIFHWADDR, &ifr) == 0)) {
+		memcpy(mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+		return update(ifindex, up, mac, nowMs);
+	}
+	return update(ifindex, up, NULL, nowMs);
+}
+
+int linkWatchOpen(const char *ifName, uint64_t nowMs) {
+	struct sockaddr_nl snl;
+	memset(&state, 0, sizeof(state));
+	strncpy(state.name, ifName, IFNAMSIZ-1);
+	netlinkFd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (netlinkFd < 0) return -1;
+	memset(&snl, 0, sizeof(snl));
+	snl.nl_family = AF_NETLINK;
+	snl.nl_groups = RTMGRP_LINK;
+	if (bind(netlinkFd, (struct sockaddr *)&snl, sizeof(snl)) < 0) {
+		close(netlinkFd);
+		netlinkFd = -1;
+		return -1;
+	}
+	ioctlFd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (ioctlFd < 0) {
+		close(netlinkFd);
+		netlinkFd = -1;
+		return -1;
+	}
+	resync(nowMs);
+	/* the start is not a change */
+	nLinkIndexChanges = nLinkDown = nLinkUp = nLinkGaps = 0;
+	linkGapTotalMs = linkGapMaxMs = linkLastGapMs = 0;
+	downSinceMs = nowMs;
+	linkWatchActive = 1;
+	return netlinkFd;
+}
+
+/* One RTM_NEWLINK or RTM_DELLINK */
+static int handleLinkMessage(const struct nlmsghdr *nh, uint64_t nowMs) {
+	const struct ifinfomsg *ifi = NLMSG_DATA(nh);
+	const struct rtattr *rta;
+	int len = IFLA_PAYLOAD(nh);
+	const char *name = NULL;
+	const uint8_t *mac = NULL;
+	int ours;
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == IFLA_IFNAME) name = RTA_DATA(rta);
+		if ((rta->rta_type == IFLA_ADDRESS) && (RTA_PAYLOAD(rta) == ETH_ALEN)) mac = RTA_DATA(rta);
+	}
+	ours = name && (strncmp(name, state.name, IFNAMSIZ) == 0);
+	if (ours && (nh->nlmsg_type == RTM_NEWLINK)) {
+		return update(ifi->ifi_index, (ifi->ifi_flags & IFF_UP) && (ifi->ifi_flags & IFF_RUNNING), mac, nowMs);
+	}
+	if ((ifi->ifi_index == state.ifindex) && (ours || (name && (nh->nlmsg_type == RTM_NEWLINK)))) {
+		/* our interface was removed, or renamed */
+		return update(0, 0, NULL, nowMs);
+	}
+	return 0;
+}
+
+int linkWatchService(uint64_t nowMs) {
+	int changes = 0;
+	ssize_t n;
+	if (netlinkFd < 0) return 0;
+	for (;;) {
+		struct nlmsghdr *nh;
+		n = recv(netlinkFd, buffer, sizeof(buffer), MSG_DONTWAIT);
+		if (n < 0) {
+			if (errno == ENOBUFS) {
+				/* messages were lost */
+				nLinkResyncs++;
+				changes |= resync(nowMs);
+				continue;
+			}
+			break; /* EAGAIN: nothing more */
+		}
+		for (nh = (struct nlmsghdr *)buffer; NLMSG_OK(nh, n); nh = NLMSG_NEXT(nh, n)) {
+			if (((nh->nlmsg_type == RTM_NEWLINK) || (nh->nlmsg_type == RTM_DELLINK)) &&
+			    (nh->nlmsg_len >= NLMSG_LENGTH(sizeof(struct ifinfomsg)))) {
+				changes |= handleLinkMessage(nh, nowMs);
+			}
+		}
+	}
+	return changes;
+}
+
+void linkWatchClose(void) {
+	if (netlinkFd >= 0) close(netlinkFd);
+	if (ioctlFd >= 0) close(ioctlFd);
+	netlinkFd = ioctlFd = -1;
+	linkWatchActive = 0;
+}
@@ -0,0 +1,51 @@
+/* Interface hot-plug: rtnetlink listener for the link of the interface
+ *
+ * The interface is resolved by name at the start. If the USB Ethernet dongle to
+ * the modem is replugged, it comes back with a new index (and maybe a new MAC),
+ * and the receive socket would stay bound to the dead index. If the link only
+ * flaps, the frames of the gap are lost.
+ * We subscribe to RTMGRP_LINK and track, for the name of our interface, the
+ * index, the MAC and whether it is up (IFF_UP and IFF_RUNNING). The netlink
+ * socket is non-blocking, linkWatchService() drains it from the main loop and
+ * reports what changed. The caller rebinds the receive socket and refreshes the
+ * transmit address; the socket itself, with its BPF filter, its io_uring and
+ * the pipeline threads, stays the same.
+ * If the netlink socket overflows (ENOBUFS), the state is read again with ioctl().
+ * Each time without link (down, or no interface with the name) is a gap; the
+ * gaps are counted with their duration.
+ */
+
+#ifndef LINKWATCH_HEADER
+#define LINKWATCH_HEADER
+
+#include <stdint.h>
+#include <net/if.h>
+#include <netinet/if_ether.h>
+
+/* what changed, the result of linkWatchService() */
+#define LINKWATCH_DOWN  0x01
+#define LINKWATCH_UP    0x02
+#define LINKWATCH_INDEX 0x04 /* the interface is new, or it is gone (index 0) */
+#define LINKWATCH_MAC   0x08
+
+typedef struct link_state {
+	char name[IFNAMSIZ];
+	int ifindex; /* 0 if there is no interface with the name */
+	int up;
+	uint8_t mac[ETH_ALEN];
+} link_state;
+
+extern int linkWatchActive;
+extern uint32_t nLinkDown, nLinkUp, nLinkIndexChanges, nLinkResyncs;
+extern uint32_t nLinkGaps;
+extern uint64_t linkGapTotalMs, linkGapMaxMs, linkLastGapMs;
+
+/* Opens the netlink socket and reads the current state of the interface. */
+int linkWatchOpen(const char *ifName, uint64_t nowMs);
+/* Handles the pending netlink messages. Returns the LINKWATCH_ flags of the changes,
+   the state is updated. */
+int linkWatchService(uint64_t nowMs);
+const link_state *linkWatchState(void);
+void linkWatchClose(void);
+
+#endif
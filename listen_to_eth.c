@@ -31,6 +31,88 @@
  *      other interfaces.
  *    - Bugfix: poll-descriptor dynamically initialized with correct socket descriptor
  *    - Decoding of CM_SET_KEY.CNF
+ *   2026-10-19
+ *    - Feature: Station discovery cache (stations.c). Each source MAC is kept in an
+ *      open-addressed hash table, with first/last seen, message counters, software
+ *      version and the NID/NMK from SLAC_MATCH. Snapshot in stations.bin, so that
+ *      a restart knows the stations immediately. Key 't' prints the table.
+ *    - Feature: command line options -i (interface) and -w (pcap capture file).
+ *    - Feature: io_uring backend (-u, uring.c). Multishot receive with provided
+ *      buffers, and queued double-buffered writes for log and capture, so that we
+ *      need nearly no syscalls per frame. Without kernel support, the poll loop is used.
+ *    - Feature: passive SLAC session tracking (slacsession.c), with timeout.
+ *    - Feature: event stream (-e, eventstream.c). Decoded MMEs, SLAC session transitions
+ *      and set-key results as JSON lines on a Unix socket. Subscribers can filter by
+ *      MMTYPE, slow subscribers lose events (counted) instead of blocking us.
+ *    - Feature: flight recorder (-f, flightrec.c). The last frames stay in a fixed
+ *      ring buffer in memory. A negative set-key/get-key result, a SLAC timeout or
+ *      the key 'd' dumps them into a pcapng file.
+ *    - Feature: decoding of the IPv6 traffic after SLAC (v2g.c, exi.c). SDP request and
+ *      response, TCP reassembly of the V2GTP messages, and a small EXI decoder for the
+ *      supportedAppProtocol handshake and the SessionID and type of each V2G_Message.
+ *      The messages are logged together with the SLAC session of the PEV.
+ *    - Improvement: key cache (keycache.c). The CM_SET_KEY.REQ is kept pre-serialized per
+ *      EVSE MAC and NID. On CM_SLAC_MATCH.CNF the frame is only patched and sent,
+ *      before any decoding and logging, to shorten the match-to-set-key latency.
+ *    - Feature: decryption of CM_ENCRYPTED_PAYLOAD.IND (-D, encpayload.c, aes.c) with the
+ *      NMKs learned from SLAC_MATCH. AES-NI or ARMv8 crypto if available, portable code
+ *      otherwise. The embedded MME is processed like a received one.
+ *    - Refactoring: the MMTYPE names are in mmtypes.c (now all HomePlug AV types), and the
+ *      SLAC tracking is per thread, both shared with the offline analyzer plc_analyzer.
+ *    - Feature: session index (sessionindex.c). With -w, a file <capture>.idx is written
+ *      next to the capture, with PEV MAC, EVSE MAC, RunID, NID, time range and file offsets
+ *      of each SLAC session. plc_analyzer -x creates it for existing captures, plc_query
+ *      finds sessions with it and extracts their frames.
+ *    - Feature: tracepoints (trace.h) at frame receive, dispatch, HomePlug handler, set-key,
+ *      log and transmit. USDT probes "plctool" if sys/sdt.h is there at build time, and
+ *      with -t a span ring, written as Chrome trace JSON at exit or on key 'c'.
+ *    - Improvement: logging with levels and categories (log.h). A disabled message costs one
+ *      compare, no formatting. The lines per frame are DEBUG, and the production build
+ *      (make LOGLEVEL=INFO) removes them completely. Runtime levels with -l.
+ *    - Feature: loss accounting of the receive socket (rxstats.c). Per status interval the
+ *      PACKET_STATISTICS (frames, drops in the socket buffer), the SO_RXQ_OVFL counter and
+ *      the drop counters of the interface. Size of the socket receive buffer with -b.
+ *    - Feature: jitter and stall monitor (-m, loopmon.c). Histograms of the durations of the
+ *      main loop iterations, of data_process() and of the log output, with a cheap clock.
+ *      Stalls above the threshold are logged with the frame type which was processed.
+ *    - Feature: MAC allow and deny lists (-a, -x, macfilter.c), checked on destination,
+ *      source and the PEV/EVSE MACs inside the SLAC messages, before anything else is done
+ *      with the frame. Small lists also go into a BPF filter on the receive socket.
+ *    - Feature: replay of a capture onto the interface (-r, -M, replay.c), with the original
+ *      timing (absolute deadlines, bursts batched with sendmmsg) and MAC rewriting. The
+ *      timing error is logged at the end.
+ *    - Feature: pipelined reception (-P, pipeline.c). A capture thread drains the socket into
+ *      a frame pool, a capture sink thread writes the pcap file, the main loop decodes and
+ *      reacts, and a log sink thread writes the log. The stages are connected by SPSC rings
+ *      of frame slots. A metrics thread reports wait time and ring occupancy per stage.
+ *    - Feature: asynchronous request/response (mmrequest.c). The CM_GET_KEY.REQ and the
+ *      manual CM_SET_KEY.REQ are sent with a callback, which gets the confirmation or a
+ *      timeout. The request id goes into the nonce, so the confirmation finds its request.
+ *    - Feature: transmit scheduler (txsched.c). All frames go through one transmit path,
+ *      with the classes critical (CM_SET_KEY after the SLAC match), control and bulk, and
+ *      a token bucket per destination modem (-R rate[:burst]). Frames without token wait
+ *      in a bounded queue. Sent, dropped and queueing delay are reported per class.
+ *    - Improvement: interface hot-plug (linkwatch.c). An rtnetlink listener follows the link
+ *      of the interface. If the dongle comes back with a new index or MAC, the receive socket
+ *      is bound again and the transmit address and the key cache are refreshed. The times
+ *      without link are counted. A receive error of the dead link no longer ends the program.
+ *    - Feature: restart without gap (-H, handoff.c). The new instance connects to the running
+ *      one over a Unix socket and gets its raw sockets (SCM_RIGHTS) and a snapshot of the keys,
+ *      the SLAC sessions and the stations. The frames of the switchover wait in the socket buffer.
+ *    - Feature: simulation of SLAC sessions on a virtual clock (-S, slacsim.c, clock.c). Frame
+ *      loss, reordering, retransmits and the timeouts run through the normal receive path in
+ *      fast-forward, and the end states are checked. The timers take their time from clock.c.
+ *    - Feature: PHY rate collector (-N, nwstats.c). The modems are polled with CM_NW_INFO and
+ *      CM_NW_STATS as bulk requests, the rates are kept per modem and station in delta-encoded
+ *      rings of fixed size, shown with key 'n', in the status, the event stream and nwstats.bin.
+ *    - Feature: compressed log storage (-L, logstore.c) instead of log.txt. Repeated lines are
+ *      counted, not written again, the blocks are compressed by a thread into rotated segments
+ *      with size cap and retention. plc_logread expands them to text.
+ *    - Feature: freestanding core (plccore.c) of the decoder, the encoders and the SLAC session
+ *      logic, without I/O, libc and allocation, in a fixed RAM budget, for the controllers in the
+ *      chargers. plccore_linux.c is its raw socket adapter, plc_core runs it live or replays the
+ *      captures through it and slacsession.c. The key cache and CM_GET_KEY.REQ use its encoders,
+ *      the 64 KB transmit buffer is gone.
  * 
  * 
  * 
@@ -112,10 +194,39 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <memory.h>
+#include <stddef.h>
 #include <errno.h>
 #include <poll.h>
+#include <time.h>
 
 #include "plc_homeplug.h" /* all types and definitions related to homeplug/etc */
+#include "stations.h"
+#include "uring.h"
+#include "capture.h"
+#include "slacsession.h"
+#include "eventstream.h"
+#include "flightrec.h"
+#include "v2g.h"
+#include "keycache.h"
+#include "encpayload.h"
+#include "mmtypes.h"
+#include "sessionindex.h"
+#include "trace.h"
+#include "log.h"
+#include "rxstats.h"
+#include "loopmon.h"
+#include "macfilter.h"
+#include "replay.h"
+#include "pipeline.h"
+#include "mmrequest.h"
+#include "txsched.h"
+#include "linkwatch.h"
+#include "handoff.h"
+#include "clock.h"
+#include "slacsim.h"
+#include "nwstats.h"
+#include "logstore.h"
+#include "plccore.h"
 
 
 int blExit=0;
@@ -171,20 +282,41 @@ int getch()
 
 /*********************************************************************/
 /* Log File handling */
-FILE* hLogFile;
-char str1000[1000];
-char strTmp[1000];
+FILE* hLogFile; /* NULL with the log store (-L) */
+int logWriter=-1; /* io_uring writer for the log file, or -1 if we use stdio */
 
 void printToLogAndScreen(char *s) {
-	printf("%s\n", s);
-	fprintf(hLogFile, "%s\n", s);
-	fflush(hLogFile);
+	LOOPMON_BEGIN(tLog);
+	TRACE_BEGIN(TRACE_LOG, log, strlen(s));
+	if (pipelineActive) {
+		/* the log sink thread writes it */
+		pipelineLog(s);
+	} else if (logStoreActive) {
+		printf("%s\n", s);
+		logStoreWrite(s);
+	} else if (logWriter>=0) {
+		printf("%s\n", s);
+		/* queued, the main loop hands it over to the kernel */
+		uringWrite(logWriter, s, strlen(s));
+		uringWrite(logWriter, "\n", 1);
+	} else {
+		printf("%s\n", s);
+		fprintf(hLogFile, "%s\n", s);
+		fflush(hLogFile);
+	}
+	TRACE_END(TRACE_LOG, log);
+	LOOPMON_END(tLog, LOOPMON_LOG);
+}
+
+void closeLog(void) {
+	if (logStoreActive) logStoreClose(); else fclose(hLogFile);
 }
 
 /*********************************************************************/
 
 int total,nHomePlug,icmp,igmp,other,iphdrlen;
 int nPollSuccess, nPollNothing, nMainLoops;
+uint32_t nRxLinkErrors; /* receive errors because the link was down */
 int nHpSlacMatchCnf, nHpGetSwVersion, nSetKey;
 
 struct sockaddr_in source,dest;
@@ -198,136 +330,104 @@ struct sockaddr socket_address_rx;
 struct pollfd mypollfd;
 
 #define RECEIVE_BUFFER_SIZE 65536
-unsigned char receivebuffer[RECEIVE_BUFFER_SIZE];
-#define TRANSMIT_BUFFER_SIZE 65536
-unsigned char transmitbuffer[TRANSMIT_BUFFER_SIZE];
+unsigned char receiveStorage[RECEIVE_BUFFER_SIZE];
+/* The frame which is processed. With the pipeline, it points into the frame pool. */
+unsigned char *receivebuffer = receiveStorage;
+uint64_t frameCaptureOffset; /* where the frame is in the capture file */
 char myNMK[SLAC_NMK_LEN] = "hallo";
 char myNID[SLAC_NID_LEN] = "1234567";
 
-void sendSetKeyRequest(void) {
-	printToLogAndScreen("sending SetKeyRequest");
-	struct ethhdr *eh = (struct ethhdr *) transmitbuffer;
-    struct cm_set_key_request *cmskr = (struct cm_set_key_request *) transmitbuffer;
-    int tx_len;
-    
-    /* Construct the Ethernet header */
-	memset(transmitbuffer, 0, TRANSMIT_BUFFER_SIZE);
-	/* Ethernet header */
-	eh->h_source[0] = ((uint8_t *)&if_mac.ifr_hwaddr.sa_data)[0];
-	eh->h_source[1] = ((uint8_t *)&if_mac.ifr_hwaddr.sa_data)[1];
-	eh->h_source[2] = ((uint8_t *)&if_mac.ifr_hwaddr.sa_data)[2];
-	eh->h_source[3] = ((uint8_t *)&if_mac.ifr_hwaddr.sa_data)[3];
-	eh->h_source[4] = ((uint8_t *)&if_mac.ifr_hwaddr.sa_data)[4];
-	eh->h_source[5] = ((uint8_t *)&if_mac.ifr_hwaddr.sa_data)[5];	
-	eh->h_dest[0] = MY_DEST_MAC0;
-	eh->h_dest[1] = MY_DEST_MAC1;
-	eh->h_dest[2] = MY_DEST_MAC2;
-	eh->h_dest[3] = MY_DEST_MAC3;
-	eh->h_dest[4] = MY_DEST_MAC4;
-	eh->h_dest[5] = MY_DEST_MAC5;
-
-	/* Ethernet protocol type */
-	eh->h_proto = htons(ETH_P_HPAV); /* Homeplug protocol 0x88e1 */
-
-	/* Fill the Homeplug packet data */
-	cmskr->homeplug.MMV = HOMEPLUG_MMV; /* the homeplug version */
-	cmskr->homeplug.MMTYPE = HTOLE16(CM_SET_KEY | MMTYPE_REQ);
-	//cmskr->homeplug.MMTYPE = HTOLE16(CM_GET_KEY | MMTYPE_REQ);
-	cmskr->homeplug.FMSN = 0;
-	cmskr->homeplug.FMID = 0;
-	cmskr->KEYTYPE = SLAC_CM_SETKEY_KEYTYPE;
-	cmskr->MYNOUNCE = 0;
-	cmskr->YOURNOUNCE = 0;
-	cmskr->PID = 4; /* Laut ISO15118-3 fest auf 4, "HLE protocol" */
-	cmskr->PRN = 0;
-	cmskr->PMN = 0;
-	cmskr->CCOCAP = 0; /* Welche CCo-Capability wäre
-						 richtig? Das wireshark interpretiert 00 als
-					    "station", das passt. */
-					    
-	/* Woher die Netzwerk-ID nehmen? 
-	   Antwort: Laut ISO aus der CM_SLAC_MATCH.CNF.NID */
-	memcpy (cmskr->NID, myNID, sizeof (cmskr->NID));	
-	cmskr->NEWEKS = SLAC_CM_SETKEY_EKS; /* 1 according to ISO */
-	memcpy (cmskr->NEWKEY, myNMK, sizeof (cmskr->NEWKEY));	
-	
-	/* The message length */
-	tx_len = sizeof(struct cm_set_key_request);
-	
-	/* Send packet */
-	if (sendto(sock_fd_tx, transmitbuffer, tx_len, 0, (struct sockaddr*)&socket_address_tx, sizeof(struct sockaddr_ll)) < 0) {
+uint8_t myEvseMac[ETH_ALEN]; /* the EVSE of the last SLAC match */
+char *traceFileName=NULL; /* -t */
+
+/* The one transmit path. It is called by the transmit scheduler, the others use txSchedSend(). */
+int transmitFrame(const void *frame, int len) {
+	if (sendto(sock_fd_tx, frame, len, 0, (struct sockaddr*)&socket_address_tx, sizeof(struct sockaddr_ll)) < 0) {
 	    perror("sendto failed");
+	    return -1;
+	}
+	TRACE_MARK(TRACE_TRANSMIT, transmit, len);
+	return 0;
+}
+
+void sendSetKeyFrame(const cm_set_key_request *frame) {
+	TRACE_BEGIN(TRACE_SETKEY, setkey, 0);
+	txSchedSend(frame, sizeof(*frame), TXSCHED_CRITICAL);
+	nSetKey++;
+	TRACE_END(TRACE_SETKEY, setkey);
+}
+
+/* The transmit function of the request/response API. The periodic statistics may wait. */
+int sendManagementFrame(const void *frame, int len) {
+	return (txSchedSend(frame, len, nwStatsIsQuery(frame, len) ? TXSCHED_BULK : TXSCHED_CONTROL) < 0) ? -1 : 0;
+}
+
+/* Callback of the CM_SET_KEY and CM_GET_KEY requests. The result itself is decoded
+   by decodeCM_SET_KEY__CNF() and decodeCM_GET_KEY__CNF(). */
+void onKeyRequestDone(void *context, int status, const unsigned char *frame, int len, uint32_t elapsedMs) {
+	const char *name = (const char *)context;
+	if (status == MMREQ_OK) {
+		LOG_INFO(LOG_CAT_KEY, "%s.CNF after %u ms", name, elapsedMs);
+	} else if (status == MMREQ_TIMEOUT) {
+		LOG_WARN(LOG_CAT_KEY, "%s.REQ: no confirmation within %u ms", name, elapsedMs);
+	}
+}
+
+void sendSetKeyRequest(void) {
+	cm_set_key_request frame;
+	LOG_INFO(LOG_CAT_KEY, "sending SetKeyRequest");
+	/* The frame comes ready from the key cache. NID and NMK are taken from
+	   the CM_SLAC_MATCH.CNF, like the ISO requires. The copy gets the nonce. */
+	frame = *keyCacheSetKeyFrame(myEvseMac, (uint8_t *)myNID, (uint8_t *)myNMK);
+	if (mmRequestSubmit((unsigned char *)&frame, sizeof(frame), clockMonotonicMs(), MMREQ_DEFAULT_TIMEOUT_MS,
+			onKeyRequestDone, "CM_SET_KEY") >= 0) {
+		nSetKey++;
 	}
-	nSetKey++;	
+}
+
+/* The critical path: CM_SLAC_MATCH.CNF received, the CM_SET_KEY.REQ with its NID
+   and NMK shall go out as fast as possible. So we send first, and the decoding
+   and logging is done afterwards. */
+void reactOnSlacMatch(int buflen) {
+	struct cm_slac_match_confirm *matchconfirm = (struct cm_slac_match_confirm *) receivebuffer;
+	if (buflen < (int)sizeof(struct cm_slac_match_confirm)) return;
+	sendSetKeyFrame(keyCacheSetKeyFrame(matchconfirm->MatchVarField.EVSE_MAC,
+		matchconfirm->MatchVarField.NID, matchconfirm->MatchVarField.NMK));
 }
 
 
 void sendGetKeyRequest(void) {
-	printToLogAndScreen("sending GetKeyRequest");
-	struct ethhdr *eh = (struct ethhdr *) transmitbuffer;
-    struct cm_get_key_request *gkr = (struct cm_get_key_request *) transmitbuffer;
-    int tx_len;
-    
-    /* Construct the Ethernet header */
-	memset(transmitbuffer, 0, TRANSMIT_BUFFER_SIZE);
-	/* Ethernet header */
-	eh->h_source[0] = ((uint8_t *)&if_mac.ifr_hwaddr.sa_data)[0];
-	eh->h_source[1] = ((uint8_t *)&if_mac.ifr_hwaddr.sa_data)[1];
-	eh->h_source[2] = ((uint8_t *)&if_mac.ifr_hwaddr.sa_data)[2];
-	eh->h_source[3] = ((uint8_t *)&if_mac.ifr_hwaddr.sa_data)[3];
-	eh->h_source[4] = ((uint8_t *)&if_mac.ifr_hwaddr.sa_data)[4];
-	eh->h_source[5] = ((uint8_t *)&if_mac.ifr_hwaddr.sa_data)[5];	
-	eh->h_dest[0] = MY_DEST_MAC0;
-	eh->h_dest[1] = MY_DEST_MAC1;
-	eh->h_dest[2] = MY_DEST_MAC2;
-	eh->h_dest[3] = MY_DEST_MAC3;
-	eh->h_dest[4] = MY_DEST_MAC4;
-	eh->h_dest[5] = MY_DEST_MAC5;
-
-	/* Ethernet protocol type */
-	eh->h_proto = htons(ETH_P_HPAV); /* Homeplug protocol 0x88e1 */
-
-	/* Fill the Homeplug packet data */
-	gkr->homeplug.MMV = HOMEPLUG_MMV; /* the homeplug version */
-	gkr->homeplug.MMTYPE = HTOLE16(CM_GET_KEY | MMTYPE_REQ);
-	gkr->homeplug.FMSN = 0;
-	gkr->homeplug.FMID = 0;
-	gkr->RequestType = 0; /* 0= direct */
-	gkr->RequestedKeyType = HOMEPLUG_KEYTYPE_NMK; /* only "NMK" is permitted over the H1 interface */
-	gkr->MYNOUNCE = 0;
-	gkr->PID = 4; /* Laut ISO15118-3 fest auf 4, "HLE protocol" */
-	gkr->PRN = 0;
-	gkr->PMN = 0;
-					    
-	/* Woher die Netzwerk-ID nehmen? 
+	static const uint8_t modemMac[ETH_ALEN] = { MY_DEST_MAC0, MY_DEST_MAC1, MY_DEST_MAC2, MY_DEST_MAC3, MY_DEST_MAC4, MY_DEST_MAC5 };
+	uint8_t frame[PLCCORE_GET_KEY_REQ_LEN];
+	int tx_len;
+	LOG_INFO(LOG_CAT_KEY, "sending GetKeyRequest");
+	/* Woher die Netzwerk-ID nehmen?
 	   Antwort: Laut ISO aus der CM_SLAC_MATCH.CNF.NID */
-	memcpy (gkr->NID, myNID, sizeof (gkr->NID));	
-	
-	/* The message length */
-	tx_len = sizeof(struct cm_get_key_request);
-	
-	/* Send packet */
-	if (sendto(sock_fd_tx, transmitbuffer, tx_len, 0, (struct sockaddr*)&socket_address_tx, sizeof(struct sockaddr_ll)) < 0) {
-	    perror("sendto failed");
-	}
+	tx_len = plcCoreEncodeGetKey(frame, sizeof(frame), (uint8_t *)if_mac.ifr_hwaddr.sa_data, modemMac, (uint8_t *)myNID);
+	/* Send packet. The confirmation or the timeout is reported by onKeyRequestDone(). */
+	mmRequestSubmit(frame, tx_len, clockMonotonicMs(), MMREQ_DEFAULT_TIMEOUT_MS, onKeyRequestDone, "CM_GET_KEY");
 }
 
 
 
 void printTheNMK(void) {
+ static const char hexDigits[] = "0123456789abcdef";
  int i;
- char sLong[1000];
-  sprintf(sLong, "NMK=");
+ char sLong[4+3*SLAC_NMK_LEN+1] = "NMK=";
+ char *p = sLong+4;
+  if (!LOG_ENABLED(LOG_CAT_KEY, LOG_LEVEL_INFO)) return;
   for (i=0; i<SLAC_NMK_LEN; i++) {
-	sprintf(strTmp, "%02x ", myNMK[i]);
-	strcat(sLong, strTmp);
+	*p++ = hexDigits[(uint8_t)myNMK[i] >> 4];
+	*p++ = hexDigits[(uint8_t)myNMK[i] & 0x0f];
+	*p++ = ' ';
   }
-  printToLogAndScreen(sLong);
+  *p = 0;
+  LOG_INFO(LOG_CAT_KEY, "%s", sLong);
 }
 
 void extractNmkFromMatchResponse(void) {
 	struct cm_slac_match_confirm *matchconfirm = (struct cm_slac_match_confirm *) receivebuffer;
-	sprintf(str1000, "Extracting the NMK from slac_match of EV %2x:%2x:%2x:%2x:%2x:%2x and EVSE %2x:%2x:%2x:%2x:%2x:%2x",
+	LOG_INFO(LOG_CAT_SLAC, "Extracting the NMK from slac_match of EV %2x:%2x:%2x:%2x:%2x:%2x and EVSE %2x:%2x:%2x:%2x:%2x:%2x",
 	   matchconfirm->MatchVarField.PEV_MAC[0],
 	   matchconfirm->MatchVarField.PEV_MAC[1],
 	   matchconfirm->MatchVarField.PEV_MAC[2],
@@ -341,151 +441,318 @@ void extractNmkFromMatchResponse(void) {
 	   matchconfirm->MatchVarField.EVSE_MAC[4],
 	   matchconfirm->MatchVarField.EVSE_MAC[5]);
 	memcpy(myNMK, matchconfirm->MatchVarField.NMK , SLAC_NMK_LEN);
-	printToLogAndScreen(str1000);
 	printTheNMK();
 }
 
 void extractNidFromMatchResponse(void) {
 	struct cm_slac_match_confirm *matchconfirm = (struct cm_slac_match_confirm *) receivebuffer;
-	printToLogAndScreen("Extracting the NID");
+	LOG_INFO(LOG_CAT_SLAC, "Extracting the NID");
 	memcpy(myNID, matchconfirm->MatchVarField.NID , SLAC_NID_LEN);
+	memcpy(myEvseMac, matchconfirm->MatchVarField.EVSE_MAC, ETH_ALEN);
 }
 
-void decodeCM_SET_KEY__CNF(void) {
+void storeKeyInStationTable(void) {
+	struct cm_slac_match_confirm *matchconfirm = (struct cm_slac_match_confirm *) receivebuffer;
+	/* Both partners of the match share the same network. */
+	stationSetKey(stationTouch(matchconfirm->MatchVarField.PEV_MAC, clockUnixTime(), -1),
+		matchconfirm->MatchVarField.NID, matchconfirm->MatchVarField.NMK);
+	stationSetKey(stationTouch(matchconfirm->MatchVarField.EVSE_MAC, clockUnixTime(), -1),
+		matchconfirm->MatchVarField.NID, matchconfirm->MatchVarField.NMK);
+	if (encPayloadActive) encPayloadLearnKey(matchconfirm->MatchVarField.NMK);
+}
+
+void decodeCM_GET_DEVICE_SW_VERSION__CNF(int buflen) {
+	struct cm_get_sw_version_confirm *swc = (struct cm_get_sw_version_confirm *) receivebuffer;
+	int len = swc->MVERLENGTH;
+	int maxlen = buflen - (int)offsetof(struct cm_get_sw_version_confirm, MVERSION);
+	if (len>maxlen) len=maxlen; /* do not trust the length field of short frames */
+	if (len>SW_VERSION_MAX_LEN) len=SW_VERSION_MAX_LEN;
+	if (len<=0) return;
+	stationSetSwVersion(stationLookup(swc->ethernet.h_source), swc->MVERSION, len);
+	LOG_INFO(LOG_CAT_HOMEPLUG, "Decoding CM_GET_DEVICE_SW_VERSION.CNF %.*s", len, swc->MVERSION);
+}
+
+void decodeCM_SET_KEY__CNF(int buflen) {
 	struct cm_set_key_confirm *skc = (struct cm_set_key_confirm *) receivebuffer;
 	uint8_t result = skc->RESULT;
 	if (result == 0) {
-		sprintf(strTmp, "RESULT ok");
+		LOG_INFO(LOG_CAT_KEY, "Decoding CM_SET_KEY__CNF RESULT ok");
 	} else {
-		sprintf(strTmp, "RESULT FAIL %d", result);
+		LOG_WARN(LOG_CAT_KEY, "Decoding CM_SET_KEY__CNF RESULT FAIL %d", result);
+	}
+	if (result != 0) flightRecorderTrigger(FLIGHTREC_TRIGGER_RESULT_FAIL, "setkey_fail");
+	eventStreamEmitSetKey(skc->ethernet.h_source, result);
+	if (!slacObserveSetKeyConfirm(receivebuffer, buflen, clockMonotonicMs())) {
+		LOG_INFO(LOG_CAT_KEY, "CM_SET_KEY.CNF is not the answer to us, the SLAC session is not changed");
 	}
-	sprintf(str1000, "Decoding CM_SET_KEY__CNF %s", strTmp);
-	printToLogAndScreen(str1000);	
 }
 
 void decodeCM_GET_KEY__CNF(void) {
 	struct cm_get_key_confirm *gkc = (struct cm_get_key_confirm *) receivebuffer;
 	uint8_t result = gkc->RESULT;
 	if (result == 0) {
-		sprintf(strTmp, "RESULT ok");
+		LOG_INFO(LOG_CAT_KEY, "Decoding CM_GET_KEY__CNF RESULT ok");
 	} else {
-		sprintf(strTmp, "RESULT FAIL %d", result);
+		LOG_WARN(LOG_CAT_KEY, "Decoding CM_GET_KEY__CNF RESULT FAIL %d", result);
 	}
-	sprintf(str1000, "Decoding CM_GET_KEY__CNF %s", strTmp);
-	printToLogAndScreen(str1000);	
+	if (result != 0) flightRecorderTrigger(FLIGHTREC_TRIGGER_RESULT_FAIL, "getkey_fail");
 }
 
-void processHomeplugFrame(void) {
-	struct homeplug_hdr *hph = (struct homeplug_hdr*)(receivebuffer+sizeof(struct ethhdr));
-	uint16_t mmtype = hph->MMTYPE;
-	uint8_t mmSubType = mmtype & 3;/* lower two bits defining the REQ/CNF/IND/RSP */
-	char strSubType[10];
-	char strMainType[50];
-	switch (mmSubType) {
-		case MMTYPE_REQ:
-			sprintf(strSubType, "REQ");
-			break;
-		case MMTYPE_CNF:
-			sprintf(strSubType, "CNF");
+/*********************************************************************/
+/* Session index of the capture file (sessionindex.c): one record per SLAC session,
+   written next to the capture when it is closed. */
+session_index captureIndex;
+
+void addSessionToCaptureIndex(const slac_session *session, int state, int flags) {
+	session_index_record *r;
+	if (sessionIndexAddSession(&captureIndex, session, state, flags, clockMonotonicToRealtimeNs())<0) return;
+	if ((state == SLAC_STATE_KEY_SET) || (state == SLAC_STATE_KEY_FAILED)) {
+		/* the CM_SET_KEY.CNF which ended the session is the frame which was captured last */
+		r = &captureIndex.records[captureIndex.nRecords-1];
+		r->lastOffset = frameCaptureOffset;
+		r->nFrames++;
+	}
+}
+
+void addOpenSessionToCaptureIndex(const slac_session *session) {
+	if ((session->core.state == SLAC_STATE_IDLE) || (session->core.state >= SLAC_STATE_KEY_SET)) return;
+	addSessionToCaptureIndex(session, session->core.state, SESSION_INDEX_FLAG_OPEN);
+}
+
+/* Called by the SLAC session tracking on each state change */
+void slacTransition(const slac_session *session, int oldState) {
+	const uint8_t *p = session->core.pevMac;
+	LOG_INFO(LOG_CAT_SLAC, "SLAC session of PEV %02x:%02x:%02x:%02x:%02x:%02x: %s -> %s",
+		p[0], p[1], p[2], p[3], p[4], p[5], slacStateName(oldState), slacStateName(session->core.state));
+	eventStreamEmitSlac(session->core.pevMac, session->core.evseMac, slacStateName(oldState), slacStateName(session->core.state),
+		session->core.nSounds);
+	if (session->core.state == SLAC_STATE_TIMEOUT) flightRecorderTrigger(FLIGHTREC_TRIGGER_SLAC_TIMEOUT, "slac_timeout");
+	if (captureActive && (session->core.state >= SLAC_STATE_KEY_SET)) addSessionToCaptureIndex(session, session->core.state, 0);
+}
+
+/* Called by the V2G decoder for each SDP or V2G message */
+void v2gEvent(const v2g_event *ev) {
+	const uint8_t *pevMac = ev->fromPev ? ev->srcMac : ev->dstMac;
+	slac_session *session = slacFindSession(pevMac);
+	const exi_decoded *x = ev->exi;
+	char strSession[80];
+	char strSessionId[2*EXI_MAX_SESSIONID_LEN+1];
+	int i;
+	if ((ev->kind == V2G_EVENT_EXI) && (x->kind == EXI_DECODED_V2G_MESSAGE) && session) {
+		session->nV2gMessages++;
+		memcpy(session->v2gSessionId, x->sessionId, x->sessionIdLen);
+		session->v2gSessionIdLen = x->sessionIdLen;
+	}
+	if (session && (ev->kind == V2G_EVENT_EXI)) {
+		switch (x->kind) {
+			case EXI_DECODED_APPHAND_REQ:
+				eventStreamEmitV2g(pevMac, session->core.evseMac, "supportedAppProtocolReq", NULL, 0);
+				break;
+			case EXI_DECODED_APPHAND_RES:
+				eventStreamEmitV2g(pevMac, session->core.evseMac, "supportedAppProtocolRes", NULL, 0);
+				break;
+			case EXI_DECODED_V2G_MESSAGE:
+				eventStreamEmitV2g(pevMac, session->core.evseMac, x->name, x->sessionId, x->sessionIdLen);
+				break;
+			default:
+				break;
+		}
+	}
+	if (!LOG_ENABLED(LOG_CAT_V2G, LOG_LEVEL_INFO)) return;
+	if (session) {
+		const uint8_t *e = session->core.evseMac;
+		sprintf(strSession, "PEV %02x:%02x:%02x:%02x:%02x:%02x, EVSE %02x:%02x:%02x:%02x:%02x:%02x, SLAC %s",
+			pevMac[0], pevMac[1], pevMac[2], pevMac[3], pevMac[4], pevMac[5],
+			e[0], e[1], e[2], e[3], e[4], e[5], slacStateName(session->core.state));
+	} else {
+		sprintf(strSession, "PEV %02x:%02x:%02x:%02x:%02x:%02x, no SLAC seen",
+			pevMac[0], pevMac[1], pevMac[2], pevMac[3], pevMac[4], pevMac[5]);
+	}
+	switch (ev->kind) {
+		case V2G_EVENT_SDP_REQ:
+			LOG_INFO(LOG_CAT_V2G, "V2G: SDP request, security 0x%02x, transport 0x%02x (%s)",
+				ev->security, ev->transport, strSession);
 			break;
-		case MMTYPE_IND:
-			sprintf(strSubType, "IND");
+		case V2G_EVENT_SDP_RES:
+			{
+				char strAddr[INET6_ADDRSTRLEN];
+				inet_ntop(AF_INET6, ev->seccAddress, strAddr, sizeof(strAddr));
+				LOG_INFO(LOG_CAT_V2G, "V2G: SDP response, SECC [%s]:%u, security 0x%02x, transport 0x%02x (%s)",
+					strAddr, ev->seccPort, ev->security, ev->transport, strSession);
+			}
 			break;
-		case MMTYPE_RSP:
-			sprintf(strSubType, "RSP");
+		case V2G_EVENT_EXI:
+			switch (x->kind) {
+				case EXI_DECODED_APPHAND_REQ:
+					LOG_INFO(LOG_CAT_V2G, "V2G: supportedAppProtocolReq with %d protocols (%s)", x->nAppProtocols, strSession);
+					for (i=0; i<x->nAppProtocols; i++) {
+						LOG_DEBUG(LOG_CAT_V2G, "V2G:   %s %u.%u SchemaID %u priority %u", x->appProtocol[i].protocolNamespace,
+							x->appProtocol[i].versionMajor, x->appProtocol[i].versionMinor,
+							x->appProtocol[i].schemaId, x->appProtocol[i].priority);
+					}
+					break;
+				case EXI_DECODED_APPHAND_RES:
+					if (x->schemaIdPresent) {
+						LOG_INFO(LOG_CAT_V2G, "V2G: supportedAppProtocolRes %s, SchemaID %u (%s)",
+							exiAppHandResponseCodeName(x->responseCode), x->schemaId, strSession);
+					} else {
+						LOG_INFO(LOG_CAT_V2G, "V2G: supportedAppProtocolRes %s (%s)",
+							exiAppHandResponseCodeName(x->responseCode), strSession);
+					}
+					break;
+				case EXI_DECODED_V2G_MESSAGE:
+					for (i=0; i<x->sessionIdLen; i++) sprintf(strSessionId+2*i, "%02x", x->sessionId[i]);
+					strSessionId[2*x->sessionIdLen]=0;
+					LOG_INFO(LOG_CAT_V2G, "V2G: %s %s, SessionID %s (%s)", (x->schema==EXI_SCHEMA_DIN) ? "DIN" : "ISO",
+						x->name, strSessionId, strSession);
+					break;
+				default:
+					break;
+			}
 			break;
 		default:
-			sprintf(strSubType, "???");
+			LOG_WARN(LOG_CAT_V2G, "V2G: undecodable message, V2GTP length %u (%s)", ev->v2gtpLength, strSession);
+			break;
 	}
-	switch (mmtype & 0xfffc) { /* upper 14 bits */
-	  case CM_SLAC_PARAM:
-	    sprintf(strMainType, "CM_SLAC_PARAM");
-	    break;
-	  case CM_MNBC_SOUND:
-	    sprintf(strMainType, "CM_MNBC_SOUND");
-	    break;
-	  case CM_START_ATTEN_CHAR:
-	    sprintf(strMainType, "CM_START_ATTEN_CHAR");
-	    break;	    
-	  case CM_ATTEN_CHAR:
-	    sprintf(strMainType, "CM_ATTEN_CHAR");
-	    break;
-	  case CM_SLAC_MATCH:
-	    sprintf(strMainType, "CM_SLAC_MATCH");
-	    break;
-	  case CM_GET_DEVICE_SW_VERSION:
-	    sprintf(strMainType, "CM_GET_DEVICE_SW_VERSION");
-	    nHpGetSwVersion++;
-	    break;
-	  case CM_SET_KEY:
-	    sprintf(strMainType, "CM_SET_KEY");
-	    break;
-	  case CM_GET_KEY:
-	    sprintf(strMainType, "CM_GET_KEY");
-	    break;
-	  default:
-	    sprintf(strMainType, "MMTYPE %4x\n", mmtype);
+}
+
+void processHomeplugFrame(int buflen);
+
+/* The embedded MME replaces the encrypted frame in the receivebuffer, and runs
+   through the normal processing. An encrypted MME inside is not decrypted again. */
+void decodeCM_ENCRYPTED_PAYLOAD__IND(int buflen) {
+	static unsigned char embedded[ETH_FRAME_LEN];
+	static int nestingLevel;
+	const cm_encrypted_payload_indicate *ep = (const cm_encrypted_payload_indicate *) receivebuffer;
+	int len;
+	if (nestingLevel>0) {
+		LOG_WARN(LOG_CAT_KEY, "nested encrypted payload, not decrypted");
+		return;
+	}
+	len = encPayloadDecrypt(receivebuffer, buflen, embedded, sizeof(embedded));
+	if (len<0) {
+		LOG_WARN(LOG_CAT_KEY, "encrypted payload with PEKS %d could not be decrypted", ep->PEKS);
+		return;
+	}
+	LOG_DEBUG(LOG_CAT_KEY, "decrypted payload, embedded MME with %d bytes", len);
+	if ((embedded[12]!=(ETH_P_HPAV>>8)) || (embedded[13]!=(ETH_P_HPAV & 0xff))) return;
+	memcpy(receivebuffer, embedded, len);
+	nestingLevel++;
+	processHomeplugFrame(len);
+	nestingLevel--;
+}
+
+void processHomeplugFrame(int buflen) {
+	struct homeplug_hdr *hph = (struct homeplug_hdr*)(receivebuffer+sizeof(struct ethhdr));
+	uint16_t mmtype = hph->MMTYPE;
+	char strName[MMTYPE_NAME_LEN];
+	slac_session *session;
+	TRACE_BEGIN(TRACE_HOMEPLUG, homeplug, mmtype);
+	if (mmtype == CM_SLAC_MATCH + MMTYPE_CNF) {
+		reactOnSlacMatch(buflen); /* before anything else */
+	}
+	if ((mmtype & 0xfffc) == CM_GET_DEVICE_SW_VERSION) nHpGetSwVersion++;
+	/* the name is only needed for the log and for the event subscribers */
+	if (LOG_ENABLED(LOG_CAT_HOMEPLUG, LOG_LEVEL_DEBUG) || nEventSubscribers) {
+		mmtypeName(mmtype, strName);
+		LOG_DEBUG(LOG_CAT_HOMEPLUG, "processing Homeplug frame %s", strName);
+		eventStreamEmitMme(receivebuffer, buflen, strName);
+	}
+	session = slacObserveFrame(receivebuffer, buflen, clockMonotonicMs());
+	if (session && captureActive) {
+		/* for the session index */
+		if (session->nCaptureFrames == 0) session->captureFirstOffset = frameCaptureOffset;
+		session->captureLastOffset = frameCaptureOffset;
+		session->nCaptureFrames++;
+	}
+	if ((mmtype & MMTYPE_MODE) == MMTYPE_CNF) {
+		/* the answer to one of our requests? */
+		mmRequestConfirm(receivebuffer, buflen, clockMonotonicMs());
 	}
-	sprintf(str1000, "processing Homeplug frame %s.%s", strMainType, strSubType);
-	printToLogAndScreen(str1000);
 	switch (mmtype) { /* For reaction, we need to check the full 16 bit mmtype */    
 	  case CM_SLAC_MATCH + MMTYPE_CNF:
 	     /* This is the interesting point: Take the NID and NMK from SLAC_MATCH confirmation message,
-	      * and create a SET_KEY with this NID and NMK. */
+	      * and create a SET_KEY with this NID and NMK. The SET_KEY is already sent
+	      * by reactOnSlacMatch(), here we only log and remember. */
 	    nHpSlacMatchCnf++;
 	    extractNmkFromMatchResponse();
 	    extractNidFromMatchResponse();
-	    sendSetKeyRequest();
+	    storeKeyInStationTable();
+	    LOG_INFO(LOG_CAT_KEY, "sent SetKeyRequest");
 	    break;
 	  case CM_SET_KEY + MMTYPE_CNF:
 	    //printToLogAndScreen("Received CM_SET_KEY confirmation");
-	    decodeCM_SET_KEY__CNF();
+	    decodeCM_SET_KEY__CNF(buflen);
 	    break;
 	  case CM_GET_KEY + MMTYPE_CNF:
 	    //printToLogAndScreen("Received CM_GET_KEY confirmation");
 	    decodeCM_GET_KEY__CNF();
 	    break;
+	  case CM_GET_DEVICE_SW_VERSION + MMTYPE_CNF:
+	    decodeCM_GET_DEVICE_SW_VERSION__CNF(buflen);
+	    break;
+	  case CM_NW_INFO + MMTYPE_CNF:
+	  case CM_NW_STATS + MMTYPE_CNF:
+	    if (nwStatsActive) nwStatsObserveFrame(receivebuffer, buflen, clockUnixTime());
+	    break;
+	  case CM_ENCRYPTED_PAYLOAD + MMTYPE_IND:
+	    if (encPayloadActive) decodeCM_ENCRYPTED_PAYLOAD__IND(buflen);
+	    break;
 	}	
-	  
+	TRACE_END(TRACE_HOMEPLUG, homeplug);
 }
 
 
 void data_process(int buflen) {
 	struct ethhdr *ethernetheader = (struct ethhdr*)(receivebuffer);
+	struct homeplug_hdr *hph = (struct homeplug_hdr*)(receivebuffer+sizeof(struct ethhdr));
+	uint32_t now = clockUnixTime();
+	TRACE_BEGIN(TRACE_DISPATCH, dispatch, ntohs(ethernetheader->h_proto));
 	total++;
 	switch (ntohs(ethernetheader->h_proto))
 	{
 		case ETH_P_HPAV: /* it is a Homeplug ethernet frame */
 			nHomePlug++;
 			//printf("h_proto= Homeplug\n");
-			processHomeplugFrame();
+			stationTouch(ethernetheader->h_source, now, stationClassOfMmtype(hph->MMTYPE));
+			processHomeplugFrame(buflen);
 			break;
 		case ETH_P_IP:
-			printf("IP");
+			stationTouch(ethernetheader->h_source, now, STA_MM_NON_HOMEPLUG);
+			LOG_DEBUG(LOG_CAT_MAIN, "IP");
+			break;
+		case ETH_P_IPV6: /* SDP and V2G after the SLAC */
+			stationTouch(ethernetheader->h_source, now, STA_MM_NON_HOMEPLUG);
+			v2gProcessIpv6Frame(receivebuffer, buflen);
 			break;
 		default:
 			++other;
-			printf("Other, h_proto=0x%4x\n", ethernetheader->h_proto);
+			stationTouch(ethernetheader->h_source, now, STA_MM_NON_HOMEPLUG);
+			LOG_DEBUG(LOG_CAT_MAIN, "Other, h_proto=0x%4x", ethernetheader->h_proto);
 	}
+	TRACE_END(TRACE_DISPATCH, dispatch);
 }
 
-int initializeTheSockets(void) {
+/* With handedOver, the sockets come from the previous instance, and they are bound already. */
+int initializeTheSockets(int handedOver) {
 	//struct ifreq ifr;
 	struct sockaddr_ll sll;
 	
-	/* open a raw socket for reception*/
-	sock_fd_rx=socket(AF_PACKET,SOCK_RAW,htons(ETH_P_ALL)); 
-	if(sock_fd_rx<0) {
-		perror("could not open the socket for reception");
-		printf("Try to run as root, sudo ./listen_to_eth\n");
-		return -1;
-	}
-	/* open a raw socket for transmission */
-	sock_fd_tx=socket(AF_PACKET,SOCK_RAW,htons(ETH_P_ALL)); 
-	if(sock_fd_tx<0) {
-		perror("could not open the socket for transmission");
-		printf("Try to run as root, sudo ./listen_to_eth\n");
-		return -1;
+	if (!handedOver) {
+		/* open a raw socket for reception*/
+		sock_fd_rx=socket(AF_PACKET,SOCK_RAW,htons(ETH_P_ALL)); 
+		if(sock_fd_rx<0) {
+			perror("could not open the socket for reception");
+			printf("Try to run as root, sudo ./listen_to_eth\n");
+			return -1;
+		}
+		/* open a raw socket for transmission */
+		sock_fd_tx=socket(AF_PACKET,SOCK_RAW,htons(ETH_P_ALL)); 
+		if(sock_fd_tx<0) {
+			perror("could not open the socket for transmission");
+			printf("Try to run as root, sudo ./listen_to_eth\n");
+			return -1;
+		}
 	}
 	/* Get the index of the interface to send on */
 	memset(&if_idx, 0, sizeof(struct ifreq));
@@ -508,6 +775,11 @@ int initializeTheSockets(void) {
 	 https://stackoverflow.com/questions/21660868/unable-to-bind-raw-socket-to-interface
 	 * setsockopt(sock_fd_rx, SOL_SOCKET, SO_BINDTODEVICE ... does not work
 	 * for raw sockets. Instead, use bind(). */
+	if (handedOver) {
+		/* binding again would miss the frames of this moment */
+		printf("continuing on the receive socket of the previous instance, %s index %d\n", ifName, if_idx.ifr_ifindex);
+		goto bound;
+	}
 	bzero(&sll , sizeof(sll));
 	sll.sll_family = AF_PACKET; 
 	sll.sll_ifindex = if_idx.ifr_ifindex;
@@ -517,6 +789,7 @@ int initializeTheSockets(void) {
 		return -1;
 	} 
 	printf("binding done of %s which is index %d\n",  ifName, if_idx.ifr_ifindex);
+bound:
      
 	/* Construct the address information for later use in the transmit function */
 	/* Index of the network device */
@@ -539,6 +812,78 @@ int initializeTheSockets(void) {
 	return 0; /* success */
 }
 
+/* The timeouts and the queued frames, in each iteration of the main loop */
+void serviceTimers(void) {
+	slacCheckTimeouts(clockMonotonicMs());
+	if (nMmRequestsPending) mmRequestCheckTimeouts(clockMonotonicMs());
+	if (nTxWaiting) txSchedService();
+	if (nwStatsActive) nwStatsService(clockMonotonicMs());
+}
+
+/* The link watcher reported a change of the interface. The sockets stay, so
+   the BPF filter, the io_uring and the pipeline threads are not affected. */
+void reactOnLinkChange(int changes) {
+	const link_state *ls = linkWatchState();
+	if (changes & LINKWATCH_DOWN) {
+		LOG_WARN(LOG_CAT_MAIN, "link of %s is down%s", ifName, (ls->ifindex == 0) ? ", the interface is gone" : "");
+	}
+	if ((changes & LINKWATCH_INDEX) && (ls->ifindex > 0)) {
+		struct sockaddr_ll sll;
+		bzero(&sll, sizeof(sll));
+		sll.sll_family = AF_PACKET;
+		sll.sll_ifindex = ls->ifindex;
+		sll.sll_protocol = htons(ETH_P_ALL);
+		if (bind(sock_fd_rx, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+			LOG_ERROR(LOG_CAT_MAIN, "could not bind the receive socket to %s index %d: %s", ifName, ls->ifindex, strerror(errno));
+		} else {
+			LOG_INFO(LOG_CAT_MAIN, "%s is now index %d, receive socket bound again", ifName, ls->ifindex);
+		}
+		if_idx.ifr_ifindex = ls->ifindex;
+		socket_address_tx.sll_ifindex = ls->ifindex;
+	}
+	if (changes & LINKWATCH_MAC) {
+		uint8_t destMac[ETH_ALEN] = { MY_DEST_MAC0, MY_DEST_MAC1, MY_DEST_MAC2, MY_DEST_MAC3, MY_DEST_MAC4, MY_DEST_MAC5 };
+		memcpy(if_mac.ifr_hwaddr.sa_data, ls->mac, ETH_ALEN);
+		keyCacheInit(ls->mac, destMac); /* the pre-serialized frames have our MAC as source */
+		slacSetKeyPeer(ls->mac, destMac);
+		nwStatsSetOwnMac(ls->mac);
+		LOG_INFO(LOG_CAT_MAIN, "MAC of %s is now %02x:%02x:%02x:%02x:%02x:%02x", ifName,
+			ls->mac[0], ls->mac[1], ls->mac[2], ls->mac[3], ls->mac[4], ls->mac[5]);
+	}
+	if (changes & LINKWATCH_UP) {
+		LOG_INFO(LOG_CAT_MAIN, "link of %s is up again after %lu ms", ifName, (unsigned long)linkLastGapMs);
+	}
+}
+
+
+/* logs the stalls which the loop monitor found in the last iteration */
+void reportStalls(void) {
+	loopmon_stall stall;
+	char strName[MMTYPE_NAME_LEN];
+	loopMonSuspendStalls(1); /* the log output below would report itself */
+	while (loopMonTakeStall(&stall)) {
+		if (!LOG_ENABLED(LOG_CAT_STATUS, LOG_LEVEL_WARN)) continue;
+		if ((stall.frameType>>16) == ETH_P_HPAV) {
+			mmtypeName(stall.frameType & 0xffff, strName);
+			LOG_WARN(LOG_CAT_STATUS, "stall: %s took %u us, while processing %s", loopMonSectionName(stall.section), stall.durationUs, strName);
+		} else if (stall.frameType) {
+			LOG_WARN(LOG_CAT_STATUS, "stall: %s took %u us, while processing ethertype 0x%04x", loopMonSectionName(stall.section), stall.durationUs, stall.frameType>>16);
+		} else {
+			LOG_WARN(LOG_CAT_STATUS, "stall: %s took %u us, no frame", loopMonSectionName(stall.section), stall.durationUs);
+		}
+	}
+	loopMonSuspendStalls(0);
+}
+
+/* writes the recorded spans as Chrome trace */
+void writeTrace(void) {
+	int n = traceWriteChrome();
+	if (n>=0) {
+		LOG_INFO(LOG_CAT_MAIN, "trace: %d events written to %s, %u overwritten in the ring", n, traceFileName, nTraceOverwritten);
+	} else {
+		LOG_WARN(LOG_CAT_MAIN, "trace: nothing written, start with -t trace.json");
+	}
+}
 
 void processTheKey(unsigned char c) {
 	switch (c) {
@@ -553,71 +898,788 @@ void processTheKey(unsigned char c) {
 		case 'g':
 			sendGetKeyRequest();
 			break;
+		case 't':
+			stationPrintTable(printToLogAndScreen);
+			keyCachePrintStatus(printToLogAndScreen);
+			break;
+		case 'e':
+			eventStreamPrintStatus(printToLogAndScreen);
+			break;
+		case 'd':
+			flightRecorderTrigger(FLIGHTREC_TRIGGER_KEY, "key");
+			break;
+		case 'c':
+			writeTrace();
+			break;
+		case 'n':
+			nwStatsPrintTable(printToLogAndScreen);
+			break;
+	}
+}
+
+/* The frame in the receivebuffer, after it was written into the capture file */
+void processReceivedFrame(int buflen, const struct timespec *ts) {
+	if (flightRecorderActive) flightRecorderRecord(receivebuffer, buflen, ts);
+	if (loopMonActive) {
+		/* for the stall report: ethertype, and the MMTYPE of HomePlug frames */
+		loopMonFrameType = (receivebuffer[12]<<24) | (receivebuffer[13]<<16);
+		if ((buflen >= (int)(sizeof(struct ethhdr)+sizeof(struct homeplug_hdr))) && (receivebuffer[12]==(ETH_P_HPAV>>8)) && (receivebuffer[13]==(ETH_P_HPAV & 0xff))) {
+			loopMonFrameType |= LE16TOH(((struct homeplug_hdr*)(receivebuffer+sizeof(struct ethhdr)))->MMTYPE);
+		}
+	}
+	{
+		LOOPMON_BEGIN(tHandler);
+		data_process(buflen);
+		LOOPMON_END(tHandler, LOOPMON_HANDLER);
 	}
 }
 
-int main() {
+/* Called for each received frame, which is in the receivebuffer. */
+void handleReceivedFrame(int buflen) {
+	struct timespec ts;
+	if (macFilterActive && !macFilterFrame(receivebuffer, buflen)) return; /* not our chargers */
+	TRACE_BEGIN(TRACE_RECEIVE, receive, buflen);
+	if (captureActive || flightRecorderActive) {
+		clockRealtime(&ts);
+		captureWriteFrame(receivebuffer, buflen, &ts);
+		frameCaptureOffset = captureLastRecordOffset;
+	}
+	processReceivedFrame(buflen, &ts);
+	TRACE_END(TRACE_RECEIVE, receive);
+}
+
+/* The pipeline delivers the frame in its slot of the frame pool. The MAC filter and
+   the capture file were already done by the capture and capture sink threads. */
+void handlePipelineFrame(pipeline_frame *frame) {
+	TRACE_BEGIN(TRACE_RECEIVE, receive, frame->len);
+	nPollSuccess++;
+	receivebuffer = frame->data;
+	frameCaptureOffset = frame->captureOffset;
+	processReceivedFrame(frame->len, &frame->ts);
+	receivebuffer = receiveStorage;
+	TRACE_END(TRACE_RECEIVE, receive);
+}
+
+/* The io_uring backend delivers the frame in one of its provided buffers. We copy
+   it into the receivebuffer, because all decoders work on the receivebuffer. */
+void handleUringFrame(unsigned char *frame, int len) {
+	nPollSuccess++;
+	memcpy(receivebuffer, frame, len);
+	handleReceivedFrame(len);
+}
+
+void printUsage(void) {
+	printf("usage: listen_to_eth [-i interface] [-w capture.pcap] [-u] [-e socketpath] [-f MB] [-W seconds] [-T triggers] [-D] [-t trace.json] [-l levels] [-b KB] [-m ms] [-a allow.txt] [-x deny.txt] [-r replay.pcap] [-M mapping.txt] [-P] [-R rate[:burst]] [-H] [-S sessions[:loss%%[:reorder%%[:seed]]]] [-N seconds[:modems.txt]] [-L dir[:segmentKB[:totalMB[:days]]]]\n");
+	printf("  -i  interface to listen on, default eth0\n");
+	printf("  -w  write all received frames into a pcap file\n");
+	printf("  -u  use io_uring for reception and file writing (falls back to poll)\n");
+	printf("  -e  stream decoded events as JSON lines on a Unix socket, e.g. %s\n", EVENTSTREAM_DEFAULT_PATH);
+	printf("  -f  flight recorder with this size in MB, dumped to pcapng on a trigger\n");
+	printf("  -W  time window of the flight recorder in seconds, default %d\n", FLIGHTREC_DEFAULT_WINDOW_S);
+	printf("  -T  flight recorder triggers: f=failed result, t=SLAC timeout, k=key 'd'. Default ftk\n");
+	printf("  -D  decrypt CM_ENCRYPTED_PAYLOAD with the NMKs learned from SLAC_MATCH\n");
+	printf("  -t  record the hot path spans, written as Chrome trace JSON at exit and on key 'c'\n");
+	printf("  -l  log levels, e.g. debug or homeplug=off,v2g=debug. Categories main, homeplug, slac,\n");
+	printf("      key, v2g, status. Levels off, error, warn, info, debug\n");
+	printf("  -b  size of the socket receive buffer in KB, default from the kernel\n");
+	printf("  -m  monitor the loop timing, and report stalls longer than this in milliseconds\n");
+	printf("  -a  process only frames from or to the MACs in this file, one aa:bb:cc:dd:ee:ff per line\n");
+	printf("  -x  drop the frames from or to the MACs in this file\n");
+	printf("  -r  send the frames of this capture file, with the original timing\n");
+	printf("  -M  MAC mapping for the replay, one \"from to\" pair per line\n");
+	printf("  -P  pipeline: separate threads for reception, capture file and log\n");
+	printf("  -R  transmitted frames per second and destination modem, and burst (default %d:%d)\n",
+		TXSCHED_DEFAULT_RATE, TXSCHED_DEFAULT_BURST);
+	printf("  -H  take the sockets and the state over from the instance which runs on the interface\n");
+	printf("  -S  simulate SLAC sessions on a virtual clock, without interface, and check their end states,\n");
+	printf("      e.g. -S 1000:5:2:7 -l slac=off,key=off. Exit code 1 if one is wrong\n");
+	printf("  -N  ask the modems for their PHY rates every so many seconds (CM_NW_STATS), the local\n");
+	printf("      modem or the ones in the file. Key 'n' shows them, they are kept in %s\n", NWSTATS_FILE);
+	printf("  -L  log into compressed segments in this directory instead of log.txt, repeated lines\n");
+	printf("      counted. Default %d kB per segment, %d MB and %d days in total. Read with plc_logread\n",
+		LOGSTORE_DEFAULT_SEGMENT_KB, LOGSTORE_DEFAULT_TOTAL_MB, LOGSTORE_DEFAULT_DAYS);
+}
+
+/*********************************************************************/
+/* Handover to a new instance (handoff.c) */
+
+typedef struct handoff_keys {
+	char nmk[SLAC_NMK_LEN];
+	char nid[SLAC_NID_LEN];
+	uint8_t evseMac[ETH_ALEN];
+} handoff_keys;
+
+typedef struct handoff_slac {
+	int32_t lastMatched;
+	uint32_t nSessions;
+	uint32_t sessionSize; /* both instances must have the same slac_session */
+	slac_session sessions[SLAC_MAX_SESSIONS];
+} handoff_slac;
+
+int handedOver; /* a new instance has taken over, we end */
+
+int buildHandoffSnapshot(handoff_buffer *b) {
+	static handoff_slac slac;
+	handoff_keys keys;
+	char *stationData = NULL;
+	size_t stationLen = 0;
+	FILE *f;
+	int lastMatched, r;
+	memcpy(keys.nmk, myNMK, SLAC_NMK_LEN);
+	memcpy(keys.nid, myNID, SLAC_NID_LEN);
+	memcpy(keys.evseMac, myEvseMac, ETH_ALEN);
+	if (handoffPutRecord(b, HANDOFF_REC_KEYS, &keys, sizeof(keys))<0) return -1;
+	slac.nSessions = slacExportSessions(slac.sessions, &lastMatched);
+	slac.lastMatched = lastMatched;
+	slac.sessionSize = sizeof(slac_session);
+	if (handoffPutRecord(b, HANDOFF_REC_SLAC, &slac, sizeof(slac))<0) return -1;
+	/* the stations in the format of stations.bin */
+	f = open_memstream(&stationData, &stationLen);
+	if (!f) return -1;
+	r = stationWriteSnapshot(f);
+	if ((fclose(f)!=0) || (r<0) || (handoffPutRecord(b, HANDOFF_REC_STATIONS, stationData, stationLen)<0)) r = -1;
+	free(stationData);
+	if (r<0) return -1;
+	return handoffPutRecord(b, HANDOFF_REC_END, NULL, 0);
+}
+
+/* Returns the number of records which were taken over */
+int restoreHandoffSnapshot(const handoff_buffer *b) {
+	const unsigned char *data;
+	uint32_t pos = 0, len;
+	uint16_t type;
+	int n = 0;
+	while (handoffNextRecord(b, &pos, &type, &data, &len)) {
+		if ((type == HANDOFF_REC_KEYS) && (len == sizeof(handoff_keys))) {
+			const handoff_keys *keys = (const handoff_keys *)data;
+			memcpy(myNMK, keys->nmk, SLAC_NMK_LEN);
+			memcpy(myNID, keys->nid, SLAC_NID_LEN);
+			memcpy(myEvseMac, keys->evseMac, ETH_ALEN);
+			n++;
+		} else if ((type == HANDOFF_REC_SLAC) && (len == sizeof(handoff_slac))) {
+			static handoff_slac slac;
+			memcpy(&slac, data, sizeof(slac));
+			if ((slac.sessionSize == sizeof(slac_session)) && (slac.nSessions == SLAC_MAX_SESSIONS)) {
+				slacImportSessions(slac.sessions, slac.lastMatched);
+				n++;
+			}
+		} else if (type == HANDOFF_REC_STATIONS) {
+			FILE *f = fmemopen((void *)data, len, "rb");
+			if (f) {
+				if (stationReadSnapshot(f)>=0) n++;
+				fclose(f);
+			}
+		}
+	}
+	return n;
+}
+
+/* A new instance has connected. We stop taking frames out of the receive socket,
+   handle the ones which we have already, and give the sockets and the state away. */
+void handOverToNewInstance(int conn) {
+	handoff_buffer snapshot = { NULL, 0, 0 };
+	int fds[2] = { sock_fd_rx, sock_fd_tx };
+	int n, nFrames = 0;
+	LOG_INFO(LOG_CAT_MAIN, "a new instance takes over");
+	if (pipelineActive) {
+		pipelineStopCapture();
+		while ((n = pipelinePoll(PIPELINE_SLOTS, handlePipelineFrame)) > 0) nFrames += n;
+	} else if (uringActive) {
+		nFrames = uringStopReceive(handleUringFrame);
+	}
+	if (nTxWaiting) {
+		LOG_WARN(LOG_CAT_MAIN, "%u queued frames are not sent", nTxWaiting);
+	}
+	if (nwStatsActive) nwStatsSave(NWSTATS_FILE); /* the new instance reads it */
+	if (buildHandoffSnapshot(&snapshot)<0) {
+		close(conn);
+	} else if (handoffSend(conn, fds, 2, &snapshot)==0) {
+		LOG_INFO(LOG_CAT_MAIN, "handed over with %u bytes of state, %d frames handled while stopping", snapshot.len, nFrames);
+		handedOver = 1;
+		blExit = 1;
+		free(snapshot.data);
+		return;
+	}
+	free(snapshot.data);
+	LOG_ERROR(LOG_CAT_MAIN, "handover failed, we continue");
+	if (pipelineActive) {
+		pipelineStop();
+		pipelineStart(sock_fd_rx, hLogFile);
+	} else if (uringActive) {
+		uringResumeReceive();
+	}
+	handoffListen(ifName);
+}
+
+/*********************************************************************/
+/* Simulation (slacsim.c): the scripted SLAC sessions go through handleReceivedFrame(),
+   one iteration per virtual millisecond, without sockets. */
+
+void simTransition(const slac_session *session, int oldState) {
+	slacTransition(session, oldState);
+	slacSimObserveTransition(session, oldState);
+}
+
+void simReceive(const unsigned char *frame, int len) {
+	nPollSuccess++;
+	memcpy(receivebuffer, frame, len);
+	handleReceivedFrame(len);
+}
+
+/* Returns the exit code: 0 if all sessions ended as expected */
+int runSimulation(const slacsim_config *cfg, unsigned int txRate, unsigned int txBurst) {
+	uint8_t ownMac[ETH_ALEN] = { 0x02, 0x4c, 0x54, 0x45, 0x00, 0x01 }; /* "LTE" */
+	uint8_t destMac[ETH_ALEN] = { MY_DEST_MAC0, MY_DEST_MAC1, MY_DEST_MAC2, MY_DEST_MAC3, MY_DEST_MAC4, MY_DEST_MAC5 };
+	struct timespec t0, t1;
+	slacsim_result r;
+	int nErrors, state;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	clockStartVirtual(SLACSIM_START_MS);
+	memcpy(if_mac.ifr_hwaddr.sa_data, ownMac, ETH_ALEN);
+	keyCacheInit(ownMac, destMac);
+	slacSetKeyPeer(ownMac, destMac);
+	txSchedInit(slacSimTransmit, txRate, txBurst);
+	mmRequestInit(sendManagementFrame);
+	slacSetTransitionCallback(simTransition);
+	v2gSetEventCallback(v2gEvent);
+	if (slacSimStart(cfg, clockMonotonicMs())<0) {
+		LOG_ERROR(LOG_CAT_MAIN, "unable to allocate the simulation");
+		return -1;
+	}
+	LOG_INFO(LOG_CAT_MAIN, "simulating %u SLAC sessions, loss %u.%u%%, reordering %u.%u%%, seed %u",
+		cfg->nSessions, cfg->lossPermille/10, cfg->lossPermille%10, cfg->reorderPermille/10, cfg->reorderPermille%10, cfg->seed);
+	while (slacSimDeliver(clockMonotonicMs(), simReceive)) {
+		nMainLoops++;
+		serviceTimers();
+		clockAdvanceMs(1);
+	}
+	mmRequestCancelAll(clockMonotonicMs());
+	nErrors = slacSimFinish(&r);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	LOG_INFO(LOG_CAT_MAIN, "simulated %lu s in %lu ms: %u sessions, frames delivered %u, lost %u, reordered %u, retransmits %u, aborted %u, SetKey %u",
+		(unsigned long)(r.virtualMs/1000),
+		(unsigned long)((t1.tv_sec - t0.tv_sec)*1000 + (t1.tv_nsec - t0.tv_nsec)/1000000),
+		r.nSessions, r.nFramesDelivered, r.nFramesLost, r.nFramesReordered, r.nRetransmits, r.nAborted, r.nSetKeyRequests);
+	for (state=0; state<SLAC_NUMBER_OF_STATES; state++) {
+		if (r.nExpected[state] + r.nObserved[state] == 0) continue;
+		LOG_INFO(LOG_CAT_MAIN, "end state %-10s expected %5u, observed %5u", (state == SLAC_STATE_IDLE) ? "none" : slacStateName(state),
+			r.nExpected[state], r.nObserved[state]);
+	}
+	if (nErrors) {
+		LOG_ERROR(LOG_CAT_MAIN, "simulation failed: %u sessions with wrong end state, %u wrong keys, %u late reactions, %u events dropped",
+			r.nMismatches, r.nWrongKeys, r.nLateReactions, r.nEventsDropped);
+	}
+	LOG_INFO(LOG_CAT_MAIN, "simulation %s, digest %08x", nErrors ? "FAILED" : "passed", r.digest);
+	return nErrors ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
   unsigned char c=0;
-  int saddr_len,buflen;
+  int buflen;
+  int opt;
+  int useUring=0;
+  char *captureFileName=NULL;
+  char *eventSocketPath=NULL;
+  int flightRecMB=0;
+  int flightRecWindow=FLIGHTREC_DEFAULT_WINDOW_S;
+  int flightRecTriggers=FLIGHTREC_TRIGGER_ALL;
+  int decryptPayloads=0;
+  int rcvbufKB=0;
+  int stallThresholdMs=0;
+  char *replayFileName=NULL;
+  int usePipeline=0;
+  unsigned int txRate=TXSCHED_DEFAULT_RATE, txBurst=TXSCHED_DEFAULT_BURST;
+  int takeOver=0, handoffConn=-1;
+  int simulate=0;
+  int nwStatsIntervalS=0;
+  char *nwStatsModemFile=NULL;
+  int useLogStore=0;
+  logstore_config logStoreConfig;
+  slacsim_config simConfig;
+  unsigned char control[RXSTATS_CONTROL_LEN];
+  struct iovec iov;
+  struct msghdr msg;
 
+	while ((opt = getopt(argc, argv, "i:w:ue:f:W:T:Dt:l:b:m:a:x:r:M:PR:HS:N:L:h")) != -1) {
+		switch (opt) {
+			case 'i':
+				strncpy(ifName, optarg, IFNAMSIZ-1);
+				break;
+			case 'w':
+				captureFileName = optarg;
+				break;
+			case 'u':
+				useUring = 1;
+				break;
+			case 'e':
+				eventSocketPath = optarg;
+				break;
+			case 'f':
+				flightRecMB = atoi(optarg);
+				break;
+			case 'W':
+				flightRecWindow = atoi(optarg);
+				break;
+			case 'T':
+				flightRecTriggers = (strchr(optarg, 'f') ? FLIGHTREC_TRIGGER_RESULT_FAIL : 0) |
+				                    (strchr(optarg, 't') ? FLIGHTREC_TRIGGER_SLAC_TIMEOUT : 0) |
+				                    (strchr(optarg, 'k') ? FLIGHTREC_TRIGGER_KEY : 0);
+				break;
+			case 'D':
+				decryptPayloads = 1;
+				break;
+			case 't':
+				traceFileName = optarg;
+				break;
+			case 'l':
+				if (logParseLevels(optarg)<0) {
+					printf("invalid log levels %s\n", optarg);
+					printUsage();
+					return -1;
+				}
+				break;
+			case 'b':
+				rcvbufKB = atoi(optarg);
+				break;
+			case 'm':
+				stallThresholdMs = atoi(optarg);
+				break;
+			case 'a':
+			case 'x':
+				if (macFilterLoad((opt == 'a') ? MACFILTER_ALLOW : MACFILTER_DENY, optarg)<0) {
+					printf("could not read the MAC list %s\n", optarg);
+					return -1;
+				}
+				break;
+			case 'r':
+				replayFileName = optarg;
+				break;
+			case 'P':
+				usePipeline = 1;
+				break;
+			case 'H':
+				takeOver = 1;
+				break;
+			case 'N':
+				{
+					char *p;
+					nwStatsIntervalS = strtoul(optarg, &p, 10);
+					if ((nwStatsIntervalS <= 0) || ((*p != 0) && (*p != ':'))) {
+						printf("invalid statistics interval %s\n", optarg);
+						return -1;
+					}
+					if (*p == ':') nwStatsModemFile = p+1;
+				}
+				break;
+			case 'L':
+				if (logStoreParse(optarg, &logStoreConfig)<0) {
+					printf("invalid log storage %s\n", optarg);
+					return -1;
+				}
+				useLogStore = 1;
+				break;
+			case 'S':
+				if (slacSimParse(optarg, &simConfig)<0) {
+					printf("invalid simulation %s\n", optarg);
+					return -1;
+				}
+				simulate = 1;
+				break;
+			case 'R':
+				if ((sscanf(optarg, "%u:%u", &txRate, &txBurst) < 1) || (txRate == 0)) {
+					printf("invalid transmit rate %s\n", optarg);
+					return -1;
+				}
+				break;
+			case 'M':
+				if (replayLoadMapping(optarg)<0) {
+					printf("could not read the MAC mapping %s\n", optarg);
+					return -1;
+				}
+				break;
+			default:
+				printUsage();
+				return -1;
+		}
+	}
+
+	if (traceFileName) {
+		/* first, so that also the startup is traced */
+		if (traceInit(traceFileName)<0) {
+			printf("unable to allocate the trace ring\n");
+			return -1;
+		}
+	}
     memset(receivebuffer,0,RECEIVE_BUFFER_SIZE);
-	hLogFile=fopen("log.txt","a"); /* open for appending */
-	if(!hLogFile) {
+	if (useLogStore) {
+		if (logStoreOpen(&logStoreConfig)<0) {
+			printf("unable to use the log directory %s\n", logStoreConfig.dir);
+			return -1;
+		}
+	} else if (!(hLogFile=fopen("log.txt","a"))) { /* open for appending */
 		printf("unable to open log.txt\n");
 		printf("Try to run as root, sudo ./listen_to_eth\n");
 		return -1;
 	}
-	printToLogAndScreen("starting. Press x to exit.");
+	logSetSink(printToLogAndScreen);
+	LOG_INFO(LOG_CAT_MAIN, "starting. Press x to exit.");
+	if (LOG_ENABLED(LOG_CAT_MAIN, LOG_LEVEL_INFO)) {
+		char strLevels[200];
+		logFormatLevels(strLevels, sizeof(strLevels));
+		LOG_INFO(LOG_CAT_MAIN, "log levels: %s", strLevels);
+	}
 	//printTheNMK();
+	if (simulate) {
+		int exitCode = runSimulation(&simConfig, txRate, txBurst);
+		closeLog();
+		return exitCode;
+	}
+	if (takeOver) {
+		int fds[HANDOFF_MAX_FDS], nFds;
+		handoff_buffer snapshot;
+		handoffConn = handoffConnect(ifName, fds, &nFds, &snapshot);
+		if ((handoffConn<0) || (nFds!=2)) {
+			LOG_ERROR(LOG_CAT_MAIN, "no instance on %s to take over from%s", ifName,
+				nHandoffRejected ? ", the listening one belongs to another user" : "");
+			return -1;
+		}
+		sock_fd_rx = fds[0];
+		sock_fd_tx = fds[1];
+		LOG_INFO(LOG_CAT_MAIN, "taking over: %d of 3 state records, %d stations", restoreHandoffSnapshot(&snapshot), stationCount());
+		free(snapshot.data);
+	} else if (stationLoadSnapshot(STATION_SNAPSHOT_FILE)>=0) {
+		LOG_INFO(LOG_CAT_MAIN, "loaded %d stations from %s", stationCount(), STATION_SNAPSHOT_FILE);
+	}
 	
-	if (initializeTheSockets()<0) {
-		printToLogAndScreen("init sockets failed. Stopping.");
+	if (initializeTheSockets(handoffConn>=0)<0) {
+		LOG_ERROR(LOG_CAT_MAIN, "init sockets failed. Stopping.");
 		return -1;
 	}
+	if (linkWatchOpen(ifName, clockMonotonicMs())<0) {
+		LOG_WARN(LOG_CAT_MAIN, "no rtnetlink, the interface is not followed if it is replugged");
+	}
+	{
+		int rcvbuf = rxStatsInit(sock_fd_rx, ifName, rcvbufKB*1024);
+		if (rcvbuf<0) {
+			LOG_WARN(LOG_CAT_MAIN, "could not configure the receive socket, no loss accounting");
+		} else {
+			LOG_INFO(LOG_CAT_MAIN, "socket receive buffer %d bytes", rcvbuf);
+		}
+	}
+	if (handoffConn>=0) {
+		/* The socket comes with the prefilter of the previous instance, which maybe had other
+		   lists or none. It would go on dropping frames by them. */
+		int r = macFilterDetachKernel(sock_fd_rx);
+		if (r<0) {
+			LOG_WARN(LOG_CAT_MAIN, "could not remove the kernel prefilter of the previous instance: %s", strerror(errno));
+		} else if (r>0) {
+			LOG_INFO(LOG_CAT_MAIN, "kernel prefilter of the previous instance removed");
+		}
+	}
+	if (macFilterActive) {
+		int n = macFilterAttachKernel(sock_fd_rx);
+		if ((n<0) && (handoffConn>=0)) macFilterDetachKernel(sock_fd_rx); /* a refused attach keeps the old one */
+		LOG_INFO(LOG_CAT_MAIN, "MAC filter: %d allowed, %d denied, kernel prefilter %s (%d instructions)",
+			macFilterCount(MACFILTER_ALLOW), macFilterCount(MACFILTER_DENY), (n>0) ? "attached" : "not used", n);
+	} else if (handoffConn>=0) {
+		LOG_INFO(LOG_CAT_MAIN, "MAC filter: none, no kernel prefilter");
+	}
+	{
+		uint8_t destMac[ETH_ALEN] = { MY_DEST_MAC0, MY_DEST_MAC1, MY_DEST_MAC2, MY_DEST_MAC3, MY_DEST_MAC4, MY_DEST_MAC5 };
+		keyCacheInit((uint8_t *)if_mac.ifr_hwaddr.sa_data, destMac);
+		slacSetKeyPeer((uint8_t *)if_mac.ifr_hwaddr.sa_data, destMac);
+	}
+	txSchedInit(transmitFrame, txRate, txBurst);
+	mmRequestInit(sendManagementFrame);
+	if (nwStatsIntervalS) {
+		int n = nwStatsInit((uint8_t *)if_mac.ifr_hwaddr.sa_data, nwStatsIntervalS, nwStatsModemFile, clockMonotonicMs());
+		if (n<0) {
+			LOG_ERROR(LOG_CAT_MAIN, "could not read the modem list %s", nwStatsModemFile);
+			return -1;
+		}
+		LOG_INFO(LOG_CAT_MAIN, "asking %d modems for the PHY rates every %d s, %d pairs from %s",
+			n, nwStatsIntervalS, nwStatsPairCount(), NWSTATS_FILE);
+		if (nNwStatsLoadDiscarded) {
+			LOG_WARN(LOG_CAT_MAIN, "%s: %u damaged pairs discarded", NWSTATS_FILE, nNwStatsLoadDiscarded);
+		}
+	}
+	if (decryptPayloads) {
+		encPayloadInit();
+		LOG_INFO(LOG_CAT_MAIN, "decrypting encrypted payloads, AES backend %s", encPayloadBackendName());
+	}
+	if (useUring && usePipeline) {
+		LOG_WARN(LOG_CAT_MAIN, "the pipeline does its own reception, io_uring is not used");
+	} else if (useUring) {
+		int r = uringInit(sock_fd_rx);
+		if (r<0) {
+			LOG_WARN(LOG_CAT_MAIN, "io_uring not available (%d), using the poll loop", r);
+		} else {
+			if (hLogFile) {
+				fflush(hLogFile);
+				logWriter = uringWriterOpen(fileno(hLogFile));
+			}
+			LOG_INFO(LOG_CAT_MAIN, "using io_uring");
+		}
+	}
+	if (captureFileName) {
+		if (captureOpen(captureFileName)<0) {
+			LOG_ERROR(LOG_CAT_MAIN, "unable to open capture file %s", captureFileName);
+			return -1;
+		}
+	}
+
+	if (eventSocketPath) {
+		if (eventStreamOpen(eventSocketPath)<0) {
+			LOG_ERROR(LOG_CAT_MAIN, "unable to open the event socket %s", eventSocketPath);
+			return -1;
+		}
+	}
+	slacSetTransitionCallback(slacTransition);
+	v2gSetEventCallback(v2gEvent);
+	if (flightRecMB>0) {
+		/* the only allocation of the flight recorder, nothing per frame */
+		if (flightRecorderInit((uint32_t)flightRecMB*1024*1024, flightRecWindow, flightRecTriggers)<0) {
+			LOG_ERROR(LOG_CAT_MAIN, "unable to allocate the flight recorder");
+			return -1;
+		}
+	}
+
+	if (stallThresholdMs>0) {
+		if (loopMonInit(stallThresholdMs*1000)<0) {
+			LOG_WARN(LOG_CAT_MAIN, "loop monitor: clock not usable");
+		} else {
+			LOG_INFO(LOG_CAT_MAIN, "loop monitor: stalls above %d ms are reported", stallThresholdMs);
+		}
+	}
+
+	if (replayFileName) {
+		if (replayStart(replayFileName, sock_fd_tx, &socket_address_tx)<0) {
+			LOG_ERROR(LOG_CAT_MAIN, "unable to replay %s", replayFileName);
+			return -1;
+		}
+		LOG_INFO(LOG_CAT_MAIN, "replaying %s%s", replayFileName, replayRealtime ? ", realtime priority" : "");
+	}
+
+	if (usePipeline) {
+		if (hLogFile) fflush(hLogFile);
+		if (pipelineStart(sock_fd_rx, hLogFile)<0) {
+			LOG_ERROR(LOG_CAT_MAIN, "unable to start the pipeline threads");
+			return -1;
+		}
+		LOG_INFO(LOG_CAT_MAIN, "pipeline started, %d frame slots%s", PIPELINE_SLOTS, captureActive ? ", with capture sink" : "");
+	}
+
+	if (handoffConn>=0) {
+		/* from now on, the previous instance does not touch the sockets any more */
+		if (handoffAcknowledge(handoffConn)<0) {
+			LOG_ERROR(LOG_CAT_MAIN, "the previous instance did not wait for the takeover");
+			return -1;
+		}
+		LOG_INFO(LOG_CAT_MAIN, "took over from the previous instance");
+	}
+	if (handoffListen(ifName)<0) {
+		LOG_WARN(LOG_CAT_MAIN, "another instance runs on %s, no handover from this one", ifName);
+	}
 
 	set_conio_terminal_mode(); /* to react on each key press */
 	printf("entering main loop\n");
     while (!blExit) {
+		LOOPMON_BEGIN(tLoop);
+		loopMonFrameType = 0;
 
 		nMainLoops++;
 		/*----- Polling and processing of the ethernet frames -----*/
-		signed status = poll (&mypollfd, 1, 1); /* one file descriptor, one millisecond timeout */
-		if ((status < 0) && (errno != EINTR)) {
-			printf("can't poll, %d", errno);
-			return (-1);
-		}
-		if (status > 0) {
-			nPollSuccess++;
-			saddr_len=sizeof socket_address_rx;
-			buflen=recvfrom(sock_fd_rx,receivebuffer,RECEIVE_BUFFER_SIZE,0,&socket_address_rx,(socklen_t *)&saddr_len);
-			//printf("poll success status %d, len %d\n", status, buflen);
-			if(buflen<0) {
-				printf("error in reading recvfrom function\n");
-				return -1;
+		if (pipelineActive) {
+			/* The capture thread has received them already. Waits up to one millisecond. */
+			if (pipelinePoll(PIPELINE_RX_BATCH, handlePipelineFrame) == 0) nPollNothing++;
+			LOOPMON_RESTART(tLoop);
+		} else if (uringActive) {
+			/* Submits the queued writes and handles all received frames. One millisecond timeout. */
+			if (uringPoll(1, handleUringFrame)<0) {
+				printf("io_uring failed, %d", errno);
+				return (-1);
 			}
-			data_process(buflen);
+			LOOPMON_RESTART(tLoop); /* the frames were already measured as handler */
 		} else {
-			nPollNothing++; 
-		}	
+			signed status = poll (&mypollfd, 1, 1); /* one file descriptor, one millisecond timeout */
+			if ((status < 0) && (errno != EINTR)) {
+				printf("can't poll, %d", errno);
+				return (-1);
+			}
+			LOOPMON_RESTART(tLoop); /* the waiting time is not part of the iteration */
+			if (status > 0) {
+				nPollSuccess++;
+				/* recvmsg() instead of recvfrom(), for the SO_RXQ_OVFL counter */
+				iov.iov_base = receivebuffer;
+				iov.iov_len = RECEIVE_BUFFER_SIZE;
+				memset(&msg, 0, sizeof(msg));
+				msg.msg_name = &socket_address_rx;
+				msg.msg_namelen = sizeof socket_address_rx;
+				msg.msg_iov = &iov;
+				msg.msg_iovlen = 1;
+				msg.msg_control = control;
+				msg.msg_controllen = sizeof(control);
+				buflen=recvmsg(sock_fd_rx,&msg,0);
+				//printf("poll success status %d, len %d\n", status, buflen);
+				if ((buflen<0) && ((errno == ENETDOWN) || (errno == ENXIO) || (errno == ENODEV))) {
+					/* the interface is gone or down, the link watcher binds it again */
+					nRxLinkErrors++;
+				} else if(buflen<0) {
+					printf("error in reading recvmsg function\n");
+					return -1;
+				} else {
+					rxStatsObserveMsg(&msg);
+					handleReceivedFrame(buflen);
+				}
+			} else {
+				nPollNothing++; 
+			}
+		}
+		/*----- Supervision of the SLAC sessions, and serving the event subscribers -----*/
+		serviceTimers();
+		/*----- Hot-plug of the interface, checked once per millisecond -----*/
+		if (linkWatchActive) {
+			static uint64_t lastLinkCheckMs;
+			uint64_t nowMs = clockMonotonicMs();
+			if (nowMs != lastLinkCheckMs) {
+				int changes = linkWatchService(nowMs);
+				lastLinkCheckMs = nowMs;
+				if (changes) reactOnLinkChange(changes);
+			}
+		}
+		/*----- Handover to a new instance -----*/
+		if (handoffListening) {
+			int conn = handoffAccept();
+			if (conn>=0) {
+				handOverToNewInstance(conn);
+			} else if (errno==EPERM) {
+				LOG_WARN(LOG_CAT_MAIN, "handover: connection of another user rejected (%u)", nHandoffRejected);
+			}
+		}
+		eventStreamService();
+		/*----- Dump of the flight recorder, if a trigger fired -----*/
+		if (flightRecorderActive) {
+			const char *dumpFile = flightRecorderService();
+			if (dumpFile) {
+				LOG_INFO(LOG_CAT_MAIN, "flight recorder dumped to %s", dumpFile);
+			}
+		}
+		/*----- End of the replay -----*/
+		if (replayActive) {
+			replay_result rr;
+			if (replayService(&rr)) {
+				LOG_INFO(LOG_CAT_MAIN, "replay finished: %u frames in %u batches in %lu ms, %u failed, %u timed out after %u retries, %u skipped, %u with rewritten MACs",
+					rr.nFrames, rr.nBatches, (unsigned long)(rr.durationNs/1000000), rr.nFailed, rr.nTimedOut, rr.nRetries, rr.nSkipped, rr.nRewritten);
+				LOG_INFO(LOG_CAT_MAIN, "replay timing error: mean %lu us, p99 below %lu us, max late %ld us, max early %ld us, %u frames more than 100 us late",
+					(unsigned long)(rr.meanAbsErrorNs/1000), (unsigned long)(rr.p99AbsErrorNs/1000),
+					(long)(rr.maxLateNs/1000), (long)(rr.maxEarlyNs/1000), rr.nLate100us);
+			}
+		}
 		/*----- Status reporting from time to time -----*/
 		if ((nMainLoops %10000)==0) {
-			sprintf(str1000, "mainloops %5d, nPollSuccess %5d, nHomePlug: %5d,  Other: %5d  Total: %5d  SlacMatchCnf: %5d  GetSwVersion: %5d  SetKey: %5d",
+			LOG_INFO(LOG_CAT_STATUS, "mainloops %5d, nPollSuccess %5d, nHomePlug: %5d,  Other: %5d  Total: %5d  SlacMatchCnf: %5d  GetSwVersion: %5d  SetKey: %5d",
 			nMainLoops, nPollSuccess, nHomePlug, other,total, nHpSlacMatchCnf, nHpGetSwVersion, nSetKey);
-	        printToLogAndScreen(str1000);
+			{
+				rx_stats_interval rxs;
+				rxStatsSample(&rxs);
+				if (rxs.ringMode) {
+					LOG_INFO(LOG_CAT_STATUS, "rx socket: frames %u, buffer drops %u, freeze %u, rxq_ovfl %u, if dropped %u, if missed %u, buffer %u/%u",
+						rxs.packets, rxs.drops, rxs.freezeQueue, rxs.rxqOverflow, rxs.ifDropped, rxs.ifMissed, rxs.rcvbufUsed, rxs.rcvbufSize);
+				} else {
+					LOG_INFO(LOG_CAT_STATUS, "rx socket: frames %u, buffer drops %u, rxq_ovfl %u, if dropped %u, if missed %u, buffer %u/%u",
+						rxs.packets, rxs.drops, rxs.rxqOverflow, rxs.ifDropped, rxs.ifMissed, rxs.rcvbufUsed, rxs.rcvbufSize);
+				}
+				if (loopMonActive && LOG_ENABLED(LOG_CAT_STATUS, LOG_LEVEL_INFO)) loopMonPrintStatus(printToLogAndScreen);
+				if (macFilterActive) {
+					LOG_INFO(LOG_CAT_STATUS, "MAC filter: passed %u, dropped %u", nMacFilterPassed, nMacFilterDropped);
+				}
+				if (rxs.drops || rxs.ifDropped || rxs.ifMissed) {
+					LOG_WARN(LOG_CAT_STATUS, "rx socket: frames lost, in total %u in the socket buffer, %u in the interface",
+						nRxTotalDrops, nRxTotalIfDropped);
+				}
+			}
+	        if (uringActive) {
+				LOG_INFO(LOG_CAT_STATUS, "io_uring: enter %u, frames %u, writes %u, rearm %u, writewaits %u, deferred %u, dropped %u",
+					nUringEnter, nUringFrames, nUringWrites, nUringRearm, nUringWriteWaits, nUringDeferred, nUringRxDropped);
+			}
+			if (pipelineActive && (nPipelineTruncated || nPipelinePoolEmpty || nPipelineLogWaits)) {
+				LOG_WARN(LOG_CAT_STATUS, "pipeline: truncated %u, pool empty %u, log waits %u",
+					nPipelineTruncated, nPipelinePoolEmpty, nPipelineLogWaits);
+			}
+			{
+				int txClass;
+				for (txClass=0; txClass<TXSCHED_NUMBER_OF_CLASSES; txClass++) {
+					txsched_class_stats *ts = &txSchedStats[txClass];
+					if (ts->nSent + ts->nDropped == 0) continue;
+					LOG_INFO(LOG_CAT_STATUS, "tx %-8s sent %u, queued %u, dropped %u, failed %u, delay avg %lu us max %lu us",
+						txSchedClassName(txClass), ts->nSent, ts->nQueued, ts->nDropped, ts->nSendFailed,
+						(unsigned long)(ts->nSent ? ts->sumDelayNs/ts->nSent/1000 : 0), (unsigned long)(ts->maxDelayNs/1000));
+				}
+			}
+			if (nLinkDown || nRxLinkErrors) {
+				LOG_WARN(LOG_CAT_STATUS, "link: down %u, up %u, new index %u, resyncs %u, gaps %u, total %lu ms, max %lu ms, rx errors %u",
+					nLinkDown, nLinkUp, nLinkIndexChanges, nLinkResyncs, nLinkGaps,
+					(unsigned long)linkGapTotalMs, (unsigned long)linkGapMaxMs, nRxLinkErrors);
+			}
+			if (nMmRequestsSent) {
+				LOG_INFO(LOG_CAT_STATUS, "requests: sent %u, pending %u, confirmed %u, timed out %u, table full %u, send failed %u",
+					nMmRequestsSent, nMmRequestsPending, nMmRequestsConfirmed, nMmRequestsTimedOut, nMmRequestsTableFull, nMmRequestsSendFailed);
+			}
+			if (nwStatsActive) {
+				LOG_INFO(LOG_CAT_STATUS, "PHY rates: queries %u, answers %u, timeouts %u, pairs %d, samples %u, pairs replaced %u",
+					nNwStatsQueries, nNwStatsAnswers, nNwStatsTimeouts, nwStatsPairCount(), nNwStatsSamples, nNwStatsPairsReplaced);
+			}
+			if (logStoreActive) {
+				LOG_INFO(LOG_CAT_STATUS, "log store: lines %llu, deduplicated %llu, text %llu kB, written %llu kB, blocks %u, segments %u, deleted %u, waits %u, write errors %u",
+					(unsigned long long)nLogStoreLines, (unsigned long long)nLogStoreDeduplicated,
+					(unsigned long long)nLogStoreTextBytes/1024, (unsigned long long)nLogStoreWrittenBytes/1024,
+					nLogStoreBlocks, nLogStoreSegments, nLogStoreDeleted, nLogStoreWaits, nLogStoreWriteErrors);
+			}
+			if (encPayloadActive) {
+				LOG_INFO(LOG_CAT_STATUS, "encrypted payloads: %u, decrypted %u, no key %u, unsupported PEKS %u, malformed %u",
+					nEncPayloads, nEncDecrypted, nEncNoKey, nEncUnsupportedPeks, nEncMalformed);
+			}
 		}
 		/*----- Polling and processing of keyboard -----*/
 	    if (kbhit()) {
 			/* A key was pressed */
 		    c=getch();
-		    sprintf(str1000, "Taste gedrückt: %02x %c", c, c);
-		    printToLogAndScreen(str1000);
+		    LOG_INFO(LOG_CAT_MAIN, "Taste gedrückt: %02x %c", c, c);
 		    processTheKey(c);
  	    }
+		LOOPMON_END(tLoop, LOOPMON_ITERATION);
+		if (loopMonActive) reportStalls();
 	}
 
+	mmRequestCancelAll(clockMonotonicMs());
+	if (pipelineActive) pipelineStop();
 	close(sock_fd_rx);
 	close(sock_fd_tx);
-	printToLogAndScreen("Terminating normally.");
-	fclose(hLogFile);
+	eventStreamClose();
+	linkWatchClose();
+	handoffClose();
+	if (handedOver) {
+		LOG_INFO(LOG_CAT_MAIN, "the stations are with the new instance, %s is not written", STATION_SNAPSHOT_FILE);
+	} else if (stationSaveSnapshot(STATION_SNAPSHOT_FILE)<0) {
+		LOG_ERROR(LOG_CAT_MAIN, "could not write the station snapshot");
+	}
+	if (!handedOver) nwStatsExit();
+	LOG_INFO(LOG_CAT_MAIN, "Terminating normally.");
+	if (captureActive) slacForEachSession(addOpenSessionToCaptureIndex);
+	uringExit(); /* writes the queued log and capture data */
+	logWriter=-1;
+	captureClose();
+	if (captureFileName) {
+		if (sessionIndexWrite(&captureIndex, captureFileName, captureOffset)<0) {
+			printf("could not write the session index %s%s\n", captureFileName, SESSION_INDEX_SUFFIX);
+		}
+		sessionIndexFree(&captureIndex);
+	}
+	flightRecorderExit();
+	if (traceActive) {
+		writeTrace();
+		traceExit();
+	}
+	closeLog();
 
-}
+}
\ No newline at end of file
@@ -0,0 +1,80 @@
+/* Logging with compile-time and runtime levels, see log.h */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "log.h"
+
+/* The MMEs are logged per frame like before, the other frames only with -l main=debug. */
+uint8_t logLevel[LOG_NUMBER_OF_CATEGORIES] = {
+	LOG_LEVEL_INFO,  /* main */
+	LOG_LEVEL_DEBUG, /* homeplug */
+	LOG_LEVEL_INFO,  /* slac */
+	LOG_LEVEL_INFO,  /* key */
+	LOG_LEVEL_INFO,  /* v2g */
+	LOG_LEVEL_INFO   /* status */
+};
+
+static const char *categoryNames[LOG_NUMBER_OF_CATEGORIES] = {
+	"main", "homeplug", "slac", "key", "v2g", "status"
+};
+
+static const char *levelNames[] = { "off", "error", "warn", "info", "debug" };
+#define NUMBER_OF_LEVELS (int)(sizeof(levelNames)/sizeof(levelNames[0]))
+
+static void (*logSink)(char *s);
+static char line[LOG_LINE_LEN];
+
+void logSetSink(void (*sink)(char *s)) {
+	logSink = sink;
+}
+
+void logWrite(const char *format, ...) {
+	va_list args;
+	va_start(args, format);
+	vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+	if (logSink) logSink(line); else puts(line);
+}
+
+static int findName(const char *s, int len, const char **names, int nNames) {
+	int i;
+	for (i=0; i<nNames; i++) {
+		if (((int)strlen(names[i]) == len) && (strncmp(s, names[i], len) == 0)) return i;
+	}
+	return -1;
+}
+
+int logParseLevels(const char *spec) {
+	while (*spec) {
+		const char *end = strchr(spec, ',');
+		const char *eq = strchr(spec, '=');
+		int len = end ? (int)(end - spec) : (int)strlen(spec);
+		int cat = -1, level, i;
+		if (eq && (eq < spec + len)) {
+			cat = findName(spec, eq - spec, categoryNames, LOG_NUMBER_OF_CATEGORIES);
+			if (cat < 0) return -1;
+			level = findName(eq + 1, spec + len - eq - 1, levelNames, NUMBER_OF_LEVELS);
+		} else {
+			level = findName(spec, len, levelNames, NUMBER_OF_LEVELS);
+		}
+		if (level < 0) return -1;
+		for (i=0; i<LOG_NUMBER_OF_CATEGORIES; i++) {
+			if ((cat < 0) || (cat == i)) logLevel[i] = level;
+		}
+		spec += len;
+		if (*spec == ',') spec++;
+	}
+	return 0;
+}
+
+void logFormatLevels(char *s, int size) {
+	int i, n = 0;
+	s[0] = 0;
+	for (i=0; (i<LOG_NUMBER_OF_CATEGORIES) && (n<size); i++) {
+		n += snprintf(s+n, size-n, "%s%s=%s", i ? " " : "", categoryNames[i],
+			levelNames[logLevel[i] <= LOG_COMPILE_LEVEL ? logLevel[i] : LOG_COMPILE_LEVEL]);
+	}
+}
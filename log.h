@@ -0,0 +1,66 @@
+/* Logging with compile-time and runtime levels, per subsystem
+ *
+ * LOG_INFO(LOG_CAT_SLAC, "format", ...) formats and writes the line only if the
+ * level is enabled for the category. The check comes before the arguments are
+ * evaluated, so a disabled message costs one well-predicted compare and no formatting:
+ *  - levels above LOG_COMPILE_LEVEL are removed by the compiler. The production
+ *    build (make LOGLEVEL=INFO) has no formatting per frame on the receive path.
+ *  - the remaining levels are compared with logLevel[category], set with -l.
+ * Code which prepares strings for a message (MAC lists, hex dumps) is put under
+ * if (LOG_ENABLED(...)), for the same reason.
+ *
+ * The levels: ERROR for failures of the tool, WARN for negative results on the
+ * line, INFO for events (SLAC match, set-key, V2G messages, status), DEBUG for
+ * lines per received frame.
+ */
+
+#ifndef LOG_HEADER
+#define LOG_HEADER
+
+#include <stdint.h>
+
+#define LOG_LEVEL_OFF 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+/* the subsystems, each with its own runtime level */
+enum {
+	LOG_CAT_MAIN,     /* startup, keys, frames which are not HomePlug */
+	LOG_CAT_HOMEPLUG, /* the received MMEs */
+	LOG_CAT_SLAC,     /* SLAC match and session transitions */
+	LOG_CAT_KEY,      /* set-key, get-key, NMK and encrypted payloads */
+	LOG_CAT_V2G,      /* SDP and V2G after the SLAC */
+	LOG_CAT_STATUS,   /* the periodic statistics */
+	LOG_NUMBER_OF_CATEGORIES
+};
+
+#define LOG_LINE_LEN 1000
+
+extern uint8_t logLevel[LOG_NUMBER_OF_CATEGORIES];
+
+#define LOG_ENABLED(cat, level) (((level) <= LOG_COMPILE_LEVEL) && ((level) <= logLevel[cat]))
+
+#define LOG(cat, level, ...) do { \
+		if (LOG_ENABLED(cat, level)) logWrite(__VA_ARGS__); \
+	} while (0)
+#define LOG_ERROR(cat, ...) LOG(cat, LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(cat, ...) LOG(cat, LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(cat, ...) LOG(cat, LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(cat, ...) LOG(cat, LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+/* The function which writes a formatted line, e.g. to screen and log file */
+void logSetSink(void (*sink)(char *s));
+void logWrite(const char *format, ...) __attribute__((format(printf, 1, 2)));
+/* Sets the runtime levels from "debug" (all categories) or "homeplug=debug,v2g=off".
+   Returns 0, or -1 on an unknown category or level. */
+int logParseLevels(const char *spec);
+/* e.g. "main=info homeplug=debug ...", for the startup message */
+void logFormatLevels(char *s, int size);
+
+#endif
@@ -0,0 +1,641 @@
+/* Compressed, deduplicated log storage, see logstore.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "logstore.h"
+
+int logStoreActive;
+uint64_t nLogStoreLines, nLogStoreDeduplicated;
+uint64_t nLogStoreTextBytes, nLogStoreWrittenBytes;
+uint32_t nLogStoreBlocks, nLogStoreSegments, nLogStoreDeleted, nLogStoreWaits, nLogStoreWriteErrors;
+
+#define BLOCK_FREE 0
+#define BLOCK_FILLING 1
+#define BLOCK_FULL 2
+
+/* space for the repetition record, which is written when the next different line comes */
+#define RUN_RESERVE (1 + 5 + 10)
+#define MAX_RECORD (1 + 10 + 5 + LOGSTORE_MAX_LINE)
+
+typedef struct log_block {
+	uint8_t data[LOGSTORE_BLOCK_BYTES];
+	uint32_t len;
+	uint32_t nLines;
+	uint64_t firstMs;
+	uint64_t lastMs;     /* of the last record, the base of the next difference */
+	uint64_t deadlineMs; /* monotonic, when it is written at the latest */
+	int state;
+} log_block;
+
+/* the deduplication of the block which is filled */
+static struct {
+	uint32_t hash[LOGSTORE_RECENT_LINES];
+	uint16_t pos[LOGSTORE_RECENT_LINES];
+	uint16_t len[LOGSTORE_RECENT_LINES];
+	int nRecent, nextRecent;
+	int prevPos, prevLen; /* the text of the line before, prevPos -1 if there is none */
+	uint32_t prevHash;
+	uint32_t runCount;
+	uint64_t runLastMs;
+} dedup;
+
+static log_block blocks[LOGSTORE_BLOCKS];
+static int filling = -1;
+static int fullQueue[LOGSTORE_BLOCKS], fullHead, nFull;
+static int running;
+static pthread_t writerThread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workCond, freedCond;
+
+static logstore_config config;
+static FILE *segment;
+static char segmentName[LOGSTORE_PATH_LEN + 32];
+static uint64_t segmentBytes;
+static uint32_t nextSeq;
+static uint8_t compBuffer[LOGSTORE_COMPRESS_BOUND(LOGSTORE_BLOCK_BYTES)];
+
+static uint64_t realtimeMs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t monotonicMs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint32_t fnv1a(const uint8_t *p, int len) {
+	uint32_t h = 2166136261u;
+	while (len-- > 0) {
+		h ^= *p++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static int putVarint(uint8_t *p, uint64_t v) {
+	int n = 0;
+	while (v >= 0x80) {
+		p[n++] = (uint8_t)v | 0x80;
+		v >>= 7;
+	}
+	p[n++] = (uint8_t)v;
+	return n;
+}
+
+static int getVarint(const uint8_t *p, uint32_t len, uint32_t *pos, uint64_t *v) {
+	int shift = 0;
+	*v = 0;
+	while (*pos < len) {
+		uint8_t b = p[(*pos)++];
+		*v |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) return 0;
+		shift += 7;
+		if (shift > 63) return -1;
+	}
+	return -1;
+}
+
+/*********************************************************************/
+/* LZ77 with hash chains, in the sequence format of LZ4:
+   token (literal length << 4 | match length - 4), the literals, the offset
+   (16 bit little endian) and the lengths above 14 in additional bytes. The
+   last sequence has only literals. Only the writer thread compresses. */
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 14
+#define LZ_MAX_CHAIN 32
+#define LZ_MAX_OFFSET 65535
+
+static int32_t lzHead[1 << LZ_HASH_BITS];
+static int32_t lzPrev[LOGSTORE_BLOCK_BYTES];
+
+static uint32_t lzHash(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static void lzInsert(const uint8_t *in, int i) {
+	uint32_t h = lzHash(in + i);
+	lzPrev[i] = lzHead[h];
+	lzHead[h] = i;
+}
+
+static uint8_t *putLength(uint8_t *op, uint32_t n) {
+	while (n >= 255) {
+		*op++ = 255;
+		n -= 255;
+	}
+	*op++ = (uint8_t)n;
+	return op;
+}
+
+static uint8_t *putLiterals(uint8_t *op, const uint8_t *lit, uint32_t n, uint32_t matchCode) {
+	*op++ = (uint8_t)(((n < 15) ? n : 15) << 4 | matchCode);
+	if (n >= 15) op = putLength(op, n - 15);
+	memcpy(op, lit, n);
+	return op + n;
+}
+
+int logStoreCompress(const uint8_t *in, int len, uint8_t *out, int outSize) {
+	uint8_t *op = out;
+	int anchor = 0, i = 0, j;
+	if ((len > LOGSTORE_BLOCK_BYTES) || (outSize < LOGSTORE_COMPRESS_BOUND(len))) return -1;
+	memset(lzHead, 0xff, sizeof(lzHead));
+	while (i + LZ_MIN_MATCH <= len) {
+		int cand = lzHead[lzHash(in + i)];
+		int depth = LZ_MAX_CHAIN, bestLen = 0, bestOffset = 0;
+		while ((cand >= 0) && (depth-- > 0) && (i - cand <= LZ_MAX_OFFSET)) {
+			/* the byte after the best match first, most candidates fail there */
+			if ((i + bestLen < len) && (in[cand + bestLen] == in[i + bestLen])) {
+				int m = 0;
+				while ((i + m < len) && (in[cand + m] == in[i + m])) m++;
+				if (m > bestLen) {
+					bestLen = m;
+					bestOffset = i - cand;
+				}
+			}
+			cand = lzPrev[cand];
+		}
+		lzInsert(in, i);
+		if (bestLen < LZ_MIN_MATCH) {
+			i++;
+			continue;
+		}
+		bestLen -= LZ_MIN_MATCH;
+		op = putLiterals(op, in + anchor, i - anchor, (bestLen < 15) ? bestLen : 15);
+		*op++ = bestOffset & 0xff;
+		*op++ = bestOffset >> 8;
+		if (bestLen >= 15) op = putLength(op, bestLen - 15);
+		bestLen += LZ_MIN_MATCH;
+		/* the positions within the match can be the start of later matches */
+		for (j = i + 1; (j < i + bestLen) && (j + LZ_MIN_MATCH <= len); j++) lzInsert(in, j);
+		i += bestLen;
+		anchor = i;
+	}
+	op = putLiterals(op, in + anchor, len - anchor, 0);
+	return op - out;
+}
+
+static int getLength(const uint8_t **ip, const uint8_t *end, uint32_t *n) {
+	uint8_t b;
+	do {
+		if (*ip >= end) return -1;
+		b = *(*ip)++;
+		*n += b;
+	} while (b == 255);
+	return 0;
+}
+
+int logStoreDecompress(const uint8_t *in, int len, uint8_t *out, int outSize) {
+	const uint8_t *ip = in, *iend = in + len;
+	uint8_t *op = out, *oend = out + outSize;
+	while (ip < iend) {
+		uint8_t token = *ip++;
+		uint32_t n = token >> 4, offset;
+		if ((n == 15) && (getLength(&ip, iend, &n) < 0)) return -1;
+		if ((n > (uint32_t)(iend - ip)) || (n > (uint32_t)(oend - op))) return -1;
+		memcpy(op, ip, n);
+		op += n;
+		ip += n;
+		if (ip == iend) break; /* the last sequence */
+		if (iend - ip < 2) return -1;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if ((offset == 0) || (offset > (uint32_t)(op - out))) return -1;
+		n = token & 15;
+		if ((n == 15) && (getLength(&ip, iend, &n) < 0)) return -1;
+		n += LZ_MIN_MATCH;
+		if (n > (uint32_t)(oend - op)) return -1;
+		/* may overlap, byte by byte */
+		while (n--) {
+			*op = *(op - offset);
+			op++;
+		}
+	}
+	return op - out;
+}
+
+/*********************************************************************/
+/* Segments and retention */
+
+static int segmentNumber(const char *path) {
+	const char *name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+	return atoi(name + strlen(LOGSTORE_PREFIX));
+}
+
+static int compareSegments(const void *a, const void *b) {
+	int na = segmentNumber(*(char * const *)a), nb = segmentNumber(*(char * const *)b);
+	return (na > nb) - (na < nb);
+}
+
+int logStoreListSegments(const char *dir, char ***names) {
+	DIR *d = opendir(dir);
+	struct dirent *e;
+	int n = 0, size = 0;
+	*names = NULL;
+	if (!d) return -1;
+	while ((e = readdir(d)) != NULL) {
+		int len = strlen(e->d_name);
+		int digits = len - strlen(LOGSTORE_PREFIX) - strlen(LOGSTORE_SUFFIX);
+		char *path;
+		if ((digits <= 0) || strncmp(e->d_name, LOGSTORE_PREFIX, strlen(LOGSTORE_PREFIX)) ||
+		    strcmp(e->d_name + len - strlen(LOGSTORE_SUFFIX), LOGSTORE_SUFFIX) ||
+		    ((int)strspn(e->d_name + strlen(LOGSTORE_PREFIX), "0123456789") != digits)) continue;
+		if (n == size) {
+			char **p = realloc(*names, (size ? size * 2 : 16) * sizeof(char *));
+			if (!p) break;
+			*names = p;
+			size = size ? size * 2 : 16;
+		}
+		path = malloc(strlen(dir) + len + 2);
+		if (!path) break;
+		sprintf(path, "%s/%s", dir, e->d_name);
+		(*names)[n++] = path;
+	}
+	closedir(d);
+	if (n) qsort(*names, n, sizeof(char *), compareSegments);
+	return n;
+}
+
+void logStoreFreeList(char **names, int n) {
+	int i;
+	for (i=0; i<n; i++) free(names[i]);
+	free(names);
+}
+
+/* The oldest go first, while the total is above the cap or they are too old.
+   The open segment stays. */
+static void enforceRetention(void) {
+	char **names;
+	int n = logStoreListSegments(config.dir, &names), i;
+	uint64_t total = 0, cap = (uint64_t)config.totalMB * 1024 * 1024;
+	time_t oldest = config.days ? time(NULL) - (time_t)config.days * 86400 : 0;
+	struct stat st;
+	if (n <= 0) return;
+	for (i=0; i<n; i++) {
+		if (stat(names[i], &st) == 0) total += st.st_size;
+	}
+	for (i=0; i<n; i++) {
+		if (segment && !strcmp(names[i], segmentName)) break;
+		if (stat(names[i], &st) < 0) continue;
+		if ((total <= cap) && (st.st_mtime >= oldest)) break;
+		if (remove(names[i]) == 0) {
+			total -= st.st_size;
+			nLogStoreDeleted++;
+		}
+	}
+	logStoreFreeList(names, n);
+}
+
+static int openSegment(void) {
+	uint64_t now = realtimeMs();
+	int tries;
+	/* exclusive: an instance which takes over (-H) may have taken the number */
+	for (tries = 0; tries < 100; tries++) {
+		snprintf(segmentName, sizeof(segmentName), "%s/%s%06u%s", config.dir, LOGSTORE_PREFIX, nextSeq++, LOGSTORE_SUFFIX);
+		segment = fopen(segmentName, "wbx");
+		if (segment || (errno != EEXIST)) break;
+	}
+	if (!segment) return -1;
+	if ((fwrite(LOGSTORE_MAGIC, LOGSTORE_MAGIC_LEN, 1, segment) != 1) || (fwrite(&now, sizeof(now), 1, segment) != 1)) {
+		fclose(segment);
+		segment = NULL;
+		return -1;
+	}
+	segmentBytes = LOGSTORE_MAGIC_LEN + sizeof(now);
+	nLogStoreSegments++;
+	/* the new file must survive a power cut as well, not only its blocks */
+	{
+		int dirFd = open(config.dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dirFd >= 0) {
+			if (fsync(dirFd) != 0) nLogStoreWriteErrors++;
+			close(dirFd);
+		}
+	}
+	return 0;
+}
+
+static void closeSegment(void) {
+	if (!segment) return;
+	if (fclose(segment) != 0) nLogStoreWriteErrors++;
+	segment = NULL;
+	enforceRetention();
+}
+
+static void writeBlock(log_block *b) {
+	logstore_block_header h;
+	int n;
+	if (!segment && (openSegment() < 0)) {
+		nLogStoreWriteErrors++;
+		return;
+	}
+	n = logStoreCompress(b->data, b->len, compBuffer, sizeof(compBuffer));
+	h.rawLen = b->len;
+	h.compLen = ((n < 0) || (n >= (int)b->len)) ? b->len : (uint32_t)n;
+	h.firstMs = b->firstMs;
+	h.nLines = b->nLines;
+	h.checksum = fnv1a(b->data, b->len);
+	if ((fwrite(&h, sizeof(h), 1, segment) != 1) ||
+	    (fwrite((h.compLen == h.rawLen) ? b->data : compBuffer, h.compLen, 1, segment) != 1) ||
+	    (fflush(segment) != 0) || (fdatasync(fileno(segment)) != 0)) {
+		nLogStoreWriteErrors++;
+	}
+	nLogStoreBlocks++;
+	nLogStoreWrittenBytes += sizeof(h) + h.compLen;
+	segmentBytes += sizeof(h) + h.compLen;
+	if (segmentBytes >= (uint64_t)config.segmentKB * 1024) closeSegment();
+}
+
+/*********************************************************************/
+/* The blocks: filled under the lock, written by the thread */
+
+static void flushRun(log_block *b) {
+	if (!dedup.runCount) return;
+	b->data[b->len++] = LOGREC_REPEAT;
+	b->len += putVarint(b->data + b->len, dedup.runCount);
+	b->len += putVarint(b->data + b->len, dedup.runLastMs - b->lastMs);
+	b->lastMs = dedup.runLastMs;
+	dedup.runCount = 0;
+}
+
+static void handOver(void) {
+	log_block *b = &blocks[filling];
+	flushRun(b);
+	filling = -1;
+	if (!b->len) {
+		b->state = BLOCK_FREE;
+		return;
+	}
+	b->state = BLOCK_FULL;
+	fullQueue[(fullHead + nFull) % LOGSTORE_BLOCKS] = b - blocks;
+	nFull++;
+	pthread_cond_signal(&workCond);
+}
+
+static void takeFreeBlock(uint64_t now) {
+	int i;
+	for (;;) {
+		for (i=0; i<LOGSTORE_BLOCKS; i++) {
+			if (blocks[i].state == BLOCK_FREE) break;
+		}
+		if (i < LOGSTORE_BLOCKS) break;
+		nLogStoreWaits++;
+		pthread_cond_wait(&freedCond, &lock);
+	}
+	blocks[i].state = BLOCK_FILLING;
+	blocks[i].len = 0;
+	blocks[i].nLines = 0;
+	blocks[i].firstMs = blocks[i].lastMs = now;
+	blocks[i].deadlineMs = monotonicMs() + LOGSTORE_FLUSH_MS;
+	memset(&dedup, 0, sizeof(dedup));
+	dedup.prevPos = -1;
+	filling = i;
+	pthread_cond_signal(&workCond); /* for the deadline */
+}
+
+static int findRecent(const log_block *b, uint32_t hash, const char *line, int len) {
+	int i;
+	for (i=0; i<dedup.nRecent; i++) {
+		if ((dedup.hash[i] == hash) && (dedup.len[i] == len) && !memcmp(b->data + dedup.pos[i], line, len)) return i;
+	}
+	return -1;
+}
+
+void logStoreWrite(const char *line) {
+	uint64_t now = realtimeMs();
+	int len = strlen(line), i;
+	uint32_t hash;
+	log_block *b;
+	if (len > LOGSTORE_MAX_LINE) len = LOGSTORE_MAX_LINE;
+	hash = fnv1a((const uint8_t *)line, len);
+	pthread_mutex_lock(&lock);
+	nLogStoreLines++;
+	nLogStoreTextBytes += len + 1;
+	if ((filling >= 0) && (dedup.prevPos >= 0) && (dedup.prevHash == hash) && (dedup.prevLen == len) &&
+	    !memcmp(blocks[filling].data + dedup.prevPos, line, len)) {
+		/* the same as before: only counted */
+		dedup.runCount++;
+		dedup.runLastMs = now;
+		blocks[filling].nLines++;
+		nLogStoreDeduplicated++;
+		pthread_mutex_unlock(&lock);
+		return;
+	}
+	if ((filling >= 0) && (blocks[filling].len + MAX_RECORD + 2 * RUN_RESERVE > LOGSTORE_BLOCK_BYTES)) handOver();
+	if (filling < 0) takeFreeBlock(now);
+	b = &blocks[filling];
+	flushRun(b);
+	if (now < b->lastMs) now = b->lastMs; /* the clock was set back */
+	i = findRecent(b, hash, line, len);
+	if (i >= 0) {
+		b->data[b->len++] = LOGREC_RECENT;
+		b->len += putVarint(b->data + b->len, now - b->lastMs);
+		b->data[b->len++] = i;
+		nLogStoreDeduplicated++;
+	} else {
+		b->data[b->len++] = LOGREC_LINE;
+		b->len += putVarint(b->data + b->len, now - b->lastMs);
+		b->len += putVarint(b->data + b->len, len);
+		i = dedup.nextRecent;
+		dedup.hash[i] = hash;
+		dedup.pos[i] = b->len;
+		dedup.len[i] = len;
+		dedup.nextRecent = (i + 1) % LOGSTORE_RECENT_LINES;
+		if (dedup.nRecent < LOGSTORE_RECENT_LINES) dedup.nRecent++;
+		memcpy(b->data + b->len, line, len);
+		b->len += len;
+	}
+	b->lastMs = now;
+	b->nLines++;
+	dedup.prevPos = dedup.pos[i];
+	dedup.prevLen = len;
+	dedup.prevHash = hash;
+	pthread_mutex_unlock(&lock);
+}
+
+static void *writerThreadFunction(void *arg) {
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		if (nFull) {
+			log_block *b = &blocks[fullQueue[fullHead]];
+			fullHead = (fullHead + 1) % LOGSTORE_BLOCKS;
+			nFull--;
+			pthread_mutex_unlock(&lock);
+			writeBlock(b);
+			pthread_mutex_lock(&lock);
+			b->state = BLOCK_FREE;
+			pthread_cond_signal(&freedCond);
+		} else if (!running) {
+			break;
+		} else if ((filling >= 0) && blocks[filling].len) {
+			/* the lines of a quiet time go to the disk after LOGSTORE_FLUSH_MS */
+			uint64_t deadline = blocks[filling].deadlineMs;
+			if (monotonicMs() >= deadline) {
+				handOver();
+			} else {
+				struct timespec ts;
+				ts.tv_sec = deadline / 1000;
+				ts.tv_nsec = (deadline % 1000) * 1000000;
+				pthread_cond_timedwait(&workCond, &lock, &ts);
+			}
+		} else {
+			/* the first line of the next block sets the deadline */
+			pthread_cond_wait(&workCond, &lock);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	closeSegment();
+	return arg;
+}
+
+int logStoreParse(const char *spec, logstore_config *cfg) {
+	const char *colon = strchr(spec, ':');
+	int dirLen = colon ? (int)(colon - spec) : (int)strlen(spec);
+	char *end;
+	cfg->segmentKB = LOGSTORE_DEFAULT_SEGMENT_KB;
+	cfg->totalMB = LOGSTORE_DEFAULT_TOTAL_MB;
+	cfg->days = LOGSTORE_DEFAULT_DAYS;
+	if ((dirLen == 0) || (dirLen >= LOGSTORE_PATH_LEN)) return -1;
+	memcpy(cfg->dir, spec, dirLen);
+	cfg->dir[dirLen] = 0;
+	if (!colon) return 0;
+	cfg->segmentKB = strtoul(colon + 1, &end, 10);
+	if (*end == ':') cfg->totalMB = strtoul(end + 1, &end, 10);
+	if (*end == ':') cfg->days = strtoul(end + 1, &end, 10);
+	if ((*end != 0) || (cfg->segmentKB < 64) || (cfg->totalMB == 0) || ((uint64_t)cfg->totalMB * 1024 < cfg->segmentKB)) return -1;
+	return 0;
+}
+
+int logStoreOpen(const logstore_config *cfg) {
+	pthread_condattr_t attr;
+	char **names;
+	int n;
+	config = *cfg;
+	if ((mkdir(config.dir, 0755) < 0) && (errno != EEXIST)) return -1;
+	n = logStoreListSegments(config.dir, &names);
+	if (n < 0) return -1;
+	nextSeq = n ? segmentNumber(names[n-1]) + 1 : 0;
+	logStoreFreeList(names, n);
+	enforceRetention();
+	/* the deadlines are monotonic */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&workCond, &attr);
+	pthread_cond_init(&freedCond, NULL);
+	pthread_condattr_destroy(&attr);
+	running = 1;
+	if (pthread_create(&writerThread, NULL, writerThreadFunction, NULL) != 0) {
+		running = 0;
+		return -1;
+	}
+	logStoreActive = 1;
+	return 0;
+}
+
+void logStoreClose(void) {
+	if (!logStoreActive) return;
+	pthread_mutex_lock(&lock);
+	if (filling >= 0) handOver();
+	running = 0;
+	pthread_cond_signal(&workCond);
+	pthread_mutex_unlock(&lock);
+	pthread_join(writerThread, NULL);
+	logStoreActive = 0;
+}
+
+/*********************************************************************/
+/* Reading */
+
+static int decodeBlock(const uint8_t *raw, uint32_t len, uint64_t t,
+	void (*fn)(const char *line, int len, uint64_t unixMs, uint32_t count, void *context),
+	void *context, logstore_read_stats *stats) {
+	uint32_t recentPos[LOGSTORE_RECENT_LINES], recentLen[LOGSTORE_RECENT_LINES];
+	int nRecent = 0, nextRecent = 0, prev = -1;
+	uint32_t p = 0;
+	while (p < len) {
+		uint8_t kind = raw[p++];
+		uint64_t dt, v;
+		if ((kind == LOGREC_REPEAT) && (getVarint(raw, len, &p, &v) == 0) && (getVarint(raw, len, &p, &dt) == 0)) {
+			if ((prev < 0) || (v == 0) || (v > UINT32_MAX)) return -1;
+			t += dt;
+			fn((const char *)raw + recentPos[prev], recentLen[prev], t, (uint32_t)v, context);
+			stats->nLines += v;
+			stats->nTextBytes += v * (recentLen[prev] + 1);
+		} else if ((kind == LOGREC_RECENT) && (getVarint(raw, len, &p, &dt) == 0) && (p < len)) {
+			prev = raw[p++];
+			if (prev >= nRecent) return -1;
+			t += dt;
+			fn((const char *)raw + recentPos[prev], recentLen[prev], t, 1, context);
+			stats->nLines++;
+			stats->nTextBytes += recentLen[prev] + 1;
+		} else if ((kind == LOGREC_LINE) && (getVarint(raw, len, &p, &dt) == 0) && (getVarint(raw, len, &p, &v) == 0)) {
+			if (v > len - p) return -1;
+			prev = nextRecent;
+			recentPos[prev] = p;
+			recentLen[prev] = v;
+			nextRecent = (nextRecent + 1) % LOGSTORE_RECENT_LINES;
+			if (nRecent < LOGSTORE_RECENT_LINES) nRecent++;
+			p += v;
+			t += dt;
+			fn((const char *)raw + recentPos[prev], recentLen[prev], t, 1, context);
+			stats->nLines++;
+			stats->nTextBytes += v + 1;
+		} else {
+			return -1;
+		}
+		stats->nRecords++;
+	}
+	return 0;
+}
+
+int logStoreReadSegment(const char *fileName,
+	void (*fn)(const char *line, int len, uint64_t unixMs, uint32_t count, void *context),
+	void *context, logstore_read_stats *stats) {
+	static uint8_t raw[LOGSTORE_BLOCK_BYTES], comp[LOGSTORE_COMPRESS_BOUND(LOGSTORE_BLOCK_BYTES)];
+	char magic[LOGSTORE_MAGIC_LEN];
+	uint64_t created;
+	logstore_block_header h;
+	FILE *f = fopen(fileName, "rb");
+	if (!f) return -1;
+	if ((fread(magic, sizeof(magic), 1, f) != 1) || memcmp(magic, LOGSTORE_MAGIC, LOGSTORE_MAGIC_LEN) ||
+	    (fread(&created, sizeof(created), 1, f) != 1)) {
+		fclose(f);
+		return -1;
+	}
+	stats->nFileBytes += sizeof(magic) + sizeof(created);
+	while (fread(&h, sizeof(h), 1, f) == 1) {
+		if ((h.rawLen > LOGSTORE_BLOCK_BYTES) || (h.compLen > h.rawLen) || (fread(comp, h.compLen, 1, f) != 1)) {
+			/* the end of a segment which was written during a power cut */
+			stats->nDamagedBlocks++;
+			break;
+		}
+		stats->nFileBytes += sizeof(h) + h.compLen;
+		stats->nBlocks++;
+		if (h.compLen == h.rawLen) {
+			memcpy(raw, comp, h.rawLen);
+		} else if (logStoreDecompress(comp, h.compLen, raw, sizeof(raw)) != (int)h.rawLen) {
+			stats->nDamagedBlocks++;
+			continue;
+		}
+		if ((fnv1a(raw, h.rawLen) != h.checksum) || (decodeBlock(raw, h.rawLen, h.firstMs, fn, context, stats) < 0)) {
+			stats->nDamagedBlocks++;
+		}
+	}
+	fclose(f);
+	return 0;
+}
@@ -0,0 +1,102 @@
+/* Compressed, deduplicated log storage with rotation
+ *
+ * Instead of appending each line to log.txt, the lines are collected in blocks of
+ * LOGSTORE_BLOCK_BYTES. Within a block, the lines are records with the time
+ * difference to the previous record in milliseconds:
+ *   - a new line as text,
+ *   - a line which is one of the last LOGSTORE_RECENT_LINES different lines of the
+ *     block as its index (the MMTYPE lines during SLAC),
+ *   - a line which is the same as the one before, any number of times, as one
+ *     counted record with the time of the last repetition.
+ * A full block, or one which is older than LOGSTORE_FLUSH_MS, is handed to a
+ * background thread, which compresses it (LZ77, hash chains, 64 kB window) and
+ * appends it to the current segment file, followed by fdatasync(). So the SD card
+ * gets one write and one sync every few seconds instead of one per frame, and at
+ * most LOGSTORE_FLUSH_MS are lost on a power cut (plus the block which is being
+ * compressed at that moment). Each block starts with an empty dictionary, so it can be read alone,
+ * and a damaged block costs only its own lines.
+ *
+ * The segments are <dir>/log-NNNNNN.plz. When a segment reaches its size, the next
+ * one is started, and the oldest ones are removed while the total is above the cap
+ * or they are older than the retention time. plc_logread expands them to text.
+ *
+ * Segment: LOGSTORE_MAGIC, creation time (uint64 unix ms), then the blocks, each
+ * with a logstore_block_header and compLen bytes (compLen == rawLen: stored).
+ */
+
+#ifndef LOGSTORE_HEADER
+#define LOGSTORE_HEADER
+
+#include <stdint.h>
+
+#define LOGSTORE_BLOCK_BYTES 65536 /* also the window of the compression */
+#define LOGSTORE_BLOCKS 4          /* one filled by the caller, the others on the way to the disk */
+#define LOGSTORE_FLUSH_MS 10000
+#define LOGSTORE_RECENT_LINES 64
+#define LOGSTORE_MAX_LINE 1024
+#define LOGSTORE_DEFAULT_SEGMENT_KB 1024
+#define LOGSTORE_DEFAULT_TOTAL_MB 64
+#define LOGSTORE_DEFAULT_DAYS 30
+#define LOGSTORE_MAGIC "PLCLOG01"
+#define LOGSTORE_MAGIC_LEN 8
+#define LOGSTORE_PREFIX "log-"
+#define LOGSTORE_SUFFIX ".plz"
+#define LOGSTORE_PATH_LEN 256
+
+/* the records in the raw block */
+#define LOGREC_LINE 0   /* varint dt, varint len, text */
+#define LOGREC_RECENT 1 /* varint dt, index into the recent lines */
+#define LOGREC_REPEAT 2 /* varint count, varint dt of the last repetition: the line before, count more times */
+
+typedef struct logstore_block_header {
+	uint32_t rawLen;
+	uint32_t compLen;
+	uint64_t firstMs;  /* unix time of the first record, the base of the differences */
+	uint32_t nLines;   /* expanded */
+	uint32_t checksum; /* FNV-1a of the raw block */
+} logstore_block_header;
+
+typedef struct logstore_config {
+	char dir[LOGSTORE_PATH_LEN];
+	uint32_t segmentKB;
+	uint32_t totalMB;
+	uint32_t days;
+} logstore_config;
+
+extern int logStoreActive;
+extern uint64_t nLogStoreLines, nLogStoreDeduplicated;
+extern uint64_t nLogStoreTextBytes;    /* what log.txt would have got */
+extern uint64_t nLogStoreWrittenBytes; /* what the segments got */
+extern uint32_t nLogStoreBlocks, nLogStoreSegments, nLogStoreDeleted, nLogStoreWaits, nLogStoreWriteErrors;
+
+/* "dir[:segmentKB[:totalMB[:days]]]". Returns -1 if it is not valid. */
+int logStoreParse(const char *spec, logstore_config *cfg);
+/* Creates the directory if needed, removes what is beyond the retention, starts the thread */
+int logStoreOpen(const logstore_config *cfg);
+/* One line without the newline. From one thread at a time. Waits only if all
+   blocks are on the way to the disk. */
+void logStoreWrite(const char *line);
+/* Writes the remaining lines, stops the thread */
+void logStoreClose(void);
+
+/* For the reader. Returns the length, or -1 if the data is damaged. */
+int logStoreCompress(const uint8_t *in, int len, uint8_t *out, int outSize);
+int logStoreDecompress(const uint8_t *in, int len, uint8_t *out, int outSize);
+#define LOGSTORE_COMPRESS_BOUND(n) ((n) + (n)/255 + 16)
+
+typedef struct logstore_read_stats {
+	uint32_t nBlocks, nDamagedBlocks;
+	uint64_t nLines, nRecords, nTextBytes, nFileBytes;
+} logstore_read_stats;
+
+/* Calls fn for each record of the segment: the line, its unix time in ms, and how
+   often it occurred there (more than 1 for the repetitions, then the time is the
+   last one). Returns 0, or -1 if the file is not a segment. */
+int logStoreReadSegment(const char *fileName,
+	void (*fn)(const char *line, int len, uint64_t unixMs, uint32_t count, void *context),
+	void *context, logstore_read_stats *stats);
+/* The segments of the directory, the oldest first. Returns their number, or -1. */
+int logStoreListSegments(const char *dir, char ***names);
+void logStoreFreeList(char **names, int n);
+
+#endif
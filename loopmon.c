@@ -0,0 +1,136 @@
+/* Jitter and stall monitor for the main loop, see loopmon.h */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "loopmon.h"
+
+typedef struct loopmon_histogram {
+	uint32_t count;
+	uint64_t maxNs;
+	uint32_t bucket[LOOPMON_BUCKETS];
+} loopmon_histogram;
+
+int loopMonActive;
+uint32_t loopMonFrameType;
+uint32_t nLoopMonStalls, nLoopMonStallsLost;
+uint32_t nLoopMonStallsSuppressed;
+
+static loopmon_histogram histogram[LOOPMON_NUMBER_OF_SECTIONS];
+static uint64_t nsPerTickQ32; /* nanoseconds per tick, 32 fractional bits */
+static uint64_t stallThresholdNs;
+static loopmon_stall pendingStalls[LOOPMON_MAX_PENDING_STALLS];
+static int nPendingStalls;
+static int stallsSuspended;
+
+static const char *sectionNames[LOOPMON_NUMBER_OF_SECTIONS] = { "iteration", "handler", "log" };
+
+static uint64_t monotonicNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t ticksToNs(uint64_t ticks) {
+	return (ticks >> 32) * nsPerTickQ32 + (((ticks & 0xffffffffull) * nsPerTickQ32) >> 32);
+}
+
+/* log-linear: values below 16 exact, above 16 buckets per power of two */
+static int bucketIndex(uint64_t ns) {
+	int e;
+	if (ns < (1u << LOOPMON_SUB_BITS)) return (int)ns;
+	e = 63 - __builtin_clzll(ns);
+	return ((e - LOOPMON_SUB_BITS + 1) << LOOPMON_SUB_BITS) | (int)((ns >> (e - LOOPMON_SUB_BITS)) & ((1u << LOOPMON_SUB_BITS) - 1));
+}
+
+static uint64_t bucketValue(int index) {
+	int e;
+	if (index < (1 << LOOPMON_SUB_BITS)) return index;
+	e = (index >> LOOPMON_SUB_BITS) + LOOPMON_SUB_BITS - 1;
+	return (uint64_t)((1 << LOOPMON_SUB_BITS) | (index & ((1 << LOOPMON_SUB_BITS) - 1))) << (e - LOOPMON_SUB_BITS);
+}
+
+int loopMonInit(uint32_t stallThresholdUs) {
+	uint64_t t0, n0, t1, n1;
+	struct timespec wait = { 0, 10000000 }; /* 10 ms */
+	n0 = monotonicNs();
+	t0 = loopMonTicks();
+	nanosleep(&wait, NULL);
+	n1 = monotonicNs();
+	t1 = loopMonTicks();
+	if (t1 <= t0) return -1;
+	nsPerTickQ32 = ((n1 - n0) << 32) / (t1 - t0);
+	stallThresholdNs = (uint64_t)stallThresholdUs * 1000;
+	memset(histogram, 0, sizeof(histogram));
+	nPendingStalls = 0;
+	loopMonActive = 1;
+	return 0;
+}
+
+void loopMonRecord(int section, uint64_t ticks) {
+	uint64_t ns = ticksToNs(ticks);
+	loopmon_histogram *h = &histogram[section];
+	h->count++;
+	h->bucket[bucketIndex(ns)]++;
+	if (ns > h->maxNs) h->maxNs = ns;
+	if ((ns > stallThresholdNs) && stallsSuspended) {
+		nLoopMonStallsSuppressed++;
+	} else if (ns > stallThresholdNs) {
+		nLoopMonStalls++;
+		if (nPendingStalls < LOOPMON_MAX_PENDING_STALLS) {
+			loopmon_stall *s = &pendingStalls[nPendingStalls++];
+			s->section = section;
+			s->durationUs = ns / 1000;
+			s->frameType = loopMonFrameType;
+		} else {
+			nLoopMonStallsLost++;
+		}
+	}
+}
+
+void loopMonSuspendStalls(int suspend) {
+	stallsSuspended = suspend;
+}
+
+int loopMonTakeStall(loopmon_stall *stall) {
+	if (nPendingStalls == 0) return 0;
+	*stall = pendingStalls[0];
+	nPendingStalls--;
+	memmove(&pendingStalls[0], &pendingStalls[1], nPendingStalls * sizeof(loopmon_stall));
+	return 1;
+}
+
+const char *loopMonSectionName(int section) {
+	return sectionNames[section];
+}
+
+/* value below which the fraction permille/1000 of the samples are */
+static uint64_t percentileNs(const loopmon_histogram *h, uint32_t permille) {
+	uint64_t needed = ((uint64_t)h->count * permille + 999) / 1000;
+	uint64_t sum = 0;
+	int i;
+	for (i=0; i<LOOPMON_BUCKETS; i++) {
+		sum += h->bucket[i];
+		if (sum >= needed) return (i + 1 < LOOPMON_BUCKETS) ? bucketValue(i + 1) : h->maxNs;
+	}
+	return h->maxNs;
+}
+
+void loopMonPrintStatus(void (*printFunction)(char *s)) {
+	char s[200];
+	int i;
+	for (i=0; i<LOOPMON_NUMBER_OF_SECTIONS; i++) {
+		loopmon_histogram *h = &histogram[i];
+		if (h->count == 0) continue;
+		sprintf(s, "loop %-9s n %7u  p50 %6luus  p99 %6luus  p99.9 %6luus  max %6luus",
+			sectionNames[i], h->count,
+			(unsigned long)(percentileNs(h, 500) / 1000), (unsigned long)(percentileNs(h, 990) / 1000),
+			(unsigned long)(percentileNs(h, 999) / 1000), (unsigned long)(h->maxNs / 1000));
+		printFunction(s);
+	}
+	sprintf(s, "loop stalls %u, not reported %u, during the report %u", nLoopMonStalls, nLoopMonStallsLost, nLoopMonStallsSuppressed);
+	printFunction(s);
+	memset(histogram, 0, sizeof(histogram));
+}
@@ -0,0 +1,82 @@
+/* Jitter and stall monitor for the main loop
+ *
+ * With -m, each main loop iteration (without the wait for frames in poll() or
+ * io_uring), each handling of a received frame and each log output is timed
+ * with a cheap clock: the TSC on x86, the virtual counter on ARMv8, otherwise
+ * CLOCK_MONOTONIC via the vDSO. The durations go into
+ * HDR-style histograms (log-linear buckets, 1/16 resolution per power of two),
+ * which are reported and reset with the status line.
+ * A duration above the stall threshold is remembered together with the frame
+ * type (ethertype and MMTYPE) that was being processed, and logged after the
+ * iteration. So we find the SD card and terminal stalls which cost SLAC frames.
+ * Without -m the cost is one well-predicted branch per point.
+ */
+
+#ifndef LOOPMON_HEADER
+#define LOOPMON_HEADER
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define LOOPMON_SUB_BITS 4 /* 16 buckets per power of two */
+#define LOOPMON_BUCKETS (64 << LOOPMON_SUB_BITS)
+#define LOOPMON_MAX_PENDING_STALLS 16
+
+/* the measured sections */
+enum {
+	LOOPMON_ITERATION, /* one pass of the main loop, after the wait for frames */
+	LOOPMON_HANDLER,   /* data_process() of one frame */
+	LOOPMON_LOG,       /* printToLogAndScreen(), screen and log file */
+	LOOPMON_NUMBER_OF_SECTIONS
+};
+
+typedef struct loopmon_stall {
+	uint8_t section;
+	uint32_t durationUs;
+	uint32_t frameType; /* ethertype << 16 | mmtype, 0 if no frame */
+} loopmon_stall;
+
+extern int loopMonActive;
+extern uint32_t loopMonFrameType; /* set by the receive path, for the stall report */
+extern uint32_t nLoopMonStalls, nLoopMonStallsLost;
+extern uint32_t nLoopMonStallsSuppressed; /* while the stalls were reported, see loopMonSuspendStalls() */
+
+static inline uint64_t loopMonTicks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#elif defined(__aarch64__)
+	uint64_t t;
+	__asm__ volatile("mrs %0, cntvct_el0" : "=r"(t));
+	return t;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+#endif
+}
+
+#define LOOPMON_BEGIN(var) uint64_t var = loopMonActive ? loopMonTicks() : 0
+#define LOOPMON_RESTART(var) do { \
+		if (loopMonActive) (var) = loopMonTicks(); \
+	} while (0)
+#define LOOPMON_END(var, section) do { \
+		if (loopMonActive) loopMonRecord(section, loopMonTicks() - (var)); \
+	} while (0)
+
+/* Calibrates the clock. Durations above stallThresholdUs are reported as stall. */
+int loopMonInit(uint32_t stallThresholdUs);
+void loopMonRecord(int section, uint64_t ticks);
+/* Returns 1 and fills the stall, if one is pending. */
+int loopMonTakeStall(loopmon_stall *stall);
+/* While the stalls are reported, the report itself is logged and timed. On a slow
+   SD card each report would queue a new stall, so the stalls are not queued while
+   suspended; the durations still go into the histograms. */
+void loopMonSuspendStalls(int suspend);
+const char *loopMonSectionName(int section);
+/* Prints the percentiles of the interval and starts a new interval. */
+void loopMonPrintStatus(void (*printFunction)(char *s));
+
+#endif
@@ -0,0 +1,189 @@
+/* MAC allow/deny filter, see macfilter.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <netinet/if_ether.h>
+#include <arpa/inet.h>
+
+#include "plc_homeplug.h"
+#include "stations.h" /* macToKey */
+#include "macfilter.h"
+
+#define MAC_INVALID 0xffffffffffffffffull /* padding, never a 48-bit MAC */
+#define MAX_BLOCKS (MACFILTER_MAX_ENTRIES / MACFILTER_BLOCK)
+
+typedef uint64_t key_vector __attribute__((vector_size(4*sizeof(uint64_t))));
+
+typedef struct mac_list {
+	uint64_t keys[MACFILTER_MAX_ENTRIES] __attribute__((aligned(64)));
+	uint64_t index[MAX_BLOCKS]; /* first key of each block */
+	uint32_t n;
+	uint32_t nBlocks;
+} mac_list;
+
+int macFilterActive;
+uint32_t nMacFilterPassed, nMacFilterDropped;
+
+static mac_list lists[MACFILTER_NUMBER_OF_LISTS];
+
+static int compareKeys(const void *a, const void *b) {
+	uint64_t ka = *(const uint64_t *)a, kb = *(const uint64_t *)b;
+	return (ka > kb) - (ka < kb);
+}
+
+int macFilterLoad(int list, const char *fileName) {
+	mac_list *l = &lists[list];
+	char line[200];
+	unsigned int m[ETH_ALEN];
+	uint8_t mac[ETH_ALEN];
+	uint32_t i, n = 0;
+	FILE *f = fopen(fileName, "r");
+	if (!f) return -1;
+	while (fgets(line, sizeof(line), f)) {
+		char *p = line + strspn(line, " \t");
+		if ((*p == '#') || (*p == '\n') || (*p == 0)) continue;
+		if (sscanf(p, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) != ETH_ALEN) {
+			fclose(f);
+			return -1;
+		}
+		if (n >= MACFILTER_MAX_ENTRIES) {
+			fclose(f);
+			return -1;
+		}
+		for (i=0; i<ETH_ALEN; i++) mac[i] = m[i];
+		l->keys[n++] = macToKey(mac);
+	}
+	fclose(f);
+	qsort(l->keys, n, sizeof(uint64_t), compareKeys);
+	/* remove the duplicates */
+	for (i=1, l->n=(n>0); i<n; i++) {
+		if (l->keys[i] != l->keys[l->n-1]) l->keys[l->n++] = l->keys[i];
+	}
+	l->nBlocks = (l->n + MACFILTER_BLOCK - 1) / MACFILTER_BLOCK;
+	for (i=l->n; i<l->nBlocks*MACFILTER_BLOCK; i++) l->keys[i] = MAC_INVALID;
+	for (i=0; i<l->nBlocks; i++) l->index[i] = l->keys[i*MACFILTER_BLOCK];
+	macFilterActive = (lists[MACFILTER_ALLOW].n > 0) || (lists[MACFILTER_DENY].n > 0);
+	return l->n;
+}
+
+int macFilterCount(int list) {
+	return lists[list].n;
+}
+
+static int listContainsKey(const mac_list *l, uint64_t key) {
+	const uint64_t *base = l->index;
+	uint32_t len = l->nBlocks;
+	const key_vector *block;
+	key_vector k = { key, key, key, key };
+	key_vector eq;
+	if (len == 0) return 0;
+	/* the last block whose first key is not larger than the key */
+	while (len > 1) {
+		uint32_t half = len / 2;
+		base = (base[half] <= key) ? base + half : base;
+		len -= half;
+	}
+	block = (const key_vector *)&l->keys[(base - l->index) * MACFILTER_BLOCK];
+	eq = (block[0] == k) | (block[1] == k);
+	return (eq[0] | eq[1] | eq[2] | eq[3]) != 0;
+}
+
+int macFilterContains(int list, const uint8_t *mac) {
+	return listContainsKey(&lists[list], macToKey(mac));
+}
+
+int macFilterFrame(const unsigned char *frame, int len) {
+	const struct ethhdr *eh = (const struct ethhdr *)frame;
+	const struct homeplug_hdr *hph = (const struct homeplug_hdr *)(frame + sizeof(struct ethhdr));
+	uint64_t keys[4];
+	int i, n = 0, allowed;
+	if (len < (int)sizeof(struct ethhdr)) return 1;
+	keys[n++] = macToKey(eh->h_dest);
+	keys[n++] = macToKey(eh->h_source);
+	if ((eh->h_proto == htons(ETH_P_HPAV)) && (len >= (int)(sizeof(struct ethhdr) + sizeof(struct homeplug_hdr)))) {
+		uint16_t mmtype = LE16TOH(hph->MMTYPE);
+		if (((mmtype & 0xfffc) == CM_ATTEN_CHAR) && (len >= (int)sizeof(cm_atten_char_response))) {
+			/* IND and RSP have the SOURCE_ADDRESS at the same place */
+			keys[n++] = macToKey(((const cm_atten_char_indicate *)frame)->ACVarField.SOURCE_ADDRESS);
+		} else if (((mmtype & 0xfffc) == CM_SLAC_MATCH) && (len >= (int)sizeof(cm_slac_match_request))) {
+			keys[n++] = macToKey(((const cm_slac_match_request *)frame)->MatchVarField.PEV_MAC);
+			keys[n++] = macToKey(((const cm_slac_match_request *)frame)->MatchVarField.EVSE_MAC);
+		}
+	}
+	allowed = (lists[MACFILTER_ALLOW].n == 0);
+	for (i=0; i<n; i++) {
+		if (listContainsKey(&lists[MACFILTER_DENY], keys[i])) {
+			nMacFilterDropped++;
+			return 0;
+		}
+		if (!allowed) allowed = listContainsKey(&lists[MACFILTER_ALLOW], keys[i]);
+	}
+	if (allowed) nMacFilterPassed++; else nMacFilterDropped++;
+	return allowed;
+}
+
+/*********************************************************************/
+/* Kernel prefilter, classic BPF. The loads of the packet data are big endian. */
+
+#define BPF_ACCEPT 0x40000
+#define SWAP16(x) ((uint16_t)((((x) & 0xff) << 8) | ((x) >> 8)))
+
+static struct sock_filter program[16 + 10*MACFILTER_BPF_MAX_ENTRIES];
+static int nInstructions;
+
+static void emit(uint16_t code, uint8_t jt, uint8_t jf, uint32_t k) {
+	struct sock_filter *ins = &program[nInstructions++];
+	ins->code = code;
+	ins->jt = jt;
+	ins->jf = jf;
+	ins->k = k;
+}
+
+/* For the MAC at offset 0 (destination) and 6 (source): on a match, return the result. */
+static void emitMacCompare(uint64_t key, uint32_t result) {
+	int offset;
+	for (offset=0; offset<=ETH_ALEN; offset+=ETH_ALEN) {
+		emit(BPF_LD | BPF_W | BPF_ABS, 0, 0, offset);
+		emit(BPF_JMP | BPF_JEQ | BPF_K, 0, 3, (uint32_t)(key >> 16));
+		emit(BPF_LD | BPF_H | BPF_ABS, 0, 0, offset + 4);
+		emit(BPF_JMP | BPF_JEQ | BPF_K, 0, 1, (uint32_t)(key & 0xffff));
+		emit(BPF_RET | BPF_K, 0, 0, result);
+	}
+}
+
+int macFilterAttachKernel(int fd) {
+	struct sock_fprog prog;
+	uint32_t i;
+	if (lists[MACFILTER_ALLOW].n + lists[MACFILTER_DENY].n > MACFILTER_BPF_MAX_ENTRIES) return -1;
+	nInstructions = 0;
+	/* HomePlug CM_ATTEN_CHAR and CM_SLAC_MATCH have MACs inside, they go to user space */
+	emit(BPF_LD | BPF_H | BPF_ABS, 0, 0, 12);
+	emit(BPF_JMP | BPF_JEQ | BPF_K, 0, 5, ETH_P_HPAV);
+	emit(BPF_LD | BPF_H | BPF_ABS, 0, 0, sizeof(struct ethhdr) + 1); /* MMTYPE, little endian */
+	emit(BPF_ALU | BPF_AND | BPF_K, 0, 0, SWAP16(0xfffc));
+	emit(BPF_JMP | BPF_JEQ | BPF_K, 1, 0, SWAP16(CM_ATTEN_CHAR));
+	emit(BPF_JMP | BPF_JEQ | BPF_K, 0, 1, SWAP16(CM_SLAC_MATCH));
+	emit(BPF_RET | BPF_K, 0, 0, BPF_ACCEPT);
+	for (i=0; i<lists[MACFILTER_DENY].n; i++) emitMacCompare(lists[MACFILTER_DENY].keys[i], 0);
+	if (lists[MACFILTER_ALLOW].n == 0) {
+		emit(BPF_RET | BPF_K, 0, 0, BPF_ACCEPT);
+	} else {
+		for (i=0; i<lists[MACFILTER_ALLOW].n; i++) emitMacCompare(lists[MACFILTER_ALLOW].keys[i], BPF_ACCEPT);
+		emit(BPF_RET | BPF_K, 0, 0, 0);
+	}
+	prog.len = nInstructions;
+	prog.filter = program;
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) return -1;
+	return nInstructions;
+}
+
+int macFilterDetachKernel(int fd) {
+	int unused = 0;
+	if (setsockopt(fd, SOL_SOCKET, SO_DETACH_FILTER, &unused, sizeof(unused)) == 0) return 1;
+	return (errno == ENOENT) ? 0 : -1;
+}
@@ -0,0 +1,53 @@
+/* MAC allow/deny filter
+ *
+ * At a depot with many chargers on one segment, we only want the frames of some
+ * PEVs and EVSEs. Each received frame is checked before any decoding: the
+ * destination and source MAC, and for CM_ATTEN_CHAR and CM_SLAC_MATCH also the
+ * PEV/EVSE MACs inside the message. A frame is dropped if one of its MACs is in the
+ * deny list, or if there is an allow list and none of its MACs is in it.
+ *
+ * Each list is a sorted array of 48-bit keys, padded to blocks of 8 keys (one
+ * cache line). A small index with the first key of each block is searched
+ * binary without branches, then the block is compared with vector compares
+ * (GCC vector extensions, SSE or NEON). Thousands of entries need two or three
+ * cache lines per lookup.
+ *
+ * If the lists are small enough, the same check on source and destination MAC is
+ * also attached as classic BPF to the receive socket, so that the kernel drops
+ * the frames before they are copied to us. The SLAC messages with MACs inside are
+ * always passed to user space, and checked here.
+ */
+
+#ifndef MACFILTER_HEADER
+#define MACFILTER_HEADER
+
+#include <stdint.h>
+
+#define MACFILTER_BLOCK 8 /* keys per block, 64 bytes */
+#define MACFILTER_MAX_ENTRIES 16384 /* per list */
+#define MACFILTER_BPF_MAX_ENTRIES 300 /* allow + deny, 10 BPF instructions each */
+
+enum {
+	MACFILTER_ALLOW,
+	MACFILTER_DENY,
+	MACFILTER_NUMBER_OF_LISTS
+};
+
+extern int macFilterActive;
+extern uint32_t nMacFilterPassed, nMacFilterDropped;
+
+/* Reads a list file: one MAC aa:bb:cc:dd:ee:ff per line, '#' starts a comment.
+   Returns the number of entries in the list, or -1. */
+int macFilterLoad(int list, const char *fileName);
+int macFilterCount(int list);
+int macFilterContains(int list, const uint8_t *mac);
+/* 1 if the frame shall be processed, 0 if it shall be dropped */
+int macFilterFrame(const unsigned char *frame, int len);
+/* Attaches the kernel prefilter to the socket. Returns the number of BPF
+   instructions, or -1 if the lists are too large or the kernel refused. */
+int macFilterAttachKernel(int fd);
+/* Removes the prefilter from the socket, e.g. the one of the previous instance after a
+   handover. Returns 1 if there was one, 0 if not, -1 on errors. */
+int macFilterDetachKernel(int fd);
+
+#endif
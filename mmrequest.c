@@ -0,0 +1,227 @@
+/* Asynchronous request/response for the HomePlug management messages, see mmrequest.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/if_ether.h>
+
+#include "plc_homeplug.h"
+#include "mmrequest.h"
+
+#define SLOT_MASK (MMREQ_MAX_PENDING - 1)
+#define GENERATION_MASK ((1u << (31 - MMREQ_SLOT_BITS)) - 1) /* the id stays positive */
+#define NO_SLOT (-1)
+
+typedef struct mm_request {
+	uint8_t inUse;
+	uint8_t anyPeer;          /* sent to broadcast or multicast */
+	uint8_t peer[ETH_ALEN];   /* destination of the request */
+	uint16_t cnfMmtype;       /* the expected confirmation */
+	uint32_t generation;
+	uint32_t heapPos;
+	int32_t older, newer;     /* list of the outstanding requests, in the order of submission */
+	uint64_t sentMs, deadlineMs;
+	mm_request_callback callback;
+	void *context;
+} mm_request;
+
+uint32_t nMmRequestsPending, nMmRequestsSent, nMmRequestsConfirmed;
+uint32_t nMmRequestsTimedOut, nMmRequestsTableFull, nMmRequestsSendFailed;
+
+static mm_request requests[MMREQ_MAX_PENDING];
+static int32_t freeList[MMREQ_MAX_PENDING];
+static uint32_t nFree;
+static int32_t heap[MMREQ_MAX_PENDING]; /* slots, the earliest deadline first */
+static int32_t oldest = NO_SLOT, newest = NO_SLOT;
+static uint32_t nextGeneration = 1;
+static mm_request_send_function sendFunction;
+static int cancelling; /* no new requests from the callbacks of mmRequestCancelAll() */
+
+void mmRequestInit(mm_request_send_function send) {
+	int32_t i;
+	memset(requests, 0, sizeof(requests));
+	for (i=0; i<MMREQ_MAX_PENDING; i++) freeList[i] = MMREQ_MAX_PENDING - 1 - i;
+	nFree = MMREQ_MAX_PENDING;
+	nMmRequestsPending = 0;
+	oldest = newest = NO_SLOT;
+	sendFunction = send;
+}
+
+/*********************************************************************/
+/* heap of the deadlines */
+
+static void heapPlace(uint32_t pos, int32_t slot) {
+	heap[pos] = slot;
+	requests[slot].heapPos = pos;
+}
+
+static void heapUp(uint32_t pos) {
+	int32_t slot = heap[pos];
+	while (pos > 0) {
+		uint32_t parent = (pos - 1) / 2;
+		if (requests[heap[parent]].deadlineMs <= requests[slot].deadlineMs) break;
+		heapPlace(pos, heap[parent]);
+		pos = parent;
+	}
+	heapPlace(pos, slot);
+}
+
+static void heapDown(uint32_t pos) {
+	int32_t slot = heap[pos];
+	uint32_t n = nMmRequestsPending;
+	for (;;) {
+		uint32_t child = 2*pos + 1;
+		if (child >= n) break;
+		if ((child + 1 < n) && (requests[heap[child+1]].deadlineMs < requests[heap[child]].deadlineMs)) child++;
+		if (requests[slot].deadlineMs <= requests[heap[child]].deadlineMs) break;
+		heapPlace(pos, heap[child]);
+		pos = child;
+	}
+	heapPlace(pos, slot);
+}
+
+/*********************************************************************/
+
+static void removeRequest(int32_t slot) {
+	mm_request *r = &requests[slot];
+	uint32_t pos = r->heapPos;
+	/* out of the heap: the last element takes its place */
+	nMmRequestsPending--;
+	if (pos < nMmRequestsPending) {
+		heapPlace(pos, heap[nMmRequestsPending]);
+		heapDown(pos);
+		heapUp(requests[heap[pos]].heapPos);
+	}
+	/* out of the list */
+	if (r->older != NO_SLOT) requests[r->older].newer = r->newer; else oldest = r->newer;
+	if (r->newer != NO_SLOT) requests[r->newer].older = r->older; else newest = r->older;
+	r->inUse = 0;
+	freeList[nFree++] = slot;
+}
+
+/* Removes the request, and then calls its callback, which may submit the next one. */
+static void completeRequest(int32_t slot, int status, const unsigned char *frame, int len, uint64_t nowMs) {
+	mm_request_callback callback = requests[slot].callback;
+	void *context = requests[slot].context;
+	uint32_t elapsedMs = (uint32_t)(nowMs - requests[slot].sentMs);
+	removeRequest(slot);
+	if (callback) callback(context, status, frame, len, elapsedMs);
+}
+
+/* The offset of the nonce in the request, or -1 if the message has none */
+static int requestNonceOffset(int len, uint16_t mmtype) {
+	if ((mmtype == (CM_SET_KEY | MMTYPE_REQ)) && (len >= (int)sizeof(cm_set_key_request))) {
+		return offsetof(cm_set_key_request, MYNOUNCE);
+	}
+	if ((mmtype == (CM_GET_KEY | MMTYPE_REQ)) && (len >= (int)sizeof(cm_get_key_request))) {
+		return offsetof(cm_get_key_request, MYNOUNCE);
+	}
+	return -1;
+}
+
+/* The nonce of the request, as the confirmation returns it, or 0 */
+static uint32_t confirmationNonce(const unsigned char *frame, int len, uint16_t mmtype) {
+	if ((mmtype == (CM_SET_KEY | MMTYPE_CNF)) && (len >= (int)(offsetof(cm_set_key_confirm, YOURNOUNCE) + 4))) {
+		return ((const cm_set_key_confirm *)frame)->YOURNOUNCE;
+	}
+	if ((mmtype == (CM_GET_KEY | MMTYPE_CNF)) && (len >= (int)(offsetof(cm_get_key_confirm, YOURNOUNCE) + 4))) {
+		return ((const cm_get_key_confirm *)frame)->YOURNOUNCE;
+	}
+	return 0;
+}
+
+int32_t mmRequestSubmit(unsigned char *frame, int len, uint64_t nowMs, uint32_t timeoutMs,
+		mm_request_callback callback, void *context) {
+	const struct ethhdr *eh = (const struct ethhdr *)frame;
+	const struct homeplug_hdr *hph = (const struct homeplug_hdr *)(frame + sizeof(struct ethhdr));
+	uint16_t mmtype;
+	int nonceOffset;
+	int32_t slot, id;
+	mm_request *r;
+	if (cancelling || (len < (int)(sizeof(struct ethhdr) + sizeof(struct homeplug_hdr)))) return -1;
+	if (nFree == 0) {
+		nMmRequestsTableFull++;
+		return -1;
+	}
+	mmtype = LE16TOH(hph->MMTYPE);
+	slot = freeList[nFree-1];
+	r = &requests[slot];
+	r->generation = nextGeneration;
+	nextGeneration = (nextGeneration + 1) & GENERATION_MASK;
+	if (nextGeneration == 0) nextGeneration = 1; /* a nonce of 0 means "none" */
+	id = (int32_t)((r->generation << MMREQ_SLOT_BITS) | slot);
+	nonceOffset = requestNonceOffset(len, mmtype);
+	if (nonceOffset >= 0) memcpy(frame + nonceOffset, &id, sizeof(id));
+	if (sendFunction(frame, len) < 0) {
+		nMmRequestsSendFailed++;
+		return -1;
+	}
+	nFree--;
+	nMmRequestsSent++;
+	r->inUse = 1;
+	r->anyPeer = (eh->h_dest[0] & 1) != 0;
+	memcpy(r->peer, eh->h_dest, ETH_ALEN);
+	r->cnfMmtype = (mmtype & MMTYPE_MASK) | MMTYPE_CNF;
+	r->sentMs = nowMs;
+	r->deadlineMs = nowMs + timeoutMs;
+	r->callback = callback;
+	r->context = context;
+	r->older = newest;
+	r->newer = NO_SLOT;
+	if (newest != NO_SLOT) requests[newest].newer = slot; else oldest = slot;
+	newest = slot;
+	heapPlace(nMmRequestsPending, slot);
+	nMmRequestsPending++;
+	heapUp(r->heapPos);
+	return id;
+}
+
+int mmRequestConfirm(const unsigned char *frame, int len, uint64_t nowMs) {
+	const struct ethhdr *eh = (const struct ethhdr *)frame;
+	const struct homeplug_hdr *hph = (const struct homeplug_hdr *)(frame + sizeof(struct ethhdr));
+	uint16_t mmtype;
+	uint32_t nonce;
+	int32_t slot;
+	if ((nMmRequestsPending == 0) || (len < (int)(sizeof(struct ethhdr) + sizeof(struct homeplug_hdr)))) return 0;
+	mmtype = LE16TOH(hph->MMTYPE);
+	if ((mmtype & MMTYPE_MODE) != MMTYPE_CNF) return 0;
+	nonce = confirmationNonce(frame, len, mmtype);
+	if (nonce) {
+		slot = nonce & SLOT_MASK;
+		if (requests[slot].inUse && (requests[slot].generation == (nonce >> MMREQ_SLOT_BITS)) &&
+		    (requests[slot].cnfMmtype == mmtype)) {
+			nMmRequestsConfirmed++;
+			completeRequest(slot, MMREQ_OK, frame, len, nowMs);
+			return 1;
+		}
+		return 0; /* not ours, or already timed out */
+	}
+	/* no nonce in the message, or the modem does not echo it */
+	for (slot=oldest; slot!=NO_SLOT; slot=requests[slot].newer) {
+		const mm_request *r = &requests[slot];
+		if ((r->cnfMmtype == mmtype) && (r->anyPeer || (memcmp(r->peer, eh->h_source, ETH_ALEN) == 0))) {
+			nMmRequestsConfirmed++;
+			completeRequest(slot, MMREQ_OK, frame, len, nowMs);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int mmRequestCheckTimeouts(uint64_t nowMs) {
+	int n = 0;
+	while ((nMmRequestsPending > 0) && (requests[heap[0]].deadlineMs <= nowMs)) {
+		nMmRequestsTimedOut++;
+		completeRequest(heap[0], MMREQ_TIMEOUT, NULL, 0, nowMs);
+		n++;
+	}
+	return n;
+}
+
+void mmRequestCancelAll(uint64_t nowMs) {
+	cancelling = 1;
+	while (nMmRequestsPending > 0) completeRequest(heap[0], MMREQ_CANCELLED, NULL, 0, nowMs);
+	cancelling = 0;
+}
@@ -0,0 +1,60 @@
+/* Asynchronous request/response for the HomePlug management messages
+ *
+ * A request is sent with mmRequestSubmit(), together with a callback and a
+ * timeout. The callback is called exactly once: with the confirmation, when it
+ * arrives, or with MMREQ_TIMEOUT. Everything runs on the main loop, nothing
+ * blocks, and up to MMREQ_MAX_PENDING requests may be outstanding. A sequence
+ * of requests (e.g. for a fleet script) is written as a chain of callbacks,
+ * each one submitting the next request with the context of the previous.
+ *
+ * Matching of the confirmation to the request:
+ *   - CM_SET_KEY and CM_GET_KEY have nonces. We put the request id into the
+ *     MYNOUNCE of the request, the modem returns it in the YOURNOUNCE of the
+ *     confirmation. The id has the slot in the low bits and a generation in the
+ *     high bits, so the lookup is direct and a late confirmation of a timed out
+ *     request does not hit its successor.
+ *     A confirmation with a nonce which is not outstanding is ignored.
+ *   - the other messages, and modems which return YOURNOUNCE=0, are matched to
+ *     the oldest outstanding request with the same MMTYPE, sent to the source
+ *     of the confirmation or to a broadcast/multicast address.
+ * The deadlines are kept in a binary heap, so mmRequestCheckTimeouts() only
+ * looks at the requests which are due.
+ */
+
+#ifndef MMREQUEST_HEADER
+#define MMREQUEST_HEADER
+
+#include <stdint.h>
+
+#define MMREQ_MAX_PENDING 4096 /* power of two */
+#define MMREQ_SLOT_BITS 12     /* log2(MMREQ_MAX_PENDING) */
+#define MMREQ_DEFAULT_TIMEOUT_MS 1000
+
+enum {
+	MMREQ_OK,        /* the confirmation is passed to the callback */
+	MMREQ_TIMEOUT,   /* no confirmation within the timeout */
+	MMREQ_CANCELLED  /* mmRequestCancelAll(), e.g. at the end of the program */
+};
+
+/* On MMREQ_OK, frame and len are the confirmation, valid during the call. Otherwise
+   frame is NULL. The callback may submit further requests. */
+typedef void (*mm_request_callback)(void *context, int status, const unsigned char *frame, int len, uint32_t elapsedMs);
+/* Sends the frame, returns <0 on error */
+typedef int (*mm_request_send_function)(const void *frame, int len);
+
+extern uint32_t nMmRequestsPending, nMmRequestsSent, nMmRequestsConfirmed;
+extern uint32_t nMmRequestsTimedOut, nMmRequestsTableFull, nMmRequestsSendFailed;
+
+void mmRequestInit(mm_request_send_function send);
+/* Sends the request (a complete Ethernet frame, the nonce is filled in here).
+   Returns the request id, or -1 if the table is full or the frame could not be
+   sent. In this case the callback is not called. */
+int32_t mmRequestSubmit(unsigned char *frame, int len, uint64_t nowMs, uint32_t timeoutMs,
+	mm_request_callback callback, void *context);
+/* For each received confirmation. Returns 1 if it answered a request. */
+int mmRequestConfirm(const unsigned char *frame, int len, uint64_t nowMs);
+/* Calls the callbacks of the expired requests. Returns their number. */
+int mmRequestCheckTimeouts(uint64_t nowMs);
+void mmRequestCancelAll(uint64_t nowMs);
+
+#endif
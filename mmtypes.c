@@ -0,0 +1,84 @@
+/* Names of the HomePlug management message types, see mmtypes.h */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <netinet/if_ether.h>
+#include "mmtypes.h"
+#include "plc_homeplug.h"
+
+const char *mmtypeMainName(uint16_t mmtype) {
+	switch (mmtype & 0xfffc) { /* upper 14 bits */
+		case CC_CCO_APPOINT: return "CC_CCO_APPOINT";
+		case CC_BACKUP_APPOINT: return "CC_BACKUP_APPOINT";
+		case CC_LINK_INFO: return "CC_LINK_INFO";
+		case CC_HANDOVER: return "CC_HANDOVER";
+		case CC_HANDOVER_INFO: return "CC_HANDOVER_INFO";
+		case CC_DISCOVER_LIST: return "CC_DISCOVER_LIST";
+		case CC_LINK_NEW: return "CC_LINK_NEW";
+		case CC_LINK_MOD: return "CC_LINK_MOD";
+		case CC_LINK_SQZ: return "CC_LINK_SQZ";
+		case CC_LINK_REL: return "CC_LINK_REL";
+		case CC_DETECT_REPORT: return "CC_DETECT_REPORT";
+		case CC_WHO_RU: return "CC_WHO_RU";
+		case CC_ASSOC: return "CC_ASSOC";
+		case CC_LEAVE: return "CC_LEAVE";
+		case CC_SET_TEI_MAP: return "CC_SET_TEI_MAP";
+		case CC_RELAY: return "CC_RELAY";
+		case CC_BEACON_RELIABILITY: return "CC_BEACON_RELIABILITY";
+		case CC_ALLOC_MOVE: return "CC_ALLOC_MOVE";
+		case CC_ACCESS_NEW: return "CC_ACCESS_NEW";
+		case CC_ACCESS_REL: return "CC_ACCESS_REL";
+		case CC_DCPPC: return "CC_DCPPC";
+		case CC_HP1_DET: return "CC_HP1_DET";
+		case CC_BLE_UPDATE: return "CC_BLE_UPDATE";
+		case CP_PROXY_APPOINT: return "CP_PROXY_APPOINT";
+		case PH_PROXY_APPOINT: return "PH_PROXY_APPOINT";
+		case CP_PROXY_WAKE: return "CP_PROXY_WAKE";
+		case NN_INL: return "NN_INL";
+		case NN_NEW_NET: return "NN_NEW_NET";
+		case NN_ADD_ALLOC: return "NN_ADD_ALLOC";
+		case NN_REL_ALLOC: return "NN_REL_ALLOC";
+		case NN_REL_NET: return "NN_REL_NET";
+		case CM_ASSOCIATED_STA: return "CM_ASSOCIATED_STA";
+		case CM_ENCRYPTED_PAYLOAD: return "CM_ENCRYPTED_PAYLOAD";
+		case CM_SET_KEY: return "CM_SET_KEY";
+		case CM_GET_KEY: return "CM_GET_KEY";
+		case CM_SC_JOIN: return "CM_SC_JOIN";
+		case CM_CHAN_EST: return "CM_CHAN_EST";
+		case CM_TM_UPDATE: return "CM_TM_UPDATE";
+		case CM_AMP_MAP: return "CM_AMP_MAP";
+		case CM_BRG_INFO: return "CM_BRG_INFO";
+		case CM_CONN_NEW: return "CM_CONN_NEW";
+		case CM_CONN_REL: return "CM_CONN_REL";
+		case CM_CONN_MOD: return "CM_CONN_MOD";
+		case CM_CONN_INFO: return "CM_CONN_INFO";
+		case CM_STA_CAP: return "CM_STA_CAP";
+		case CM_NW_INFO: return "CM_NW_INFO";
+		case CM_GET_BEACON: return "CM_GET_BEACON";
+		case CM_HFID: return "CM_HFID";
+		case CM_MME_ERROR: return "CM_MME_ERROR";
+		case CM_NW_STATS: return "CM_NW_STATS";
+		case CM_SLAC_PARAM: return "CM_SLAC_PARAM";
+		case CM_START_ATTEN_CHAR: return "CM_START_ATTEN_CHAR";
+		case CM_ATTEN_CHAR: return "CM_ATTEN_CHAR";
+		case CM_PKCS_CERT: return "CM_PKCS_CERT";
+		case CM_MNBC_SOUND: return "CM_MNBC_SOUND";
+		case CM_VALIDATE: return "CM_VALIDATE";
+		case CM_SLAC_MATCH: return "CM_SLAC_MATCH";
+		case CM_SLAC_USER_DATA: return "CM_SLAC_USER_DATA";
+		case CM_ATTEN_PROFILE: return "CM_ATTEN_PROFILE";
+		case CM_GET_DEVICE_SW_VERSION: return "CM_GET_DEVICE_SW_VERSION";
+	}
+	return NULL;
+}
+
+void mmtypeName(uint16_t mmtype, char *strName) {
+	static const char *subTypes[4] = { "REQ", "CNF", "IND", "RSP" }; /* lower two bits */
+	const char *mainName = mmtypeMainName(mmtype);
+	if (mainName) {
+		sprintf(strName, "%s.%s", mainName, subTypes[mmtype & 3]);
+	} else {
+		sprintf(strName, "MMTYPE %4x.%s", mmtype, subTypes[mmtype & 3]);
+	}
+}
@@ -0,0 +1,15 @@
+/* Names of the HomePlug management message types, for logging and reports */
+
+#ifndef MMTYPES_HEADER
+#define MMTYPES_HEADER
+
+#include <stdint.h>
+
+#define MMTYPE_NAME_LEN 70
+
+/* The name of the message, without the REQ/CNF/IND/RSP. NULL if unknown. */
+const char *mmtypeMainName(uint16_t mmtype);
+/* The full name, e.g. "CM_SLAC_MATCH.CNF". strName needs MMTYPE_NAME_LEN bytes. */
+void mmtypeName(uint16_t mmtype, char *strName);
+
+#endif
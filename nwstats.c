@@ -0,0 +1,507 @@
+/* Collector of the PHY rates and network info of the modems, see nwstats.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <arpa/inet.h>
+#include <netinet/if_ether.h>
+
+#include "plc_homeplug.h"
+#include "stations.h" /* macToKey */
+#include "mmrequest.h"
+#include "eventstream.h"
+#include "nwstats.h"
+
+#define NWSTATS_MAGIC "NWSTAT01"
+#define MAX_SAMPLE_BYTES 15 /* three varints */
+
+typedef struct nwstats_record {
+	uint8_t modem[ETH_ALEN];
+	uint8_t peer[ETH_ALEN];
+	uint32_t nSamples, nTotal;
+	nwstats_sample first, last;
+	uint16_t used;
+} __attribute__((packed)) nwstats_record;
+
+int nwStatsActive;
+uint32_t nNwStatsQueries, nNwStatsAnswers, nNwStatsTimeouts;
+uint32_t nNwStatsSamples, nNwStatsPairsReplaced, nNwStatsMalformed;
+uint32_t nNwStatsLoadDiscarded;
+
+static nwstats_modem modems[NWSTATS_MAX_MODEMS];
+static int nModems;
+static nwstats_pair pairs[NWSTATS_MAX_PAIRS];
+static int nPairs;
+static uint8_t ownMac[ETH_ALEN];
+static uint64_t intervalMs, nextDueMs, nextSaveMs;
+
+void nwStatsSetOwnMac(const uint8_t *mac) {
+	memcpy(ownMac, mac, ETH_ALEN);
+}
+
+static nwstats_modem *findModem(const uint8_t *mac, int create) {
+	int i;
+	for (i=0; i<nModems; i++) {
+		if (memcmp(modems[i].mac, mac, ETH_ALEN)==0) return &modems[i];
+	}
+	if (!create || (nModems>=NWSTATS_MAX_MODEMS)) return NULL;
+	memset(&modems[nModems], 0, sizeof(nwstats_modem));
+	memcpy(modems[nModems].mac, mac, ETH_ALEN);
+	return &modems[nModems++];
+}
+
+static int loadModems(const char *fileName) {
+	char line[200];
+	unsigned int m[ETH_ALEN];
+	uint8_t mac[ETH_ALEN];
+	int i;
+	FILE *f = fopen(fileName, "r");
+	if (!f) return -1;
+	while (fgets(line, sizeof(line), f)) {
+		char *p = line + strspn(line, " \t");
+		nwstats_modem *modem;
+		if ((*p == '#') || (*p == '\n') || (*p == 0)) continue;
+		if (sscanf(p, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) != ETH_ALEN) {
+			fclose(f);
+			return -1;
+		}
+		for (i=0; i<ETH_ALEN; i++) mac[i] = m[i];
+		modem = findModem(mac, 1);
+		if (!modem) {
+			fclose(f);
+			return -1;
+		}
+		modem->configured = 1;
+	}
+	fclose(f);
+	return nModems;
+}
+
+int nwStatsInit(const uint8_t *mac, uint32_t intervalS, const char *modemFile, uint64_t nowMs) {
+	int i;
+	memset(modems, 0, sizeof(modems));
+	memset(pairs, 0, sizeof(pairs));
+	nModems = nPairs = 0;
+	nwStatsSetOwnMac(mac);
+	if (modemFile) {
+		if (loadModems(modemFile)<0) return -1;
+	} else {
+		uint8_t localModem[ETH_ALEN] = { MY_DEST_MAC0, MY_DEST_MAC1, MY_DEST_MAC2, MY_DEST_MAC3, MY_DEST_MAC4, MY_DEST_MAC5 };
+		findModem(localModem, 1)->configured = 1;
+	}
+	intervalMs = (uint64_t)(intervalS ? intervalS : NWSTATS_DEFAULT_INTERVAL_S) * 1000;
+	/* spread over the interval, the first one soon after the start */
+	nextDueMs = UINT64_MAX;
+	for (i=0; i<nModems; i++) {
+		modems[i].nextPollMs = nowMs + 1000 + (intervalMs * i) / nModems;
+		if (modems[i].nextPollMs < nextDueMs) nextDueMs = modems[i].nextPollMs;
+	}
+	nextSaveMs = nowMs + (uint64_t)NWSTATS_SAVE_INTERVAL_S * 1000;
+	nwStatsLoad(NWSTATS_FILE);
+	nwStatsActive = 1;
+	return nModems;
+}
+
+/*********************************************************************/
+/* Polling */
+
+int nwStatsIsQuery(const void *frame, int len) {
+	const struct homeplug_hdr *hph = (const struct homeplug_hdr *)((const unsigned char *)frame + sizeof(struct ethhdr));
+	uint16_t mmtype;
+	if (len < (int)(sizeof(struct ethhdr) + sizeof(struct homeplug_hdr))) return 0;
+	mmtype = LE16TOH(hph->MMTYPE);
+	return (mmtype == (CM_NW_INFO | MMTYPE_REQ)) || (mmtype == (CM_NW_STATS | MMTYPE_REQ));
+}
+
+static void onQueryDone(void *context, int status, const unsigned char *frame, int len, uint32_t elapsedMs) {
+	nwstats_modem *modem = context;
+	/* the content is taken by nwStatsObserveFrame(), like all confirmations on the line */
+	if (status == MMREQ_OK) {
+		modem->nAnswers++;
+		nNwStatsAnswers++;
+	} else if (status == MMREQ_TIMEOUT) {
+		modem->nTimeouts++;
+		nNwStatsTimeouts++;
+	}
+}
+
+static void sendQuery(nwstats_modem *modem, uint16_t mmtype, uint64_t nowMs) {
+	unsigned char frame[ETH_ZLEN];
+	struct ethhdr *eh = (struct ethhdr *)frame;
+	struct homeplug_fmi *hp = (struct homeplug_fmi *)(frame + sizeof(struct ethhdr));
+	memset(frame, 0, sizeof(frame));
+	memcpy(eh->h_dest, modem->mac, ETH_ALEN);
+	memcpy(eh->h_source, ownMac, ETH_ALEN);
+	eh->h_proto = htons(ETH_P_HPAV);
+	hp->MMV = HOMEPLUG_MMV;
+	hp->MMTYPE = HTOLE16(mmtype | MMTYPE_REQ);
+	if (mmRequestSubmit(frame, sizeof(frame), nowMs, NWSTATS_TIMEOUT_MS, onQueryDone, modem) >= 0) {
+		modem->nQueries++;
+		nNwStatsQueries++;
+	}
+}
+
+void nwStatsService(uint64_t nowMs) {
+	int i;
+	if (nowMs < nextDueMs) return;
+	nextDueMs = nextSaveMs;
+	for (i=0; i<nModems; i++) {
+		nwstats_modem *modem = &modems[i];
+		if (!modem->configured) continue;
+		if (nowMs >= modem->nextPollMs) {
+			sendQuery(modem, CM_NW_INFO, nowMs);
+			sendQuery(modem, CM_NW_STATS, nowMs);
+			modem->nextPollMs += intervalMs;
+			if (modem->nextPollMs <= nowMs) modem->nextPollMs = nowMs + intervalMs; /* we were late */
+		}
+		if (modem->nextPollMs < nextDueMs) nextDueMs = modem->nextPollMs;
+	}
+	if (nowMs >= nextSaveMs) {
+		nwStatsSave(NWSTATS_FILE);
+		nextSaveMs = nowMs + (uint64_t)NWSTATS_SAVE_INTERVAL_S * 1000;
+		if (nextSaveMs < nextDueMs) nextDueMs = nextSaveMs;
+	}
+}
+
+/*********************************************************************/
+/* The time series */
+
+static int putVarint(uint8_t *out, uint32_t v) {
+	int n = 0;
+	while (v >= 0x80) {
+		out[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	out[n++] = v;
+	return n;
+}
+
+static uint32_t zigzag(int32_t v) {
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v) {
+	return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static uint32_t getVarint(const nwstats_pair *p, uint16_t *pos) {
+	uint32_t v = 0;
+	int shift = 0;
+	uint8_t b;
+	do {
+		b = p->ring[*pos];
+		*pos = (*pos + 1) % NWSTATS_RING_BYTES;
+		if (shift < 32) v |= (uint32_t)(b & 0x7f) << shift;
+		shift += 7;
+	} while (b & 0x80);
+	return v;
+}
+
+/* Applies the difference at pos to the sample, returns the position after it */
+static uint16_t applyDifference(const nwstats_pair *p, uint16_t pos, nwstats_sample *s) {
+	s->time += getVarint(p, &pos);
+	s->txRate += unzigzag(getVarint(p, &pos));
+	s->rxRate += unzigzag(getVarint(p, &pos));
+	return pos;
+}
+
+static void dropOldest(nwstats_pair *p) {
+	uint16_t pos = applyDifference(p, p->tail, &p->first);
+	p->used -= (pos + NWSTATS_RING_BYTES - p->tail) % NWSTATS_RING_BYTES;
+	p->tail = pos;
+	p->nSamples--;
+}
+
+static void addSample(nwstats_pair *p, const nwstats_sample *s) {
+	uint8_t buf[MAX_SAMPLE_BYTES];
+	int n, i;
+	uint16_t pos;
+	p->nTotal++;
+	nNwStatsSamples++;
+	if (p->nSamples == 0) {
+		p->first = p->last = *s;
+		p->nSamples = 1;
+		p->tail = p->used = 0;
+		return;
+	}
+	/* the time does not go backwards in the series, even if the clock does */
+	n = putVarint(buf, (s->time > p->last.time) ? s->time - p->last.time : 0);
+	n += putVarint(buf + n, zigzag((int32_t)s->txRate - p->last.txRate));
+	n += putVarint(buf + n, zigzag((int32_t)s->rxRate - p->last.rxRate));
+	while (NWSTATS_RING_BYTES - p->used < n) dropOldest(p);
+	pos = (p->tail + p->used) % NWSTATS_RING_BYTES;
+	for (i=0; i<n; i++) {
+		p->ring[pos] = buf[i];
+		pos = (pos + 1) % NWSTATS_RING_BYTES;
+	}
+	p->used += n;
+	p->nSamples++;
+	if (s->time > p->last.time) p->last.time = s->time;
+	p->last.txRate = s->txRate;
+	p->last.rxRate = s->rxRate;
+}
+
+int nwStatsForEachSample(const nwstats_pair *p, void (*fn)(const nwstats_sample *sample, void *context), void *context) {
+	nwstats_sample s;
+	uint16_t pos = p->tail;
+	uint32_t i;
+	if (p->nSamples == 0) return 0;
+	s = p->first;
+	fn(&s, context);
+	for (i=1; i<p->nSamples; i++) {
+		pos = applyDifference(p, pos, &s);
+		fn(&s, context);
+	}
+	return p->nSamples;
+}
+
+/* The pair, or a free entry, or the one which was not updated for the longest time */
+static nwstats_pair *findPair(uint64_t modem, uint64_t peer) {
+	int i, oldest = 0;
+	for (i=0; i<NWSTATS_MAX_PAIRS; i++) {
+		nwstats_pair *p = &pairs[i];
+		if ((p->modem == modem) && (p->peer == peer)) return p;
+		if (pairs[oldest].modem && (!p->modem || (p->last.time < pairs[oldest].last.time))) oldest = i;
+	}
+	if (pairs[oldest].modem) {
+		nNwStatsPairsReplaced++;
+	} else {
+		nPairs++;
+	}
+	memset(&pairs[oldest], 0, sizeof(nwstats_pair));
+	pairs[oldest].modem = modem;
+	pairs[oldest].peer = peer;
+	return &pairs[oldest];
+}
+
+int nwStatsPairCount(void) {
+	return nPairs;
+}
+
+/*********************************************************************/
+/* The confirmations */
+
+static void observeStats(const unsigned char *frame, int len, uint32_t now) {
+	const cm_nw_stats_confirm *cnf = (const cm_nw_stats_confirm *)frame;
+	int i, n;
+	uint64_t modem = macToKey(cnf->ethernet.h_source);
+	if (len < (int)sizeof(*cnf)) {
+		nNwStatsMalformed++;
+		return;
+	}
+	n = cnf->NumSTAs;
+	if (n > (len - (int)sizeof(*cnf)) / (int)sizeof(cm_nw_stats_station)) {
+		nNwStatsMalformed++;
+		n = (len - (int)sizeof(*cnf)) / (int)sizeof(cm_nw_stats_station); /* do not trust the count of short frames */
+	}
+	findModem(cnf->ethernet.h_source, 1);
+	for (i=0; i<n; i++) {
+		const cm_nw_stats_station *sta = &cnf->STA[i];
+		nwstats_sample s;
+		s.time = now;
+		s.txRate = LE16TOH(sta->AvgPHYDR_TX);
+		s.rxRate = LE16TOH(sta->AvgPHYDR_RX);
+		addSample(findPair(modem, macToKey(sta->DA)), &s);
+		eventStreamEmitPhyRate(cnf->ethernet.h_source, sta->DA, s.txRate, s.rxRate);
+	}
+}
+
+static void observeInfo(const unsigned char *frame, int len) {
+	const cm_nw_info_confirm *cnf = (const cm_nw_info_confirm *)frame;
+	nwstats_modem *modem;
+	if (len < (int)sizeof(*cnf)) {
+		nNwStatsMalformed++;
+		return;
+	}
+	modem = findModem(cnf->ethernet.h_source, 1);
+	if (!modem) return;
+	if ((cnf->NumNWs == 0) || (len < (int)(sizeof(*cnf) + sizeof(cm_nw_info_network)))) {
+		/* not (yet) member of a network */
+		if (modem->hasInfo && modem->nNetworks) modem->nInfoChanges++;
+		modem->nNetworks = 0;
+		memset(&modem->info, 0, sizeof(modem->info));
+	} else {
+		if (modem->hasInfo && memcmp(&modem->info, &cnf->NW[0], sizeof(cm_nw_info_network))) modem->nInfoChanges++;
+		modem->nNetworks = cnf->NumNWs;
+		memcpy(&modem->info, &cnf->NW[0], sizeof(cm_nw_info_network));
+	}
+	modem->hasInfo = 1;
+}
+
+void nwStatsObserveFrame(const unsigned char *frame, int len, uint32_t now) {
+	const struct homeplug_hdr *hph = (const struct homeplug_hdr *)(frame + sizeof(struct ethhdr));
+	uint16_t mmtype;
+	if (len < (int)(sizeof(struct ethhdr) + sizeof(struct homeplug_hdr))) return;
+	mmtype = LE16TOH(hph->MMTYPE);
+	if (mmtype == (CM_NW_STATS | MMTYPE_CNF)) observeStats(frame, len, now);
+	if (mmtype == (CM_NW_INFO | MMTYPE_CNF)) observeInfo(frame, len);
+}
+
+/*********************************************************************/
+/* Output */
+
+typedef struct rate_summary {
+	uint32_t n;
+	uint16_t minTx, maxTx, minRx, maxRx;
+	uint64_t sumTx, sumRx;
+} rate_summary;
+
+static void summarize(const nwstats_sample *s, void *context) {
+	rate_summary *r = context;
+	if ((r->n == 0) || (s->txRate < r->minTx)) r->minTx = s->txRate;
+	if ((r->n == 0) || (s->rxRate < r->minRx)) r->minRx = s->rxRate;
+	if (s->txRate > r->maxTx) r->maxTx = s->txRate;
+	if (s->rxRate > r->maxRx) r->maxRx = s->rxRate;
+	r->sumTx += s->txRate;
+	r->sumRx += s->rxRate;
+	r->n++;
+}
+
+void nwStatsPrintTable(void (*printFunction)(char *s)) {
+	static const char *roles[] = { "STA", "PCo", "CCo" };
+	char s[300];
+	uint8_t a[ETH_ALEN], b[ETH_ALEN];
+	int i;
+	sprintf(s, "network statistics: %d modems, %d pairs, %u samples, %u pairs replaced, %u malformed",
+		nModems, nPairs, nNwStatsSamples, nNwStatsPairsReplaced, nNwStatsMalformed);
+	printFunction(s);
+	for (i=0; i<nModems; i++) {
+		nwstats_modem *m = &modems[i];
+		int n = sprintf(s, "  modem %02x:%02x:%02x:%02x:%02x:%02x%s queries %u, answers %u, timeouts %u",
+			m->mac[0], m->mac[1], m->mac[2], m->mac[3], m->mac[4], m->mac[5], m->configured ? "" : " (seen)",
+			m->nQueries, m->nAnswers, m->nTimeouts);
+		if (m->hasInfo && m->nNetworks) {
+			const cm_nw_info_network *nw = &m->info;
+			sprintf(s+n, ", NID %02x%02x%02x%02x%02x%02x%02x TEI %u %s, CCo %02x:%02x:%02x:%02x:%02x:%02x, %u changes",
+				nw->NID[0], nw->NID[1], nw->NID[2], nw->NID[3], nw->NID[4], nw->NID[5], nw->NID[6],
+				nw->TEI, (nw->StationRole < 3) ? roles[nw->StationRole] : "?",
+				nw->CCo_MAC[0], nw->CCo_MAC[1], nw->CCo_MAC[2], nw->CCo_MAC[3], nw->CCo_MAC[4], nw->CCo_MAC[5],
+				m->nInfoChanges);
+		} else if (m->hasInfo) {
+			sprintf(s+n, ", no network");
+		}
+		printFunction(s);
+	}
+	for (i=0; i<NWSTATS_MAX_PAIRS; i++) {
+		nwstats_pair *p = &pairs[i];
+		rate_summary r;
+		if (!p->modem) continue;
+		memset(&r, 0, sizeof(r));
+		nwStatsForEachSample(p, summarize, &r);
+		keyToMac(p->modem, a);
+		keyToMac(p->peer, b);
+		sprintf(s, "  %02x:%02x:%02x:%02x:%02x:%02x -> %02x:%02x:%02x:%02x:%02x:%02x  tx %u rx %u Mbit/s, "
+			"%u samples since %u (%u bytes): tx %u..%u avg %u, rx %u..%u avg %u",
+			a[0], a[1], a[2], a[3], a[4], a[5], b[0], b[1], b[2], b[3], b[4], b[5],
+			p->last.txRate, p->last.rxRate, p->nSamples, p->first.time, p->used,
+			r.minTx, r.maxTx, (unsigned)(r.n ? r.sumTx/r.n : 0), r.minRx, r.maxRx, (unsigned)(r.n ? r.sumRx/r.n : 0));
+		printFunction(s);
+	}
+}
+
+/*********************************************************************/
+/* File */
+
+int nwStatsSave(const char *fileName) {
+	char tmpName[300];
+	nwstats_record r;
+	uint32_t n = nPairs;
+	uint16_t k, pos;
+	int i;
+	FILE *f;
+	/* a crash while writing shall not destroy the last file */
+	snprintf(tmpName, sizeof(tmpName), "%s.tmp", fileName);
+	f = fopen(tmpName, "wb");
+	if (!f) return -1;
+	fwrite(NWSTATS_MAGIC, 1, 8, f);
+	fwrite(&n, sizeof(n), 1, f);
+	for (i=0; i<NWSTATS_MAX_PAIRS; i++) {
+		nwstats_pair *p = &pairs[i];
+		if (!p->modem) continue;
+		keyToMac(p->modem, r.modem);
+		keyToMac(p->peer, r.peer);
+		r.nSamples = p->nSamples;
+		r.nTotal = p->nTotal;
+		r.first = p->first;
+		r.last = p->last;
+		r.used = p->used;
+		fwrite(&r, sizeof(r), 1, f);
+		for (k=0, pos=p->tail; k<p->used; k++, pos=(pos+1)%NWSTATS_RING_BYTES) fputc(p->ring[pos], f);
+	}
+	i = ferror(f);
+	if ((fclose(f)!=0) || i) {
+		remove(tmpName);
+		return -1;
+	}
+	return rename(tmpName, fileName);
+}
+
+/* A loaded ring must be exactly nSamples-1 differences in used bytes, which lead
+   from first to last. Otherwise getVarint() could run around a ring of 0x80 bytes,
+   or dropOldest() could take more than used. The ring starts at 0 after loading. */
+static int ringIsConsistent(const nwstats_pair *p) {
+	nwstats_sample s = p->first;
+	uint32_t i, v;
+	uint16_t pos = 0;
+	int k, shift;
+	uint8_t b;
+	for (i=1; i<p->nSamples; i++) {
+		for (k=0; k<3; k++) {
+			v = 0;
+			shift = 0;
+			do {
+				if ((pos >= p->used) || (shift > 28)) return 0;
+				b = p->ring[pos++];
+				v |= (uint32_t)(b & 0x7f) << shift;
+				shift += 7;
+			} while (b & 0x80);
+			if (k==0) s.time += v;
+			else if (k==1) s.txRate += unzigzag(v);
+			else s.rxRate += unzigzag(v);
+		}
+	}
+	return (pos == p->used) && (s.time == p->last.time) && (s.txRate == p->last.txRate) && (s.rxRate == p->last.rxRate);
+}
+
+int nwStatsLoad(const char *fileName) {
+	char magic[8];
+	nwstats_record r;
+	uint32_t n, i;
+	FILE *f = fopen(fileName, "rb");
+	if (!f) return -1;
+	if ((fread(magic, 1, 8, f)!=8) || (memcmp(magic, NWSTATS_MAGIC, 8)!=0) || (fread(&n, sizeof(n), 1, f)!=1)) {
+		fclose(f);
+		return -1;
+	}
+	for (i=0; i<n; i++) {
+		nwstats_pair *p;
+		if ((fread(&r, sizeof(r), 1, f)!=1) || (r.used > NWSTATS_RING_BYTES) || (r.nSamples == 0)) break;
+		p = findPair(macToKey(r.modem), macToKey(r.peer));
+		if ((fread(p->ring, 1, r.used, f)!=r.used)) {
+			p->modem = 0;
+			nPairs--;
+			break;
+		}
+		p->nSamples = r.nSamples;
+		p->nTotal = r.nTotal;
+		p->first = r.first;
+		p->last = r.last;
+		p->used = r.used;
+		p->tail = 0;
+		if (!ringIsConsistent(p)) {
+			memset(p, 0, sizeof(*p));
+			nPairs--;
+			nNwStatsLoadDiscarded++;
+		}
+	}
+	fclose(f);
+	return i;
+}
+
+void nwStatsExit(void) {
+	if (!nwStatsActive) return;
+	nwStatsSave(NWSTATS_FILE);
+	nwStatsActive = 0;
+}
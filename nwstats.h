@@ -0,0 +1,98 @@
+/* Collector of the PHY rates and network info of the modems
+ *
+ * Every interval, each configured modem is asked with CM_NW_INFO.REQ and
+ * CM_NW_STATS.REQ. The requests go through the request/response API (timeouts)
+ * and the transmit scheduler, as bulk class, so they wait behind the SLAC
+ * reaction and the requests of the operator. The modems are spread over the
+ * interval. nwStatsService() costs one comparison per main loop iteration as
+ * long as nothing is due.
+ * Each CM_NW_STATS.CNF and CM_NW_INFO.CNF on the line is taken, also the
+ * answers to the requests of other tools, and also when several modems answer
+ * to a broadcast.
+ *
+ * CM_NW_STATS gives, for each other station of the network, the average PHY
+ * rate in both directions. Per pair (modem, station) there is a time series in a
+ * fixed ring of NWSTATS_RING_BYTES. The oldest sample is kept as it is, each
+ * further sample as difference to its predecessor: the seconds as varint, the
+ * two rates as zigzag varints. With steady rates, a sample takes 3 bytes. If the
+ * ring is full, the oldest samples are dropped, and the next one becomes the new
+ * start. The pair table has NWSTATS_MAX_PAIRS entries; a new pair replaces the
+ * one which was not updated for the longest time. So the memory stays the same
+ * over weeks, only the depth of the history is limited.
+ * CM_NW_INFO gives the network of the modem (NID, TEI, role, CCo); only the
+ * latest is kept, and changes are counted.
+ *
+ * The pairs are written to NWSTATS_FILE every NWSTATS_SAVE_INTERVAL_S and at the
+ * end, and are read again at the start. Each new sample is also sent as "phyrate"
+ * event on the event stream.
+ */
+
+#ifndef NWSTATS_HEADER
+#define NWSTATS_HEADER
+
+#include <stdio.h>
+#include <stdint.h>
+#include <netinet/if_ether.h>
+#include "plc_homeplug.h"
+
+#define NWSTATS_MAX_MODEMS 16
+#define NWSTATS_MAX_PAIRS 256
+#define NWSTATS_RING_BYTES 512
+#define NWSTATS_DEFAULT_INTERVAL_S 60
+#define NWSTATS_TIMEOUT_MS 2000
+#define NWSTATS_SAVE_INTERVAL_S 3600
+#define NWSTATS_FILE "nwstats.bin"
+
+typedef struct nwstats_sample {
+	uint32_t time;   /* unix time in seconds */
+	uint16_t txRate; /* Mbit/s, from the modem to the station */
+	uint16_t rxRate;
+} nwstats_sample;
+
+typedef struct nwstats_pair {
+	uint64_t modem; /* 48 bit MACs in the lower bits. 0 means "entry is free" */
+	uint64_t peer;
+	uint32_t nSamples; /* in the ring, including first */
+	uint32_t nTotal;   /* since the pair is known, including the dropped ones */
+	nwstats_sample first; /* the oldest sample in the ring */
+	nwstats_sample last;  /* the newest one, the base of the next difference */
+	uint16_t tail;        /* the difference to the second sample */
+	uint16_t used;        /* bytes of differences */
+	uint8_t ring[NWSTATS_RING_BYTES];
+} nwstats_pair;
+
+typedef struct nwstats_modem {
+	uint8_t mac[ETH_ALEN];
+	uint8_t configured; /* polled by us, or only seen */
+	uint8_t hasInfo;
+	uint8_t nNetworks;
+	cm_nw_info_network info; /* the first network */
+	uint32_t nQueries, nAnswers, nTimeouts, nInfoChanges;
+	uint64_t nextPollMs;
+} nwstats_modem;
+
+extern int nwStatsActive;
+extern uint32_t nNwStatsQueries, nNwStatsAnswers, nNwStatsTimeouts;
+extern uint32_t nNwStatsSamples, nNwStatsPairsReplaced, nNwStatsMalformed;
+extern uint32_t nNwStatsLoadDiscarded; /* pairs of nwstats.bin whose ring did not parse */
+
+/* Polls the modems of the file (one aa:bb:cc:dd:ee:ff per line), or without
+   file the local modem. Reads NWSTATS_FILE. Returns the number of modems, or -1. */
+int nwStatsInit(const uint8_t *ownMac, uint32_t intervalS, const char *modemFile, uint64_t nowMs);
+void nwStatsSetOwnMac(const uint8_t *ownMac);
+/* Sends the due requests, and saves from time to time. From the main loop. */
+void nwStatsService(uint64_t nowMs);
+/* For each CM_NW_INFO.CNF and CM_NW_STATS.CNF */
+void nwStatsObserveFrame(const unsigned char *frame, int len, uint32_t now);
+/* The requests which are sent with the bulk class */
+int nwStatsIsQuery(const void *frame, int len);
+
+/* Calls fn for the samples of the pair, the oldest first. Returns their number. */
+int nwStatsForEachSample(const nwstats_pair *pair, void (*fn)(const nwstats_sample *sample, void *context), void *context);
+int nwStatsPairCount(void);
+void nwStatsPrintTable(void (*printFunction)(char *s));
+int nwStatsSave(const char *fileName);
+int nwStatsLoad(const char *fileName);
+void nwStatsExit(void); /* saves */
+
+#endif
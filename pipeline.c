@@ -0,0 +1,407 @@
+/* Pipelined reception with SPSC rings, see pipeline.h */
+
+#define _GNU_SOURCE /* recvmmsg */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#include "pipeline.h"
+#include "capture.h"
+#include "macfilter.h"
+#include "rxstats.h"
+#include "logstore.h"
+
+#define CAPTURE_POLL_MS 10 /* so that the capture thread sees the stop */
+#define IDLE_SPINS 100 /* sched_yield() before the sinks start to sleep */
+#define IDLE_SLEEP_US 200
+#define METRICS_SLOTS 64
+
+typedef struct log_line {
+	uint64_t enqueueNs;
+	char text[PIPELINE_LOG_LINE_LEN];
+} log_line;
+
+int pipelineActive;
+uint32_t nPipelineTruncated, nPipelinePoolEmpty, nPipelineLogWaits;
+
+static pipeline_frame *pool;
+static pipeline_stage_stats stats[PIPELINE_NUMBER_OF_STAGES];
+
+static spsc_ring freeRing, capRing, decRing, logRing, metricsRing;
+static uint32_t *freeSlots, *capSlots, *decSlots;
+static log_line *logLines;
+static log_line metricsLines[METRICS_SLOTS];
+
+static int rxFd;
+static FILE *logFile;
+static int decodeEventFd = -1; /* wakes up the decode stage */
+static int withCaptureSink;
+static int running; /* metrics */
+static int captureRunning, capsinkRunning, logRunning;
+static pthread_t captureThread, capsinkThread, logsinkThread, metricsThread;
+
+static const char *stageNames[PIPELINE_NUMBER_OF_STAGES] = { "capture", "capsink", "decode", "logsink" };
+
+static uint64_t monotonicNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+static void ringInit(spsc_ring *r, uint32_t size) {
+	memset(r, 0, sizeof(*r));
+	r->size = size;
+	r->mask = size - 1;
+}
+
+static uint32_t ringOccupancy(spsc_ring *r) {
+	return __atomic_load_n(&r->head, __ATOMIC_RELAXED) - __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+}
+
+/* The counters have one writer each, the metrics thread only reads them. */
+static void statAdd(uint64_t *counter, uint64_t value) {
+	__atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+static void statLatency(int stage, uint64_t enqueueNs, uint64_t nowNs) {
+	pipeline_stage_stats *s = &stats[stage];
+	uint64_t latency = nowNs - enqueueNs;
+	statAdd(&s->nItems, 1);
+	statAdd(&s->sumLatencyNs, latency);
+	if (latency > s->maxLatencyNs) __atomic_store_n(&s->maxLatencyNs, latency, __ATOMIC_RELAXED);
+}
+
+static void idleWait(unsigned *idle) {
+	struct timespec t = { 0, IDLE_SLEEP_US*1000 };
+	if (++*idle < IDLE_SPINS) {
+		sched_yield();
+	} else {
+		nanosleep(&t, NULL);
+	}
+}
+
+static void wakeDecode(void) {
+	uint64_t one = 1;
+	if (write(decodeEventFd, &one, sizeof(one)) < 0) { } /* the counter is full, it is awake anyway */
+}
+
+/* Hands the frame to the next stage. Returns 0 if the ring is full. */
+static int pushFrame(int stage, spsc_ring *r, uint32_t *ringSlots, uint32_t slot) {
+	int p = spscReserve(r);
+	if (p < 0) {
+		statAdd(&stats[stage].nNextFull, 1);
+		return 0;
+	}
+	pool[slot].enqueueNs = monotonicNs();
+	ringSlots[p] = slot;
+	spscCommit(r);
+	return 1;
+}
+
+/*********************************************************************/
+/* Capture thread: socket -> capture sink or decode */
+
+static void *captureThreadFunction(void *arg) {
+	struct mmsghdr msgs[PIPELINE_RX_BATCH];
+	struct iovec iov[PIPELINE_RX_BATCH];
+	unsigned char control[PIPELINE_RX_BATCH][RXSTATS_CONTROL_LEN];
+	uint32_t slots[PIPELINE_RX_BATCH], keep[PIPELINE_RX_BATCH];
+	struct pollfd pfd;
+	struct timespec ts;
+	int i, n, nSlots = 0, nKeep;
+	pfd.fd = rxFd;
+	pfd.events = POLLIN;
+	while (__atomic_load_n(&captureRunning, __ATOMIC_ACQUIRE)) {
+		/* the free slots, which the decode stage gave back */
+		while (nSlots < PIPELINE_RX_BATCH) {
+			int p = spscPeek(&freeRing);
+			if (p < 0) break;
+			slots[nSlots++] = freeSlots[p];
+			spscRelease(&freeRing);
+		}
+		if (nSlots == 0) {
+			/* The decode stage is behind. The frames wait in the socket buffer meanwhile. */
+			unsigned idle = IDLE_SPINS;
+			nPipelinePoolEmpty++;
+			idleWait(&idle);
+			continue;
+		}
+		if (poll(&pfd, 1, CAPTURE_POLL_MS) <= 0) continue;
+		for (i=0; i<nSlots; i++) {
+			iov[i].iov_base = pool[slots[i]].data;
+			iov[i].iov_len = PIPELINE_FRAME_SIZE;
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = control[i];
+			msgs[i].msg_hdr.msg_controllen = RXSTATS_CONTROL_LEN;
+		}
+		n = recvmmsg(rxFd, msgs, nSlots, MSG_DONTWAIT, NULL);
+		if (n <= 0) continue;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		nKeep = 0;
+		for (i=0; i<n; i++) {
+			pipeline_frame *f = &pool[slots[i]];
+			int pushed;
+			f->len = msgs[i].msg_len;
+			if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) nPipelineTruncated++;
+			rxStatsObserveMsg(&msgs[i].msg_hdr);
+			statAdd(&stats[PIPELINE_STAGE_CAPTURE].nItems, 1);
+			if (macFilterActive && !macFilterFrame(f->data, f->len)) {
+				keep[nKeep++] = slots[i]; /* not our chargers, the slot is used again */
+				continue;
+			}
+			f->ts = ts;
+			if (withCaptureSink) {
+				pushed = pushFrame(PIPELINE_STAGE_CAPTURE, &capRing, capSlots, slots[i]);
+			} else {
+				pushed = pushFrame(PIPELINE_STAGE_CAPTURE, &decRing, decSlots, slots[i]);
+			}
+			if (!pushed) keep[nKeep++] = slots[i];
+		}
+		if (!withCaptureSink) wakeDecode();
+		/* the slots which were not filled, and the dropped ones */
+		for (i=n; i<nSlots; i++) keep[nKeep++] = slots[i];
+		memcpy(slots, keep, nKeep * sizeof(uint32_t));
+		nSlots = nKeep;
+	}
+	return arg;
+}
+
+/*********************************************************************/
+/* Capture sink thread: pcap file, then decode */
+
+static void *capsinkThreadFunction(void *arg) {
+	unsigned idle = 0;
+	int last = 0;
+	for (;;) {
+		int nHandled = 0;
+		int p;
+		while ((p = spscPeek(&capRing)) >= 0) {
+			uint32_t slot = capSlots[p];
+			pipeline_frame *f = &pool[slot];
+			spscRelease(&capRing);
+			statLatency(PIPELINE_STAGE_CAPSINK, f->enqueueNs, monotonicNs());
+			captureWriteFrame(f->data, f->len, &f->ts);
+			f->captureOffset = captureLastRecordOffset;
+			/* the decode ring has room for the whole pool, so this does not fail */
+			pushFrame(PIPELINE_STAGE_CAPSINK, &decRing, decSlots, slot);
+			nHandled++;
+		}
+		if (nHandled) {
+			wakeDecode();
+			idle = 0;
+		} else if (last) {
+			break;
+		} else {
+			idleWait(&idle);
+		}
+		/* once more after the capture thread has stopped, for its last frames */
+		last = !__atomic_load_n(&capsinkRunning, __ATOMIC_ACQUIRE);
+	}
+	return arg;
+}
+
+/*********************************************************************/
+/* Decode stage, in the main loop */
+
+int pipelinePoll(int maxFrames, void (*onFrame)(pipeline_frame *frame)) {
+	struct pollfd pfd;
+	uint64_t counter;
+	int n = 0, p;
+	if (spscPeek(&decRing) < 0) {
+		/* nothing there, wait up to one millisecond, like the poll loop */
+		pfd.fd = decodeEventFd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 1) > 0) {
+			if (read(decodeEventFd, &counter, sizeof(counter)) < 0) { }
+		}
+	}
+	while ((n < maxFrames) && ((p = spscPeek(&decRing)) >= 0)) {
+		uint32_t slot = decSlots[p];
+		pipeline_frame *f = &pool[slot];
+		spscRelease(&decRing);
+		statLatency(PIPELINE_STAGE_DECODE, f->enqueueNs, monotonicNs());
+		onFrame(f);
+		/* back to the capture thread, the free ring holds the whole pool */
+		p = spscReserve(&freeRing);
+		freeSlots[p] = slot;
+		spscCommit(&freeRing);
+		n++;
+	}
+	return n;
+}
+
+void pipelineLog(const char *s) {
+	int p;
+	while ((p = spscReserve(&logRing)) < 0) {
+		unsigned idle = 0;
+		nPipelineLogWaits++;
+		idleWait(&idle);
+	}
+	logLines[p].enqueueNs = monotonicNs();
+	strncpy(logLines[p].text, s, PIPELINE_LOG_LINE_LEN-1);
+	logLines[p].text[PIPELINE_LOG_LINE_LEN-1] = 0;
+	spscCommit(&logRing);
+}
+
+/*********************************************************************/
+/* Log sink thread: screen and log file */
+
+static int drainLogRing(spsc_ring *r, log_line *lines) {
+	int p, n = 0;
+	while ((p = spscPeek(r)) >= 0) {
+		statLatency(PIPELINE_STAGE_LOGSINK, lines[p].enqueueNs, monotonicNs());
+		printf("%s\n", lines[p].text);
+		if (logStoreActive) logStoreWrite(lines[p].text); else fprintf(logFile, "%s\n", lines[p].text);
+		spscRelease(r);
+		n++;
+	}
+	return n;
+}
+
+static void *logsinkThreadFunction(void *arg) {
+	unsigned idle = 0;
+	for (;;) {
+		int n = drainLogRing(&logRing, logLines) + drainLogRing(&metricsRing, metricsLines);
+		if (n) {
+			/* one flush for all lines which came together */
+			if (logFile) fflush(logFile);
+			fflush(stdout);
+			idle = 0;
+		} else if (!__atomic_load_n(&logRunning, __ATOMIC_ACQUIRE)) {
+			break;
+		} else {
+			idleWait(&idle);
+		}
+	}
+	return arg;
+}
+
+/*********************************************************************/
+/* Metrics thread: occupancy, and the statistics through the log sink */
+
+static void metricsLog(const char *s) {
+	int p = spscReserve(&metricsRing);
+	if (p < 0) return; /* the log sink is behind, the next interval comes */
+	metricsLines[p].enqueueNs = monotonicNs();
+	strncpy(metricsLines[p].text, s, PIPELINE_LOG_LINE_LEN-1);
+	metricsLines[p].text[PIPELINE_LOG_LINE_LEN-1] = 0;
+	spscCommit(&metricsRing);
+}
+
+static void *metricsThreadFunction(void *arg) {
+	struct timespec t = { 0, PIPELINE_METRICS_SAMPLE_MS*1000000 };
+	pipeline_stage_stats last[PIPELINE_NUMBER_OF_STAGES];
+	uint32_t occupancy[PIPELINE_NUMBER_OF_STAGES];
+	char s[300];
+	int i, nSamples = 0;
+	memset(last, 0, sizeof(last));
+	while (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+		nanosleep(&t, NULL);
+		occupancy[PIPELINE_STAGE_CAPTURE] = PIPELINE_SLOTS - ringOccupancy(&freeRing); /* slots in use */
+		occupancy[PIPELINE_STAGE_CAPSINK] = ringOccupancy(&capRing);
+		occupancy[PIPELINE_STAGE_DECODE] = ringOccupancy(&decRing);
+		occupancy[PIPELINE_STAGE_LOGSINK] = ringOccupancy(&logRing) + ringOccupancy(&metricsRing);
+		for (i=0; i<PIPELINE_NUMBER_OF_STAGES; i++) {
+			stats[i].sumOccupancy += occupancy[i];
+			stats[i].nSamples++;
+			if (occupancy[i] > stats[i].maxOccupancy) stats[i].maxOccupancy = occupancy[i];
+		}
+		if (++nSamples < PIPELINE_METRICS_INTERVAL_S*1000/PIPELINE_METRICS_SAMPLE_MS) continue;
+		nSamples = 0;
+		for (i=0; i<PIPELINE_NUMBER_OF_STAGES; i++) {
+			pipeline_stage_stats *st = &stats[i];
+			uint64_t nItems = __atomic_load_n(&st->nItems, __ATOMIC_RELAXED) - last[i].nItems;
+			uint64_t sumLatency = __atomic_load_n(&st->sumLatencyNs, __ATOMIC_RELAXED) - last[i].sumLatencyNs;
+			uint64_t nNextFull = __atomic_load_n(&st->nNextFull, __ATOMIC_RELAXED) - last[i].nNextFull;
+			uint64_t maxLatency = __atomic_exchange_n(&st->maxLatencyNs, 0, __ATOMIC_RELAXED);
+			if ((i == PIPELINE_STAGE_CAPSINK) && !withCaptureSink) continue;
+			snprintf(s, sizeof(s), "pipeline %-7s items %7lu  wait avg %5lu us max %6lu us  %s avg %4lu max %4u  next ring full %lu",
+				stageNames[i], (unsigned long)nItems,
+				(unsigned long)(nItems ? sumLatency/nItems/1000 : 0), (unsigned long)(maxLatency/1000),
+				(i == PIPELINE_STAGE_CAPTURE) ? "slots used" : "ring",
+				(unsigned long)(st->sumOccupancy/st->nSamples), st->maxOccupancy, (unsigned long)nNextFull);
+			metricsLog(s);
+			last[i].nItems += nItems;
+			last[i].sumLatencyNs += sumLatency;
+			last[i].nNextFull += nNextFull;
+			st->sumOccupancy = 0;
+			st->nSamples = 0;
+			st->maxOccupancy = 0;
+		}
+		snprintf(s, sizeof(s), "pipeline: pool empty %u, truncated %u, log waits %u",
+			nPipelinePoolEmpty, nPipelineTruncated, nPipelineLogWaits);
+		metricsLog(s);
+	}
+	return arg;
+}
+
+/*********************************************************************/
+
+int pipelineStart(int fd, FILE *hLogFile) {
+	uint32_t i;
+	rxFd = fd;
+	logFile = hLogFile;
+	withCaptureSink = captureActive;
+	pool = aligned_alloc(PIPELINE_CACHE_LINE, PIPELINE_SLOTS * sizeof(pipeline_frame));
+	freeSlots = malloc(PIPELINE_SLOTS * sizeof(uint32_t));
+	capSlots = malloc(PIPELINE_SLOTS * sizeof(uint32_t));
+	decSlots = malloc(PIPELINE_SLOTS * sizeof(uint32_t));
+	logLines = malloc(PIPELINE_LOG_SLOTS * sizeof(log_line));
+	decodeEventFd = eventfd(0, EFD_NONBLOCK);
+	if (!pool || !freeSlots || !capSlots || !decSlots || !logLines || (decodeEventFd < 0)) return -1;
+	ringInit(&freeRing, PIPELINE_SLOTS);
+	ringInit(&capRing, PIPELINE_SLOTS);
+	ringInit(&decRing, PIPELINE_SLOTS);
+	ringInit(&logRing, PIPELINE_LOG_SLOTS);
+	ringInit(&metricsRing, METRICS_SLOTS);
+	memset(stats, 0, sizeof(stats));
+	/* all slots are free at the beginning */
+	for (i=0; i<PIPELINE_SLOTS; i++) {
+		freeSlots[spscReserve(&freeRing)] = i;
+		spscCommit(&freeRing);
+	}
+	running = 1;
+	captureRunning = capsinkRunning = 1;
+	logRunning = 1;
+	if (pthread_create(&logsinkThread, NULL, logsinkThreadFunction, NULL) != 0) return -1;
+	pipelineActive = 1; /* from now on, the log lines go through the log sink */
+	if (pthread_create(&metricsThread, NULL, metricsThreadFunction, NULL) != 0) return -1;
+	if (withCaptureSink && (pthread_create(&capsinkThread, NULL, capsinkThreadFunction, NULL) != 0)) return -1;
+	if (pthread_create(&captureThread, NULL, captureThreadFunction, NULL) != 0) return -1;
+	return 0;
+}
+
+void pipelineStopCapture(void) {
+	if (!pipelineActive || !captureRunning) return;
+	__atomic_store_n(&captureRunning, 0, __ATOMIC_RELEASE);
+	pthread_join(captureThread, NULL);
+	__atomic_store_n(&capsinkRunning, 0, __ATOMIC_RELEASE);
+	if (withCaptureSink) pthread_join(capsinkThread, NULL);
+}
+
+void pipelineStop(void) {
+	if (!pipelineActive) return;
+	pipelineStopCapture();
+	__atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+	pthread_join(metricsThread, NULL);
+	/* the log sink writes what is left, then the log lines go the direct way again */
+	__atomic_store_n(&logRunning, 0, __ATOMIC_RELEASE);
+	pthread_join(logsinkThread, NULL);
+	pipelineActive = 0;
+	close(decodeEventFd);
+	free(pool);
+	free(freeSlots);
+	free(capSlots);
+	free(decSlots);
+	free(logLines);
+}
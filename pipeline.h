@@ -0,0 +1,122 @@
+/* Pipelined reception: capture, decode and sink threads connected by SPSC rings
+ *
+ * With -P, the work of the main loop is split, so that a slow stage does not
+ * delay the next recvfrom():
+ *   - the capture thread only drains the socket, with recvmmsg() into the frame
+ *     slots of a fixed pool, and applies the MAC filter.
+ *   - with -w, the capture sink thread writes the frames into the pcap file.
+ *   - the decode and reaction stage is the main loop, as before. It gets the
+ *     frame in its slot (receivebuffer points there) and returns the slot.
+ *   - the log sink thread writes the log lines to screen and log.txt.
+ *   - the metrics thread samples the ring occupancy and reports the stage
+ *     statistics through the log sink.
+ * Between the stages there are single-producer/single-consumer rings with the
+ * head and the tail in their own cache lines. The frame rings pass slot
+ * numbers, not the frames. The free slots go back to the capture thread in
+ * another ring, so the pool needs no lock.
+ * Each stage counts items, the wait in its input ring (latency) and the times
+ * its producer found the next ring full; the metrics thread adds the occupancy.
+ */
+
+#ifndef PIPELINE_HEADER
+#define PIPELINE_HEADER
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define PIPELINE_SLOTS 4096 /* frames in the pool, power of two */
+#define PIPELINE_FRAME_SIZE 2048 /* larger frames are truncated */
+#define PIPELINE_RX_BATCH 32 /* frames per recvmmsg() */
+#define PIPELINE_LOG_SLOTS 1024 /* log lines in flight, power of two */
+#define PIPELINE_LOG_LINE_LEN 1024
+#define PIPELINE_METRICS_SAMPLE_MS 10
+#define PIPELINE_METRICS_INTERVAL_S 10
+#define PIPELINE_CACHE_LINE 64
+
+typedef struct spsc_ring {
+	/* producer side */
+	uint32_t head __attribute__((aligned(PIPELINE_CACHE_LINE)));
+	uint32_t cachedTail;
+	/* consumer side */
+	uint32_t tail __attribute__((aligned(PIPELINE_CACHE_LINE)));
+	uint32_t cachedHead;
+	/* constant */
+	uint32_t size __attribute__((aligned(PIPELINE_CACHE_LINE)));
+	uint32_t mask;
+} spsc_ring;
+
+/* Returns the position for the next item, or -1 if the ring is full. The item
+   is visible to the consumer after spscCommit(). */
+static inline int spscReserve(spsc_ring *r) {
+	uint32_t head = r->head;
+	if (head - r->cachedTail == r->size) {
+		r->cachedTail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		if (head - r->cachedTail == r->size) return -1;
+	}
+	return head & r->mask;
+}
+
+static inline void spscCommit(spsc_ring *r) {
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+/* Returns the position of the oldest item, or -1 if the ring is empty. The
+   position may be reused by the producer after spscRelease(). */
+static inline int spscPeek(spsc_ring *r) {
+	uint32_t tail = r->tail;
+	if (tail == r->cachedHead) {
+		r->cachedHead = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		if (tail == r->cachedHead) return -1;
+	}
+	return tail & r->mask;
+}
+
+static inline void spscRelease(spsc_ring *r) {
+	__atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+/* the stages, each with the ring in front of it */
+enum {
+	PIPELINE_STAGE_CAPTURE, /* input: the free slots */
+	PIPELINE_STAGE_CAPSINK, /* input: frames from the capture thread */
+	PIPELINE_STAGE_DECODE,  /* input: frames from capture thread or capture sink */
+	PIPELINE_STAGE_LOGSINK, /* input: log lines from decode and metrics */
+	PIPELINE_NUMBER_OF_STAGES
+};
+
+typedef struct pipeline_stage_stats {
+	uint64_t nItems;        /* handled by the stage */
+	uint64_t nNextFull;     /* the output ring of the stage was full */
+	uint64_t sumLatencyNs;  /* time of the items in the input ring */
+	uint64_t maxLatencyNs;
+	uint64_t sumOccupancy;  /* samples of the metrics thread */
+	uint32_t nSamples;
+	uint32_t maxOccupancy;
+} pipeline_stage_stats;
+
+typedef struct pipeline_frame {
+	uint32_t len;
+	struct timespec ts;     /* CLOCK_REALTIME of the reception */
+	uint64_t captureOffset; /* of the record in the capture file */
+	uint64_t enqueueNs;     /* CLOCK_MONOTONIC, when it went into the current ring */
+	unsigned char data[PIPELINE_FRAME_SIZE];
+} pipeline_frame;
+
+extern int pipelineActive;
+extern uint32_t nPipelineTruncated, nPipelinePoolEmpty, nPipelineLogWaits;
+
+/* Starts the threads. The capture sink only if the capture file is open. */
+int pipelineStart(int rxFd, FILE *logFile);
+/* Decode stage: calls onFrame for up to maxFrames received frames, and returns
+   the slots. Returns the number of frames. */
+int pipelinePoll(int maxFrames, void (*onFrame)(pipeline_frame *frame));
+/* Hands the line over to the log sink. Waits if the ring is full. */
+void pipelineLog(const char *s);
+/* Stops the capture thread and the capture sink. The frames which were received
+   stay in the decode ring, pipelinePoll() still returns them. */
+void pipelineStopCapture(void);
+/* Stops the threads. The pending frames are dropped, the pending log lines written. */
+void pipelineStop(void);
+
+#endif
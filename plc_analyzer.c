@@ -0,0 +1,564 @@
+/* Offline analyzer for HomePlug capture archives
+ *
+ * Reads pcap and pcapng files (also the ones written by listen_to_eth -w and by the
+ * flight recorder), and rebuilds what listen_to_eth would have seen live:
+ *   - the SLAC sessions and how they ended (key set, key failed, timeout, and in
+ *     which state the timeouts happened),
+ *   - the CM_SET_KEY.CNF results,
+ *   - a statistic per MMTYPE.
+ * The SLAC reconstruction is the same code as in listen_to_eth (slacsession.c).
+ *
+ *    ./plc_analyzer [-j threads] [-c chunkMB] [-x] file1.pcap file2.pcapng ...
+ *
+ * The files are memory-mapped. Each file is split into chunks of some MB at record
+ * boundaries, and the chunks are processed by a pool of worker threads. Each worker
+ * has its own queue; a worker without work steals from the others. A SLAC session
+ * may cross a chunk boundary, so each chunk starts a little earlier (warm-up) and
+ * ends a little later (overrun) than its own range, and counts only the sessions
+ * which started in its own range. The results of the workers are merged at the end.
+ * With -x, the session index (sessionindex.h) of each file is written, for plc_query.
+ *
+ * Change Log
+ *   2026-10-19
+ *    - neu angelegt
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/if_ether.h>
+
+#include "plc_homeplug.h"
+#include "capture.h"
+#include "capreader.h"
+#include "slacsession.h"
+#include "mmtypes.h"
+#include "sessionindex.h"
+
+#define DEFAULT_CHUNK_MB 64
+#define INDEX_STRIDE (1024*1024) /* one index point per MB */
+#define SESSION_MARGIN_MS 30000 /* warm-up and overrun around each chunk */
+#define MAX_WORKERS 256
+#define DURATION_BUCKET_MS 100
+#define DURATION_BUCKETS 100 /* up to 10s, the last bucket collects the rest */
+
+/* the results, one per worker, merged at the end */
+typedef struct analysis_result {
+	uint64_t nFrames, nBytes, nHomePlug, nOther, nSkippedLinktype;
+	uint64_t mmCount[65536];
+	uint64_t nSetKeyOk, nSetKeyFailed;
+	uint64_t nSessions, nKeySet, nKeyFailed, nTimeout, nOpenAtEnd;
+	uint64_t timeoutInState[SLAC_NUMBER_OF_STATES];
+	uint64_t durationHistogram[DURATION_BUCKETS];
+	uint64_t durationMaxMs;
+	uint64_t firstTsNs, lastTsNs;
+} analysis_result;
+
+typedef struct chunk {
+	capture_file *file;
+	session_index *ix; /* of the file, NULL without -x */
+	int firstPoint, endPoint; /* index points [firstPoint, endPoint) */
+	size_t size;
+} chunk;
+
+/* what a worker is doing at the moment, for the SLAC transition callback */
+typedef struct chunk_context {
+	analysis_result *result;
+	uint64_t ownFromMs, ownToMs; /* the sessions starting in this range belong to this chunk */
+	int atEndOfCapture;
+	session_index *ix;
+	uint64_t recordOffset; /* of the current frame */
+	const capture_cursor *cursor;
+} chunk_context;
+
+static __thread chunk_context *currentChunk;
+static pthread_mutex_t indexLock = PTHREAD_MUTEX_INITIALIZER; /* for the session indexes, shared by the chunks of a file */
+
+/* First pass over a file: only the record headers are touched. Builds the
+   index points, and the interface table of pcapng. */
+static void indexFile(capture_file *f) {
+	capture_cursor c = { 0, 0 };
+	const uint8_t *frame;
+	uint32_t capLen;
+	uint64_t tsNs;
+	uint16_t linktype;
+	size_t nextPoint = 0;
+	int maxPoints = f->size / INDEX_STRIDE + 2;
+	int pendingTs = 0, r;
+	f->points = malloc(maxPoints * sizeof(index_point));
+	if (!f->points) return;
+	for (;;) {
+		if ((c.offset >= nextPoint) && (c.offset > 0) && (f->nPoints < maxPoints)) {
+			f->points[f->nPoints].offset = c.offset;
+			f->points[f->nPoints].section = c.section;
+			f->points[f->nPoints].tsNs = (f->nPoints > 0) ? f->points[f->nPoints-1].tsNs : 0;
+			f->nPoints++;
+			pendingTs = 1;
+			nextPoint = c.offset + INDEX_STRIDE;
+		}
+		r = captureReaderNext(f, &c, 1, &frame, &capLen, &tsNs, &linktype);
+		if (r<0) break;
+		if ((r==1) && pendingTs && (tsNs>0)) {
+			f->points[f->nPoints-1].tsNs = tsNs;
+			pendingTs = 0;
+		}
+	}
+}
+
+/*********************************************************************/
+/* analysis of one chunk */
+
+static void addToSessionIndex(chunk_context *cc, const slac_session *s, int oldState) {
+	session_index_record *r;
+	int state = s->core.state, flags = 0;
+	if ((state == SLAC_STATE_TIMEOUT) && cc->atEndOfCapture) {
+		state = oldState;
+		flags = SESSION_INDEX_FLAG_OPEN;
+	}
+	pthread_mutex_lock(&indexLock);
+	if (sessionIndexAddSession(cc->ix, s, state, flags, 0) == 0) {
+		/* the capture has unix time already */
+		r = &cc->ix->records[cc->ix->nRecords-1];
+		r->section = cc->cursor->section;
+		if ((state == SLAC_STATE_KEY_SET) || (state == SLAC_STATE_KEY_FAILED)) {
+			/* ended by the CM_SET_KEY.CNF, which is the current frame */
+			r->lastOffset = cc->recordOffset;
+			r->nFrames++;
+		}
+	}
+	pthread_mutex_unlock(&indexLock);
+}
+
+static void analyzerTransition(const slac_session *s, int oldState) {
+	chunk_context *cc = currentChunk;
+	analysis_result *r = cc->result;
+	uint64_t duration;
+	if ((s->core.startMs < cc->ownFromMs) || (s->core.startMs >= cc->ownToMs)) return; /* counted by the neighbour chunk */
+	if (oldState == SLAC_STATE_IDLE) r->nSessions++;
+	if (cc->ix && (s->core.state >= SLAC_STATE_KEY_SET)) addToSessionIndex(cc, s, oldState);
+	switch (s->core.state) {
+		case SLAC_STATE_KEY_SET:
+			r->nKeySet++;
+			duration = s->core.lastMs - s->core.startMs;
+			if (duration > r->durationMaxMs) r->durationMaxMs = duration;
+			duration /= DURATION_BUCKET_MS;
+			r->durationHistogram[(duration < DURATION_BUCKETS) ? duration : DURATION_BUCKETS-1]++;
+			break;
+		case SLAC_STATE_KEY_FAILED:
+			r->nKeyFailed++;
+			break;
+		case SLAC_STATE_TIMEOUT:
+			if (cc->atEndOfCapture) {
+				r->nOpenAtEnd++;
+			} else {
+				r->nTimeout++;
+				r->timeoutInState[oldState]++;
+			}
+			break;
+	}
+}
+
+static void analyzeChunk(chunk *ck, analysis_result *r) {
+	capture_file *f = ck->file;
+	chunk_context cc;
+	capture_cursor c;
+	const uint8_t *frame;
+	uint32_t capLen;
+	uint64_t tsNs = 0, lastTsNs = 0, tsMs, lastCheckMs = 0;
+	uint16_t linktype;
+	size_t beginOffset = f->points[ck->firstPoint].offset;
+	size_t endOffset = (ck->endPoint < f->nPoints) ? f->points[ck->endPoint].offset : f->size;
+	uint64_t beginMs = f->points[ck->firstPoint].tsNs / 1000000;
+	uint64_t endMs = (ck->endPoint < f->nPoints) ? f->points[ck->endPoint].tsNs / 1000000 : UINT64_MAX;
+	int p = ck->firstPoint, rec, isHomePlug;
+	/* warm-up: start early enough to see the beginning of the sessions which run into our range */
+	while ((p > 0) && (f->points[p-1].tsNs/1000000 + SESSION_MARGIN_MS > beginMs)) p--;
+	if (p > 0) p--;
+	c.offset = (ck->firstPoint == 0) ? 0 : f->points[p].offset;
+	c.section = (ck->firstPoint == 0) ? 0 : f->points[p].section;
+	cc.result = r;
+	cc.ownFromMs = (ck->firstPoint == 0) ? 0 : beginMs;
+	cc.ownToMs = endMs;
+	cc.atEndOfCapture = 0;
+	cc.ix = ck->ix;
+	cc.cursor = &c;
+	currentChunk = &cc;
+	slacReset();
+	slacSetTransitionCallback(analyzerTransition);
+	for (;;) {
+		cc.recordOffset = c.offset;
+		rec = captureReaderNext(f, &c, 0, &frame, &capLen, &tsNs, &linktype);
+		if (rec < 0) {
+			cc.atEndOfCapture = 1;
+			break;
+		}
+		if (rec == 0) continue;
+		if (tsNs == 0) tsNs = lastTsNs; /* simple packet block */
+		lastTsNs = tsNs;
+		tsMs = tsNs / 1000000;
+		if ((c.offset > endOffset) && (tsMs > endMs + SESSION_MARGIN_MS)) break; /* overrun is over. endOffset is the file end for the last chunk. */
+		if (tsMs >= lastCheckMs + 100) {
+			slacCheckTimeouts(tsMs);
+			lastCheckMs = tsMs;
+		}
+		if (linktype != PCAP_LINKTYPE_ETHERNET) {
+			if ((c.offset > beginOffset) && (c.offset <= endOffset)) r->nSkippedLinktype++;
+			continue;
+		}
+		isHomePlug = (capLen >= sizeof(struct ethhdr)+sizeof(struct homeplug_hdr)) &&
+		             (frame[12] == (ETH_P_HPAV>>8)) && (frame[13] == (ETH_P_HPAV & 0xff));
+		if ((c.offset > beginOffset) && (c.offset <= endOffset)) {
+			/* our own range: statistics */
+			r->nFrames++;
+			r->nBytes += capLen;
+			if ((r->firstTsNs == 0) || (tsNs < r->firstTsNs)) r->firstTsNs = tsNs;
+			if (tsNs > r->lastTsNs) r->lastTsNs = tsNs;
+			if (isHomePlug) {
+				const struct homeplug_hdr *hph = (const struct homeplug_hdr *)(frame+sizeof(struct ethhdr));
+				uint16_t mmtype = LE16TOH(hph->MMTYPE);
+				r->nHomePlug++;
+				r->mmCount[mmtype]++;
+				if ((mmtype == CM_SET_KEY + MMTYPE_CNF) && (capLen > offsetof(cm_set_key_confirm, RESULT))) {
+					if (((const cm_set_key_confirm *)frame)->RESULT == 0) r->nSetKeyOk++; else r->nSetKeyFailed++;
+				}
+			} else {
+				r->nOther++;
+			}
+		}
+		/* the SLAC tracking sees also the warm-up and overrun */
+		if (isHomePlug) {
+			const struct homeplug_hdr *hph = (const struct homeplug_hdr *)(frame+sizeof(struct ethhdr));
+			slac_session *s = slacObserveFrame(frame, capLen, tsMs);
+			if (s) {
+				if (s->nCaptureFrames == 0) s->captureFirstOffset = cc.recordOffset;
+				s->captureLastOffset = cc.recordOffset;
+				s->nCaptureFrames++;
+			}
+			if (LE16TOH(hph->MMTYPE) == CM_SET_KEY + MMTYPE_CNF) {
+				slacObserveSetKeyConfirm(frame, capLen, tsMs);
+			}
+		}
+	}
+	/* the sessions which are still open: at the end of the capture they are "open",
+	   otherwise they had no progress during the overrun, so they are timed out */
+	slacCheckTimeouts((lastTsNs/1000000) + SLAC_SESSION_TIMEOUT_MS + 1);
+	currentChunk = NULL;
+}
+
+/*********************************************************************/
+/* work-stealing thread pool */
+
+typedef struct task {
+	void (*function)(void *arg, analysis_result *r);
+	void *arg;
+} task;
+
+typedef struct worker {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	task *tasks;
+	int head, tail; /* own work is taken from the tail, stolen work from the head */
+	analysis_result *result;
+} worker;
+
+static worker workers[MAX_WORKERS];
+static int nWorkers;
+static uint64_t nSteals;
+static pthread_mutex_t stealCountLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int popOwn(worker *w, task *t) {
+	int ok = 0;
+	pthread_mutex_lock(&w->lock);
+	if (w->tail > w->head) {
+		*t = w->tasks[--w->tail];
+		ok = 1;
+	}
+	pthread_mutex_unlock(&w->lock);
+	return ok;
+}
+
+static int steal(worker *w, task *t) {
+	int ok = 0;
+	pthread_mutex_lock(&w->lock);
+	if (w->tail > w->head) {
+		*t = w->tasks[w->head++];
+		ok = 1;
+	}
+	pthread_mutex_unlock(&w->lock);
+	return ok;
+}
+
+static void *workerThread(void *arg) {
+	worker *w = arg;
+	int self = w - workers, i, found;
+	task t;
+	for (;;) {
+		found = popOwn(w, &t);
+		for (i=1; !found && (i<nWorkers); i++) {
+			found = steal(&workers[(self+i) % nWorkers], &t);
+			if (found) {
+				pthread_mutex_lock(&stealCountLock);
+				nSteals++;
+				pthread_mutex_unlock(&stealCountLock);
+			}
+		}
+		if (!found) break; /* no new tasks come during a run, so we are done */
+		t.function(t.arg, w->result);
+	}
+	return NULL;
+}
+
+/* Runs the tasks on all workers and waits until all are done. The tasks should
+   be sorted with the biggest first; they are dealt out round robin. */
+static void poolRun(task *tasks, int nTasks) {
+	int i;
+	for (i=0; i<nWorkers; i++) {
+		workers[i].head = workers[i].tail = 0;
+	}
+	for (i=nTasks-1; i>=0; i--) {
+		/* reverse, so that each worker pops its biggest task first */
+		worker *w = &workers[i % nWorkers];
+		w->tasks[w->tail++] = tasks[i];
+	}
+	for (i=0; i<nWorkers; i++) pthread_create(&workers[i].thread, NULL, workerThread, &workers[i]);
+	for (i=0; i<nWorkers; i++) pthread_join(workers[i].thread, NULL);
+}
+
+static void indexTask(void *arg, analysis_result *r) {
+	(void)r;
+	indexFile(arg);
+}
+
+static void chunkTask(void *arg, analysis_result *r) {
+	analyzeChunk(arg, r);
+}
+
+/*********************************************************************/
+/* report */
+
+static void mergeResult(analysis_result *total, const analysis_result *r) {
+	int i;
+	total->nFrames += r->nFrames;
+	total->nBytes += r->nBytes;
+	total->nHomePlug += r->nHomePlug;
+	total->nOther += r->nOther;
+	total->nSkippedLinktype += r->nSkippedLinktype;
+	for (i=0; i<65536; i++) total->mmCount[i] += r->mmCount[i];
+	total->nSetKeyOk += r->nSetKeyOk;
+	total->nSetKeyFailed += r->nSetKeyFailed;
+	total->nSessions += r->nSessions;
+	total->nKeySet += r->nKeySet;
+	total->nKeyFailed += r->nKeyFailed;
+	total->nTimeout += r->nTimeout;
+	total->nOpenAtEnd += r->nOpenAtEnd;
+	for (i=0; i<SLAC_NUMBER_OF_STATES; i++) total->timeoutInState[i] += r->timeoutInState[i];
+	for (i=0; i<DURATION_BUCKETS; i++) total->durationHistogram[i] += r->durationHistogram[i];
+	if (r->durationMaxMs > total->durationMaxMs) total->durationMaxMs = r->durationMaxMs;
+	if (r->firstTsNs && ((total->firstTsNs == 0) || (r->firstTsNs < total->firstTsNs))) total->firstTsNs = r->firstTsNs;
+	if (r->lastTsNs > total->lastTsNs) total->lastTsNs = r->lastTsNs;
+}
+
+static uint64_t durationPercentile(const analysis_result *r, int percent) {
+	uint64_t n = 0, limit = (r->nKeySet * percent + 99) / 100;
+	int i;
+	for (i=0; i<DURATION_BUCKETS; i++) {
+		n += r->durationHistogram[i];
+		if (n >= limit) break;
+	}
+	if ((uint64_t)(i+1) * DURATION_BUCKET_MS < r->durationMaxMs) return (uint64_t)(i+1) * DURATION_BUCKET_MS;
+	return r->durationMaxMs;
+}
+
+static const analysis_result *sortResult; /* for qsort, which has no context parameter */
+
+static int compareMmCount(const void *a, const void *b) {
+	uint64_t ca = sortResult->mmCount[*(const uint16_t *)a];
+	uint64_t cb = sortResult->mmCount[*(const uint16_t *)b];
+	return (ca < cb) ? 1 : (ca > cb) ? -1 : 0;
+}
+
+static void printReport(const analysis_result *r, int nFiles, uint64_t nFileBytes, double seconds) {
+	static uint16_t order[65536];
+	char strName[MMTYPE_NAME_LEN];
+	int i, n=0;
+	time_t t;
+	printf("files: %d, %.1f MB in %.2f s with %d threads, %.1f MB/s, %lu steals\n", nFiles, nFileBytes/1e6, seconds,
+		nWorkers, (seconds > 0) ? nFileBytes/1e6/seconds : 0.0, (unsigned long)nSteals);
+	if (r->firstTsNs) {
+		char s1[40], s2[40];
+		t = r->firstTsNs / 1000000000ull;
+		strftime(s1, sizeof(s1), "%Y-%m-%d %H:%M:%S", localtime(&t));
+		t = r->lastTsNs / 1000000000ull;
+		strftime(s2, sizeof(s2), "%Y-%m-%d %H:%M:%S", localtime(&t));
+		printf("time range: %s .. %s\n", s1, s2);
+	}
+	printf("frames: %lu (%lu bytes), HomePlug %lu, other %lu, other link types %lu\n", (unsigned long)r->nFrames,
+		(unsigned long)r->nBytes, (unsigned long)r->nHomePlug, (unsigned long)r->nOther, (unsigned long)r->nSkippedLinktype);
+	printf("\nSLAC sessions: %lu\n", (unsigned long)r->nSessions);
+	printf("  key set      %lu\n", (unsigned long)r->nKeySet);
+	printf("  key failed   %lu\n", (unsigned long)r->nKeyFailed);
+	printf("  timeout      %lu\n", (unsigned long)r->nTimeout);
+	for (i=0; i<SLAC_NUMBER_OF_STATES; i++) {
+		if (r->timeoutInState[i]) printf("    in %-11s %lu\n", slacStateName(i), (unsigned long)r->timeoutInState[i]);
+	}
+	printf("  open at end  %lu\n", (unsigned long)r->nOpenAtEnd);
+	if (r->nKeySet) {
+		printf("  duration until key set: p50 <=%lu ms, p95 <=%lu ms, max %lu ms\n", (unsigned long)durationPercentile(r, 50),
+			(unsigned long)durationPercentile(r, 95), (unsigned long)r->durationMaxMs);
+	}
+	printf("\nCM_SET_KEY.CNF: ok %lu, failed %lu\n", (unsigned long)r->nSetKeyOk, (unsigned long)r->nSetKeyFailed);
+	printf("\nMMTYPE statistics:\n");
+	for (i=0; i<65536; i++) if (r->mmCount[i]) order[n++] = i;
+	sortResult = r;
+	qsort(order, n, sizeof(order[0]), compareMmCount);
+	for (i=0; i<n; i++) {
+		mmtypeName(order[i], strName);
+		printf("  0x%04x %-36s %12lu\n", order[i], strName, (unsigned long)r->mmCount[order[i]]);
+	}
+}
+
+/*********************************************************************/
+
+static int compareChunkSize(const void *a, const void *b) {
+	const chunk *ca = ((const task *)a)->arg;
+	const chunk *cb = ((const task *)b)->arg;
+	return (ca->size < cb->size) ? 1 : (ca->size > cb->size) ? -1 : 0;
+}
+
+static int compareFileSize(const void *a, const void *b) {
+	const capture_file *fa = ((const task *)a)->arg;
+	const capture_file *fb = ((const task *)b)->arg;
+	return (fa->size < fb->size) ? 1 : (fa->size > fb->size) ? -1 : 0;
+}
+
+static double getSeconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+void printUsage(void) {
+	printf("usage: plc_analyzer [-j threads] [-c chunkMB] [-x] file.pcap|file.pcapng ...\n");
+	printf("  -j  number of worker threads, default: number of CPUs\n");
+	printf("  -c  size of the work units in MB, default %d\n", DEFAULT_CHUNK_MB);
+	printf("  -x  write the session index file.idx of each file, for plc_query\n");
+}
+
+int main(int argc, char *argv[]) {
+	capture_file *files;
+	chunk *chunks;
+	task *tasks;
+	analysis_result *total;
+	session_index *indexes = NULL;
+	int writeIndex = 0;
+	int opt, i, j, k, nFiles=0, nChunks=0, maxChunks=0, pointsPerChunk;
+	int chunkMB = DEFAULT_CHUNK_MB;
+	uint64_t nFileBytes = 0;
+	double t0;
+	nWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "j:c:xh")) != -1) {
+		switch (opt) {
+			case 'j':
+				nWorkers = atoi(optarg);
+				break;
+			case 'c':
+				chunkMB = atoi(optarg);
+				break;
+			case 'x':
+				writeIndex = 1;
+				break;
+			default:
+				printUsage();
+				return -1;
+		}
+	}
+	if (optind >= argc) {
+		printUsage();
+		return -1;
+	}
+	if (nWorkers < 1) nWorkers = 1;
+	if (nWorkers > MAX_WORKERS) nWorkers = MAX_WORKERS;
+	if (chunkMB < 1) chunkMB = 1;
+	pointsPerChunk = chunkMB * (1024*1024 / INDEX_STRIDE);
+	t0 = getSeconds();
+
+	files = calloc(argc - optind, sizeof(capture_file));
+	tasks = calloc(argc - optind, sizeof(task));
+	if (!files || !tasks) return -1;
+	for (i=optind; i<argc; i++) {
+		if (captureReaderOpen(&files[nFiles], argv[i]) == 0) {
+			tasks[nFiles].function = indexTask;
+			tasks[nFiles].arg = &files[nFiles];
+			nFileBytes += files[nFiles].size;
+			nFiles++;
+		}
+	}
+	for (i=0; i<nWorkers; i++) {
+		pthread_mutex_init(&workers[i].lock, NULL);
+		workers[i].result = calloc(1, sizeof(analysis_result));
+		if (!workers[i].result) return -1;
+	}
+
+	/* first pass: index the files, one task per file */
+	for (i=0; i<nWorkers; i++) workers[i].tasks = malloc((nFiles/nWorkers + 1) * sizeof(task));
+	qsort(tasks, nFiles, sizeof(task), compareFileSize);
+	poolRun(tasks, nFiles);
+	for (i=0; i<nWorkers; i++) free(workers[i].tasks);
+	free(tasks);
+
+	/* second pass: the chunks */
+	for (i=0; i<nFiles; i++) {
+		if (files[i].corrupt) fprintf(stderr, "%s: corrupt or truncated, analyzed up to the damage\n", files[i].name);
+		maxChunks += files[i].nPoints / pointsPerChunk + 1;
+	}
+	chunks = calloc(maxChunks, sizeof(chunk));
+	tasks = calloc(maxChunks, sizeof(task));
+	if (!chunks || !tasks) return -1;
+	if (writeIndex) {
+		indexes = calloc(nFiles, sizeof(session_index));
+		if (!indexes) return -1;
+	}
+	for (i=0; i<nFiles; i++) {
+		capture_file *f = &files[i];
+		for (j=0; j<f->nPoints; j+=pointsPerChunk) {
+			chunk *ck = &chunks[nChunks];
+			k = j + pointsPerChunk;
+			if (k > f->nPoints) k = f->nPoints;
+			ck->file = f;
+			ck->ix = indexes ? &indexes[i] : NULL;
+			ck->firstPoint = j;
+			ck->endPoint = k;
+			ck->size = ((k < f->nPoints) ? f->points[k].offset : f->size) - f->points[j].offset;
+			tasks[nChunks].function = chunkTask;
+			tasks[nChunks].arg = ck;
+			nChunks++;
+		}
+	}
+	for (i=0; i<nWorkers; i++) workers[i].tasks = malloc((nChunks/nWorkers + 1) * sizeof(task));
+	qsort(tasks, nChunks, sizeof(task), compareChunkSize);
+	poolRun(tasks, nChunks);
+
+	total = calloc(1, sizeof(analysis_result));
+	if (!total) return -1;
+	for (i=0; i<nWorkers; i++) mergeResult(total, workers[i].result);
+	printReport(total, nFiles, nFileBytes, getSeconds() - t0);
+
+	for (i=0; i<nFiles; i++) {
+		if (indexes) {
+			if (sessionIndexWrite(&indexes[i], files[i].name, files[i].size) < 0) {
+				fprintf(stderr, "%s: could not write the session index\n", files[i].name);
+			} else {
+				printf("%s%s: %d sessions\n", files[i].name, SESSION_INDEX_SUFFIX, indexes[i].nRecords);
+			}
+			sessionIndexFree(&indexes[i]);
+		}
+		captureReaderClose(&files[i]);
+		free(files[i].points);
+	}
+	return 0;
+}
@@ -0,0 +1,275 @@
+/* The freestanding core (plccore.h) on Linux
+ *
+ *    ./plc_core -i interface     run the core live: SLAC tracking and the CM_SET_KEY.REQ
+ *    ./plc_core -r capture ...   replay the captures through the core, and compare
+ *                                - the CM_SET_KEY.REQ with a reference, which is filled
+ *                                  field by field into cm_set_key_request (plc_homeplug.h),
+ *                                  like listen_to_eth did it before the core
+ *                                - the transitions with slacsession.c. That is the same
+ *                                  session tracking (plcCoreObserve()), so this checks only
+ *                                  its table of SLAC_MAX_SESSIONS, the thread-local wrapper
+ *                                  and the separate CM_SET_KEY.CNF path, not the state
+ *                                  machine itself.
+ *    ./plc_core -m               the memory budget of the core
+ *
+ * With -r, the exit code is 1 if anything differs.
+ * The code size of the core: make coresize.
+ *
+ * Change Log
+ *   2026-10-19
+ *    - neu angelegt
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netinet/if_ether.h>
+#include <arpa/inet.h>
+
+#include "plc_homeplug.h"
+#include "plccore.h"
+#include "plccore_linux.h"
+#include "slacsession.h"
+#include "capture.h"
+#include "capreader.h"
+
+/* the sizes are fixed by the wire format, the core does not use the structs */
+typedef char setkey_length_check[(sizeof(cm_set_key_request) == PLCCORE_SET_KEY_REQ_LEN) ? 1 : -1];
+typedef char getkey_length_check[(sizeof(cm_get_key_request) == PLCCORE_GET_KEY_REQ_LEN) ? 1 : -1];
+typedef char match_length_check[(sizeof(cm_slac_match_confirm) == PLCCORE_MATCH_CNF_LEN) ? 1 : -1];
+
+static volatile sig_atomic_t stopRequested;
+static plccore core;
+
+static void onSignal(int sig) {
+	stopRequested = 1;
+}
+
+static void printMac(const uint8_t *mac) {
+	printf("%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+static void printBudget(void) {
+	printf("plccore: %d sessions of %d bytes, %d bytes in total, budget %d bytes (PLCCORE_MAX_SESSIONS, PLCCORE_RAM_BUDGET)\n",
+		PLCCORE_MAX_SESSIONS, (int)sizeof(plccore_session), (int)sizeof(plccore), PLCCORE_RAM_BUDGET);
+	printf("stack: %d bytes for the decoded message, no recursion\n", (int)sizeof(plccore_mme));
+	printf("Linux adapter: %d bytes, with the receive and transmit buffer\n", (int)sizeof(plccore_linux));
+}
+
+/*********************************************************************/
+/* Live */
+
+static void liveTransition(plccore *c, const plccore_session *s, int oldState) {
+	printf("SLAC session of PEV ");
+	printMac(s->pevMac);
+	printf(": %s -> %s\n", plcCoreStateName(oldState), plcCoreStateName(s->state));
+	fflush(stdout);
+}
+
+static int runLive(const char *ifName) {
+	plccore_linux adapter;
+	uint8_t modemMac[ETH_ALEN] = { MY_DEST_MAC0, MY_DEST_MAC1, MY_DEST_MAC2, MY_DEST_MAC3, MY_DEST_MAC4, MY_DEST_MAC5 };
+	if (plcCoreLinuxOpen(&adapter, ifName) < 0) {
+		perror(ifName);
+		return 1;
+	}
+	plcCoreInit(&core, adapter.ownMac, modemMac, liveTransition, NULL);
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+	printf("core running on %s, ", ifName);
+	printMac(adapter.ownMac);
+	printf(", Ctrl-C to stop\n");
+	fflush(stdout);
+	while (!stopRequested) {
+		if (plcCoreLinuxPoll(&adapter, &core, 100) < 0) {
+			perror("poll");
+			break;
+		}
+	}
+	printf("frames %u, sessions %u, timeouts %u, CM_SET_KEY.REQ %u, sent %u, send errors %u\n",
+		core.nFrames, core.nSessions, core.nTimeouts, core.nSetKeys, adapter.nSent, adapter.nSendErrors);
+	plcCoreLinuxClose(&adapter);
+	return 0;
+}
+
+/*********************************************************************/
+/* Replay: the core against slacsession.c and the reference CM_SET_KEY.REQ */
+
+#define MAX_STEP_TRANSITIONS 64
+
+typedef struct transition {
+	uint8_t pevMac[ETH_ALEN];
+	uint8_t oldState, newState;
+} transition;
+
+typedef struct transition_list {
+	transition t[MAX_STEP_TRANSITIONS];
+	int n;
+} transition_list;
+
+static const uint8_t replayOwnMac[ETH_ALEN] = { 0x02, 0, 0, 0, 0, 0x01 };
+static const uint8_t replayModemMac[ETH_ALEN] = { MY_DEST_MAC0, MY_DEST_MAC1, MY_DEST_MAC2, MY_DEST_MAC3, MY_DEST_MAC4, MY_DEST_MAC5 };
+static transition_list coreSteps, referenceSteps;
+static uint32_t nEndStates[PLCCORE_NUMBER_OF_STATES];
+static uint32_t nFrames, nTransitions, nMismatches, nSetKeyCompared, nSetKeyDifferent;
+
+static void addTransition(transition_list *l, const uint8_t *pevMac, int oldState, int newState) {
+	if (l->n >= MAX_STEP_TRANSITIONS) return;
+	memcpy(l->t[l->n].pevMac, pevMac, ETH_ALEN);
+	l->t[l->n].oldState = oldState;
+	l->t[l->n].newState = newState;
+	l->n++;
+}
+
+static void coreTransition(plccore *c, const plccore_session *s, int oldState) {
+	addTransition(&coreSteps, s->pevMac, oldState, s->state);
+}
+
+static void referenceTransition(const slac_session *s, int oldState) {
+	addTransition(&referenceSteps, s->core.pevMac, oldState, s->core.state);
+}
+
+/* after each frame and each timeout check, both must have done the same */
+static void compareSteps(const char *fileName, uint64_t nowMs) {
+	int i;
+	if ((coreSteps.n != referenceSteps.n) || memcmp(coreSteps.t, referenceSteps.t, coreSteps.n * sizeof(transition))) {
+		if (nMismatches < 10) {
+			printf("%s, frame %u at %llu ms: core", fileName, nFrames, (unsigned long long)nowMs);
+			for (i=0; i<coreSteps.n; i++) printf(" %s->%s", plcCoreStateName(coreSteps.t[i].oldState), plcCoreStateName(coreSteps.t[i].newState));
+			printf(", slacsession.c");
+			for (i=0; i<referenceSteps.n; i++) printf(" %s->%s", slacStateName(referenceSteps.t[i].oldState), slacStateName(referenceSteps.t[i].newState));
+			printf("\n");
+		}
+		nMismatches++;
+	}
+	for (i=0; i<coreSteps.n; i++) {
+		if ((coreSteps.t[i].newState == PLCCORE_STATE_KEY_SET) || (coreSteps.t[i].newState == PLCCORE_STATE_KEY_FAILED) ||
+		    (coreSteps.t[i].newState == PLCCORE_STATE_TIMEOUT)) nEndStates[coreSteps.t[i].newState]++;
+	}
+	nTransitions += coreSteps.n;
+	coreSteps.n = referenceSteps.n = 0;
+}
+
+static void checkTimeouts(const char *fileName, uint64_t nowMs) {
+	plcCoreCheckTimeouts(&core, nowMs);
+	slacCheckTimeouts(nowMs);
+	compareSteps(fileName, nowMs);
+}
+
+/* Does not share code with plcCoreEncodeSetKey(), which the key cache also uses */
+static void referenceSetKey(cm_set_key_request *f, const uint8_t *nid, const uint8_t *nmk) {
+	memset(f, 0, sizeof(*f));
+	memcpy(f->ethernet.h_dest, replayModemMac, ETH_ALEN);
+	memcpy(f->ethernet.h_source, replayOwnMac, ETH_ALEN);
+	f->ethernet.h_proto = htons(ETH_P_HPAV);
+	f->homeplug.MMV = HOMEPLUG_MMV;
+	f->homeplug.MMTYPE = HTOLE16(CM_SET_KEY | MMTYPE_REQ);
+	f->KEYTYPE = SLAC_CM_SETKEY_KEYTYPE;
+	f->PID = 4; /* ISO15118-3, "HLE protocol" */
+	memcpy(f->NID, nid, SLAC_NID_LEN);
+	f->NEWEKS = SLAC_CM_SETKEY_EKS;
+	memcpy(f->NEWKEY, nmk, SLAC_NMK_LEN);
+}
+
+static void replayFrame(const char *fileName, const uint8_t *frame, int len, uint64_t nowMs) {
+	uint8_t tx[PLCCORE_SET_KEY_REQ_LEN];
+	const struct homeplug_hdr *hph = (const struct homeplug_hdr *)(frame + sizeof(struct ethhdr));
+	int txLen;
+	nFrames++;
+	checkTimeouts(fileName, nowMs);
+	txLen = plcCoreReceive(&core, frame, len, nowMs, tx, sizeof(tx));
+	/* like listen_to_eth: reactOnSlacMatch(), slacObserveFrame(), decodeCM_SET_KEY__CNF() */
+	if ((len >= (int)(sizeof(struct ethhdr) + sizeof(struct homeplug_hdr))) && (frame[12] == (ETH_P_HPAV >> 8)) && (frame[13] == (ETH_P_HPAV & 0xff))) {
+		uint16_t mmtype = LE16TOH(hph->MMTYPE);
+		if ((mmtype == (CM_SLAC_MATCH | MMTYPE_CNF)) && (len >= (int)sizeof(cm_slac_match_confirm))) {
+			const cm_slac_match_confirm *mc = (const cm_slac_match_confirm *)frame;
+			cm_set_key_request reference;
+			referenceSetKey(&reference, mc->MatchVarField.NID, mc->MatchVarField.NMK);
+			nSetKeyCompared++;
+			if ((txLen != sizeof(reference)) || memcmp(tx, &reference, sizeof(reference))) {
+				if (nSetKeyDifferent < 10) printf("%s, frame %u: the CM_SET_KEY.REQ differs\n", fileName, nFrames);
+				nSetKeyDifferent++;
+			}
+		}
+		slacObserveFrame(frame, len, nowMs);
+		if (mmtype == (CM_SET_KEY | MMTYPE_CNF)) {
+			slacObserveSetKeyConfirm(frame, len, nowMs);
+		}
+	}
+	compareSteps(fileName, nowMs);
+}
+
+static int replayFile(const char *fileName, uint64_t *lastMs) {
+	capture_file f;
+	capture_cursor c = { 0, 0 };
+	const uint8_t *frame;
+	uint32_t capLen;
+	uint64_t tsNs;
+	uint16_t linktype;
+	int r;
+	if (captureReaderOpen(&f, fileName) < 0) return -1;
+	while ((r = captureReaderNext(&f, &c, 1, &frame, &capLen, &tsNs, &linktype)) >= 0) {
+		if ((r == 0) || (linktype != PCAP_LINKTYPE_ETHERNET)) continue;
+		*lastMs = tsNs / 1000000;
+		replayFrame(fileName, frame, capLen, *lastMs);
+	}
+	if (f.corrupt) printf("%s: corrupt, read up to the damage\n", fileName);
+	captureReaderClose(&f);
+	return 0;
+}
+
+static int runReplay(int nFiles, char **files) {
+	uint64_t lastMs = 0;
+	int i;
+	plcCoreInit(&core, replayOwnMac, replayModemMac, coreTransition, NULL);
+	core.passive = 1; /* the captures are of another station, like slacsession.c offline */
+	slacSetTransitionCallback(referenceTransition);
+	for (i=0; i<nFiles; i++) {
+		if (replayFile(files[i], &lastMs) < 0) return 1;
+	}
+	/* the sessions which were open at the end */
+	checkTimeouts("end", lastMs + PLCCORE_SESSION_TIMEOUT_MS + 1);
+	printf("%u frames, %u HomePlug, %u sessions, %u transitions, %u mismatches\n",
+		nFrames, core.nFrames, core.nSessions, nTransitions, nMismatches);
+	printf("end states: KEY_SET %u, KEY_FAILED %u, TIMEOUT %u\n",
+		nEndStates[PLCCORE_STATE_KEY_SET], nEndStates[PLCCORE_STATE_KEY_FAILED], nEndStates[PLCCORE_STATE_TIMEOUT]);
+	printf("CM_SET_KEY.REQ: %u compared with the reference, %u different\n", nSetKeyCompared, nSetKeyDifferent);
+	printBudget();
+	return (nMismatches || nSetKeyDifferent) ? 1 : 0;
+}
+
+static void printUsage(void) {
+	printf("usage: plc_core -i interface | -r capture ... | -m\n");
+	printf("  -i  run the core on the interface\n");
+	printf("  -r  replay the captures through the core, compare the CM_SET_KEY.REQ with a reference\n");
+	printf("      and the transitions with slacsession.c (its table and wrapper, the same tracking)\n");
+	printf("  -m  show the memory budget of the core\n");
+}
+
+int main(int argc, char *argv[]) {
+	int opt;
+	while ((opt = getopt(argc, argv, "i:rmh")) != -1) {
+		switch (opt) {
+			case 'i':
+				return runLive(optarg);
+			case 'r':
+				if (optind >= argc) {
+					printUsage();
+					return 1;
+				}
+				return runReplay(argc - optind, argv + optind);
+			case 'm':
+				printBudget();
+				return 0;
+			default:
+				printUsage();
+				return 1;
+		}
+	}
+	printUsage();
+	return 1;
+}
@@ -369,11 +369,149 @@ typedef struct __packed cm_get_key_confirm
 	}
 	cm_get_key_confirm;
 
+/* The CM_GET_DEVICE_SW_VERSION is vendor specific (Qualcomm VS_SW_VER). It uses
+   MMV=0, so there are no FMSN and FMID, but the vendor OUI follows the MMTYPE. */
+#define SW_VERSION_MAX_LEN 128
+typedef struct __packed cm_get_sw_version_confirm
+	{
+		struct ethhdr ethernet;
+		struct homeplug_hdr homeplug;
+		uint8_t OUI [3];
+		uint8_t MSTATUS;
+		uint8_t MDEVICEID;
+		uint8_t MVERLENGTH;
+		uint8_t MVERSION [SW_VERSION_MAX_LEN]; /* variable length, MVERLENGTH */
+	}
+	cm_get_sw_version_confirm;
+
 
 #ifndef __GNUC__
 #pragma pack (push, 1)
 #endif
 
+typedef struct __packed cm_slac_param_request
+{
+	struct ethhdr ethernet;
+	struct homeplug_fmi homeplug;
+	uint8_t APPLICATION_TYPE;
+	uint8_t SECURITY_TYPE;
+	uint8_t RunID [SLAC_RUNID_LEN];
+}
+cm_slac_param_request;
+
+typedef struct __packed cm_slac_param_confirm
+{
+	struct ethhdr ethernet;
+	struct homeplug_fmi homeplug;
+	uint8_t MSOUND_TARGET [ETHER_ADDR_LEN];
+	uint8_t NUM_SOUNDS;
+	uint8_t TIME_OUT;
+	uint8_t RESP_TYPE;
+	uint8_t FORWARDING_STA [ETHER_ADDR_LEN];
+	uint8_t APPLICATION_TYPE;
+	uint8_t SECURITY_TYPE;
+	uint8_t RunID [SLAC_RUNID_LEN];
+}
+cm_slac_param_confirm;
+
+typedef struct __packed cm_start_atten_char_indicate
+{
+	struct ethhdr ethernet;
+	struct homeplug_fmi homeplug;
+	uint8_t APPLICATION_TYPE;
+	uint8_t SECURITY_TYPE;
+	struct __packed
+	{
+		uint8_t NUM_SOUNDS;
+		uint8_t TIME_OUT;
+		uint8_t RESP_TYPE;
+		uint8_t FORWARDING_STA [ETHER_ADDR_LEN];
+		uint8_t RunID [SLAC_RUNID_LEN];
+	}
+	ACVarField;
+}
+cm_start_atten_char_indicate;
+
+typedef struct __packed cm_mnbc_sound_indicate
+{
+	struct ethhdr ethernet;
+	struct homeplug_fmi homeplug;
+	uint8_t APPLICATION_TYPE;
+	uint8_t SECURITY_TYPE;
+	struct __packed
+	{
+		uint8_t SenderID [SLAC_UNIQUE_ID_LEN];
+		uint8_t CNT;
+		uint8_t RunID [SLAC_RUNID_LEN];
+		uint8_t RSVD [8];
+		uint8_t RND [SLAC_RND_LEN];
+	}
+	MSVarField;
+}
+cm_mnbc_sound_indicate;
+
+typedef struct __packed cm_atten_char_indicate
+{
+	struct ethhdr ethernet;
+	struct homeplug_fmi homeplug;
+	uint8_t APPLICATION_TYPE;
+	uint8_t SECURITY_TYPE;
+	struct __packed
+	{
+		uint8_t SOURCE_ADDRESS [ETHER_ADDR_LEN];
+		uint8_t RunID [SLAC_RUNID_LEN];
+		uint8_t SOURCE_ID [SLAC_UNIQUE_ID_LEN];
+		uint8_t RESP_ID [SLAC_UNIQUE_ID_LEN];
+		uint8_t NUM_SOUNDS;
+		struct __packed
+		{
+			uint8_t NumGroups;
+			uint8_t AAG [SLAC_GROUPS];
+		}
+		ATTEN_PROFILE;
+	}
+	ACVarField;
+}
+cm_atten_char_indicate;
+
+typedef struct __packed cm_atten_char_response
+{
+	struct ethhdr ethernet;
+	struct homeplug_fmi homeplug;
+	uint8_t APPLICATION_TYPE;
+	uint8_t SECURITY_TYPE;
+	struct __packed
+	{
+		uint8_t SOURCE_ADDRESS [ETHER_ADDR_LEN];
+		uint8_t RunID [SLAC_RUNID_LEN];
+		uint8_t SOURCE_ID [SLAC_UNIQUE_ID_LEN];
+		uint8_t RESP_ID [SLAC_UNIQUE_ID_LEN];
+		uint8_t Result;
+	}
+	ACVarField;
+}
+cm_atten_char_response;
+
+typedef struct __packed cm_slac_match_request
+{
+	struct ethhdr ethernet;
+	struct homeplug_fmi homeplug;
+	uint8_t APPLICATION_TYPE;
+	uint8_t SECURITY_TYPE;
+	uint16_t MVFLength;
+	struct __packed
+	{
+		uint8_t PEV_ID [SLAC_UNIQUE_ID_LEN];
+		uint8_t PEV_MAC [ETHER_ADDR_LEN];
+		uint8_t EVSE_ID [SLAC_UNIQUE_ID_LEN];
+		uint8_t EVSE_MAC [ETHER_ADDR_LEN];
+		uint8_t RunID [SLAC_RUNID_LEN];
+		uint8_t RSVD [8];
+	}
+	MatchVarField;
+}
+cm_slac_match_request;
+
 typedef struct __packed cm_slac_match_confirm
 {
 	struct ethhdr ethernet;
@@ -397,6 +535,69 @@ typedef struct __packed cm_slac_match_confirm
 }
 cm_slac_match_confirm;
 
+/* HomePlug AV 1.1, CM_NW_INFO.CNF: the networks of which the station is a member.
+   The request has no payload. */
+typedef struct __packed cm_nw_info_network
+{
+	uint8_t NID [SLAC_NID_LEN];
+	uint8_t SNID;
+	uint8_t TEI;
+	uint8_t StationRole; /* 0 station, 1 proxy coordinator, 2 central coordinator */
+	uint8_t CCo_MAC [ETHER_ADDR_LEN];
+	uint8_t Access;
+	uint8_t NumCordNWs;
+}
+cm_nw_info_network;
+
+typedef struct __packed cm_nw_info_confirm
+{
+	struct ethhdr ethernet;
+	struct homeplug_fmi homeplug;
+	uint8_t NumNWs;
+	cm_nw_info_network NW [];
+}
+cm_nw_info_confirm;
+
+/* HomePlug AV 1.1, CM_NW_STATS.CNF: the average PHY rates to the other stations
+   of the network, in Mbit/s. The request has no payload. */
+typedef struct __packed cm_nw_stats_station
+{
+	uint8_t DA [ETHER_ADDR_LEN];
+	uint16_t AvgPHYDR_TX;
+	uint16_t AvgPHYDR_RX;
+}
+cm_nw_stats_station;
+
+typedef struct __packed cm_nw_stats_confirm
+{
+	struct ethhdr ethernet;
+	struct homeplug_fmi homeplug;
+	uint8_t NumSTAs;
+	cm_nw_stats_station STA [];
+}
+cm_nw_stats_confirm;
+
+/* HomePlug AV 1.1 table 11-178. The encrypted part (after LEN, multiple of 16 bytes, AES-128-CBC) contains:
+   random filler (RFLEN bytes), the embedded MME (LEN bytes), CRC-32 of the MME,
+   PID, PRN, PMN, padding, RFLEN (last byte). */
+#define HOMEPLUG_PEKS_DAK 0x00
+#define HOMEPLUG_PEKS_NMK 0x01
+#define HOMEPLUG_PEKS_NONE 0x0F
+typedef struct __packed cm_encrypted_payload_indicate
+	{
+		struct ethhdr ethernet;
+		struct homeplug_fmi homeplug;
+		uint8_t PEKS; /* payload encryption key select */
+		uint8_t AVLNSTATUS;
+		uint8_t PID;
+		uint16_t PRN;
+		uint8_t PMN;
+		uint8_t IV [16];
+		uint16_t LEN; /* length of the embedded MME */
+		uint8_t PAYLOAD []; /* encrypted */
+	}
+	cm_encrypted_payload_indicate;
+
 #ifndef __GNUC__
 #pragma pack (pop)
 #endif
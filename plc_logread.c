@@ -0,0 +1,115 @@
+/* Reader of the compressed log segments of listen_to_eth -L
+ *
+ * Expands the segments (see logstore.h) back to the text of log.txt, the oldest
+ * first. A directory stands for all its segments.
+ *
+ *    ./plc_logread [-t] [-s] [-i] dir|segment ...
+ *
+ *   -t  each line with its time, local time with milliseconds
+ *   -s  the repetitions of a line as one line with the count, not expanded
+ *   -i  no text, only the statistics: lines, bytes as text and in the files
+ *
+ * Damaged blocks (e.g. the last one after a power cut) are skipped and counted.
+ *
+ * Change Log
+ *   2026-10-19
+ *    - neu angelegt
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "logstore.h"
+
+typedef struct read_options {
+	int withTime;
+	int summarize;
+	int statisticsOnly;
+} read_options;
+
+static void printTime(uint64_t unixMs) {
+	time_t t = unixMs / 1000;
+	struct tm tm;
+	char s[40];
+	localtime_r(&t, &tm);
+	strftime(s, sizeof(s), "%Y-%m-%d %H:%M:%S", &tm);
+	printf("%s.%03u ", s, (unsigned)(unixMs % 1000));
+}
+
+static void printRecord(const char *line, int len, uint64_t unixMs, uint32_t count, void *context) {
+	const read_options *o = context;
+	uint32_t i;
+	if (o->statisticsOnly) return;
+	if (o->summarize && (count > 1)) {
+		if (o->withTime) printTime(unixMs);
+		printf("%.*s [%u more times]\n", len, line, count);
+		return;
+	}
+	for (i=0; i<count; i++) {
+		if (o->withTime) printTime(unixMs);
+		printf("%.*s\n", len, line);
+	}
+}
+
+static int readSegment(const char *name, read_options *o, logstore_read_stats *stats) {
+	if (logStoreReadSegment(name, printRecord, o, stats) < 0) {
+		fprintf(stderr, "%s: not a log segment\n", name);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	read_options o;
+	logstore_read_stats stats;
+	int opt, i, j, nSegments = 0, errors = 0;
+	memset(&o, 0, sizeof(o));
+	memset(&stats, 0, sizeof(stats));
+	while ((opt = getopt(argc, argv, "tsih")) != -1) {
+		switch (opt) {
+			case 't': o.withTime = 1; break;
+			case 's': o.summarize = 1; break;
+			case 'i': o.statisticsOnly = 1; break;
+			default:
+				fprintf(stderr, "usage: %s [-t] [-s] [-i] dir|segment ...\n", argv[0]);
+				return 1;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "usage: %s [-t] [-s] [-i] dir|segment ...\n", argv[0]);
+		return 1;
+	}
+	for (i=optind; i<argc; i++) {
+		struct stat st;
+		if ((stat(argv[i], &st) == 0) && S_ISDIR(st.st_mode)) {
+			char **names;
+			int n = logStoreListSegments(argv[i], &names);
+			if (n < 0) {
+				fprintf(stderr, "%s: cannot read the directory\n", argv[i]);
+				errors++;
+				continue;
+			}
+			for (j=0; j<n; j++) {
+				if (readSegment(names[j], &o, &stats) < 0) errors++; else nSegments++;
+			}
+			logStoreFreeList(names, n);
+		} else {
+			if (readSegment(argv[i], &o, &stats) < 0) errors++; else nSegments++;
+		}
+	}
+	if (o.statisticsOnly) {
+		printf("%d segments, %u blocks, %u damaged\n", nSegments, stats.nBlocks, stats.nDamagedBlocks);
+		printf("%llu lines in %llu records\n", (unsigned long long)stats.nLines, (unsigned long long)stats.nRecords);
+		printf("%llu bytes as text, %llu bytes in the files, ratio %.1f\n",
+			(unsigned long long)stats.nTextBytes, (unsigned long long)stats.nFileBytes,
+			stats.nFileBytes ? (double)stats.nTextBytes / stats.nFileBytes : 0.0);
+	} else if (stats.nDamagedBlocks) {
+		fprintf(stderr, "%u damaged blocks skipped\n", stats.nDamagedBlocks);
+	}
+	return (errors || stats.nDamagedBlocks) ? 1 : 0;
+}
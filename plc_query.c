@@ -0,0 +1,254 @@
+/* Search of SLAC sessions in capture archives, with the session index
+ *
+ * Uses the index files <capture>.idx (see sessionindex.h), which are written by
+ * listen_to_eth -w and by plc_analyzer -x. The index is memory-mapped and searched
+ * binary, so that a query does not need to read the captures at all.
+ *
+ *    ./plc_query [-p PEV-MAC] [-e EVSE-MAC] [-r RunID] [-n NID] [-s from] [-t to] [-o out.pcap] capture ...
+ *
+ * Without -o, the matching sessions are listed. With -o, the frames of the matching
+ * sessions are extracted into a pcap file: everything from and to the PEV and the
+ * EVSE, and the CM_SET_KEY, between the first and the last frame of the session.
+ *
+ * Change Log
+ *   2026-10-19
+ *    - neu angelegt
+ */
+
+#define _GNU_SOURCE /* for strptime() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/if_ether.h>
+
+#include "plc_homeplug.h"
+#include "capture.h"
+#include "capreader.h"
+#include "slacsession.h"
+#include "sessionindex.h"
+
+typedef struct query_context {
+	const char *captureName;
+	capture_file *file; /* opened on the first match, for the extraction */
+	int interfacesScanned, sectionsIndexed;
+	FILE *out;
+	uint64_t nFramesWritten;
+} query_context;
+
+static int parseHex(const char *s, uint8_t *out, int len) {
+	int i = 0;
+	while (*s && (i < len)) {
+		if ((*s == ':') || (*s == '-')) {
+			s++;
+			continue;
+		}
+		if (!isxdigit((unsigned char)s[0]) || !isxdigit((unsigned char)s[1])) return -1;
+		if (sscanf(s, "%2hhx", &out[i]) != 1) return -1;
+		i++;
+		s += 2;
+	}
+	return ((i == len) && (*s == 0)) ? 0 : -1;
+}
+
+/* unix seconds, or local time "YYYY-MM-DD HH:MM:SS", "YYYY-MM-DDTHH:MM:SS", "YYYY-MM-DD" */
+static int parseTime(const char *s, uint64_t *ns) {
+	struct tm tm;
+	const char *end;
+	char *e;
+	unsigned long long sec = strtoull(s, &e, 10);
+	if ((*e == 0) && (e != s)) {
+		*ns = sec * 1000000000ull;
+		return 0;
+	}
+	memset(&tm, 0, sizeof(tm));
+	end = strptime(s, "%Y-%m-%d", &tm);
+	if (!end) return -1;
+	if (*end) {
+		if ((*end != ' ') && (*end != 'T')) return -1;
+		end = strptime(end+1, "%H:%M:%S", &tm);
+		if (!end || *end) return -1;
+	}
+	tm.tm_isdst = -1;
+	*ns = (uint64_t)mktime(&tm) * 1000000000ull;
+	return 0;
+}
+
+static void formatTime(uint64_t ns, char *s, size_t size) {
+	time_t t = ns / 1000000000ull;
+	size_t n = strftime(s, size, "%Y-%m-%d %H:%M:%S", localtime(&t));
+	snprintf(s+n, size-n, ".%03u", (unsigned)((ns / 1000000) % 1000));
+}
+
+static void printSession(const session_index_record *r, void *context) {
+	query_context *qc = context;
+	char strStart[40];
+	const uint8_t *p = r->pevMac, *e = r->evseMac;
+	formatTime(r->startNs, strStart, sizeof(strStart));
+	printf("%s  %s  %7.3f s  PEV %02x:%02x:%02x:%02x:%02x:%02x  EVSE %02x:%02x:%02x:%02x:%02x:%02x  RunID %02x%02x%02x%02x%02x%02x%02x%02x"
+		"  NID %02x%02x%02x%02x%02x%02x%02x  %s%s  %u frames @%lu\n",
+		qc->captureName, strStart, (r->endNs - r->startNs)/1e9,
+		p[0], p[1], p[2], p[3], p[4], p[5], e[0], e[1], e[2], e[3], e[4], e[5],
+		r->runId[0], r->runId[1], r->runId[2], r->runId[3], r->runId[4], r->runId[5], r->runId[6], r->runId[7],
+		r->nid[0], r->nid[1], r->nid[2], r->nid[3], r->nid[4], r->nid[5], r->nid[6],
+		slacStateName(r->state), (r->flags & SESSION_INDEX_FLAG_OPEN) ? " (open at end)" : "",
+		r->nFrames, (unsigned long)r->firstOffset);
+}
+
+static int belongsToSession(const session_index_record *r, const uint8_t *frame, uint32_t capLen) {
+	const struct ethhdr *eh = (const struct ethhdr *)frame;
+	const struct homeplug_hdr *hph = (const struct homeplug_hdr *)(frame+sizeof(struct ethhdr));
+	if (capLen < sizeof(struct ethhdr)) return 0;
+	if ((memcmp(eh->h_source, r->pevMac, ETH_ALEN)==0) || (memcmp(eh->h_dest, r->pevMac, ETH_ALEN)==0)) return 1;
+	if ((memcmp(eh->h_source, r->evseMac, ETH_ALEN)==0) || (memcmp(eh->h_dest, r->evseMac, ETH_ALEN)==0)) return 1;
+	/* the CM_SET_KEY goes between us and our modem */
+	return (capLen >= sizeof(struct ethhdr)+sizeof(struct homeplug_hdr)) && (frame[12] == (ETH_P_HPAV>>8)) &&
+	       (frame[13] == (ETH_P_HPAV & 0xff)) && ((LE16TOH(hph->MMTYPE) & 0xfffc) == CM_SET_KEY);
+}
+
+static void extractSession(const session_index_record *r, void *context) {
+	query_context *qc = context;
+	capture_file *f = qc->file;
+	capture_cursor c;
+	const uint8_t *frame;
+	uint32_t capLen;
+	uint64_t tsNs;
+	uint16_t linktype;
+	pcap_record_header rh;
+	int rec;
+	printSession(r, context);
+	if (!f) {
+		f = calloc(1, sizeof(capture_file));
+		if (!f || (captureReaderOpen(f, qc->captureName) < 0)) {
+			free(f);
+			return;
+		}
+		qc->file = f;
+	}
+	if ((r->section > 0) && !qc->sectionsIndexed) {
+		/* the interfaces of the later sections: one pass over the block headers */
+		capture_cursor all = { 0, 0 };
+		while (captureReaderNext(f, &all, 1, &frame, &capLen, &tsNs, &linktype) >= 0);
+		qc->sectionsIndexed = qc->interfacesScanned = 1;
+	} else if (!qc->interfacesScanned) {
+		captureReaderScanInterfaces(f);
+		qc->interfacesScanned = 1;
+	}
+	c.offset = r->firstOffset;
+	c.section = r->section;
+	while (c.offset <= r->lastOffset) {
+		rec = captureReaderNext(f, &c, 0, &frame, &capLen, &tsNs, &linktype);
+		if (rec < 0) break;
+		if ((rec == 0) || (linktype != PCAP_LINKTYPE_ETHERNET) || !belongsToSession(r, frame, capLen)) continue;
+		rh.tsSec = tsNs / 1000000000ull;
+		rh.tsFrac = tsNs % 1000000000ull;
+		rh.capLen = capLen;
+		rh.origLen = capLen;
+		fwrite(&rh, sizeof(rh), 1, qc->out);
+		fwrite(frame, 1, capLen, qc->out);
+		qc->nFramesWritten++;
+	}
+}
+
+void printUsage(void) {
+	printf("usage: plc_query [-p PEV-MAC] [-e EVSE-MAC] [-r RunID] [-n NID] [-s from] [-t to] [-o out.pcap] capture ...\n");
+	printf("  -p, -e  MAC as 11:22:33:44:55:66\n");
+	printf("  -r      RunID, 8 bytes hex\n");
+	printf("  -n      NID, 7 bytes hex\n");
+	printf("  -s, -t  sessions which overlap this time range, unix seconds or \"YYYY-MM-DD HH:MM:SS\"\n");
+	printf("  -o      write the frames of the matching sessions into a pcap file\n");
+	printf("The index capture.idx is written by listen_to_eth -w and by plc_analyzer -x.\n");
+}
+
+int main(int argc, char *argv[]) {
+	uint8_t pevMac[ETH_ALEN], evseMac[ETH_ALEN], runId[SLAC_RUNID_LEN], nid[SLAC_NID_LEN];
+	session_index_query q;
+	session_index_map m;
+	query_context qc;
+	const char *outName = NULL;
+	FILE *out = NULL;
+	int opt, i, nMatches = 0, ok = 1;
+	uint64_t nFramesWritten = 0;
+	memset(&q, 0, sizeof(q));
+	while ((opt = getopt(argc, argv, "p:e:r:n:s:t:o:h")) != -1) {
+		switch (opt) {
+			case 'p':
+				ok = (parseHex(optarg, pevMac, ETH_ALEN) == 0);
+				q.pevMac = pevMac;
+				break;
+			case 'e':
+				ok = (parseHex(optarg, evseMac, ETH_ALEN) == 0);
+				q.evseMac = evseMac;
+				break;
+			case 'r':
+				ok = (parseHex(optarg, runId, SLAC_RUNID_LEN) == 0);
+				q.runId = runId;
+				break;
+			case 'n':
+				ok = (parseHex(optarg, nid, SLAC_NID_LEN) == 0);
+				q.nid = nid;
+				break;
+			case 's':
+				ok = (parseTime(optarg, &q.fromNs) == 0);
+				break;
+			case 't':
+				ok = (parseTime(optarg, &q.toNs) == 0);
+				break;
+			case 'o':
+				outName = optarg;
+				break;
+			default:
+				ok = 0;
+		}
+		if (!ok) {
+			if ((opt != 'h') && (opt != '?')) fprintf(stderr, "invalid value for -%c: %s\n", opt, optarg);
+			printUsage();
+			return -1;
+		}
+	}
+	if (optind >= argc) {
+		printUsage();
+		return -1;
+	}
+	if (outName) {
+		pcap_file_header fh;
+		out = fopen(outName, "wb");
+		if (!out) {
+			fprintf(stderr, "unable to open %s\n", outName);
+			return -1;
+		}
+		memset(&fh, 0, sizeof(fh));
+		fh.magic = PCAP_MAGIC_NSEC;
+		fh.versionMajor = 2;
+		fh.versionMinor = 4;
+		fh.snaplen = PCAP_SNAPLEN;
+		fh.linktype = PCAP_LINKTYPE_ETHERNET;
+		fwrite(&fh, sizeof(fh), 1, out);
+	}
+	for (i=optind; i<argc; i++) {
+		if (sessionIndexMap(&m, argv[i]) < 0) {
+			fprintf(stderr, "%s: no session index or a damaged one, create it with plc_analyzer -x\n", argv[i]);
+			continue;
+		}
+		if (m.stale) fprintf(stderr, "%s: the capture has changed since the index was written\n", argv[i]);
+		memset(&qc, 0, sizeof(qc));
+		qc.captureName = argv[i];
+		qc.out = out;
+		nMatches += sessionIndexQuery(&m, &q, out ? extractSession : printSession, &qc);
+		nFramesWritten += qc.nFramesWritten;
+		if (qc.file) {
+			captureReaderClose(qc.file);
+			free(qc.file);
+		}
+		sessionIndexUnmap(&m);
+	}
+	printf("%d sessions\n", nMatches);
+	if (out) {
+		fclose(out);
+		printf("%lu frames written to %s\n", (unsigned long)nFramesWritten, outName);
+	}
+	return 0;
+}
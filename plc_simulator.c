@@ -0,0 +1,317 @@
+/* PLC modem and EVSE simulator
+ *
+ * Allows testing listen_to_eth without Devolo adaptor and without a real charger.
+ * The simulator binds to one end of a veth pair, and listen_to_eth listens on the
+ * other end:
+ *    sudo ip link add plcsim0 type veth peer name plcsim1
+ *    sudo ip link set plcsim0 up
+ *    sudo ip link set plcsim1 up
+ *    sudo ./plc_simulator -i plcsim1 -r 1000 -t 10
+ *    sudo ./listen_to_eth -i plcsim0
+ *
+ * The simulator behaves
+ *   - like the modem: it answers CM_SET_KEY.REQ and CM_GET_KEY.REQ with a configurable
+ *     RESULT and after a configurable latency, from the modem MAC which they went to.
+ *   - like a PEV and an EVSE: it generates complete SLAC sequences (PARAM, START_ATTEN_CHAR,
+ *     MNBC_SOUND, ATTEN_CHAR, SLAC_MATCH) with a configurable rate. Each session uses its
+ *     own PEV MAC, RunID and NMK.
+ *
+ * Change Log
+ *   2026-10-19
+ *    - neu angelegt
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <netinet/if_ether.h>
+
+#include "plc_homeplug.h"
+#include "slacframes.h"
+
+#define MAX_PENDING_RESPONSES 256
+#define MAX_FRAME_LEN SLACFRAMES_FRAME_SIZE
+
+typedef struct pending_response {
+	uint64_t dueMs;
+	int len;
+	unsigned char frame[MAX_FRAME_LEN];
+} pending_response;
+
+char ifName[IFNAMSIZ] = "plcsim1";
+int sock_fd;
+int ifIndex;
+uint8_t ownMac[ETH_ALEN];
+int setKeyResult = 0;
+int getKeyResult = 0;
+int latencyMs = 0;
+double sessionRate = 1.0; /* SLAC sessions per second, 0 for none */
+int numberOfSounds = SLAC_MSOUNDS;
+int durationS = 0; /* 0 means: run until Ctrl-C */
+uint8_t lastNMK[SLAC_NMK_LEN];
+uint8_t lastNID[SLAC_NID_LEN];
+
+pending_response pendingResponses[MAX_PENDING_RESPONSES];
+unsigned pendingHead, pendingTail; /* free running indices */
+uint32_t nSessions, nFramesSent, nSetKeyReq, nGetKeyReq, nResponsesDropped, nSendErrors;
+
+uint64_t getMonotonicMs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+void sendFrame(unsigned char *frame, int len) {
+	struct sockaddr_ll sll;
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_ifindex = ifIndex;
+	sll.sll_halen = ETH_ALEN;
+	memcpy(sll.sll_addr, frame, ETH_ALEN);
+	if (len < ETH_ZLEN) len = ETH_ZLEN; /* minimum ethernet frame, the padding is already zero */
+	if (sendto(sock_fd, frame, len, 0, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+		nSendErrors++;
+	} else {
+		nFramesSent++;
+	}
+}
+
+/*********************************************************************/
+/* The modem part: confirmations of SET_KEY and GET_KEY */
+
+unsigned char *allocateResponse(void) {
+	pending_response *r;
+	if (pendingHead - pendingTail >= MAX_PENDING_RESPONSES) {
+		nResponsesDropped++;
+		return NULL;
+	}
+	r = &pendingResponses[pendingHead % MAX_PENDING_RESPONSES];
+	memset(r->frame, 0, MAX_FRAME_LEN);
+	r->dueMs = getMonotonicMs() + latencyMs;
+	return r->frame;
+}
+
+void commitResponse(int len) {
+	pendingResponses[pendingHead % MAX_PENDING_RESPONSES].len = len;
+	pendingHead++;
+}
+
+/* We answer as the modem which listen_to_eth has configured, it takes only its answers.
+   For a broadcast request, from our own MAC. */
+const uint8_t *modemSource(const unsigned char *rx) {
+	const struct ethhdr *eh = (const struct ethhdr *)rx;
+	return (eh->h_dest[0] & 0x01) ? ownMac : eh->h_dest;
+}
+
+void answerSetKey(unsigned char *rx) {
+	struct cm_set_key_request *req = (struct cm_set_key_request *)rx;
+	struct cm_set_key_confirm *cnf = (struct cm_set_key_confirm *)allocateResponse();
+	nSetKeyReq++;
+	if (!cnf) return;
+	memcpy(lastNMK, req->NEWKEY, SLAC_NMK_LEN);
+	memcpy(lastNID, req->NID, SLAC_NID_LEN);
+	slacFramesHeader((unsigned char *)cnf, req->ethernet.h_source, modemSource(rx), CM_SET_KEY | MMTYPE_CNF);
+	cnf->RESULT = setKeyResult;
+	cnf->MYNOUNCE = req->YOURNOUNCE;
+	cnf->YOURNOUNCE = req->MYNOUNCE;
+	cnf->PID = req->PID;
+	cnf->PRN = req->PRN;
+	cnf->PMN = req->PMN;
+	cnf->CCOCAP = req->CCOCAP;
+	commitResponse(sizeof(*cnf));
+}
+
+void answerGetKey(unsigned char *rx) {
+	struct cm_get_key_request *req = (struct cm_get_key_request *)rx;
+	struct cm_get_key_confirm *cnf = (struct cm_get_key_confirm *)allocateResponse();
+	nGetKeyReq++;
+	if (!cnf) return;
+	slacFramesHeader((unsigned char *)cnf, req->ethernet.h_source, modemSource(rx), CM_GET_KEY | MMTYPE_CNF);
+	cnf->RESULT = getKeyResult;
+	cnf->RequestedKeyType = req->RequestedKeyType;
+	cnf->YOURNOUNCE = req->MYNOUNCE;
+	memcpy(cnf->NID, lastNID, SLAC_NID_LEN);
+	cnf->EKS = SLAC_CM_SETKEY_EKS;
+	cnf->PID = req->PID;
+	cnf->PRN = req->PRN;
+	cnf->PMN = req->PMN;
+	if (getKeyResult == 0) memcpy(cnf->KEY, lastNMK, SLAC_NMK_LEN);
+	commitResponse(sizeof(*cnf));
+}
+
+void sendDueResponses(uint64_t nowMs) {
+	while (pendingTail != pendingHead) {
+		pending_response *r = &pendingResponses[pendingTail % MAX_PENDING_RESPONSES];
+		if (r->dueMs > nowMs) break; /* all have the same latency, so they are sorted */
+		sendFrame(r->frame, r->len);
+		pendingTail++;
+	}
+}
+
+void handleReceivedFrame(unsigned char *rx, int len) {
+	struct ethhdr *eh = (struct ethhdr *)rx;
+	struct homeplug_hdr *hph = (struct homeplug_hdr *)(rx + sizeof(struct ethhdr));
+	if (len < (int)(sizeof(struct ethhdr) + sizeof(struct homeplug_hdr))) return;
+	if (ntohs(eh->h_proto) != ETH_P_HPAV) return;
+	switch (LE16TOH(hph->MMTYPE)) {
+		case CM_SET_KEY | MMTYPE_REQ:
+			if (len >= (int)sizeof(struct cm_set_key_request)) answerSetKey(rx);
+			break;
+		case CM_GET_KEY | MMTYPE_REQ:
+			if (len >= (int)sizeof(struct cm_get_key_request)) answerGetKey(rx);
+			break;
+	}
+}
+
+/*********************************************************************/
+/* The PEV and EVSE part: a complete SLAC sequence */
+
+/* The frames come from slacframes.c, the same as in the simulation of listen_to_eth -S */
+void generateSlacSession(uint32_t n) {
+	unsigned char frame[MAX_FRAME_LEN];
+	slacframes_session session;
+	int i;
+	slacFramesSession(&session, n);
+	memcpy(session.evseMac, ownMac, ETH_ALEN);
+	session.numberOfSounds = numberOfSounds;
+	/* a new NID and NMK per session */
+	for (i = 0; i < SLAC_NID_LEN; i++) session.nid[i] = (n >> (8 * (i & 3))) ^ (0x11 * i);
+	session.nid[SLAC_NID_LEN - 1] &= 0x0f; /* the upper bits of the last NID byte are the security level */
+	for (i = 0; i < SLAC_NMK_LEN; i++) session.nmk[i] = rand() & 0xff;
+
+	sendFrame(frame, slacFramesBuild(frame, sizeof(frame), SLACFRAME_PARAM_REQ, &session, 0));
+	sendFrame(frame, slacFramesBuild(frame, sizeof(frame), SLACFRAME_PARAM_CNF, &session, 0));
+	for (i = 0; i < 3; i++) {
+		sendFrame(frame, slacFramesBuild(frame, sizeof(frame), SLACFRAME_START_ATTEN, &session, i));
+	}
+	for (i = 0; i < numberOfSounds; i++) {
+		sendFrame(frame, slacFramesBuild(frame, sizeof(frame), SLACFRAME_SOUND, &session, i));
+	}
+	sendFrame(frame, slacFramesBuild(frame, sizeof(frame), SLACFRAME_ATTEN_IND, &session, 0));
+	sendFrame(frame, slacFramesBuild(frame, sizeof(frame), SLACFRAME_ATTEN_RSP, &session, 0));
+	sendFrame(frame, slacFramesBuild(frame, sizeof(frame), SLACFRAME_MATCH_REQ, &session, 0));
+	sendFrame(frame, slacFramesBuild(frame, sizeof(frame), SLACFRAME_MATCH_CNF, &session, 0));
+	nSessions++;
+}
+
+/*********************************************************************/
+
+int initializeTheSocket(void) {
+	struct ifreq ifr;
+	struct sockaddr_ll sll;
+	sock_fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if (sock_fd < 0) {
+		perror("could not open the socket");
+		printf("Try to run as root, sudo ./plc_simulator\n");
+		return -1;
+	}
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifName, IFNAMSIZ - 1);
+	if (ioctl(sock_fd, SIOCGIFINDEX, &ifr) < 0) {
+		perror("SIOCGIFINDEX");
+		return -1;
+	}
+	ifIndex = ifr.ifr_ifindex;
+	if (ioctl(sock_fd, SIOCGIFHWADDR, &ifr) < 0) {
+		perror("SIOCGIFHWADDR");
+		return -1;
+	}
+	memcpy(ownMac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_ifindex = ifIndex;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	if (bind(sock_fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+		perror("bind");
+		return -1;
+	}
+	return 0;
+}
+
+void printUsage(void) {
+	printf("usage: plc_simulator [-i interface] [-s result] [-g result] [-l latency_ms] [-r rate] [-n sounds] [-t seconds]\n");
+	printf("  -i  interface, one end of a veth pair, default %s\n", ifName);
+	printf("  -s  RESULT of the CM_SET_KEY.CNF, default 0 (ok)\n");
+	printf("  -g  RESULT of the CM_GET_KEY.CNF, default 0 (ok)\n");
+	printf("  -l  latency of the confirmations in ms, default 0\n");
+	printf("  -r  SLAC sessions per second, default 1, 0 for none\n");
+	printf("  -n  number of MNBC sounds per session, default %d\n", SLAC_MSOUNDS);
+	printf("  -t  run time in seconds, default 0 (endless)\n");
+}
+
+int main(int argc, char *argv[]) {
+	unsigned char rxbuffer[2048];
+	struct sockaddr_ll from;
+	socklen_t fromLen;
+	struct pollfd pfd;
+	uint64_t startMs, nowMs, nextSessionMs, timeoutMs;
+	double sessionIntervalMs;
+	uint32_t sessionIndex = 0;
+	int opt, len;
+
+	while ((opt = getopt(argc, argv, "i:s:g:l:r:n:t:h")) != -1) {
+		switch (opt) {
+			case 'i': strncpy(ifName, optarg, IFNAMSIZ - 1); break;
+			case 's': setKeyResult = atoi(optarg); break;
+			case 'g': getKeyResult = atoi(optarg); break;
+			case 'l': latencyMs = atoi(optarg); break;
+			case 'r': sessionRate = atof(optarg); break;
+			case 'n': numberOfSounds = atoi(optarg); break;
+			case 't': durationS = atoi(optarg); break;
+			default:
+				printUsage();
+				return -1;
+		}
+	}
+	if (initializeTheSocket() < 0) return -1;
+	printf("simulating modem and EVSE %02x:%02x:%02x:%02x:%02x:%02x on %s, %.1f sessions/s, set_key result %d, latency %d ms\n",
+		ownMac[0], ownMac[1], ownMac[2], ownMac[3], ownMac[4], ownMac[5], ifName, sessionRate, setKeyResult, latencyMs);
+
+	pfd.fd = sock_fd;
+	pfd.events = POLLIN;
+	startMs = getMonotonicMs();
+	sessionIntervalMs = (sessionRate > 0) ? 1000.0 / sessionRate : 0;
+	nextSessionMs = startMs;
+	for (;;) {
+		nowMs = getMonotonicMs();
+		if (durationS && (nowMs - startMs >= (uint64_t)durationS * 1000)) break;
+		/* Absolute deadlines, so that the rate does not drift. If we are late, we catch up. */
+		while ((sessionRate > 0) && (nowMs >= nextSessionMs)) {
+			generateSlacSession(sessionIndex++);
+			nextSessionMs = startMs + (uint64_t)(sessionIndex * sessionIntervalMs);
+		}
+		sendDueResponses(nowMs);
+		timeoutMs = 100;
+		if ((sessionRate > 0) && (nextSessionMs - nowMs < timeoutMs)) timeoutMs = nextSessionMs - nowMs;
+		if ((pendingTail != pendingHead) && (pendingResponses[pendingTail % MAX_PENDING_RESPONSES].dueMs - nowMs < timeoutMs)) {
+			timeoutMs = pendingResponses[pendingTail % MAX_PENDING_RESPONSES].dueMs - nowMs;
+		}
+		if (poll(&pfd, 1, (int)timeoutMs) < 0) {
+			if (errno == EINTR) continue;
+			perror("poll");
+			return -1;
+		}
+		/* drain everything which is there */
+		for (;;) {
+			fromLen = sizeof(from);
+			len = recvfrom(sock_fd, rxbuffer, sizeof(rxbuffer), MSG_DONTWAIT, (struct sockaddr *)&from, &fromLen);
+			if (len < 0) break;
+			if (from.sll_pkttype == PACKET_OUTGOING) continue; /* our own frames */
+			handleReceivedFrame(rxbuffer, len);
+		}
+	}
+	printf("sessions %u, frames sent %u, send errors %u, SET_KEY.REQ %u, GET_KEY.REQ %u, responses dropped %u\n",
+		nSessions, nFramesSent, nSendErrors, nSetKeyReq, nGetKeyReq, nResponsesDropped);
+	close(sock_fd);
+	return 0;
+}
@@ -0,0 +1,305 @@
+/* Freestanding HomePlug/SLAC core, see plccore.h */
+
+#include <stdint.h>
+
+#include "plccore.h"
+
+/* the budget is checked by the compiler: a negative array size if it is exceeded */
+typedef char plccore_ram_budget_exceeded[(sizeof(plccore) <= PLCCORE_RAM_BUDGET) ? 1 : -1];
+
+static const char *const stateNames[PLCCORE_NUMBER_OF_STATES] = {
+	"IDLE", "PARAM", "ATTEN", "SOUNDING", "ATTEN_CHAR", "MATCH_REQ", "MATCHED", "KEY_SET", "KEY_FAILED", "TIMEOUT"
+};
+
+/* without libc */
+static void copyBytes(uint8_t *dst, const uint8_t *src, int n) {
+	while (n-- > 0) *dst++ = *src++;
+}
+
+static void clearBytes(void *p, int n) {
+	uint8_t *d = p;
+	while (n-- > 0) *d++ = 0;
+}
+
+static int sameBytes(const uint8_t *a, const uint8_t *b, int n) {
+	while (n-- > 0) {
+		if (*a++ != *b++) return 0;
+	}
+	return 1;
+}
+
+static void putLe16(uint8_t *p, uint16_t v) {
+	p[0] = v & 0xff;
+	p[1] = v >> 8;
+}
+
+const char *plcCoreStateName(int state) {
+	if ((state<0) || (state>=PLCCORE_NUMBER_OF_STATES)) return "???";
+	return stateNames[state];
+}
+
+void plcCoreInit(plccore *core, const uint8_t *ownMac, const uint8_t *modemMac,
+	plccore_transition_function onTransition, void *user) {
+	clearBytes(core, sizeof(*core));
+	if (ownMac) {
+		copyBytes(core->ownMac, ownMac, PLCCORE_MAC_LEN);
+		copyBytes(core->modemMac, modemMac, PLCCORE_MAC_LEN);
+		core->reactOnMatch = 1;
+	} else {
+		core->passive = 1;
+	}
+	core->onTransition = onTransition;
+	core->user = user;
+	plcCoreUseTable(core, core->ownSessions, sizeof(plccore_session), PLCCORE_MAX_SESSIONS);
+}
+
+void plcCoreUseTable(plccore *core, void *table, int sessionSize, int maxSessions) {
+	clearBytes(table, sessionSize * maxSessions);
+	core->sessions = table;
+	core->sessionSize = sessionSize;
+	core->maxSessions = maxSessions;
+	core->lastMatched = -1;
+}
+
+/*********************************************************************/
+/* Decoder and encoders */
+
+int plcCoreDecode(const uint8_t *frame, int len, plccore_mme *mme) {
+	clearBytes(mme, sizeof(*mme));
+	mme->result = -1;
+	if (len < PLCCORE_HEADER_LEN) return PLCCORE_E_SHORT;
+	if (((frame[PLCCORE_OFS_ETHERTYPE] << 8) | frame[PLCCORE_OFS_ETHERTYPE+1]) != PLCCORE_ETHERTYPE_HPAV) return PLCCORE_E_NOT_HOMEPLUG;
+	mme->dest = frame + PLCCORE_OFS_DEST;
+	mme->source = frame + PLCCORE_OFS_SOURCE;
+	mme->mmtype = frame[PLCCORE_OFS_MMTYPE] | (frame[PLCCORE_OFS_MMTYPE+1] << 8);
+	mme->payload = frame + PLCCORE_HEADER_LEN;
+	mme->payloadLen = len - PLCCORE_HEADER_LEN;
+	switch (mme->mmtype) {
+		case PLCCORE_CM_SLAC_PARAM | PLCCORE_MMTYPE_REQ:
+			/* the session starts also without the RunID */
+			if (len >= PLCCORE_PARAM_REQ_LEN) mme->runId = frame + PLCCORE_OFS_PARAM_RUNID;
+			break;
+		case PLCCORE_CM_SLAC_MATCH | PLCCORE_MMTYPE_CNF:
+			if (len < PLCCORE_MATCH_CNF_LEN) return PLCCORE_E_SHORT;
+			mme->pevMac = frame + PLCCORE_OFS_MATCH_PEV_MAC;
+			mme->evseMac = frame + PLCCORE_OFS_MATCH_EVSE_MAC;
+			mme->runId = frame + PLCCORE_OFS_MATCH_RUNID;
+			mme->nid = frame + PLCCORE_OFS_MATCH_NID;
+			mme->nmk = frame + PLCCORE_OFS_MATCH_NMK;
+			break;
+		case PLCCORE_CM_SET_KEY | PLCCORE_MMTYPE_CNF:
+		case PLCCORE_CM_GET_KEY | PLCCORE_MMTYPE_CNF:
+			if (len <= PLCCORE_OFS_RESULT) return PLCCORE_E_SHORT;
+			mme->result = frame[PLCCORE_OFS_RESULT];
+			break;
+	}
+	return PLCCORE_OK;
+}
+
+int plcCoreEncodeHeader(uint8_t *buf, int size, const uint8_t *source, const uint8_t *dest, uint16_t mmtype) {
+	if (size < PLCCORE_HEADER_LEN) return PLCCORE_E_BUFFER;
+	copyBytes(buf + PLCCORE_OFS_DEST, dest, PLCCORE_MAC_LEN);
+	copyBytes(buf + PLCCORE_OFS_SOURCE, source, PLCCORE_MAC_LEN);
+	buf[PLCCORE_OFS_ETHERTYPE] = PLCCORE_ETHERTYPE_HPAV >> 8;
+	buf[PLCCORE_OFS_ETHERTYPE+1] = PLCCORE_ETHERTYPE_HPAV & 0xff;
+	buf[PLCCORE_OFS_MMV] = PLCCORE_MMV;
+	putLe16(buf + PLCCORE_OFS_MMTYPE, mmtype);
+	buf[PLCCORE_OFS_MMTYPE+2] = 0; /* FMSN */
+	buf[PLCCORE_OFS_MMTYPE+3] = 0; /* FMID */
+	return PLCCORE_HEADER_LEN;
+}
+
+/* ISO15118-3: KEYTYPE NMK, PID 4 "HLE protocol", station, EKS 1. The nonces stay 0,
+   the request/response API of listen_to_eth puts its own in. */
+int plcCoreEncodeSetKey(uint8_t *buf, int size, const uint8_t *source, const uint8_t *dest,
+	const uint8_t *nid, const uint8_t *nmk) {
+	if (size < PLCCORE_SET_KEY_REQ_LEN) return PLCCORE_E_BUFFER;
+	clearBytes(buf, PLCCORE_SET_KEY_REQ_LEN);
+	plcCoreEncodeHeader(buf, size, source, dest, PLCCORE_CM_SET_KEY | PLCCORE_MMTYPE_REQ);
+	buf[19] = 0x01; /* KEYTYPE */
+	buf[28] = 0x04; /* PID */
+	buf[40] = 0x01; /* NEWEKS */
+	copyBytes(buf + PLCCORE_OFS_SETKEY_NID, nid, PLCCORE_NID_LEN);
+	copyBytes(buf + PLCCORE_OFS_SETKEY_NMK, nmk, PLCCORE_NMK_LEN);
+	return PLCCORE_SET_KEY_REQ_LEN;
+}
+
+int plcCoreEncodeGetKey(uint8_t *buf, int size, const uint8_t *source, const uint8_t *dest, const uint8_t *nid) {
+	if (size < PLCCORE_GET_KEY_REQ_LEN) return PLCCORE_E_BUFFER;
+	clearBytes(buf, PLCCORE_GET_KEY_REQ_LEN);
+	plcCoreEncodeHeader(buf, size, source, dest, PLCCORE_CM_GET_KEY | PLCCORE_MMTYPE_REQ);
+	buf[19] = 0x00; /* RequestType direct */
+	buf[20] = 0x01; /* RequestedKeyType NMK, the only one over the H1 interface */
+	copyBytes(buf + PLCCORE_OFS_GETKEY_NID, nid, PLCCORE_NID_LEN);
+	buf[32] = 0x04; /* PID */
+	return PLCCORE_GET_KEY_REQ_LEN;
+}
+
+/*********************************************************************/
+/* Session tracking */
+
+static plccore_session *sessionAt(const plccore *core, int i) {
+	return (plccore_session *)((uint8_t *)core->sessions + i * core->sessionSize);
+}
+
+static int isFinalState(int state) {
+	return (state==PLCCORE_STATE_KEY_SET) || (state==PLCCORE_STATE_KEY_FAILED) || (state==PLCCORE_STATE_TIMEOUT);
+}
+
+static void setState(plccore *core, plccore_session *s, int newState, uint64_t nowMs) {
+	int oldState = s->state;
+	s->lastMs = nowMs;
+	if (newState==oldState) return;
+	s->state = newState;
+	if (core->onTransition) core->onTransition(core, s, oldState);
+}
+
+/* Finds the session of the PEV. If there is none, takes a free slot or the
+   oldest one, and clears it with the data of the caller. */
+static plccore_session *findSession(plccore *core, const uint8_t *pevMac, int create, uint64_t nowMs) {
+	int i, oldest=0;
+	plccore_session *s;
+	for (i=0; i<core->maxSessions; i++) {
+		s = sessionAt(core, i);
+		if (s->inUse && sameBytes(s->pevMac, pevMac, PLCCORE_MAC_LEN)) return s;
+	}
+	if (!create) return 0;
+	for (i=0; i<core->maxSessions; i++) {
+		if (!sessionAt(core, i)->inUse) break;
+		if (sessionAt(core, i)->lastMs < sessionAt(core, oldest)->lastMs) oldest=i;
+	}
+	if (i==core->maxSessions) i=oldest;
+	if (i==core->lastMatched) core->lastMatched=-1;
+	s = sessionAt(core, i);
+	clearBytes(s, core->sessionSize);
+	s->inUse = 1;
+	copyBytes(s->pevMac, pevMac, PLCCORE_MAC_LEN);
+	s->startMs = nowMs;
+	s->lastMs = nowMs;
+	core->nSessions++;
+	return s;
+}
+
+/* A new SLAC attempt of a PEV, which maybe already had an (old) session. The data of
+   the caller stays, the transition from IDLE tells about the new attempt. */
+static plccore_session *restartSession(plccore *core, const uint8_t *pevMac, uint64_t nowMs) {
+	plccore_session *s = findSession(core, pevMac, 1, nowMs);
+	if (s->state!=PLCCORE_STATE_IDLE) {
+		s->state = PLCCORE_STATE_IDLE;
+		s->startMs = nowMs;
+		s->nSounds = 0;
+		clearBytes(s->evseMac, PLCCORE_MAC_LEN);
+		core->nSessions++;
+	}
+	return s;
+}
+
+/* Is the CM_SET_KEY.CNF the answer to our CM_SET_KEY.REQ for the session s? */
+static int isOurSetKeyConfirm(const plccore *core, const plccore_mme *m, const plccore_session *s) {
+	if (core->passive) return !sameBytes(m->dest, s->pevMac, PLCCORE_MAC_LEN);
+	if (!sameBytes(m->dest, core->ownMac, PLCCORE_MAC_LEN)) return 0;
+	/* a multicast modem address: we do not know the modem, any station may answer */
+	return (core->modemMac[0] & 0x01) || sameBytes(m->source, core->modemMac, PLCCORE_MAC_LEN);
+}
+
+plccore_session *plcCoreObserve(plccore *core, const plccore_mme *m, uint64_t nowMs) {
+	plccore_session *s = 0;
+	int newState = PLCCORE_STATE_IDLE;
+	switch (m->mmtype) {
+		case PLCCORE_CM_SLAC_PARAM | PLCCORE_MMTYPE_REQ:
+			s = findSession(core, m->source, 1, nowMs);
+			if ((s->state!=PLCCORE_STATE_IDLE) &&
+			    (isFinalState(s->state) || !m->runId || !sameBytes(s->runId, m->runId, PLCCORE_RUNID_LEN))) {
+				s = restartSession(core, m->source, nowMs);
+			}
+			if (m->runId) copyBytes(s->runId, m->runId, PLCCORE_RUNID_LEN);
+			newState = PLCCORE_STATE_PARAM;
+			break;
+		case PLCCORE_CM_SLAC_PARAM | PLCCORE_MMTYPE_CNF:
+			s = findSession(core, m->dest, 0, nowMs);
+			if (s) copyBytes(s->evseMac, m->source, PLCCORE_MAC_LEN);
+			newState = PLCCORE_STATE_PARAM;
+			break;
+		case PLCCORE_CM_START_ATTEN_CHAR | PLCCORE_MMTYPE_IND:
+			s = findSession(core, m->source, 0, nowMs);
+			newState = PLCCORE_STATE_ATTEN;
+			break;
+		case PLCCORE_CM_MNBC_SOUND | PLCCORE_MMTYPE_IND:
+			s = findSession(core, m->source, 0, nowMs);
+			if (s) s->nSounds++;
+			newState = PLCCORE_STATE_SOUNDING;
+			break;
+		case PLCCORE_CM_ATTEN_CHAR | PLCCORE_MMTYPE_IND:
+			s = findSession(core, m->dest, 0, nowMs);
+			if (s) copyBytes(s->evseMac, m->source, PLCCORE_MAC_LEN);
+			newState = PLCCORE_STATE_ATTEN_CHAR;
+			break;
+		case PLCCORE_CM_ATTEN_CHAR | PLCCORE_MMTYPE_RSP:
+			s = findSession(core, m->source, 0, nowMs);
+			newState = PLCCORE_STATE_ATTEN_CHAR;
+			break;
+		case PLCCORE_CM_SLAC_MATCH | PLCCORE_MMTYPE_REQ:
+			s = findSession(core, m->source, 0, nowMs);
+			newState = PLCCORE_STATE_MATCH_REQ;
+			break;
+		case PLCCORE_CM_SLAC_MATCH | PLCCORE_MMTYPE_CNF:
+			/* if we missed the beginning, the session starts here */
+			s = findSession(core, m->pevMac, 1, nowMs);
+			if (isFinalState(s->state)) s = restartSession(core, m->pevMac, nowMs);
+			copyBytes(s->evseMac, m->evseMac, PLCCORE_MAC_LEN);
+			copyBytes(s->runId, m->runId, PLCCORE_RUNID_LEN);
+			copyBytes(s->nid, m->nid, PLCCORE_NID_LEN);
+			core->lastMatched = ((uint8_t *)s - (uint8_t *)core->sessions) / core->sessionSize;
+			newState = PLCCORE_STATE_MATCHED;
+			break;
+		case PLCCORE_CM_SET_KEY | PLCCORE_MMTYPE_CNF:
+			/* the key belongs to the session which was matched last */
+			if (core->lastMatched < 0) return 0;
+			s = sessionAt(core, core->lastMatched);
+			if (!s->inUse || (s->state!=PLCCORE_STATE_MATCHED)) return 0;
+			if (!isOurSetKeyConfirm(core, m, s)) {
+				core->nForeignSetKeyCnf++;
+				return 0;
+			}
+			setState(core, s, (m->result==0) ? PLCCORE_STATE_KEY_SET : PLCCORE_STATE_KEY_FAILED, nowMs);
+			return s;
+	}
+	if (!s) return 0;
+	if (isFinalState(s->state)) return s; /* late frames of a finished session */
+	if (newState > s->state) {
+		setState(core, s, newState, nowMs);
+	} else {
+		s->lastMs = nowMs; /* e.g. further sounds */
+	}
+	return s;
+}
+
+int plcCoreReceive(plccore *core, const uint8_t *frame, int len, uint64_t nowMs, uint8_t *tx, int txSize) {
+	plccore_mme m;
+	int txLen = 0;
+	if (plcCoreDecode(frame, len, &m) != PLCCORE_OK) return 0;
+	core->nFrames++;
+	if ((m.mmtype == (PLCCORE_CM_SLAC_MATCH | PLCCORE_MMTYPE_CNF)) && core->reactOnMatch) {
+		/* the critical path: the answer is ready before the session is updated */
+		txLen = plcCoreEncodeSetKey(tx, txSize, core->ownMac, core->modemMac, m.nid, m.nmk);
+		if (txLen > 0) core->nSetKeys++; else txLen = 0;
+	}
+	plcCoreObserve(core, &m, nowMs);
+	return txLen;
+}
+
+void plcCoreCheckTimeouts(plccore *core, uint64_t nowMs) {
+	int i;
+	for (i=0; i<core->maxSessions; i++) {
+		plccore_session *s = sessionAt(core, i);
+		if (!s->inUse || isFinalState(s->state) || (s->state==PLCCORE_STATE_IDLE)) continue;
+		if (nowMs - s->lastMs > PLCCORE_SESSION_TIMEOUT_MS) {
+			core->nTimeouts++;
+			setState(core, s, PLCCORE_STATE_TIMEOUT, nowMs);
+		}
+	}
+}
+
+plccore_session *plcCoreFindSession(plccore *core, const uint8_t *pevMac) {
+	return findSession(core, pevMac, 0, 0);
+}
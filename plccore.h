@@ -0,0 +1,186 @@
+/* Freestanding HomePlug/SLAC core
+ *
+ * The protocol logic of listen_to_eth without any I/O, for the controllers in
+ * the chargers: decoder and encoder of the management messages, the SLAC
+ * session tracking, and the reaction on CM_SLAC_MATCH.CNF with CM_SET_KEY.REQ.
+ *   - no stdio, no sockets, no time source, no libc at all (own copy loops),
+ *     only <stdint.h>. Compiles with -ffreestanding, see "make coresize".
+ *   - no dynamic allocation and no globals: the whole state is one plccore,
+ *     which the caller places where it wants. Its size is fixed at compile time
+ *     by PLCCORE_MAX_SESSIONS and checked against PLCCORE_RAM_BUDGET.
+ *   - the frames are in buffers of the caller; the decoder gives pointers into
+ *     the received frame, the encoders write into the given transmit buffer.
+ *   - the time is passed in, milliseconds of any monotonic clock, 64 bit, so
+ *     that the sessions of a capture keep the times of the capture.
+ * The wire layout is taken byte by byte (little endian MMTYPE, offsets below),
+ * so there are no packed structs and no alignment or byte order assumptions.
+ *
+ * slacsession.c (listen_to_eth and the offline tools) is this session tracking with a
+ * bigger table and its own data per session, see plcCoreUseTable(). plc_core -r checks
+ * the CM_SET_KEY.REQ of a capture against a reference which is built without the core.
+ * plccore_linux.h is the adapter for raw sockets.
+ */
+
+#ifndef PLCCORE_HEADER
+#define PLCCORE_HEADER
+
+#include <stdint.h>
+
+/* The memory budget. Each session takes sizeof(plccore_session), 48 bytes. */
+#ifndef PLCCORE_MAX_SESSIONS
+#define PLCCORE_MAX_SESSIONS 8
+#endif
+#ifndef PLCCORE_RAM_BUDGET
+#define PLCCORE_RAM_BUDGET 512 /* bytes, for the whole plccore */
+#endif
+#ifndef PLCCORE_SESSION_TIMEOUT_MS
+#define PLCCORE_SESSION_TIMEOUT_MS 5000 /* generous, the sounding takes some time */
+#endif
+
+#define PLCCORE_MAC_LEN 6
+#define PLCCORE_RUNID_LEN 8
+#define PLCCORE_NID_LEN 7
+#define PLCCORE_NMK_LEN 16
+#define PLCCORE_ETHERTYPE_HPAV 0x88E1
+#define PLCCORE_MMV 0x01
+
+/* the management messages which the core knows, the base types (REQ) */
+#define PLCCORE_MMTYPE_REQ 0x0000
+#define PLCCORE_MMTYPE_CNF 0x0001
+#define PLCCORE_MMTYPE_IND 0x0002
+#define PLCCORE_MMTYPE_RSP 0x0003
+#define PLCCORE_CM_SET_KEY 0x6008
+#define PLCCORE_CM_GET_KEY 0x600C
+#define PLCCORE_CM_SLAC_PARAM 0x6064
+#define PLCCORE_CM_START_ATTEN_CHAR 0x6068
+#define PLCCORE_CM_ATTEN_CHAR 0x606C
+#define PLCCORE_CM_MNBC_SOUND 0x6074
+#define PLCCORE_CM_SLAC_MATCH 0x607C
+#define PLCCORE_CM_GET_DEVICE_SW_VERSION 0xA000
+
+/* Offsets in the frame: Ethernet header, then MMV, MMTYPE, FMSN, FMID */
+#define PLCCORE_OFS_DEST 0
+#define PLCCORE_OFS_SOURCE 6
+#define PLCCORE_OFS_ETHERTYPE 12
+#define PLCCORE_OFS_MMV 14
+#define PLCCORE_OFS_MMTYPE 15
+#define PLCCORE_HEADER_LEN 19
+/* CM_SLAC_PARAM.REQ */
+#define PLCCORE_OFS_PARAM_RUNID 21
+#define PLCCORE_PARAM_REQ_LEN 29
+/* CM_SLAC_MATCH.CNF */
+#define PLCCORE_OFS_MATCH_PEV_MAC 40
+#define PLCCORE_OFS_MATCH_EVSE_MAC 63
+#define PLCCORE_OFS_MATCH_RUNID 69
+#define PLCCORE_OFS_MATCH_NID 85
+#define PLCCORE_OFS_MATCH_NMK 93
+#define PLCCORE_MATCH_CNF_LEN 109
+/* CM_SET_KEY.REQ */
+#define PLCCORE_OFS_SETKEY_NID 33
+#define PLCCORE_OFS_SETKEY_NMK 41
+#define PLCCORE_SET_KEY_REQ_LEN 57
+/* CM_GET_KEY.REQ */
+#define PLCCORE_OFS_GETKEY_NID 21
+#define PLCCORE_GET_KEY_REQ_LEN 36
+/* the RESULT of CM_SET_KEY.CNF and CM_GET_KEY.CNF */
+#define PLCCORE_OFS_RESULT 19
+
+/* return values */
+#define PLCCORE_OK 0
+#define PLCCORE_E_SHORT -1        /* frame too short for its type */
+#define PLCCORE_E_NOT_HOMEPLUG -2 /* other ethertype */
+#define PLCCORE_E_BUFFER -3       /* transmit buffer too small */
+
+/* the same numbers as SLAC_STATE_... in slacsession.h */
+enum {
+	PLCCORE_STATE_IDLE,
+	PLCCORE_STATE_PARAM,
+	PLCCORE_STATE_ATTEN,
+	PLCCORE_STATE_SOUNDING,
+	PLCCORE_STATE_ATTEN_CHAR,
+	PLCCORE_STATE_MATCH_REQ,
+	PLCCORE_STATE_MATCHED,
+	PLCCORE_STATE_KEY_SET,
+	PLCCORE_STATE_KEY_FAILED,
+	PLCCORE_STATE_TIMEOUT,
+	PLCCORE_NUMBER_OF_STATES
+};
+
+/* A decoded management message. The pointers go into the received frame; the
+   ones which the type does not have are NULL. */
+typedef struct plccore_mme {
+	const uint8_t *dest, *source;
+	uint16_t mmtype;
+	uint16_t payloadLen; /* after PLCCORE_HEADER_LEN */
+	const uint8_t *payload;
+	const uint8_t *runId;             /* CM_SLAC_PARAM.REQ, CM_SLAC_MATCH.CNF */
+	const uint8_t *pevMac, *evseMac;  /* CM_SLAC_MATCH.CNF */
+	const uint8_t *nid, *nmk;         /* CM_SLAC_MATCH.CNF */
+	int result;                       /* CM_SET_KEY.CNF, CM_GET_KEY.CNF, else -1 */
+} plccore_mme;
+
+typedef struct plccore_session {
+	uint8_t inUse;
+	uint8_t state;
+	uint8_t pevMac[PLCCORE_MAC_LEN];
+	uint8_t evseMac[PLCCORE_MAC_LEN];
+	uint8_t runId[PLCCORE_RUNID_LEN];
+	uint8_t nid[PLCCORE_NID_LEN];
+	uint8_t reserved;
+	uint16_t nSounds;
+	uint64_t startMs; /* time of the first message */
+	uint64_t lastMs;  /* time of the last progress */
+} plccore_session;
+
+struct plccore;
+typedef void (*plccore_transition_function)(struct plccore *core, const plccore_session *session, int oldState);
+
+typedef struct plccore {
+	uint8_t ownMac[PLCCORE_MAC_LEN];
+	uint8_t modemMac[PLCCORE_MAC_LEN]; /* the destination of the CM_SET_KEY.REQ */
+	uint8_t reactOnMatch;              /* send the CM_SET_KEY.REQ */
+	uint8_t passive;                   /* which CM_SET_KEY.CNF is taken, see plcCoreInit() */
+	int8_t lastMatched;                /* the session which gets the CM_SET_KEY.CNF */
+	uint8_t maxSessions;
+	uint16_t sessionSize;              /* the distance of the sessions in the table */
+	plccore_transition_function onTransition;
+	void *user;                        /* for the callback */
+	plccore_session *sessions;         /* ownSessions, or the table of plcCoreUseTable() */
+	uint32_t nFrames, nSessions, nTimeouts, nSetKeys;
+	uint32_t nForeignSetKeyCnf;        /* CM_SET_KEY.CNF which were not the answer to us */
+	plccore_session ownSessions[PLCCORE_MAX_SESSIONS];
+} plccore;
+
+const char *plcCoreStateName(int state);
+/* The CM_SET_KEY.REQ goes from ownMac to modemMac, and only the CM_SET_KEY.CNF to ownMac,
+   and from modemMac unless it is a multicast address, is the answer. Without ownMac
+   (NULL), the core is passive, it only observes the capture of other stations: no
+   CM_SET_KEY.REQ, and a CM_SET_KEY.CNF is taken unless it goes to the PEV, which is
+   the PEV setting its own modem. */
+void plcCoreInit(plccore *core, const uint8_t *ownMac, const uint8_t *modemMac,
+	plccore_transition_function onTransition, void *user);
+/* Instead of the PLCCORE_MAX_SESSIONS sessions in the plccore: the table of the caller,
+   maxSessions elements of sessionSize bytes, each starting with its plccore_session. The
+   rest of an element is the caller's, it is cleared together with a new session. Clears
+   the table, also for starting over. */
+void plcCoreUseTable(plccore *core, void *table, int sessionSize, int maxSessions);
+
+/* Decoder. Returns PLCCORE_OK, PLCCORE_E_NOT_HOMEPLUG or PLCCORE_E_SHORT. */
+int plcCoreDecode(const uint8_t *frame, int len, plccore_mme *mme);
+/* Encoders. Return the length of the frame, or PLCCORE_E_BUFFER. */
+int plcCoreEncodeHeader(uint8_t *buf, int size, const uint8_t *source, const uint8_t *dest, uint16_t mmtype);
+int plcCoreEncodeSetKey(uint8_t *buf, int size, const uint8_t *source, const uint8_t *dest,
+	const uint8_t *nid, const uint8_t *nmk);
+int plcCoreEncodeGetKey(uint8_t *buf, int size, const uint8_t *source, const uint8_t *dest, const uint8_t *nid);
+
+/* For each received frame. If it is the CM_SLAC_MATCH.CNF, the CM_SET_KEY.REQ is
+   written to tx first, and its length is returned: the caller sends it. Otherwise 0. */
+int plcCoreReceive(plccore *core, const uint8_t *frame, int len, uint64_t nowMs, uint8_t *tx, int txSize);
+/* The session tracking alone, for a decoded message. Returns the session which the message
+   belongs to, or NULL; for the CM_SET_KEY.CNF, only if it was taken as the answer. */
+plccore_session *plcCoreObserve(plccore *core, const plccore_mme *m, uint64_t nowMs);
+void plcCoreCheckTimeouts(plccore *core, uint64_t nowMs);
+/* NULL if there is no session of this PEV */
+plccore_session *plcCoreFindSession(plccore *core, const uint8_t *pevMac);
+
+#endif
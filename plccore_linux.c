@@ -0,0 +1,89 @@
+/* Linux adapter of the freestanding core, see plccore_linux.h */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+
+#include "plccore_linux.h"
+
+int plcCoreLinuxOpen(plccore_linux *a, const char *ifName) {
+	struct ifreq ifr;
+	struct sockaddr_ll sll;
+	memset(a, 0, sizeof(*a));
+	strncpy(a->ifName, ifName, IFNAMSIZ-1);
+	/* only the HomePlug frames, the rest does not concern the core */
+	a->fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, htons(PLCCORE_ETHERTYPE_HPAV));
+	if (a->fd < 0) return -1;
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifName, IFNAMSIZ-1);
+	if (ioctl(a->fd, SIOCGIFINDEX, &ifr) < 0) goto fail;
+	a->ifIndex = ifr.ifr_ifindex;
+	if (ioctl(a->fd, SIOCGIFHWADDR, &ifr) < 0) goto fail;
+	memcpy(a->ownMac, ifr.ifr_hwaddr.sa_data, PLCCORE_MAC_LEN);
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_ifindex = a->ifIndex;
+	sll.sll_protocol = htons(PLCCORE_ETHERTYPE_HPAV);
+	if (bind(a->fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) goto fail;
+	return 0;
+fail:
+	close(a->fd);
+	a->fd = -1;
+	return -1;
+}
+
+void plcCoreLinuxClose(plccore_linux *a) {
+	if (a->fd >= 0) close(a->fd);
+	a->fd = -1;
+}
+
+uint64_t plcCoreLinuxNowMs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int plcCoreLinuxSend(plccore_linux *a, const uint8_t *frame, int len) {
+	struct sockaddr_ll to;
+	memset(&to, 0, sizeof(to));
+	to.sll_family = AF_PACKET;
+	to.sll_ifindex = a->ifIndex;
+	to.sll_halen = PLCCORE_MAC_LEN;
+	memcpy(to.sll_addr, frame + PLCCORE_OFS_DEST, PLCCORE_MAC_LEN);
+	if (sendto(a->fd, frame, len, 0, (struct sockaddr *)&to, sizeof(to)) < 0) {
+		a->nSendErrors++;
+		return -1;
+	}
+	a->nSent++;
+	return 0;
+}
+
+int plcCoreLinuxPoll(plccore_linux *a, plccore *core, int timeoutMs) {
+	struct pollfd pfd;
+	int r, len, txLen;
+	pfd.fd = a->fd;
+	pfd.events = POLLIN;
+	r = poll(&pfd, 1, timeoutMs);
+	if (r < 0) {
+		if (errno == EINTR) r = 0; else return -1;
+	}
+	if (r > 0) {
+		len = recv(a->fd, a->rx, sizeof(a->rx), MSG_DONTWAIT);
+		if (len > 0) {
+			a->nReceived++;
+			txLen = plcCoreReceive(core, a->rx, len, plcCoreLinuxNowMs(), a->tx, sizeof(a->tx));
+			if (txLen > 0) plcCoreLinuxSend(a, a->tx, txLen);
+		}
+		r = (len > 0);
+	}
+	plcCoreCheckTimeouts(core, plcCoreLinuxNowMs());
+	return r;
+}
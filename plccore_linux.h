@@ -0,0 +1,37 @@
+/* Linux adapter of the freestanding core (plccore.h)
+ *
+ * Everything which the core does not do: one raw socket for the HomePlug
+ * ethertype, bound to the interface, the own MAC, the clock, and the receive and
+ * transmit buffers, which the core only borrows. On a controller, this file is
+ * replaced by the driver of its Ethernet MAC; the core stays the same.
+ */
+
+#ifndef PLCCORE_LINUX_HEADER
+#define PLCCORE_LINUX_HEADER
+
+#include <stdint.h>
+#include <net/if.h>
+#include "plccore.h"
+
+#define PLCCORE_LINUX_FRAME_LEN 1518 /* the core knows no frames beyond the Ethernet MTU */
+
+typedef struct plccore_linux {
+	int fd;
+	int ifIndex;
+	char ifName[IFNAMSIZ];
+	uint8_t ownMac[PLCCORE_MAC_LEN];
+	uint8_t rx[PLCCORE_LINUX_FRAME_LEN];
+	uint8_t tx[PLCCORE_LINUX_FRAME_LEN];
+	uint32_t nReceived, nSent, nSendErrors;
+} plccore_linux;
+
+/* Opens and binds the socket, reads the MAC. Returns 0, or -1 with errno. */
+int plcCoreLinuxOpen(plccore_linux *a, const char *ifName);
+void plcCoreLinuxClose(plccore_linux *a);
+uint64_t plcCoreLinuxNowMs(void); /* CLOCK_MONOTONIC */
+int plcCoreLinuxSend(plccore_linux *a, const uint8_t *frame, int len);
+/* Waits up to timeoutMs for a frame, gives it to the core and sends the reaction,
+   then checks the timeouts. Returns 1 if a frame came, 0 if not, -1 on error. */
+int plcCoreLinuxPoll(plccore_linux *a, plccore *core, int timeoutMs);
+
+#endif
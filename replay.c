@@ -0,0 +1,260 @@
+/* Timing-faithful replay of a capture onto the interface, see replay.h */
+
+#define _GNU_SOURCE /* sendmmsg */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <netinet/if_ether.h>
+#include <arpa/inet.h>
+
+#include "plc_homeplug.h"
+#include "stations.h" /* macToKey */
+#include "capture.h"
+#include "capreader.h"
+#include "replay.h"
+
+typedef struct mac_mapping {
+	uint64_t from;
+	uint8_t to[ETH_ALEN];
+} mac_mapping;
+
+int replayActive;
+int replayRealtime;
+
+static mac_mapping mappings[REPLAY_MAX_MAPPINGS];
+static int nMappings;
+
+static capture_file replayFile;
+static int replayFd;
+static struct sockaddr_ll replayAddress;
+static pthread_t replayThread;
+static int replayDone; /* set by the thread, atomic */
+static replay_result result;
+static uint32_t errorHistogram[REPLAY_ERROR_BUCKETS+1];
+static uint64_t spinNs;
+
+/* the frames of one sendmmsg() */
+static unsigned char batchFrames[REPLAY_MAX_BATCH][REPLAY_MAX_FRAME_LEN];
+static struct mmsghdr batchMsgs[REPLAY_MAX_BATCH];
+static struct iovec batchIov[REPLAY_MAX_BATCH];
+static uint64_t batchDeadlines[REPLAY_MAX_BATCH];
+
+static uint64_t monotonicNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+static int parseMac(const char *s, uint8_t *mac) {
+	unsigned int m[ETH_ALEN];
+	int i;
+	if (sscanf(s, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) != ETH_ALEN) return -1;
+	for (i=0; i<ETH_ALEN; i++) mac[i] = m[i];
+	return 0;
+}
+
+int replayLoadMapping(const char *fileName) {
+	char line[200], from[40], to[40];
+	uint8_t mac[ETH_ALEN];
+	FILE *f = fopen(fileName, "r");
+	if (!f) return -1;
+	nMappings = 0;
+	while (fgets(line, sizeof(line), f)) {
+		char *p = line + strspn(line, " \t");
+		if ((*p == '#') || (*p == '\n') || (*p == 0)) continue;
+		if ((nMappings >= REPLAY_MAX_MAPPINGS) || (sscanf(p, "%39s %39s", from, to) != 2) ||
+		    (parseMac(from, mac) < 0) || (parseMac(to, mappings[nMappings].to) < 0)) {
+			fclose(f);
+			return -1;
+		}
+		mappings[nMappings++].from = macToKey(mac);
+	}
+	fclose(f);
+	return nMappings;
+}
+
+/* Returns 1 if the MAC was rewritten */
+static int mapMac(uint8_t *mac) {
+	uint64_t key = macToKey(mac);
+	int i;
+	for (i=0; i<nMappings; i++) {
+		if (mappings[i].from == key) {
+			memcpy(mac, mappings[i].to, ETH_ALEN);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void rewriteMacs(unsigned char *frame, uint32_t len) {
+	struct ethhdr *eh = (struct ethhdr *)frame;
+	int n;
+	if (nMappings == 0) return;
+	n = mapMac(eh->h_dest) + mapMac(eh->h_source);
+	if ((eh->h_proto == htons(ETH_P_HPAV)) && (len >= sizeof(struct ethhdr) + sizeof(struct homeplug_hdr))) {
+		uint16_t mmtype = LE16TOH(((struct homeplug_hdr *)(frame + sizeof(struct ethhdr)))->MMTYPE);
+		if (((mmtype & 0xfffc) == CM_ATTEN_CHAR) && (len >= sizeof(cm_atten_char_response))) {
+			n += mapMac(((cm_atten_char_indicate *)frame)->ACVarField.SOURCE_ADDRESS);
+		} else if (((mmtype & 0xfffc) == CM_SLAC_MATCH) && (len >= sizeof(cm_slac_match_request))) {
+			n += mapMac(((cm_slac_match_request *)frame)->MatchVarField.PEV_MAC);
+			n += mapMac(((cm_slac_match_request *)frame)->MatchVarField.EVSE_MAC);
+		}
+	}
+	if (n) result.nRewritten++;
+}
+
+/* Sleeps until spinNs before the deadline, and spins the rest. If the sleep
+   overshoots, the spin time is increased, and it decays again slowly. */
+static void waitUntil(uint64_t deadlineNs) {
+	struct timespec ts;
+	uint64_t now = monotonicNs();
+	if (deadlineNs > now + spinNs) {
+		uint64_t wake = deadlineNs - spinNs;
+		ts.tv_sec = wake / 1000000000ull;
+		ts.tv_nsec = wake % 1000000000ull;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) { }
+		now = monotonicNs();
+		if (now > wake + spinNs/2) {
+			spinNs = 2*(now - wake);
+			if (spinNs > REPLAY_MAX_SPIN_US*1000ull) spinNs = REPLAY_MAX_SPIN_US*1000ull;
+		} else if (spinNs > REPLAY_SPIN_US*1000ull) {
+			spinNs -= spinNs/64;
+		}
+	}
+	while (now < deadlineNs) now = monotonicNs();
+}
+
+static void recordTiming(uint64_t t, uint64_t deadlineNs, uint64_t *sumAbsErrorNs) {
+	int64_t err = (int64_t)(t - deadlineNs);
+	uint64_t absErr = (err < 0) ? -err : err;
+	if (err > result.maxLateNs) result.maxLateNs = err;
+	if (-err > result.maxEarlyNs) result.maxEarlyNs = -err;
+	if (err > 100000) result.nLate100us++;
+	*sumAbsErrorNs += absErr;
+	errorHistogram[(absErr/1000 < REPLAY_ERROR_BUCKETS) ? absErr/1000 : REPLAY_ERROR_BUCKETS]++;
+}
+
+/* The socket queue is full for a moment, the frame is tried again. */
+static int transientError(int e) {
+	return (e == ENOBUFS) || (e == EAGAIN) || (e == EWOULDBLOCK) || (e == EINTR);
+}
+
+/* Sends the batch. sendmmsg() stops at the first frame it cannot send, so the rest
+   (batchMsgs + done) is sent again. A hard error skips only that one frame. */
+static void sendBatch(int n, uint64_t *sumAbsErrorNs) {
+	int i, sent, done = 0;
+	uint64_t t;
+	result.nBatches++;
+	while (done < n) {
+		t = monotonicNs();
+		sent = sendmmsg(replayFd, batchMsgs + done, n - done, 0);
+		if (sent > 0) {
+			for (i=done; i<done+sent; i++) recordTiming(t, batchDeadlines[i], sumAbsErrorNs);
+			result.nFrames += sent;
+			done += sent;
+			if (done < n) result.nRetries++;
+			continue;
+		}
+		if ((sent < 0) && !transientError(errno)) {
+			result.nFailed++;
+			done++;
+			continue;
+		}
+		if (t > batchDeadlines[done] + REPLAY_RETRY_BUDGET_US*1000ull) {
+			result.nTimedOut += n - done;
+			break;
+		}
+		result.nRetries++;
+		sched_yield();
+	}
+}
+
+static void *replayThreadFunction(void *arg) {
+	capture_cursor cursor = { 0, 0 };
+	const uint8_t *frame;
+	uint32_t capLen;
+	uint64_t tsNs, firstTsNs = 0, startNs = 0, sumAbsErrorNs = 0;
+	uint16_t linktype;
+	int r, n = 0, first = 1;
+	uint32_t i, sum;
+	for (;;) {
+		r = captureReaderNext(&replayFile, &cursor, 1, &frame, &capLen, &tsNs, &linktype);
+		if (r < 0) break;
+		if (r == 0) continue;
+		if ((linktype != PCAP_LINKTYPE_ETHERNET) || (capLen < sizeof(struct ethhdr)) || (capLen > REPLAY_MAX_FRAME_LEN)) {
+			result.nSkipped++;
+			continue;
+		}
+		if (!first && (tsNs < firstTsNs)) tsNs = firstTsNs; /* capture time went backwards */
+		if (first) {
+			firstTsNs = tsNs;
+			startNs = monotonicNs() + 1000000; /* 1 ms to get going */
+			first = 0;
+		}
+		/* the batch is full, or this frame is not due together with the first one */
+		if ((n > 0) && ((n == REPLAY_MAX_BATCH) || (startNs + (tsNs - firstTsNs) > batchDeadlines[0] + REPLAY_BATCH_WINDOW_US*1000ull))) {
+			sendBatch(n, &sumAbsErrorNs);
+			n = 0;
+		}
+		memcpy(batchFrames[n], frame, capLen);
+		rewriteMacs(batchFrames[n], capLen);
+		batchIov[n].iov_base = batchFrames[n];
+		batchIov[n].iov_len = capLen;
+		memset(&batchMsgs[n], 0, sizeof(batchMsgs[n]));
+		batchMsgs[n].msg_hdr.msg_name = &replayAddress;
+		batchMsgs[n].msg_hdr.msg_namelen = sizeof(replayAddress);
+		batchMsgs[n].msg_hdr.msg_iov = &batchIov[n];
+		batchMsgs[n].msg_hdr.msg_iovlen = 1;
+		batchDeadlines[n] = startNs + (tsNs - firstTsNs);
+		if (n == 0) waitUntil(batchDeadlines[0]);
+		n++;
+	}
+	if (n > 0) sendBatch(n, &sumAbsErrorNs);
+	if (!first) result.durationNs = monotonicNs() - startNs;
+	if (result.nFrames > 0) {
+		result.meanAbsErrorNs = sumAbsErrorNs / result.nFrames;
+		for (i=0, sum=0; i<=REPLAY_ERROR_BUCKETS; i++) {
+			sum += errorHistogram[i];
+			if ((uint64_t)sum*100 >= (uint64_t)result.nFrames*99) break;
+		}
+		result.p99AbsErrorNs = (uint64_t)(i+1)*1000;
+	}
+	__atomic_store_n(&replayDone, 1, __ATOMIC_RELEASE);
+	return arg;
+}
+
+int replayStart(const char *fileName, int fd, const struct sockaddr_ll *address) {
+	struct sched_param param;
+	if (captureReaderOpen(&replayFile, fileName) < 0) return -1;
+	replayFd = fd;
+	replayAddress = *address;
+	memset(&result, 0, sizeof(result));
+	memset(errorHistogram, 0, sizeof(errorHistogram));
+	spinNs = REPLAY_SPIN_US*1000ull;
+	replayDone = 0;
+	if (pthread_create(&replayThread, NULL, replayThreadFunction, NULL) != 0) {
+		captureReaderClose(&replayFile);
+		return -1;
+	}
+	/* If we may, the replay thread preempts the main loop. It only spins for REPLAY_SPIN_US. */
+	param.sched_priority = REPLAY_THREAD_PRIORITY;
+	replayRealtime = (pthread_setschedparam(replayThread, SCHED_FIFO, &param) == 0);
+	replayActive = 1;
+	return 0;
+}
+
+int replayService(replay_result *r) {
+	if (!replayActive || !__atomic_load_n(&replayDone, __ATOMIC_ACQUIRE)) return 0;
+	pthread_join(replayThread, NULL);
+	captureReaderClose(&replayFile);
+	replayActive = 0;
+	*r = result;
+	return 1;
+}
@@ -0,0 +1,63 @@
+/* Timing-faithful replay of a capture onto the interface
+ *
+ * With -r, the frames of a pcap/pcapng file are sent through the transmit socket,
+ * with the inter-frame timing of the capture, to reproduce field failures against
+ * the bench modem. The replay runs in its own thread, the main loop keeps on
+ * receiving and logging the reactions.
+ *
+ * Each frame has an absolute deadline, start time plus its offset in the capture,
+ * so errors do not add up over the file. The thread sleeps with
+ * clock_nanosleep(TIMER_ABSTIME) until shortly before the deadline, and spins the
+ * rest. The spin time follows how much the sleeps overshoot. All frames which
+ * are due within REPLAY_BATCH_WINDOW_US are sent with one sendmmsg(), so that
+ * the dense CM_MNBC_SOUND bursts keep their timing. If the socket takes only a part
+ * of the batch, or refuses it for a moment (ENOBUFS, EAGAIN), the rest is sent
+ * again, until REPLAY_RETRY_BUDGET_US after its deadline. A frame counts as failed
+ * only if sending it gives another error.
+ * Source, destination and the PEV/EVSE MACs inside the SLAC messages are rewritten
+ * with a mapping file (-M), one "from to" MAC pair per line.
+ * The difference between deadline and submission is reported at the end.
+ */
+
+#ifndef REPLAY_HEADER
+#define REPLAY_HEADER
+
+#include <stdint.h>
+#include <linux/if_packet.h>
+
+#define REPLAY_BATCH_WINDOW_US 50
+#define REPLAY_MAX_BATCH 32
+#define REPLAY_SPIN_US 200 /* the last part before the deadline is spun, not slept */
+#define REPLAY_MAX_SPIN_US 5000 /* limit, if the sleeps overshoot on a loaded machine */
+#define REPLAY_RETRY_BUDGET_US 2000 /* after the deadline, for the frames which the socket refused for a moment */
+#define REPLAY_MAX_MAPPINGS 256
+#define REPLAY_MAX_FRAME_LEN 2048
+#define REPLAY_THREAD_PRIORITY 10 /* SCHED_FIFO, if permitted */
+#define REPLAY_ERROR_BUCKETS 10000 /* 1 us each, plus one for everything above */
+
+typedef struct replay_result {
+	uint32_t nFrames;    /* sent */
+	uint32_t nFailed;    /* sendmmsg refused them with a hard error */
+	uint32_t nTimedOut;  /* still refused with ENOBUFS or EAGAIN at the end of the retry budget */
+	uint32_t nRetries;   /* sendmmsg calls for the rest of a batch */
+	uint32_t nSkipped;   /* not Ethernet, too short or too long */
+	uint32_t nRewritten; /* frames with at least one MAC rewritten */
+	uint32_t nBatches;
+	uint32_t nLate100us; /* frames submitted more than 100 us after the deadline */
+	int64_t maxLateNs, maxEarlyNs;
+	uint64_t meanAbsErrorNs;
+	uint64_t p99AbsErrorNs;
+	uint64_t durationNs;
+} replay_result;
+
+extern int replayActive;
+extern int replayRealtime; /* the replay thread runs with SCHED_FIFO */
+
+/* Reads the MAC mapping. Returns the number of pairs, or -1. */
+int replayLoadMapping(const char *fileName);
+/* Opens the capture and starts the replay thread. */
+int replayStart(const char *fileName, int fd, const struct sockaddr_ll *address);
+/* Returns 1 once, when the replay has finished, and fills the result. */
+int replayService(replay_result *result);
+
+#endif
@@ -0,0 +1,103 @@
+/* Loss accounting for the receive socket, see rxstats.h */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#include <linux/sock_diag.h>
+#include <net/if.h>
+
+#include "rxstats.h"
+
+uint32_t nRxTotalDrops, nRxTotalIfDropped;
+
+static int rxFd = -1;
+static char rxIfName[IFNAMSIZ];
+static uint32_t rxqOverflowCounter, rxqOverflowLast; /* SO_RXQ_OVFL, cumulative */
+static uint64_t ifDroppedLast, ifMissedLast;
+
+/* one counter of /sys/class/net/<if>/statistics, 0 if not there */
+static uint64_t readIfCounter(const char *name) {
+	char fileName[100];
+	unsigned long long value = 0;
+	FILE *f;
+	snprintf(fileName, sizeof(fileName), "/sys/class/net/%s/statistics/%s", rxIfName, name);
+	f = fopen(fileName, "r");
+	if (!f) return 0;
+	if (fscanf(f, "%llu", &value) != 1) value = 0;
+	fclose(f);
+	return value;
+}
+
+static uint32_t getRcvbuf(void) {
+	int size = 0;
+	socklen_t len = sizeof(size);
+	if (getsockopt(rxFd, SOL_SOCKET, SO_RCVBUF, &size, &len) < 0) return 0;
+	return size;
+}
+
+int rxStatsInit(int fd, const char *ifName, int rcvbufBytes) {
+	int one = 1;
+	struct tpacket_stats st;
+	socklen_t len = sizeof(st);
+	rxFd = fd;
+	strncpy(rxIfName, ifName, IFNAMSIZ-1);
+	if (rcvbufBytes > 0) {
+		/* SO_RCVBUFFORCE ignores rmem_max, but needs CAP_NET_ADMIN */
+		if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbufBytes, sizeof(rcvbufBytes)) < 0) {
+			if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbufBytes, sizeof(rcvbufBytes)) < 0) return -1;
+		}
+	}
+	if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) < 0) return -1;
+	/* reading the statistics resets them, so the first interval starts now */
+	getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &st, &len);
+	ifDroppedLast = readIfCounter("rx_dropped");
+	ifMissedLast = readIfCounter("rx_missed_errors") + readIfCounter("rx_fifo_errors");
+	return getRcvbuf();
+}
+
+void rxStatsObserveMsg(const struct msghdr *msg) {
+	struct cmsghdr *cmsg;
+	for (cmsg = CMSG_FIRSTHDR((struct msghdr *)msg); cmsg; cmsg = CMSG_NXTHDR((struct msghdr *)msg, cmsg)) {
+		if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SO_RXQ_OVFL)) {
+			memcpy(&rxqOverflowCounter, CMSG_DATA(cmsg), sizeof(rxqOverflowCounter));
+		}
+	}
+}
+
+void rxStatsSample(rx_stats_interval *s) {
+	struct tpacket_stats_v3 st;
+	socklen_t len = sizeof(st);
+	uint32_t meminfo[SK_MEMINFO_VARS];
+	socklen_t memLen = sizeof(meminfo);
+	uint64_t ifDropped, ifMissed;
+	memset(s, 0, sizeof(*s));
+	memset(&st, 0, sizeof(st));
+	if (rxFd < 0) return;
+	/* Without ring, the kernel fills only the tpacket_stats part and shortens len. */
+	if (getsockopt(rxFd, SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0) {
+		s->packets = st.tp_packets;
+		s->drops = st.tp_drops;
+		if (len >= sizeof(struct tpacket_stats_v3)) {
+			s->ringMode = 1;
+			s->freezeQueue = st.tp_freeze_q_cnt;
+		}
+	}
+	s->rxqOverflow = rxqOverflowCounter - rxqOverflowLast;
+	rxqOverflowLast = rxqOverflowCounter;
+	ifDropped = readIfCounter("rx_dropped");
+	ifMissed = readIfCounter("rx_missed_errors") + readIfCounter("rx_fifo_errors");
+	s->ifDropped = ifDropped - ifDroppedLast;
+	s->ifMissed = ifMissed - ifMissedLast;
+	ifDroppedLast = ifDropped;
+	ifMissedLast = ifMissed;
+	if (getsockopt(rxFd, SOL_SOCKET, SO_MEMINFO, meminfo, &memLen) == 0) {
+		s->rcvbufUsed = meminfo[SK_MEMINFO_RMEM_ALLOC];
+		s->rcvbufSize = meminfo[SK_MEMINFO_RCVBUF];
+	} else {
+		s->rcvbufSize = getRcvbuf();
+	}
+	nRxTotalDrops += s->drops;
+	nRxTotalIfDropped += s->ifDropped;
+}
@@ -0,0 +1,49 @@
+/* Loss accounting for the receive socket
+ *
+ * To know where frames are lost, we look at three places:
+ *   - the interface: rx_dropped, rx_missed_errors and rx_fifo_errors from
+ *     /sys/class/net/<if>/statistics. Frames which the driver or the NIC dropped,
+ *     before any socket saw them.
+ *   - the socket: PACKET_STATISTICS of sock_fd_rx. tp_packets are the frames which
+ *     the kernel handed to the socket, tp_drops the ones which did not fit into the
+ *     receive buffer, because the main loop did not read fast enough. With a
+ *     TPACKET_V3 ring, the kernel also reports tp_freeze_q_cnt.
+ *     The kernel resets these counters on each read, so each sample is one interval.
+ *   - SO_RXQ_OVFL: the drop counter of the socket, delivered with each frame which
+ *     is read by recvmsg(). Tells us in the log between which frames the loss was.
+ * The size of the receive buffer is set with SO_RCVBUFFORCE (as root) or SO_RCVBUF,
+ * and SO_MEMINFO shows how full it is at the time of the sample.
+ */
+
+#ifndef RXSTATS_HEADER
+#define RXSTATS_HEADER
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+/* space for the SO_RXQ_OVFL control message of recvmsg() */
+#define RXSTATS_CONTROL_LEN CMSG_SPACE(sizeof(uint32_t))
+
+typedef struct rx_stats_interval {
+	uint32_t packets;       /* tp_packets, including the dropped ones */
+	uint32_t drops;         /* tp_drops: receive buffer of the socket was full */
+	uint32_t freezeQueue;   /* tp_freeze_q_cnt, only in ring mode */
+	uint32_t rxqOverflow;   /* increase of the SO_RXQ_OVFL counter */
+	uint32_t ifDropped;     /* increase of rx_dropped of the interface */
+	uint32_t ifMissed;      /* increase of rx_missed_errors + rx_fifo_errors */
+	uint32_t rcvbufUsed;    /* bytes in the receive buffer at the sample time */
+	uint32_t rcvbufSize;    /* effective size of the receive buffer */
+	uint8_t ringMode;       /* the kernel reported TPACKET_V3 statistics */
+} rx_stats_interval;
+
+extern uint32_t nRxTotalDrops, nRxTotalIfDropped; /* sums over all intervals */
+
+/* Sets the receive buffer (0: keep the default) and enables SO_RXQ_OVFL.
+   Returns the effective size of the receive buffer, or -1. */
+int rxStatsInit(int fd, const char *ifName, int rcvbufBytes);
+/* To be called with the msghdr of each recvmsg(), picks the SO_RXQ_OVFL counter. */
+void rxStatsObserveMsg(const struct msghdr *msg);
+/* Reads the counters of the interval since the last sample. */
+void rxStatsSample(rx_stats_interval *s);
+
+#endif
@@ -0,0 +1,212 @@
+/* On-disk index of the SLAC sessions in a capture file, see sessionindex.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sessionindex.h"
+
+/* the key of each sort order: offset and length in the record */
+static const struct {
+	int offset, len;
+} keyFields[SESSION_INDEX_NUMBER_OF_KEYS] = {
+	{ offsetof(session_index_record, pevMac), ETH_ALEN },
+	{ offsetof(session_index_record, evseMac), ETH_ALEN },
+	{ offsetof(session_index_record, runId), SLAC_RUNID_LEN },
+	{ offsetof(session_index_record, nid), SLAC_NID_LEN }
+};
+
+void sessionIndexInit(session_index *ix) {
+	memset(ix, 0, sizeof(*ix));
+}
+
+void sessionIndexFree(session_index *ix) {
+	free(ix->records);
+	sessionIndexInit(ix);
+}
+
+int sessionIndexAddSession(session_index *ix, const slac_session *s, int state, int flags, int64_t timeOffsetNs) {
+	session_index_record *r;
+	if (ix->nRecords == ix->size) {
+		int newSize = ix->size ? 2*ix->size : 256;
+		session_index_record *p = realloc(ix->records, newSize * sizeof(session_index_record));
+		if (!p) return -1;
+		ix->records = p;
+		ix->size = newSize;
+	}
+	r = &ix->records[ix->nRecords++];
+	memset(r, 0, sizeof(*r));
+	memcpy(r->pevMac, s->core.pevMac, ETH_ALEN);
+	memcpy(r->evseMac, s->core.evseMac, ETH_ALEN);
+	memcpy(r->runId, s->core.runId, SLAC_RUNID_LEN);
+	memcpy(r->nid, s->core.nid, SLAC_NID_LEN);
+	r->state = state;
+	r->flags = flags;
+	r->nFrames = s->nCaptureFrames;
+	r->startNs = s->core.startMs*1000000ull + timeOffsetNs;
+	r->endNs = s->core.lastMs*1000000ull + timeOffsetNs;
+	r->firstOffset = s->captureFirstOffset;
+	r->lastOffset = s->captureLastOffset;
+	return 0;
+}
+
+/* qsort has no context parameter. Writing happens in one thread only. */
+static const session_index_record *sortRecords;
+static int sortKey;
+
+static int compareStart(const void *a, const void *b) {
+	const session_index_record *ra = a, *rb = b;
+	return (ra->startNs < rb->startNs) ? -1 : (ra->startNs > rb->startNs) ? 1 : 0;
+}
+
+static int compareKey(const void *a, const void *b) {
+	const uint8_t *ra = (const uint8_t *)&sortRecords[*(const uint32_t *)a];
+	const uint8_t *rb = (const uint8_t *)&sortRecords[*(const uint32_t *)b];
+	int c = memcmp(ra + keyFields[sortKey].offset, rb + keyFields[sortKey].offset, keyFields[sortKey].len);
+	if (c) return c;
+	/* same key: in time order */
+	return (*(const uint32_t *)a < *(const uint32_t *)b) ? -1 : 1;
+}
+
+int sessionIndexWrite(session_index *ix, const char *captureFileName, uint64_t captureSize) {
+	char fileName[1024];
+	session_index_header h;
+	uint32_t *order;
+	FILE *f;
+	int i, k, ok = 1;
+	snprintf(fileName, sizeof(fileName), "%s%s", captureFileName, SESSION_INDEX_SUFFIX);
+	order = malloc((ix->nRecords+1) * sizeof(uint32_t));
+	if (!order) return -1;
+	f = fopen(fileName, "wb");
+	if (!f) {
+		free(order);
+		return -1;
+	}
+	qsort(ix->records, ix->nRecords, sizeof(session_index_record), compareStart);
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SESSION_INDEX_MAGIC, sizeof(h.magic));
+	h.nRecords = ix->nRecords;
+	h.recordSize = sizeof(session_index_record);
+	h.captureSize = captureSize;
+	for (i=0; i<ix->nRecords; i++) {
+		uint64_t d = ix->records[i].endNs - ix->records[i].startNs;
+		if (d > h.maxDurationNs) h.maxDurationNs = d;
+	}
+	ok &= (fwrite(&h, sizeof(h), 1, f) == 1);
+	ok &= (fwrite(ix->records, sizeof(session_index_record), ix->nRecords, f) == (size_t)ix->nRecords);
+	sortRecords = ix->records;
+	for (k=0; k<SESSION_INDEX_NUMBER_OF_KEYS; k++) {
+		for (i=0; i<ix->nRecords; i++) order[i] = i;
+		sortKey = k;
+		qsort(order, ix->nRecords, sizeof(uint32_t), compareKey);
+		ok &= (fwrite(order, sizeof(uint32_t), ix->nRecords, f) == (size_t)ix->nRecords);
+	}
+	free(order);
+	ok &= (fclose(f) == 0);
+	return ok ? 0 : -1;
+}
+
+int sessionIndexMap(session_index_map *m, const char *captureFileName) {
+	char fileName[1024];
+	struct stat st, stCapture;
+	const session_index_header *h;
+	uint32_t i;
+	int fd, k;
+	memset(m, 0, sizeof(*m));
+	snprintf(fileName, sizeof(fileName), "%s%s", captureFileName, SESSION_INDEX_SUFFIX);
+	fd = open(fileName, O_RDONLY);
+	if (fd<0) return -1;
+	if ((fstat(fd, &st)<0) || (st.st_size < (off_t)sizeof(session_index_header))) {
+		close(fd);
+		return -1;
+	}
+	m->mapSize = st.st_size;
+	h = mmap(NULL, m->mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (h == MAP_FAILED) return -1;
+	if ((memcmp(h->magic, SESSION_INDEX_MAGIC, sizeof(h->magic))!=0) || (h->recordSize != sizeof(session_index_record)) ||
+	    (m->mapSize < sizeof(*h) + (uint64_t)h->nRecords * (sizeof(session_index_record) + SESSION_INDEX_NUMBER_OF_KEYS*sizeof(uint32_t)))) {
+		munmap((void *)h, m->mapSize);
+		return -1;
+	}
+	m->header = h;
+	m->records = (const session_index_record *)(h+1);
+	for (k=0; k<SESSION_INDEX_NUMBER_OF_KEYS; k++) {
+		m->byKey[k] = (const uint32_t *)(m->records + h->nRecords) + (size_t)k*h->nRecords;
+		/* the queries use the record numbers without checking, so a garbled file is rejected here */
+		for (i=0; i<h->nRecords; i++) {
+			if (m->byKey[k][i] >= h->nRecords) {
+				munmap((void *)h, m->mapSize);
+				memset(m, 0, sizeof(*m));
+				return -1;
+			}
+		}
+	}
+	m->stale = (stat(captureFileName, &stCapture)<0) || ((uint64_t)stCapture.st_size != h->captureSize);
+	return 0;
+}
+
+void sessionIndexUnmap(session_index_map *m) {
+	if (m->header) munmap((void *)m->header, m->mapSize);
+	m->header = NULL;
+}
+
+static int matches(const session_index_record *r, const session_index_query *q) {
+	if (q->pevMac && memcmp(r->pevMac, q->pevMac, ETH_ALEN)) return 0;
+	if (q->evseMac && memcmp(r->evseMac, q->evseMac, ETH_ALEN)) return 0;
+	if (q->runId && memcmp(r->runId, q->runId, SLAC_RUNID_LEN)) return 0;
+	if (q->nid && memcmp(r->nid, q->nid, SLAC_NID_LEN)) return 0;
+	if (q->fromNs && (r->endNs < q->fromNs)) return 0;
+	if (q->toNs && (r->startNs > q->toNs)) return 0;
+	return 1;
+}
+
+int sessionIndexQuery(const session_index_map *m, const session_index_query *q, session_index_callback cb, void *context) {
+	const uint8_t *key = NULL;
+	const uint32_t *order;
+	uint32_t n = m->header->nRecords, lo, hi, mid, i;
+	int k = -1, nMatches = 0;
+	/* the most selective key which is given */
+	if (q->runId) { k = SESSION_INDEX_BY_RUNID; key = q->runId; }
+	else if (q->pevMac) { k = SESSION_INDEX_BY_PEV; key = q->pevMac; }
+	else if (q->nid) { k = SESSION_INDEX_BY_NID; key = q->nid; }
+	else if (q->evseMac) { k = SESSION_INDEX_BY_EVSE; key = q->evseMac; }
+	if (k < 0) {
+		/* only the time: binary search in the records, which are sorted by start time */
+		uint64_t from = (q->fromNs > m->header->maxDurationNs) ? q->fromNs - m->header->maxDurationNs : 0;
+		lo = 0; hi = n;
+		while (lo < hi) {
+			mid = (lo+hi)/2;
+			if (m->records[mid].startNs < from) lo = mid+1; else hi = mid;
+		}
+		for (i=lo; i<n; i++) {
+			if (q->toNs && (m->records[i].startNs > q->toNs)) break;
+			if (matches(&m->records[i], q)) {
+				cb(&m->records[i], context);
+				nMatches++;
+			}
+		}
+		return nMatches;
+	}
+	order = m->byKey[k];
+	lo = 0; hi = n;
+	while (lo < hi) {
+		mid = (lo+hi)/2;
+		if (memcmp((const uint8_t *)&m->records[order[mid]] + keyFields[k].offset, key, keyFields[k].len) < 0) lo = mid+1; else hi = mid;
+	}
+	for (i=lo; i<n; i++) {
+		const session_index_record *r = &m->records[order[i]];
+		if (memcmp((const uint8_t *)r + keyFields[k].offset, key, keyFields[k].len)) break;
+		if (matches(r, q)) {
+			cb(r, context);
+			nMatches++;
+		}
+	}
+	return nMatches;
+}
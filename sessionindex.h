@@ -0,0 +1,92 @@
+/* On-disk index of the SLAC sessions in a capture file
+ *
+ * Next to each capture file "x.pcap" an index "x.pcap.idx" is written, with one
+ * record per SLAC session: PEV MAC, EVSE MAC, RunID, NID, time range, final state
+ * and the byte offsets of the first and last frame of the session in the capture.
+ * listen_to_eth writes it when the capture (-w) is closed, plc_analyzer -x writes
+ * it for existing captures, and plc_query uses it to find sessions and to extract
+ * their frames, without reading the capture.
+ *
+ * File layout, host byte order, made to be used directly from mmap:
+ *   session_index_header
+ *   nRecords session_index_record, sorted by start time
+ *   four uint32_t arrays with nRecords record numbers each, sorted by
+ *   PEV MAC, EVSE MAC, RunID and NID, for the binary search.
+ */
+
+#ifndef SESSIONINDEX_HEADER
+#define SESSIONINDEX_HEADER
+
+#include <stdint.h>
+#include <netinet/if_ether.h>
+#include "plc_homeplug.h"
+#include "slacsession.h"
+
+#define SESSION_INDEX_MAGIC "PLCIDX01"
+#define SESSION_INDEX_SUFFIX ".idx"
+#define SESSION_INDEX_FLAG_OPEN 0x01 /* the capture ended before the session */
+
+enum {
+	SESSION_INDEX_BY_PEV,
+	SESSION_INDEX_BY_EVSE,
+	SESSION_INDEX_BY_RUNID,
+	SESSION_INDEX_BY_NID,
+	SESSION_INDEX_NUMBER_OF_KEYS
+};
+
+typedef struct __packed session_index_header {
+	char magic[8];
+	uint32_t nRecords;
+	uint32_t recordSize;
+	uint64_t captureSize; /* size of the capture file, to detect a stale index */
+	uint64_t maxDurationNs; /* for the search by time */
+} session_index_header;
+
+typedef struct __packed session_index_record {
+	uint8_t pevMac[ETH_ALEN];
+	uint8_t evseMac[ETH_ALEN];
+	uint8_t runId[SLAC_RUNID_LEN];
+	uint8_t nid[SLAC_NID_LEN];
+	uint8_t state; /* the last SLAC state, see slacsession.h */
+	uint8_t flags;
+	uint8_t reserved;
+	uint16_t section; /* pcapng section of the session, 0 for pcap */
+	uint32_t nFrames;
+	uint64_t startNs, endNs; /* unix time */
+	uint64_t firstOffset, lastOffset; /* of the first and last frame record in the capture file */
+} session_index_record;
+
+/* collecting the records, for writing */
+typedef struct session_index {
+	session_index_record *records;
+	int nRecords, size;
+} session_index;
+
+/* a mapped index file, for reading */
+typedef struct session_index_map {
+	const session_index_header *header;
+	const session_index_record *records;
+	const uint32_t *byKey[SESSION_INDEX_NUMBER_OF_KEYS];
+	size_t mapSize;
+	int stale; /* the capture file has changed since the index was written */
+} session_index_map;
+
+typedef struct session_index_query {
+	const uint8_t *pevMac, *evseMac, *runId, *nid; /* NULL: do not care */
+	uint64_t fromNs, toNs; /* sessions which overlap this range. 0: do not care */
+} session_index_query;
+
+typedef void (*session_index_callback)(const session_index_record *r, void *context);
+
+void sessionIndexInit(session_index *ix);
+/* Adds the session. timeOffsetNs converts the times of the session (ms) into unix time (ns). */
+int sessionIndexAddSession(session_index *ix, const slac_session *s, int state, int flags, int64_t timeOffsetNs);
+int sessionIndexWrite(session_index *ix, const char *captureFileName, uint64_t captureSize);
+void sessionIndexFree(session_index *ix);
+
+int sessionIndexMap(session_index_map *m, const char *captureFileName);
+void sessionIndexUnmap(session_index_map *m);
+/* Calls the callback for each matching session, returns the number of matches. */
+int sessionIndexQuery(const session_index_map *m, const session_index_query *q, session_index_callback cb, void *context);
+
+#endif
@@ -0,0 +1,115 @@
+/* The frames of a scripted SLAC session, see slacframes.h */
+
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <netinet/if_ether.h>
+
+#include "plc_homeplug.h"
+#include "slacframes.h"
+
+static const uint8_t broadcastMac[ETH_ALEN] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+void slacFramesSession(slacframes_session *s, uint32_t n) {
+	memset(s, 0, sizeof(*s));
+	s->pevMac[0] = 0x02; s->pevMac[1] = 0x50; s->pevMac[2] = 0x45; s->pevMac[3] = 0x56;
+	s->pevMac[4] = (n >> 8) & 0xff;
+	s->pevMac[5] = n & 0xff;
+	memcpy(s->runId, &n, sizeof(n));
+	s->runId[7] = 0x5a;
+	s->numberOfSounds = SLAC_MSOUNDS;
+}
+
+int32_t slacFramesSessionOfPevMac(const uint8_t *mac) {
+	if ((mac[0] != 0x02) || (mac[1] != 0x50) || (mac[2] != 0x45) || (mac[3] != 0x56)) return -1;
+	return (mac[4] << 8) | mac[5];
+}
+
+void slacFramesHeader(unsigned char *frame, const uint8_t *dst, const uint8_t *src, uint16_t mmtype) {
+	struct ethhdr *eh = (struct ethhdr *)frame;
+	struct homeplug_fmi *hp = (struct homeplug_fmi *)(frame + sizeof(struct ethhdr));
+	memcpy(eh->h_dest, dst, ETH_ALEN);
+	memcpy(eh->h_source, src, ETH_ALEN);
+	eh->h_proto = htons(ETH_P_HPAV);
+	hp->MMV = HOMEPLUG_MMV;
+	hp->MMTYPE = HTOLE16(mmtype);
+}
+
+int slacFramesBuild(unsigned char *frame, int size, int kind, const slacframes_session *s, int count) {
+	int i;
+	memset(frame, 0, size);
+	switch (kind) {
+		case SLACFRAME_PARAM_REQ: { /* PEV -> broadcast */
+			struct cm_slac_param_request *m = (struct cm_slac_param_request *)frame;
+			slacFramesHeader(frame, broadcastMac, s->pevMac, CM_SLAC_PARAM | MMTYPE_REQ);
+			memcpy(m->RunID, s->runId, SLAC_RUNID_LEN);
+			return sizeof(*m);
+		}
+		case SLACFRAME_PARAM_CNF: { /* EVSE -> PEV */
+			struct cm_slac_param_confirm *m = (struct cm_slac_param_confirm *)frame;
+			slacFramesHeader(frame, s->pevMac, s->evseMac, CM_SLAC_PARAM | MMTYPE_CNF);
+			memset(m->MSOUND_TARGET, 0xff, ETH_ALEN);
+			m->NUM_SOUNDS = s->numberOfSounds;
+			m->TIME_OUT = SLAC_TIMETOSOUND;
+			m->RESP_TYPE = 1;
+			memcpy(m->FORWARDING_STA, s->pevMac, ETH_ALEN);
+			memcpy(m->RunID, s->runId, SLAC_RUNID_LEN);
+			return sizeof(*m);
+		}
+		case SLACFRAME_START_ATTEN: { /* PEV -> broadcast */
+			struct cm_start_atten_char_indicate *m = (struct cm_start_atten_char_indicate *)frame;
+			slacFramesHeader(frame, broadcastMac, s->pevMac, CM_START_ATTEN_CHAR | MMTYPE_IND);
+			m->ACVarField.NUM_SOUNDS = s->numberOfSounds;
+			m->ACVarField.TIME_OUT = SLAC_TIMETOSOUND;
+			m->ACVarField.RESP_TYPE = 1;
+			memcpy(m->ACVarField.FORWARDING_STA, s->pevMac, ETH_ALEN);
+			memcpy(m->ACVarField.RunID, s->runId, SLAC_RUNID_LEN);
+			return sizeof(*m);
+		}
+		case SLACFRAME_SOUND: { /* PEV -> broadcast */
+			struct cm_mnbc_sound_indicate *m = (struct cm_mnbc_sound_indicate *)frame;
+			slacFramesHeader(frame, broadcastMac, s->pevMac, CM_MNBC_SOUND | MMTYPE_IND);
+			m->MSVarField.CNT = s->numberOfSounds - 1 - count;
+			memcpy(m->MSVarField.RunID, s->runId, SLAC_RUNID_LEN);
+			return sizeof(*m);
+		}
+		case SLACFRAME_ATTEN_IND: { /* EVSE -> PEV */
+			struct cm_atten_char_indicate *m = (struct cm_atten_char_indicate *)frame;
+			slacFramesHeader(frame, s->pevMac, s->evseMac, CM_ATTEN_CHAR | MMTYPE_IND);
+			memcpy(m->ACVarField.SOURCE_ADDRESS, s->pevMac, ETH_ALEN);
+			memcpy(m->ACVarField.RunID, s->runId, SLAC_RUNID_LEN);
+			m->ACVarField.NUM_SOUNDS = s->numberOfSounds;
+			m->ACVarField.ATTEN_PROFILE.NumGroups = SLAC_GROUPS;
+			for (i = 0; i < SLAC_GROUPS; i++) m->ACVarField.ATTEN_PROFILE.AAG[i] = 20 + (i & 7);
+			return sizeof(*m);
+		}
+		case SLACFRAME_ATTEN_RSP: { /* PEV -> EVSE */
+			struct cm_atten_char_response *m = (struct cm_atten_char_response *)frame;
+			slacFramesHeader(frame, s->evseMac, s->pevMac, CM_ATTEN_CHAR | MMTYPE_RSP);
+			memcpy(m->ACVarField.SOURCE_ADDRESS, s->pevMac, ETH_ALEN);
+			memcpy(m->ACVarField.RunID, s->runId, SLAC_RUNID_LEN);
+			return sizeof(*m);
+		}
+		case SLACFRAME_MATCH_REQ: { /* PEV -> EVSE */
+			struct cm_slac_match_request *m = (struct cm_slac_match_request *)frame;
+			slacFramesHeader(frame, s->evseMac, s->pevMac, CM_SLAC_MATCH | MMTYPE_REQ);
+			m->MVFLength = HTOLE16(sizeof(m->MatchVarField));
+			memcpy(m->MatchVarField.PEV_MAC, s->pevMac, ETH_ALEN);
+			memcpy(m->MatchVarField.EVSE_MAC, s->evseMac, ETH_ALEN);
+			memcpy(m->MatchVarField.RunID, s->runId, SLAC_RUNID_LEN);
+			return sizeof(*m);
+		}
+		case SLACFRAME_MATCH_CNF: { /* EVSE -> PEV, with the NID and NMK of the session */
+			struct cm_slac_match_confirm *m = (struct cm_slac_match_confirm *)frame;
+			slacFramesHeader(frame, s->pevMac, s->evseMac, CM_SLAC_MATCH | MMTYPE_CNF);
+			m->MVFLength = HTOLE16(sizeof(m->MatchVarField));
+			memcpy(m->MatchVarField.PEV_MAC, s->pevMac, ETH_ALEN);
+			memcpy(m->MatchVarField.EVSE_MAC, s->evseMac, ETH_ALEN);
+			memcpy(m->MatchVarField.RunID, s->runId, SLAC_RUNID_LEN);
+			memcpy(m->MatchVarField.NID, s->nid, SLAC_NID_LEN);
+			memcpy(m->MatchVarField.NMK, s->nmk, SLAC_NMK_LEN);
+			return sizeof(*m);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,47 @@
+/* The frames of a scripted SLAC session
+ *
+ * plc_simulator (on a veth pair) and the simulation of listen_to_eth -S (slacsim.c)
+ * play the same sequence of the PEV and the EVSE:
+ *   CM_SLAC_PARAM.REQ/CNF, CM_START_ATTEN_CHAR.IND, CM_MNBC_SOUND.IND,
+ *   CM_ATTEN_CHAR.IND/RSP, CM_SLAC_MATCH.REQ/CNF.
+ * Both take the frames from here, so they cannot drift apart. Session n has the
+ * PEV MAC 02:50:45:56:nn:nn (locally administered, "PEV") and a RunID of n and 0x5a.
+ * The EVSE MAC, the NID and the NMK are chosen by the caller.
+ */
+
+#ifndef SLACFRAMES_HEADER
+#define SLACFRAMES_HEADER
+
+#include <stdint.h>
+#include <netinet/if_ether.h>
+#include "plc_homeplug.h"
+
+#define SLACFRAMES_FRAME_SIZE 256
+
+enum {
+	SLACFRAME_PARAM_REQ, SLACFRAME_PARAM_CNF, SLACFRAME_START_ATTEN, SLACFRAME_SOUND,
+	SLACFRAME_ATTEN_IND, SLACFRAME_ATTEN_RSP, SLACFRAME_MATCH_REQ, SLACFRAME_MATCH_CNF
+};
+
+typedef struct slacframes_session {
+	uint8_t pevMac[ETH_ALEN];
+	uint8_t evseMac[ETH_ALEN];
+	uint8_t runId[SLAC_RUNID_LEN];
+	uint8_t nid[SLAC_NID_LEN];   /* only for the CM_SLAC_MATCH.CNF */
+	uint8_t nmk[SLAC_NMK_LEN];   /* only for the CM_SLAC_MATCH.CNF */
+	int numberOfSounds;
+} slacframes_session;
+
+/* PEV MAC and RunID of session n, numberOfSounds SLAC_MSOUNDS. The rest is zero. */
+void slacFramesSession(slacframes_session *s, uint32_t n);
+/* The session n of a PEV MAC, or -1 if the MAC is not from slacFramesSession(). */
+int32_t slacFramesSessionOfPevMac(const uint8_t *mac);
+
+/* Fills the ethernet and homeplug header. The frame must be zeroed before. */
+void slacFramesHeader(unsigned char *frame, const uint8_t *dst, const uint8_t *src, uint16_t mmtype);
+/* Zeroes size bytes of frame and builds the frame of the kind. size must hold the largest
+   SLAC frame, SLACFRAMES_FRAME_SIZE. count is the number of the CM_MNBC_SOUND.IND, from 0.
+   Returns the length, 0 for an unknown kind. */
+int slacFramesBuild(unsigned char *frame, int size, int kind, const slacframes_session *s, int count);
+
+#endif
@@ -0,0 +1,87 @@
+/* SLAC session tracking, see slacsession.h */
+
+#include <string.h>
+#include <stdint.h>
+
+#include "slacsession.h"
+
+/* thread local, so that each worker of the offline analyzer has its own tracking */
+static __thread plccore tracker;
+static __thread int trackerReady;
+static __thread slac_session sessions[SLAC_MAX_SESSIONS];
+static __thread slac_transition_callback transitionCallback;
+
+const char *slacStateName(int state) {
+	return plcCoreStateName(state);
+}
+
+/* The plccore_session is the first member of the slac_session, see slacsession.h */
+static void onCoreTransition(plccore *core, const plccore_session *session, int oldState) {
+	slac_session *s = (slac_session *)session;
+	if (oldState==SLAC_STATE_IDLE) s->nCaptureFrames = 0; /* a new attempt */
+	if (transitionCallback) transitionCallback(s, oldState);
+}
+
+static plccore *getTracker(void) {
+	if (!trackerReady) {
+		plcCoreInit(&tracker, NULL, NULL, onCoreTransition, NULL);
+		plcCoreUseTable(&tracker, sessions, sizeof(slac_session), SLAC_MAX_SESSIONS);
+		trackerReady = 1;
+	}
+	return &tracker;
+}
+
+void slacSetTransitionCallback(slac_transition_callback cb) {
+	transitionCallback = cb;
+}
+
+void slacReset(void) {
+	plcCoreUseTable(getTracker(), sessions, sizeof(slac_session), SLAC_MAX_SESSIONS);
+}
+
+slac_session *slacObserveFrame(const unsigned char *frame, int len, uint64_t nowMs) {
+	plccore_mme m;
+	if (plcCoreDecode(frame, len, &m) != PLCCORE_OK) return NULL;
+	if (m.mmtype == (PLCCORE_CM_SET_KEY | PLCCORE_MMTYPE_CNF)) return NULL; /* slacObserveSetKeyConfirm() */
+	return (slac_session *)plcCoreObserve(getTracker(), &m, nowMs);
+}
+
+void slacSetKeyPeer(const uint8_t *ownMac, const uint8_t *modemMac) {
+	plccore *core = getTracker();
+	memcpy(core->ownMac, ownMac, ETH_ALEN);
+	memcpy(core->modemMac, modemMac, ETH_ALEN);
+	core->passive = 0;
+}
+
+int slacObserveSetKeyConfirm(const unsigned char *frame, int len, uint64_t nowMs) {
+	plccore_mme m;
+	if (plcCoreDecode(frame, len, &m) != PLCCORE_OK) return 0;
+	if (m.mmtype != (PLCCORE_CM_SET_KEY | PLCCORE_MMTYPE_CNF)) return 0;
+	return plcCoreObserve(getTracker(), &m, nowMs) != NULL;
+}
+
+void slacCheckTimeouts(uint64_t nowMs) {
+	plcCoreCheckTimeouts(getTracker(), nowMs);
+}
+
+slac_session *slacFindSession(const uint8_t *pevMac) {
+	return (slac_session *)plcCoreFindSession(getTracker(), pevMac);
+}
+
+int slacExportSessions(slac_session *out, int *lastMatched) {
+	memcpy(out, sessions, sizeof(sessions));
+	*lastMatched = getTracker()->lastMatched;
+	return SLAC_MAX_SESSIONS;
+}
+
+void slacImportSessions(const slac_session *in, int lastMatched) {
+	getTracker()->lastMatched = lastMatched;
+	memcpy(sessions, in, sizeof(sessions));
+}
+
+void slacForEachSession(void (*fn)(const slac_session *session)) {
+	int i;
+	for (i=0; i<SLAC_MAX_SESSIONS; i++) {
+		if (sessions[i].core.inUse) fn(&sessions[i]);
+	}
+}
@@ -0,0 +1,73 @@
+/* SLAC session tracking
+ *
+ * We only listen, so this is a passive observer of the SLAC sequence between
+ * a PEV and an EVSE (ISO15118-3):
+ *   CM_SLAC_PARAM.REQ/CNF, CM_START_ATTEN_CHAR.IND, CM_MNBC_SOUND.IND,
+ *   CM_ATTEN_CHAR.IND/RSP, CM_SLAC_MATCH.REQ/CNF, followed by our CM_SET_KEY.
+ * A session is identified by the MAC of the PEV. If a session does not make
+ * progress within SLAC_SESSION_TIMEOUT_MS, it ends with state "TIMEOUT".
+ * Each state change is reported through the transition callback.
+ * The tracking is the one of the freestanding core (plccore.h), with a table of
+ * SLAC_MAX_SESSIONS sessions, which carry also the V2G data and the position in the
+ * capture. The tracking state is per thread: listen_to_eth has one, each worker of
+ * the offline analyzer its own.
+ */
+
+#ifndef SLACSESSION_HEADER
+#define SLACSESSION_HEADER
+
+#include <stdint.h>
+#include <netinet/if_ether.h>
+#include "plc_homeplug.h"
+#include "plccore.h"
+
+#define SLAC_MAX_SESSIONS 32
+#define SLAC_SESSION_TIMEOUT_MS PLCCORE_SESSION_TIMEOUT_MS
+
+enum {
+	SLAC_STATE_IDLE = PLCCORE_STATE_IDLE,
+	SLAC_STATE_PARAM = PLCCORE_STATE_PARAM,           /* CM_SLAC_PARAM seen */
+	SLAC_STATE_ATTEN = PLCCORE_STATE_ATTEN,           /* CM_START_ATTEN_CHAR seen */
+	SLAC_STATE_SOUNDING = PLCCORE_STATE_SOUNDING,     /* CM_MNBC_SOUND seen */
+	SLAC_STATE_ATTEN_CHAR = PLCCORE_STATE_ATTEN_CHAR, /* CM_ATTEN_CHAR seen */
+	SLAC_STATE_MATCH_REQ = PLCCORE_STATE_MATCH_REQ,   /* CM_SLAC_MATCH.REQ seen */
+	SLAC_STATE_MATCHED = PLCCORE_STATE_MATCHED,       /* CM_SLAC_MATCH.CNF seen, NID and NMK known */
+	SLAC_STATE_KEY_SET = PLCCORE_STATE_KEY_SET,       /* CM_SET_KEY.CNF positive */
+	SLAC_STATE_KEY_FAILED = PLCCORE_STATE_KEY_FAILED, /* CM_SET_KEY.CNF negative */
+	SLAC_STATE_TIMEOUT = PLCCORE_STATE_TIMEOUT,
+	SLAC_NUMBER_OF_STATES = PLCCORE_NUMBER_OF_STATES
+};
+
+typedef struct slac_session {
+	plccore_session core; /* PEV, EVSE, state and times, kept by plccore.c; the first member */
+	/* the V2G communication which followed this SLAC, see v2g.c */
+	uint32_t nV2gMessages;
+	uint8_t v2gSessionId[8];
+	uint8_t v2gSessionIdLen;
+	/* where the session is in the capture file, maintained by the caller, see sessionindex.h */
+	uint64_t captureFirstOffset, captureLastOffset;
+	uint32_t nCaptureFrames;
+} slac_session;
+
+typedef void (*slac_transition_callback)(const slac_session *session, int oldState);
+
+const char *slacStateName(int state);
+void slacSetTransitionCallback(slac_transition_callback cb);
+void slacReset(void); /* forget all sessions */
+/* To be called for each HomePlug frame. Returns the session, or NULL if the frame is not part of SLAC. */
+slac_session *slacObserveFrame(const unsigned char *frame, int len, uint64_t nowMs);
+/* Who sends the CM_SET_KEY.REQ (ownMac) and to which modem, so that only the answer to
+   it is taken, see plcCoreInit(). Without this, the tracking is passive (offline). */
+void slacSetKeyPeer(const uint8_t *ownMac, const uint8_t *modemMac);
+/* For each CM_SET_KEY.CNF. If it is the answer to our CM_SET_KEY.REQ, the key belongs
+   to the session which was matched last. Returns 1 if the CNF was taken. */
+int slacObserveSetKeyConfirm(const unsigned char *frame, int len, uint64_t nowMs);
+void slacCheckTimeouts(uint64_t nowMs);
+slac_session *slacFindSession(const uint8_t *pevMac); /* NULL if there is no session of this PEV */
+void slacForEachSession(void (*fn)(const slac_session *session)); /* all sessions which are in use */
+/* The whole tracking state, SLAC_MAX_SESSIONS sessions, for the handover to a new
+   instance. The times are CLOCK_MONOTONIC, so they stay valid on the same machine. */
+int slacExportSessions(slac_session *out, int *lastMatched);
+void slacImportSessions(const slac_session *in, int lastMatched);
+
+#endif
@@ -0,0 +1,383 @@
+/* Deterministic simulation of SLAC sessions, see slacsim.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <netinet/if_ether.h>
+
+#include "plc_homeplug.h"
+#include "slacsession.h"
+#include "slacframes.h"
+#include "slacsim.h"
+
+#define DRAIN_MS 100 /* after the last frame, in addition to SLAC_SESSION_TIMEOUT_MS */
+#define NO_SESSION (-1)
+
+/* the frames of the script are SLACFRAME_*, and the answer of the modem */
+enum {
+	SIM_SETKEY_CNF = SLACFRAME_MATCH_CNF + 1
+};
+
+typedef struct sim_event {
+	uint64_t dueMs;
+	uint32_t seq; /* same due time: in the order of the script */
+	int32_t session;
+	uint8_t kind;
+	int16_t len;
+	unsigned char frame[SLACSIM_FRAME_SIZE];
+} sim_event;
+
+typedef struct sim_session {
+	uint8_t expected; /* end state, MATCHED while the CM_SET_KEY.REQ is awaited */
+	uint8_t observed; /* last state of the transition callback */
+	uint8_t nFinal;   /* final transitions, must be one at most */
+	uint8_t evse;
+	uint8_t nid[SLAC_NID_LEN];
+	uint8_t nmk[SLAC_NMK_LEN];
+} sim_session;
+
+static slacsim_config config;
+static slacsim_result result;
+static sim_session *sessions;
+static uint32_t nGenerated;
+static uint64_t startMs, nextSessionMs, lastFrameMs, simNowMs;
+static uint32_t scriptRng, modemRng;
+static int32_t lastMatchDelivered = NO_SESSION;
+static uint64_t lastMatchMs;
+
+/* binary heap of the events on the way, by due time and sequence */
+static sim_event events[SLACSIM_MAX_EVENTS];
+static uint16_t heap[SLACSIM_MAX_EVENTS];
+static uint16_t freeList[SLACSIM_MAX_EVENTS];
+static uint32_t nHeap, nFree, nextSeq;
+
+/* the generator of the current script */
+static uint64_t scriptMs;
+static int held = -1; /* the event which is delivered after the next one */
+
+static uint32_t nextRandom(uint32_t *state) {
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+static int chance(uint32_t *state, uint32_t permille) {
+	return (nextRandom(state) % 1000) < permille;
+}
+
+static void digest(const void *data, int len) {
+	const uint8_t *p = data;
+	while (len-- > 0) {
+		result.digest ^= *p++;
+		result.digest *= 16777619u; /* FNV-1a */
+	}
+}
+
+static void evseMac(uint8_t *mac, int evse) {
+	mac[0] = 0x02; mac[1] = 0x45; mac[2] = 0x56; mac[3] = 0x53; mac[4] = 0x45; /* "EVSE" */
+	mac[5] = evse;
+}
+
+static int32_t sessionOfPevMac(const uint8_t *mac) {
+	int32_t session = slacFramesSessionOfPevMac(mac);
+	return ((session >= 0) && (session < (int32_t)nGenerated)) ? session : NO_SESSION;
+}
+
+/*********************************************************************/
+/* Event heap */
+
+static int earlier(uint16_t a, uint16_t b) {
+	if (events[a].dueMs != events[b].dueMs) return events[a].dueMs < events[b].dueMs;
+	return events[a].seq < events[b].seq;
+}
+
+static sim_event *allocateEvent(void) {
+	if (nFree == 0) {
+		result.nEventsDropped++;
+		return NULL;
+	}
+	return &events[freeList[--nFree]];
+}
+
+static void pushEvent(sim_event *e) {
+	uint32_t i = nHeap++;
+	uint16_t idx = e - events;
+	e->seq = nextSeq++;
+	while (i > 0) {
+		uint32_t parent = (i - 1) / 2;
+		if (!earlier(idx, heap[parent])) break;
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = idx;
+}
+
+static uint16_t popEvent(void) {
+	uint16_t top = heap[0];
+	uint16_t last = heap[--nHeap];
+	uint32_t i = 0;
+	for (;;) {
+		uint32_t child = 2*i + 1;
+		if (child >= nHeap) break;
+		if ((child + 1 < nHeap) && earlier(heap[child + 1], heap[child])) child++;
+		if (!earlier(heap[child], last)) break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+	return top;
+}
+
+/*********************************************************************/
+/* The frames */
+
+/* Builds the frame of the script, returns its length */
+static int buildFrame(unsigned char *frame, int kind, int32_t session, int count) {
+	sim_session *s = &sessions[session];
+	slacframes_session f;
+	slacFramesSession(&f, session);
+	evseMac(f.evseMac, s->evse);
+	memcpy(f.nid, s->nid, SLAC_NID_LEN);
+	memcpy(f.nmk, s->nmk, SLAC_NMK_LEN);
+	return slacFramesBuild(frame, SLACSIM_FRAME_SIZE, kind, &f, count);
+}
+
+/*********************************************************************/
+/* The script of a session */
+
+/* One frame of the script at scriptMs. Returns 1 if it is not lost. */
+static int scriptFrame(int kind, int32_t session, int count) {
+	sim_event *e;
+	if (chance(&scriptRng, config.lossPermille)) {
+		result.nFramesLost++;
+		return 0;
+	}
+	e = allocateEvent();
+	if (!e) return 1;
+	e->dueMs = scriptMs;
+	e->session = session;
+	e->kind = kind;
+	e->len = buildFrame(e->frame, kind, session, count);
+	if (held >= 0) {
+		/* the held frame comes right after this one */
+		pushEvent(e);
+		events[held].dueMs = scriptMs;
+		pushEvent(&events[held]);
+		held = -1;
+		result.nFramesReordered++;
+	} else if (chance(&scriptRng, config.reorderPermille)) {
+		held = e - events;
+	} else {
+		pushEvent(e);
+	}
+	return 1;
+}
+
+/* Request and answer. If one of them is lost, the request is repeated after
+   SLAC_TIMEOUT. Returns 1 if the exchange succeeded. */
+static int scriptExchange(int request, int answer, int32_t session, int *requestArrived) {
+	int attempt;
+	for (attempt = 0; attempt <= SLACSIM_RETRIES; attempt++) {
+		if (attempt) {
+			scriptMs += SLAC_TIMEOUT;
+			result.nRetransmits++;
+		}
+		if (!scriptFrame(request, session, 0)) continue;
+		if (requestArrived) *requestArrived = 1;
+		scriptMs += 5;
+		if (scriptFrame(answer, session, 0)) return 1;
+	}
+	return 0;
+}
+
+static void generateSession(int32_t session, uint64_t beginMs) {
+	sim_session *s = &sessions[session];
+	int i, created = 0, matched = 0;
+	s->evse = nextRandom(&scriptRng) % SLACSIM_NUMBER_OF_EVSES;
+	for (i = 0; i < SLAC_NID_LEN; i++) s->nid[i] = nextRandom(&scriptRng);
+	s->nid[SLAC_NID_LEN - 1] &= 0x0f; /* the upper bits of the last NID byte are the security level */
+	for (i = 0; i < SLAC_NMK_LEN; i++) s->nmk[i] = nextRandom(&scriptRng);
+	scriptMs = beginMs;
+	if (!scriptExchange(SLACFRAME_PARAM_REQ, SLACFRAME_PARAM_CNF, session, &created)) goto end;
+	for (i = 0; i < 3; i++) {
+		scriptMs += 20;
+		scriptFrame(SLACFRAME_START_ATTEN, session, i);
+	}
+	for (i = 0; i < SLAC_MSOUNDS; i++) {
+		scriptMs += 40;
+		scriptFrame(SLACFRAME_SOUND, session, i);
+	}
+	scriptMs += 100;
+	if (!scriptExchange(SLACFRAME_ATTEN_IND, SLACFRAME_ATTEN_RSP, session, NULL)) goto end;
+	if (chance(&scriptRng, SLACSIM_ABORT_PERMILLE)) {
+		result.nAborted++;
+		goto end;
+	}
+	scriptMs += 50;
+	matched = scriptExchange(SLACFRAME_MATCH_REQ, SLACFRAME_MATCH_CNF, session, NULL);
+end:
+	if (held >= 0) {
+		/* nothing came after it */
+		pushEvent(&events[held]);
+		held = -1;
+	}
+	if (matched) {
+		s->expected = SLAC_STATE_MATCHED; /* the modem decides */
+	} else if (created) {
+		s->expected = SLAC_STATE_TIMEOUT;
+	} else {
+		s->expected = SLAC_STATE_IDLE;
+	}
+	nGenerated++;
+	nextSessionMs = scriptMs + SLACSIM_SESSION_GAP_MS + nextRandom(&scriptRng) % SLACSIM_SESSION_GAP_MS;
+}
+
+/*********************************************************************/
+
+int slacSimParse(const char *spec, slacsim_config *cfg) {
+	char *end;
+	double percent;
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->nSessions = SLACSIM_DEFAULT_SESSIONS;
+	cfg->seed = 1;
+	if (*spec != ':') {
+		cfg->nSessions = strtoul(spec, &end, 10);
+		spec = end;
+	}
+	if (*spec == ':') {
+		percent = strtod(spec + 1, &end);
+		if ((end == spec + 1) || (percent < 0) || (percent > 100)) return -1;
+		cfg->lossPermille = percent*10 + 0.5;
+		spec = end;
+	}
+	if (*spec == ':') {
+		percent = strtod(spec + 1, &end);
+		if ((end == spec + 1) || (percent < 0) || (percent > 100)) return -1;
+		cfg->reorderPermille = percent*10 + 0.5;
+		spec = end;
+	}
+	if (*spec == ':') {
+		cfg->seed = strtoul(spec + 1, &end, 0);
+		if (end == spec + 1) return -1;
+		spec = end;
+	}
+	if (*spec || (cfg->nSessions == 0) || (cfg->nSessions > SLACSIM_MAX_SESSIONS)) return -1;
+	return 0;
+}
+
+int slacSimStart(const slacsim_config *cfg, uint64_t nowMs) {
+	uint32_t i;
+	config = *cfg;
+	memset(&result, 0, sizeof(result));
+	result.nSessions = cfg->nSessions;
+	result.digest = 2166136261u;
+	free(sessions);
+	sessions = calloc(cfg->nSessions, sizeof(sim_session));
+	if (!sessions) return -1;
+	/* xorshift must not start with 0 */
+	scriptRng = cfg->seed ? cfg->seed : 1;
+	modemRng = (cfg->seed ^ 0x9e3779b9u) ? (cfg->seed ^ 0x9e3779b9u) : 1;
+	nGenerated = 0;
+	startMs = nextSessionMs = lastFrameMs = simNowMs = nowMs;
+	lastMatchDelivered = NO_SESSION;
+	nHeap = nextSeq = 0;
+	nFree = SLACSIM_MAX_EVENTS;
+	for (i = 0; i < SLACSIM_MAX_EVENTS; i++) freeList[i] = SLACSIM_MAX_EVENTS - 1 - i;
+	held = -1;
+	return 0;
+}
+
+int slacSimDeliver(uint64_t nowMs, void (*receive)(const unsigned char *frame, int len)) {
+	simNowMs = nowMs;
+	if ((nGenerated < config.nSessions) && (nowMs >= nextSessionMs)) generateSession(nGenerated, nextSessionMs);
+	while (nHeap && (events[heap[0]].dueMs <= nowMs)) {
+		sim_event *e = &events[popEvent()];
+		if (e->kind == SLACFRAME_MATCH_CNF) {
+			lastMatchDelivered = e->session;
+			lastMatchMs = nowMs;
+		}
+		result.nFramesDelivered++;
+		lastFrameMs = nowMs;
+		receive(e->frame, e->len);
+		freeList[nFree++] = e - events;
+	}
+	if (nGenerated < config.nSessions) return 1;
+	return nHeap || (nowMs < lastFrameMs + SLAC_SESSION_TIMEOUT_MS + DRAIN_MS);
+}
+
+/* The modem: answers the CM_SET_KEY.REQ, and checks that it belongs to the match */
+int slacSimTransmit(const void *frame, int len) {
+	const struct cm_set_key_request *req = frame;
+	struct cm_set_key_confirm *cnf;
+	sim_session *s;
+	sim_event *e;
+	uint8_t modemMac[ETH_ALEN] = { MY_DEST_MAC0, MY_DEST_MAC1, MY_DEST_MAC2, MY_DEST_MAC3, MY_DEST_MAC4, MY_DEST_MAC5 };
+	digest(frame, len);
+	if ((len < (int)sizeof(*req)) || (LE16TOH(req->homeplug.MMTYPE) != (CM_SET_KEY | MMTYPE_REQ))) return 0;
+	result.nSetKeyRequests++;
+	if (lastMatchDelivered == NO_SESSION) {
+		result.nWrongKeys++;
+		return 0;
+	}
+	s = &sessions[lastMatchDelivered];
+	if (memcmp(req->NID, s->nid, SLAC_NID_LEN) || memcmp(req->NEWKEY, s->nmk, SLAC_NMK_LEN)) result.nWrongKeys++;
+	if (simNowMs != lastMatchMs) result.nLateReactions++;
+	if (chance(&modemRng, config.lossPermille)) {
+		result.nFramesLost++;
+		s->expected = SLAC_STATE_TIMEOUT;
+		return 0;
+	}
+	s->expected = chance(&modemRng, SLACSIM_SETKEY_FAIL_PERMILLE) ? SLAC_STATE_KEY_FAILED : SLAC_STATE_KEY_SET;
+	e = allocateEvent();
+	if (!e) return 0;
+	memset(e->frame, 0, SLACSIM_FRAME_SIZE);
+	cnf = (struct cm_set_key_confirm *)e->frame;
+	slacFramesHeader(e->frame, req->ethernet.h_source, modemMac, CM_SET_KEY | MMTYPE_CNF);
+	cnf->RESULT = (s->expected == SLAC_STATE_KEY_SET) ? 0 : 1;
+	cnf->MYNOUNCE = req->YOURNOUNCE;
+	cnf->YOURNOUNCE = req->MYNOUNCE;
+	cnf->PID = req->PID;
+	cnf->PRN = req->PRN;
+	cnf->PMN = req->PMN;
+	cnf->CCOCAP = req->CCOCAP;
+	e->len = sizeof(*cnf);
+	e->dueMs = simNowMs + SLACSIM_MODEM_LATENCY_MS;
+	e->session = lastMatchDelivered;
+	e->kind = SIM_SETKEY_CNF;
+	pushEvent(e);
+	return 0;
+}
+
+void slacSimObserveTransition(const slac_session *session, int oldState) {
+	int32_t n = sessionOfPevMac(session->core.pevMac);
+	uint32_t t[4];
+	if (n == NO_SESSION) return;
+	sessions[n].observed = session->core.state;
+	if ((session->core.state == SLAC_STATE_KEY_SET) || (session->core.state == SLAC_STATE_KEY_FAILED) ||
+	    (session->core.state == SLAC_STATE_TIMEOUT)) sessions[n].nFinal++;
+	t[0] = simNowMs;
+	t[1] = n;
+	t[2] = oldState;
+	t[3] = session->core.state;
+	digest(t, sizeof(t));
+}
+
+int slacSimFinish(slacsim_result *r) {
+	uint32_t i;
+	for (i = 0; i < nGenerated; i++) {
+		sim_session *s = &sessions[i];
+		result.nExpected[s->expected]++;
+		result.nObserved[s->observed]++;
+		if ((s->observed != s->expected) || (s->nFinal > 1)) result.nMismatches++;
+	}
+	result.virtualMs = simNowMs - startMs;
+	*r = result;
+	free(sessions);
+	sessions = NULL;
+	return result.nMismatches + result.nWrongKeys + result.nLateReactions + result.nEventsDropped;
+}
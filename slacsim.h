@@ -0,0 +1,89 @@
+/* Deterministic simulation of SLAC sessions on the virtual clock
+ *
+ * The timeout paths (SLAC_SESSION_TIMEOUT_MS, the retransmits of the PEV, a lost
+ * CM_SET_KEY.CNF) take seconds in real time. Here they run on the virtual clock
+ * (clock.h) in fast-forward: listen_to_eth -S feeds the scripted frames through
+ * its normal receive path, handleReceivedFrame(), and calls its timer services
+ * once per virtual millisecond, like the main loop does.
+ *
+ * One script per session, the sessions one after the other, each with its own
+ * PEV MAC (02:50:45:56:nn:nn), RunID, NID and NMK, and one of a few EVSEs:
+ *   CM_SLAC_PARAM.REQ/CNF, 3x CM_START_ATTEN_CHAR.IND, SLAC_MSOUNDS x CM_MNBC_SOUND.IND,
+ *   CM_ATTEN_CHAR.IND/RSP, CM_SLAC_MATCH.REQ/CNF.
+ * The frames are built by slacframes.c, like the ones of plc_simulator.
+ * Each frame is lost with the configured probability, for everybody on the wire.
+ * If the request or the answer of an exchange is lost, the PEV repeats the
+ * request after SLAC_TIMEOUT ms, up to SLACSIM_RETRIES times, and gives up then.
+ * A frame may be delivered after the next frame of the session (reordering), and
+ * a PEV may give up before the match (SLACSIM_ABORT_PERMILLE).
+ * The simulated modem answers the CM_SET_KEY.REQ, which listen_to_eth sends
+ * through the transmit scheduler, after SLACSIM_MODEM_LATENCY_MS. The confirmation
+ * may be lost as well, and it is negative with SLACSIM_SETKEY_FAIL_PERMILLE.
+ *
+ * From the script, the outcome of each session is known before it runs:
+ *   - no CM_SLAC_PARAM.REQ and no CM_SLAC_MATCH.CNF arrived: no session,
+ *   - the match arrived: the CM_SET_KEY.REQ must carry its NID and NMK, in the
+ *     same millisecond, and the session ends as KEY_SET or KEY_FAILED, or as TIMEOUT
+ *     if the confirmation was lost,
+ *   - otherwise: TIMEOUT.
+ * The observed end states (transition callback) are compared with that. All
+ * random decisions come from the seed, so a run is repeatable; the digest over the
+ * transitions and the transmitted frames shows it.
+ */
+
+#ifndef SLACSIM_HEADER
+#define SLACSIM_HEADER
+
+#include <stdint.h>
+#include <netinet/if_ether.h>
+#include "slacsession.h"
+#include "slacframes.h"
+
+#define SLACSIM_MAX_SESSIONS 65535 /* the last two bytes of the PEV MAC */
+#define SLACSIM_DEFAULT_SESSIONS 1000
+#define SLACSIM_START_MS 1000000 /* virtual monotonic time of the start */
+#define SLACSIM_RETRIES 2
+#define SLACSIM_MODEM_LATENCY_MS 20
+#define SLACSIM_SESSION_GAP_MS 200 /* plus up to the same again, between two sessions */
+#define SLACSIM_ABORT_PERMILLE 20
+#define SLACSIM_SETKEY_FAIL_PERMILLE 50
+#define SLACSIM_NUMBER_OF_EVSES 4
+#define SLACSIM_MAX_EVENTS 256 /* frames on the way, of about two sessions */
+#define SLACSIM_FRAME_SIZE SLACFRAMES_FRAME_SIZE
+
+typedef struct slacsim_config {
+	uint32_t nSessions;
+	uint32_t lossPermille;
+	uint32_t reorderPermille;
+	uint32_t seed;
+} slacsim_config;
+
+typedef struct slacsim_result {
+	uint32_t nSessions;
+	uint32_t nFramesDelivered, nFramesLost, nFramesReordered, nRetransmits, nAborted;
+	uint32_t nSetKeyRequests;
+	uint32_t nExpected[SLAC_NUMBER_OF_STATES]; /* the end states; IDLE means no session */
+	uint32_t nObserved[SLAC_NUMBER_OF_STATES];
+	uint32_t nMismatches;     /* end state not as expected */
+	uint32_t nWrongKeys;      /* CM_SET_KEY.REQ without the NID and NMK of the match */
+	uint32_t nLateReactions;  /* CM_SET_KEY.REQ not in the millisecond of the match */
+	uint32_t nEventsDropped;  /* SLACSIM_MAX_EVENTS too small, makes the run invalid */
+	uint64_t virtualMs;
+	uint32_t digest;
+} slacsim_result;
+
+/* "sessions[:loss%[:reorder%[:seed]]]". Returns -1 if it is not valid. */
+int slacSimParse(const char *spec, slacsim_config *cfg);
+int slacSimStart(const slacsim_config *cfg, uint64_t nowMs);
+/* Hands the frames which are due to the receive function. Returns 0 when all
+   sessions have ended, including the time for their timeouts. */
+int slacSimDeliver(uint64_t nowMs, void (*receive)(const unsigned char *frame, int len));
+/* The transmit function of the simulation, for txSchedInit(): the modem. */
+int slacSimTransmit(const void *frame, int len);
+/* To be called from the transition callback */
+void slacSimObserveTransition(const slac_session *session, int oldState);
+/* Compares the end states. Returns the number of errors, the sum of the mismatches,
+   wrong keys, late reactions and dropped events. */
+int slacSimFinish(slacsim_result *r);
+
+#endif
@@ -0,0 +1,264 @@
+/* Station discovery cache, see stations.h */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "stations.h"
+
+static station_entry stationTable[STATION_TABLE_SIZE];
+static int nStations;
+static int nTombstones;
+uint32_t nStationOverflow;
+uint32_t nStationEvictions;
+
+/* The snapshot file format:
+ *   header: magic "PLCSTA01", uint32 number of records
+ *   records: the packed station_snapshot_record, in host byte order.
+ * The snapshot is only used on the same machine, so we do not care about
+ * the byte order. */
+#define STATION_SNAPSHOT_MAGIC "PLCSTA01"
+
+typedef struct __packed station_snapshot_record {
+	uint8_t mac[ETH_ALEN];
+	uint32_t firstSeen;
+	uint32_t lastSeen;
+	uint32_t mmCount[STA_MM_NUMBER_OF_CLASSES];
+	uint8_t flags;
+	uint8_t NID[SLAC_NID_LEN];
+	uint8_t NMK[SLAC_NMK_LEN];
+	uint8_t swVersionLen;
+	/* followed by swVersionLen bytes of the software version, without terminating zero */
+} station_snapshot_record;
+
+uint64_t macToKey(const uint8_t *mac) {
+	return ((uint64_t)mac[0]<<40) | ((uint64_t)mac[1]<<32) | ((uint64_t)mac[2]<<24) |
+	       ((uint64_t)mac[3]<<16) | ((uint64_t)mac[4]<<8) | (uint64_t)mac[5];
+}
+
+void keyToMac(uint64_t key, uint8_t *mac) {
+	int i;
+	for (i=5; i>=0; i--) {
+		mac[i] = key & 0xff;
+		key >>= 8;
+	}
+}
+
+static uint32_t stationHash(uint64_t key) {
+	/* Fibonacci hashing: multiply with 2^64/phi and take the upper bits. */
+	return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> (64 - STATION_TABLE_BITS));
+}
+
+int stationClassOfMmtype(uint16_t mmtype) {
+	switch (mmtype & 0xfffc) {
+		case CM_SLAC_PARAM: return STA_MM_SLAC_PARAM;
+		case CM_START_ATTEN_CHAR: return STA_MM_START_ATTEN_CHAR;
+		case CM_MNBC_SOUND: return STA_MM_MNBC_SOUND;
+		case CM_ATTEN_CHAR: return STA_MM_ATTEN_CHAR;
+		case CM_SLAC_MATCH: return STA_MM_SLAC_MATCH;
+		case CM_SET_KEY: return STA_MM_SET_KEY;
+		case CM_GET_KEY: return STA_MM_GET_KEY;
+		case CM_GET_DEVICE_SW_VERSION: return STA_MM_GET_SW_VERSION;
+	}
+	return STA_MM_OTHER_HOMEPLUG;
+}
+
+/* Returns the slot which contains the key, or the slot where it shall be
+   inserted (the first tombstone of the probe sequence, else the free slot),
+   or -1 if the table is completely full. */
+static int stationFindSlot(uint64_t key) {
+	uint32_t i = stationHash(key);
+	uint32_t n;
+	int tombstone = -1;
+	for (n=0; n<STATION_TABLE_SIZE; n++) {
+		if (stationTable[i].mac == key) return i;
+		if (stationTable[i].mac == 0) return (tombstone>=0) ? tombstone : (int)i;
+		if ((stationTable[i].mac == STATION_TOMBSTONE) && (tombstone<0)) tombstone = i;
+		i = (i+1) & (STATION_TABLE_SIZE-1);
+	}
+	return tombstone;
+}
+
+/* The station which was not seen for the longest time makes room. */
+static void stationEvictOldest(void) {
+	int i, oldest = -1;
+	for (i=0; i<STATION_TABLE_SIZE; i++) {
+		uint64_t mac = stationTable[i].mac;
+		if ((mac==0) || (mac==STATION_TOMBSTONE)) continue;
+		if ((oldest<0) || (stationTable[i].lastSeen < stationTable[oldest].lastSeen)) oldest = i;
+	}
+	if (oldest<0) return;
+	memset(&stationTable[oldest], 0, sizeof(station_entry));
+	stationTable[oldest].mac = STATION_TOMBSTONE;
+	nStations--;
+	nTombstones++;
+	nStationEvictions++;
+}
+
+/* Too many tombstones make the probe sequences long: insert all stations again. */
+static void stationRebuild(void) {
+	static station_entry old[STATION_TABLE_SIZE];
+	int i, k;
+	memcpy(old, stationTable, sizeof(old));
+	memset(stationTable, 0, sizeof(stationTable));
+	nTombstones = 0;
+	for (i=0; i<STATION_TABLE_SIZE; i++) {
+		if ((old[i].mac==0) || (old[i].mac==STATION_TOMBSTONE)) continue;
+		k = stationFindSlot(old[i].mac);
+		stationTable[k] = old[i];
+	}
+}
+
+station_entry *stationLookup(const uint8_t *mac) {
+	uint64_t key = macToKey(mac);
+	int i;
+	if (key==0) return NULL;
+	i = stationFindSlot(key);
+	if ((i<0) || (stationTable[i].mac != key)) return NULL;
+	return &stationTable[i];
+}
+
+static station_entry *stationInsert(uint64_t key) {
+	int i = stationFindSlot(key);
+	if ((i>=0) && (stationTable[i].mac == key)) return &stationTable[i];
+	if (nStations>=STATION_TABLE_MAXFILL) {
+		/* keep the probe sequences short, do not fill up completely */
+		stationEvictOldest();
+	}
+	if (nTombstones>STATION_TABLE_MAX_TOMBSTONES) stationRebuild();
+	i = stationFindSlot(key);
+	if (i<0) return NULL;
+	if (stationTable[i].mac == STATION_TOMBSTONE) nTombstones--;
+	memset(&stationTable[i], 0, sizeof(station_entry));
+	stationTable[i].mac = key;
+	nStations++;
+	return &stationTable[i];
+}
+
+station_entry *stationTouch(const uint8_t *mac, uint32_t now, int mmClass) {
+	uint64_t key = macToKey(mac);
+	station_entry *sta;
+	if (key==0) return NULL; /* 00:00:00:00:00:00 is reserved as "free" marker */
+	sta = stationInsert(key);
+	if (sta==NULL) {
+		nStationOverflow++;
+		return NULL;
+	}
+	if (sta->firstSeen==0) sta->firstSeen = now;
+	sta->lastSeen = now;
+	if ((mmClass>=0) && (mmClass<STA_MM_NUMBER_OF_CLASSES)) sta->mmCount[mmClass]++;
+	return sta;
+}
+
+void stationSetSwVersion(station_entry *sta, const uint8_t *version, int len) {
+	if (sta==NULL) return;
+	if (len<0) len=0;
+	if (len>STATION_SW_VERSION_LEN-1) len=STATION_SW_VERSION_LEN-1;
+	memcpy(sta->swVersion, version, len);
+	sta->swVersion[len]=0;
+	sta->flags |= STA_FLAG_HAS_SW_VERSION;
+}
+
+void stationSetKey(station_entry *sta, const uint8_t *nid, const uint8_t *nmk) {
+	if (sta==NULL) return;
+	memcpy(sta->NID, nid, SLAC_NID_LEN);
+	memcpy(sta->NMK, nmk, SLAC_NMK_LEN);
+	sta->flags |= STA_FLAG_HAS_KEY;
+}
+
+int stationCount(void) {
+	return nStations;
+}
+
+void stationPrintTable(void (*printFunction)(char *s)) {
+	char s[300];
+	uint8_t mac[ETH_ALEN];
+	uint32_t nHomeplug;
+	int i, k;
+	sprintf(s, "station table: %d stations, %u evictions, %u overflows", nStations, nStationEvictions, nStationOverflow);
+	printFunction(s);
+	for (i=0; i<STATION_TABLE_SIZE; i++) {
+		station_entry *sta = &stationTable[i];
+		if ((sta->mac==0) || (sta->mac==STATION_TOMBSTONE)) continue;
+		keyToMac(sta->mac, mac);
+		nHomeplug=0;
+		for (k=0; k<STA_MM_NON_HOMEPLUG; k++) nHomeplug+=sta->mmCount[k];
+		sprintf(s, "  %02x:%02x:%02x:%02x:%02x:%02x seen %u..%u  HomePlug %u  Other %u  SlacMatch %u  SetKey %u%s%s%s",
+			mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+			sta->firstSeen, sta->lastSeen, nHomeplug, sta->mmCount[STA_MM_NON_HOMEPLUG],
+			sta->mmCount[STA_MM_SLAC_MATCH], sta->mmCount[STA_MM_SET_KEY],
+			(sta->flags & STA_FLAG_HAS_KEY) ? "  [key]" : "",
+			(sta->flags & STA_FLAG_HAS_SW_VERSION) ? "  SW " : "",
+			(sta->flags & STA_FLAG_HAS_SW_VERSION) ? sta->swVersion : "");
+		printFunction(s);
+	}
+}
+
+int stationWriteSnapshot(FILE *f) {
+	station_snapshot_record r;
+	uint32_t n = nStations;
+	int i;
+	fwrite(STATION_SNAPSHOT_MAGIC, 1, 8, f);
+	fwrite(&n, sizeof(n), 1, f);
+	for (i=0; i<STATION_TABLE_SIZE; i++) {
+		station_entry *sta = &stationTable[i];
+		if ((sta->mac==0) || (sta->mac==STATION_TOMBSTONE)) continue;
+		keyToMac(sta->mac, r.mac);
+		r.firstSeen = sta->firstSeen;
+		r.lastSeen = sta->lastSeen;
+		memcpy(r.mmCount, sta->mmCount, sizeof(r.mmCount));
+		r.flags = sta->flags;
+		memcpy(r.NID, sta->NID, SLAC_NID_LEN);
+		memcpy(r.NMK, sta->NMK, SLAC_NMK_LEN);
+		r.swVersionLen = strlen(sta->swVersion);
+		fwrite(&r, sizeof(r), 1, f);
+		fwrite(sta->swVersion, 1, r.swVersionLen, f);
+	}
+	return ferror(f) ? -1 : 0;
+}
+
+int stationSaveSnapshot(const char *fileName) {
+	FILE *f = fopen(fileName, "wb");
+	int r;
+	if (!f) return -1;
+	r = stationWriteSnapshot(f);
+	if (fclose(f)!=0) return -1;
+	return r;
+}
+
+int stationReadSnapshot(FILE *f) {
+	char magic[8];
+	station_snapshot_record r;
+	station_entry *sta;
+	uint32_t n, i;
+	uint8_t version[256];
+	if ((fread(magic, 1, 8, f)!=8) || (memcmp(magic, STATION_SNAPSHOT_MAGIC, 8)!=0) ||
+	    (fread(&n, sizeof(n), 1, f)!=1)) {
+		return -1;
+	}
+	for (i=0; i<n; i++) {
+		if (fread(&r, sizeof(r), 1, f)!=1) break;
+		if (fread(version, 1, r.swVersionLen, f)!=r.swVersionLen) break;
+		if (macToKey(r.mac)==0) continue; /* the "free" marker, not a station */
+		sta = stationInsert(macToKey(r.mac));
+		if (sta==NULL) break;
+		sta->firstSeen = r.firstSeen;
+		sta->lastSeen = r.lastSeen;
+		memcpy(sta->mmCount, r.mmCount, sizeof(r.mmCount));
+		sta->flags = r.flags;
+		memcpy(sta->NID, r.NID, SLAC_NID_LEN);
+		memcpy(sta->NMK, r.NMK, SLAC_NMK_LEN);
+		stationSetSwVersion(sta, version, r.swVersionLen);
+		sta->flags = r.flags; /* stationSetSwVersion() touched the flags */
+	}
+	return i;
+}
+
+int stationLoadSnapshot(const char *fileName) {
+	FILE *f = fopen(fileName, "rb");
+	int n;
+	if (!f) return -1;
+	n = stationReadSnapshot(f);
+	fclose(f);
+	return n;
+}
@@ -0,0 +1,86 @@
+/* Station discovery cache
+ *
+ * Remembers every station (source MAC) which we have seen on the line, together
+ * with some statistics and the information which we learned from the
+ * HomePlug messages (software version, NID and NMK of the SLAC match).
+ *
+ * The table is an open-addressed hash on the 48-bit MAC with linear probing.
+ * It lives in static memory, so that the lookup on the receive path is O(1)
+ * and never allocates. At exit, the table is written as compact binary
+ * snapshot, and at startup it is read again, so that a restart does not
+ * forget the stations.
+ *
+ * When the table has reached STATION_TABLE_MAXFILL, a new station evicts the
+ * one with the oldest lastSeen. The evicted slot becomes a tombstone, so that
+ * the probe sequences which pass it stay intact; an insert reuses it. When
+ * there are more than STATION_TABLE_MAX_TOMBSTONES, the table is rebuilt.
+ */
+
+#ifndef STATIONS_HEADER
+#define STATIONS_HEADER
+
+#include <stdint.h>
+#include <netinet/if_ether.h>
+#include "plc_homeplug.h"
+
+/* Number of slots, a power of two. We keep the load factor below 75%. */
+#define STATION_TABLE_BITS 10
+#define STATION_TABLE_SIZE (1 << STATION_TABLE_BITS)
+#define STATION_TABLE_MAXFILL ((STATION_TABLE_SIZE*3)/4)
+#define STATION_TABLE_MAX_TOMBSTONES (STATION_TABLE_SIZE/8)
+
+#define STATION_SNAPSHOT_FILE "stations.bin"
+#define STATION_SW_VERSION_LEN 64
+
+/* The message classes which we count per station */
+enum {
+	STA_MM_SLAC_PARAM,
+	STA_MM_START_ATTEN_CHAR,
+	STA_MM_MNBC_SOUND,
+	STA_MM_ATTEN_CHAR,
+	STA_MM_SLAC_MATCH,
+	STA_MM_SET_KEY,
+	STA_MM_GET_KEY,
+	STA_MM_GET_SW_VERSION,
+	STA_MM_OTHER_HOMEPLUG,
+	STA_MM_NON_HOMEPLUG,
+	STA_MM_NUMBER_OF_CLASSES
+};
+
+#define STATION_TOMBSTONE (1ull<<48) /* no 48 bit MAC */
+
+#define STA_FLAG_HAS_SW_VERSION 0x01
+#define STA_FLAG_HAS_KEY        0x02
+
+typedef struct station_entry {
+	uint64_t mac; /* 48 bit MAC in the lower bits. 0 means "slot is free", STATION_TOMBSTONE "evicted" */
+	uint32_t firstSeen; /* unix time in seconds */
+	uint32_t lastSeen;  /* unix time in seconds */
+	uint32_t mmCount[STA_MM_NUMBER_OF_CLASSES];
+	uint8_t flags;
+	uint8_t NID[SLAC_NID_LEN];
+	uint8_t NMK[SLAC_NMK_LEN];
+	char swVersion[STATION_SW_VERSION_LEN];
+} station_entry;
+
+extern uint32_t nStationOverflow; /* number of lookups which did not find a free slot */
+extern uint32_t nStationEvictions; /* stations which made room for a new one */
+
+uint64_t macToKey(const uint8_t *mac);
+void keyToMac(uint64_t key, uint8_t *mac);
+int stationClassOfMmtype(uint16_t mmtype);
+
+station_entry *stationLookup(const uint8_t *mac); /* NULL if unknown */
+station_entry *stationTouch(const uint8_t *mac, uint32_t now, int mmClass); /* find or insert, and count */
+void stationSetSwVersion(station_entry *sta, const uint8_t *version, int len);
+void stationSetKey(station_entry *sta, const uint8_t *nid, const uint8_t *nmk);
+
+int stationCount(void);
+void stationPrintTable(void (*printFunction)(char *s));
+int stationSaveSnapshot(const char *fileName);
+int stationLoadSnapshot(const char *fileName);
+/* the same on an open stream, e.g. for the handover to a new instance */
+int stationWriteSnapshot(FILE *f);
+int stationReadSnapshot(FILE *f);
+
+#endif
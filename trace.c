@@ -0,0 +1,109 @@
+/* Static tracepoints and span recording, see trace.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+typedef struct trace_event {
+	uint64_t tsNs; /* CLOCK_MONOTONIC */
+	uint32_t arg;
+	uint8_t point;
+	uint8_t phase;
+	uint16_t reserved;
+} trace_event;
+
+int traceActive;
+uint32_t nTraceEvents, nTraceOverwritten;
+
+static trace_event *ring;
+static uint32_t head; /* next write position */
+static uint64_t startNs;
+static const char *traceFileName;
+
+static const struct {
+	const char *name;
+	const char *argName;
+	int argHex;
+} pointInfo[TRACE_NUMBER_OF_POINTS] = {
+	{ "receive", "len", 0 },
+	{ "data_process", "ethertype", 1 },
+	{ "processHomeplugFrame", "mmtype", 1 },
+	{ "sendSetKeyFrame", NULL, 0 },
+	{ "printToLogAndScreen", "len", 0 },
+	{ "sendto", "len", 0 }
+};
+
+static uint64_t nowNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+int traceInit(const char *fileName) {
+	ring = calloc(TRACE_RING_SIZE, sizeof(trace_event));
+	if (!ring) return -1;
+	head = 0;
+	startNs = nowNs();
+	traceFileName = fileName;
+	traceActive = 1;
+	return 0;
+}
+
+void traceRecord(int point, int phase, uint32_t arg) {
+	trace_event *e = &ring[head];
+	e->tsNs = nowNs();
+	e->arg = arg;
+	e->point = point;
+	e->phase = phase;
+	head = (head + 1) & (TRACE_RING_SIZE - 1);
+	if (nTraceEvents >= TRACE_RING_SIZE) nTraceOverwritten++; else nTraceEvents++;
+}
+
+int traceWriteChrome(void) {
+	FILE *f;
+	uint32_t i, n = nTraceEvents, first = (head - n) & (TRACE_RING_SIZE - 1);
+	int depth = 0, nWritten = 0;
+	int pid = getpid();
+	if (!traceActive) return -1;
+	f = fopen(traceFileName, "w");
+	if (!f) return -1;
+	fprintf(f, "{\"traceEvents\":[\n");
+	for (i=0; i<n; i++) {
+		const trace_event *e = &ring[(first + i) & (TRACE_RING_SIZE - 1)];
+		uint64_t ts = e->tsNs - startNs;
+		if (e->phase == TRACE_PHASE_END) {
+			/* the begin may have been overwritten in the ring */
+			if (depth == 0) continue;
+			depth--;
+		} else if (e->phase == TRACE_PHASE_BEGIN) {
+			depth++;
+		}
+		fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"plctool\",\"ph\":\"%c\",\"ts\":%lu.%03u,\"pid\":%d,\"tid\":1",
+			nWritten ? ",\n" : "", pointInfo[e->point].name, e->phase,
+			(unsigned long)(ts / 1000), (unsigned)(ts % 1000), pid);
+		if (e->phase == TRACE_PHASE_MARK) fprintf(f, ",\"s\":\"t\"");
+		if ((e->phase != TRACE_PHASE_END) && pointInfo[e->point].argName) {
+			if (pointInfo[e->point].argHex) {
+				fprintf(f, ",\"args\":{\"%s\":\"0x%04x\"}", pointInfo[e->point].argName, e->arg);
+			} else {
+				fprintf(f, ",\"args\":{\"%s\":%u}", pointInfo[e->point].argName, e->arg);
+			}
+		}
+		fprintf(f, "}");
+		nWritten++;
+	}
+	fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+	if (fclose(f) != 0) return -1;
+	return nWritten;
+}
+
+void traceExit(void) {
+	traceActive = 0;
+	free(ring);
+	ring = NULL;
+}
@@ -0,0 +1,70 @@
+/* Static tracepoints and span recording for the hot path
+ *
+ * Each TRACE_BEGIN/TRACE_END/TRACE_MARK is two things:
+ *  - a USDT probe of the provider "plctool", if <sys/sdt.h> (systemtap-sdt-dev) is
+ *    available at build time. This is one nop in the code and an ELF note, perf and
+ *    bpftrace attach to it at runtime, e.g.
+ *      bpftrace -e 'usdt:./listen_to_eth:plctool:homeplug_entry { @[arg0] = count(); }'
+ *  - with -t, an entry in the span ring of trace.c. The ring is written as Chrome
+ *    trace-event JSON at exit or on key 'c', to be opened in chrome://tracing or Perfetto.
+ * Without -t the cost is one well-predicted branch per point.
+ */
+
+#ifndef TRACE_HEADER
+#define TRACE_HEADER
+
+#include <stdint.h>
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE_HAVE_SDT 1
+#endif
+#endif
+
+#ifdef TRACE_HAVE_SDT
+#define TRACE_SDT(probe, arg) DTRACE_PROBE1(plctool, probe, arg)
+#else
+#define TRACE_SDT(probe, arg) do { } while (0)
+#endif
+
+#define TRACE_RING_SIZE (1024*1024) /* events, 16 bytes each */
+
+/* the traced points */
+enum {
+	TRACE_RECEIVE,   /* a frame from the socket or io_uring, arg: length */
+	TRACE_DISPATCH,  /* data_process(), arg: ethertype */
+	TRACE_HOMEPLUG,  /* processHomeplugFrame(), arg: mmtype */
+	TRACE_SETKEY,    /* sending the CM_SET_KEY.REQ, arg: 0 */
+	TRACE_LOG,       /* printToLogAndScreen(), arg: length */
+	TRACE_TRANSMIT,  /* sendto(), arg: length */
+	TRACE_NUMBER_OF_POINTS
+};
+
+#define TRACE_PHASE_BEGIN 'B'
+#define TRACE_PHASE_END 'E'
+#define TRACE_PHASE_MARK 'i'
+
+#define TRACE_BEGIN(point, probe, arg) do { \
+		TRACE_SDT(probe##_entry, arg); \
+		if (traceActive) traceRecord(point, TRACE_PHASE_BEGIN, arg); \
+	} while (0)
+#define TRACE_END(point, probe) do { \
+		TRACE_SDT(probe##_exit, 0); \
+		if (traceActive) traceRecord(point, TRACE_PHASE_END, 0); \
+	} while (0)
+#define TRACE_MARK(point, probe, arg) do { \
+		TRACE_SDT(probe, arg); \
+		if (traceActive) traceRecord(point, TRACE_PHASE_MARK, arg); \
+	} while (0)
+
+extern int traceActive;
+extern uint32_t nTraceEvents, nTraceOverwritten;
+
+int traceInit(const char *fileName);
+void traceRecord(int point, int phase, uint32_t arg);
+/* Writes the ring as Chrome trace-event JSON. Returns the number of events written, or -1. */
+int traceWriteChrome(void);
+void traceExit(void);
+
+#endif
@@ -0,0 +1,230 @@
+/* Transmit scheduler, see txsched.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <netinet/if_ether.h>
+
+#include "plc_homeplug.h"
+#include "stations.h" /* macToKey */
+#include "txsched.h"
+#include "clock.h"
+
+#define NO_ENTRY (-1)
+#define KEY_FREE 0xffffffffffffffffull /* never a 48-bit MAC */
+
+typedef struct tx_destination {
+	uint64_t key;      /* the MAC */
+	int64_t creditNs;  /* one frame costs intervalNs, may go negative for the critical class */
+	uint64_t lastNs;   /* of the last refill */
+	uint32_t nWaiting; /* frames in the queue, of all classes */
+} tx_destination;
+
+typedef struct tx_entry {
+	int16_t next;
+	int16_t destination;
+	uint16_t len;
+	uint64_t enqueueNs;
+	unsigned char data[TXSCHED_FRAME_SIZE];
+} tx_entry;
+
+txsched_class_stats txSchedStats[TXSCHED_NUMBER_OF_CLASSES];
+uint32_t nTxWaiting, nTxDestinationResets;
+
+static txsched_send_function sendFunction;
+static int64_t intervalNs, maxCreditNs;
+static tx_destination destinations[TXSCHED_MAX_DESTINATIONS];
+static uint32_t nDestinations;
+static tx_entry entries[TXSCHED_QUEUE_LEN];
+static int16_t freeEntries = NO_ENTRY;
+static int16_t head[TXSCHED_NUMBER_OF_CLASSES], tail[TXSCHED_NUMBER_OF_CLASSES];
+
+static const char *classNames[TXSCHED_NUMBER_OF_CLASSES] = { "critical", "control", "bulk" };
+
+const char *txSchedClassName(int txClass) {
+	return classNames[txClass];
+}
+
+static void resetDestinations(void) {
+	uint32_t i;
+	for (i=0; i<TXSCHED_MAX_DESTINATIONS; i++) destinations[i].key = KEY_FREE;
+	nDestinations = 0;
+}
+
+void txSchedInit(txsched_send_function send, uint32_t ratePerSecond, uint32_t burst) {
+	int i;
+	sendFunction = send;
+	if (ratePerSecond == 0) ratePerSecond = TXSCHED_DEFAULT_RATE;
+	if (burst == 0) burst = 1;
+	intervalNs = 1000000000ll / ratePerSecond;
+	maxCreditNs = (int64_t)burst * intervalNs;
+	resetDestinations();
+	memset(txSchedStats, 0, sizeof(txSchedStats));
+	for (i=0; i<TXSCHED_NUMBER_OF_CLASSES; i++) head[i] = tail[i] = NO_ENTRY;
+	freeEntries = NO_ENTRY;
+	for (i=TXSCHED_QUEUE_LEN-1; i>=0; i--) {
+		entries[i].next = freeEntries;
+		freeEntries = i;
+	}
+	nTxWaiting = 0;
+}
+
+/* Open addressing: the entry of the key, or the free entry where it belongs */
+static uint32_t probe(uint64_t key) {
+	uint32_t i = (uint32_t)((key * 0x9e3779b97f4a7c15ull) >> 32) & (TXSCHED_MAX_DESTINATIONS - 1);
+	while ((destinations[i].key != key) && (destinations[i].key != KEY_FREE)) {
+		i = (i + 1) & (TXSCHED_MAX_DESTINATIONS - 1);
+	}
+	return i;
+}
+
+/* The table is half full: it starts again with the destinations which have frames
+   in the queue. The others are forgotten, with their debts. */
+static void compactDestinations(void) {
+	static tx_destination old[TXSCHED_MAX_DESTINATIONS];
+	static int16_t newIndex[TXSCHED_MAX_DESTINATIONS];
+	uint32_t i, j;
+	int c, e;
+	memcpy(old, destinations, sizeof(old));
+	resetDestinations();
+	for (i=0; i<TXSCHED_MAX_DESTINATIONS; i++) {
+		if ((old[i].key == KEY_FREE) || (old[i].nWaiting == 0)) continue;
+		j = probe(old[i].key);
+		destinations[j] = old[i];
+		newIndex[i] = j;
+		nDestinations++;
+	}
+	for (c=0; c<TXSCHED_NUMBER_OF_CLASSES; c++) {
+		for (e=head[c]; e!=NO_ENTRY; e=entries[e].next) entries[e].destination = newIndex[entries[e].destination];
+	}
+	nTxDestinationResets++;
+}
+
+/* The bucket of the destination, a new one has full credit. */
+static int findDestination(const uint8_t *mac, uint64_t now) {
+	uint64_t key = macToKey(mac);
+	uint32_t i = probe(key);
+	if (destinations[i].key == key) return i;
+	if (nDestinations >= TXSCHED_MAX_DESTINATIONS/2) {
+		/* at most TXSCHED_QUEUE_LEN destinations have frames waiting */
+		compactDestinations();
+		i = probe(key);
+	}
+	destinations[i].key = key;
+	destinations[i].creditNs = maxCreditNs;
+	destinations[i].lastNs = now;
+	destinations[i].nWaiting = 0;
+	nDestinations++;
+	return i;
+}
+
+static void refill(tx_destination *d, uint64_t now) {
+	d->creditNs += (int64_t)(now - d->lastNs);
+	if (d->creditNs > maxCreditNs) d->creditNs = maxCreditNs;
+	d->lastNs = now;
+}
+
+static int transmit(const void *frame, int len, int txClass, uint64_t enqueueNs, uint64_t now) {
+	txsched_class_stats *s = &txSchedStats[txClass];
+	uint64_t delay = now - enqueueNs;
+	if (sendFunction(frame, len) < 0) {
+		s->nSendFailed++;
+		return -1;
+	}
+	s->nSent++;
+	s->sumDelayNs += delay;
+	if (delay > s->maxDelayNs) s->maxDelayNs = delay;
+	return 1;
+}
+
+/* Unlinks the newest frame of the lowest class below txClass. Returns 0 if there is none. */
+static int dropLowerFrame(int txClass) {
+	int c, e, prev;
+	for (c=TXSCHED_NUMBER_OF_CLASSES-1; c>txClass; c--) {
+		if (head[c] == NO_ENTRY) continue;
+		for (prev=NO_ENTRY, e=head[c]; e!=tail[c]; prev=e, e=entries[e].next) { }
+		if (prev == NO_ENTRY) head[c] = NO_ENTRY; else entries[prev].next = NO_ENTRY;
+		tail[c] = prev;
+		destinations[entries[e].destination].nWaiting--;
+		entries[e].next = freeEntries;
+		freeEntries = e;
+		nTxWaiting--;
+		txSchedStats[c].nDropped++;
+		return 1;
+	}
+	return 0;
+}
+
+int txSchedSend(const void *frame, int len, int txClass) {
+	const struct ethhdr *eh = (const struct ethhdr *)frame;
+	uint64_t now = clockMonotonicNs();
+	tx_destination *d;
+	tx_entry *entry;
+	int dest, e;
+	if ((len < (int)sizeof(struct ethhdr)) || (len > TXSCHED_FRAME_SIZE)) return -1;
+	dest = findDestination(eh->h_dest, now);
+	d = &destinations[dest];
+	refill(d, now);
+	if (txClass == TXSCHED_CRITICAL) {
+		/* at once, the token is borrowed */
+		d->creditNs -= intervalNs;
+		if (d->creditNs < -maxCreditNs) d->creditNs = -maxCreditNs;
+		return transmit(frame, len, txClass, now, now);
+	}
+	if ((d->nWaiting == 0) && (d->creditNs >= intervalNs)) {
+		d->creditNs -= intervalNs;
+		return transmit(frame, len, txClass, now, now);
+	}
+	/* it has to wait */
+	if ((freeEntries == NO_ENTRY) && !dropLowerFrame(txClass)) {
+		txSchedStats[txClass].nDropped++;
+		return -1;
+	}
+	e = freeEntries;
+	entry = &entries[e];
+	freeEntries = entry->next;
+	entry->next = NO_ENTRY;
+	entry->destination = dest;
+	entry->len = len;
+	entry->enqueueNs = now;
+	memcpy(entry->data, frame, len);
+	if (tail[txClass] == NO_ENTRY) head[txClass] = e; else entries[tail[txClass]].next = e;
+	tail[txClass] = e;
+	d->nWaiting++;
+	nTxWaiting++;
+	txSchedStats[txClass].nQueued++;
+	return 0;
+}
+
+int txSchedService(void) {
+	uint64_t now;
+	int c, e, next, prev, n = 0;
+	if (nTxWaiting == 0) return 0;
+	now = clockMonotonicNs();
+	for (c=0; c<TXSCHED_NUMBER_OF_CLASSES; c++) {
+		for (prev=NO_ENTRY, e=head[c]; e!=NO_ENTRY; e=next) {
+			tx_entry *entry = &entries[e];
+			tx_destination *d = &destinations[entry->destination];
+			next = entry->next;
+			refill(d, now);
+			if (d->creditNs < intervalNs) {
+				/* this modem has to wait, the next frames to it as well, since the credit
+				   only goes down in this pass */
+				prev = e;
+				continue;
+			}
+			d->creditNs -= intervalNs;
+			transmit(entry->data, entry->len, c, entry->enqueueNs, now);
+			/* unlink */
+			if (prev == NO_ENTRY) head[c] = next; else entries[prev].next = next;
+			if (tail[c] == e) tail[c] = prev;
+			d->nWaiting--;
+			entry->next = freeEntries;
+			freeEntries = e;
+			nTxWaiting--;
+			n++;
+		}
+	}
+	return n;
+}
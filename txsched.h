@@ -0,0 +1,62 @@
+/* Transmit scheduler: priority classes and a rate limit per destination modem
+ *
+ * All frames of listen_to_eth go out through txSchedSend(), which calls the one
+ * sendto() of the program. The frames have a class:
+ *   - TXSCHED_CRITICAL: the CM_SET_KEY.REQ after the SLAC match. It is sent at
+ *     once, before anything queued. It still takes its token, the bucket may go
+ *     into debt, so the frames which follow are delayed instead.
+ *   - TXSCHED_CONTROL: requests of the operator and of the request/response API.
+ *   - TXSCHED_BULK: queries which may wait.
+ * Each destination MAC has a token bucket (rate frames per second, burst frames),
+ * so that a modem is not flooded. A frame which has no token, or which would
+ * overtake an earlier frame to the same modem, waits in a bounded queue (one FIFO
+ * per class). txSchedService() sends the waiting frames, the higher class first,
+ * and skips the modems without tokens, so one slow modem does not block the others.
+ * If the queue is full, a new frame replaces the newest frame of a lower class,
+ * or it is dropped.
+ * Per class, the sent and dropped frames and the queueing delay are counted.
+ * The replay (-r) has its own sendmmsg(), it must keep the timing of the capture.
+ */
+
+#ifndef TXSCHED_HEADER
+#define TXSCHED_HEADER
+
+#include <stdint.h>
+
+#define TXSCHED_QUEUE_LEN 256
+#define TXSCHED_FRAME_SIZE 1536
+#define TXSCHED_MAX_DESTINATIONS 1024 /* power of two, more than twice TXSCHED_QUEUE_LEN */
+#define TXSCHED_DEFAULT_RATE 100 /* frames per second and destination */
+#define TXSCHED_DEFAULT_BURST 10
+
+enum {
+	TXSCHED_CRITICAL,
+	TXSCHED_CONTROL,
+	TXSCHED_BULK,
+	TXSCHED_NUMBER_OF_CLASSES
+};
+
+typedef struct txsched_class_stats {
+	uint32_t nSent;
+	uint32_t nQueued;     /* had to wait */
+	uint32_t nDropped;    /* queue full, or replaced by a frame of a higher class */
+	uint32_t nSendFailed;
+	uint64_t sumDelayNs;  /* from txSchedSend() to sendto(), of the sent frames */
+	uint64_t maxDelayNs;
+} txsched_class_stats;
+
+/* Sends the frame, returns <0 on error */
+typedef int (*txsched_send_function)(const void *frame, int len);
+
+extern txsched_class_stats txSchedStats[TXSCHED_NUMBER_OF_CLASSES];
+extern uint32_t nTxWaiting;          /* frames in the queue */
+extern uint32_t nTxDestinationResets; /* the destination table was half full and was compacted */
+
+void txSchedInit(txsched_send_function send, uint32_t ratePerSecond, uint32_t burst);
+/* Returns 1 if the frame was sent, 0 if it is queued, -1 if it was dropped or sending failed. */
+int txSchedSend(const void *frame, int len, int txClass);
+/* Sends the queued frames which have their tokens. Returns their number. */
+int txSchedService(void);
+const char *txSchedClassName(int txClass);
+
+#endif
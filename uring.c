@@ -0,0 +1,410 @@
+/* io_uring backend for reception and file writing, see uring.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "uring.h"
+
+int uringActive;
+uint32_t nUringEnter, nUringFrames, nUringWrites, nUringRearm, nUringWriteWaits, nUringDeferred, nUringRxDropped;
+
+/* user_data of the submissions: the kind of operation in the upper bits */
+#define UD_RECV    0x100000000ull
+#define UD_PROVIDE 0x200000000ull
+#define UD_WRITE   0x300000000ull
+#define UD_CANCEL  0x400000000ull
+#define UD_KIND_MASK 0xF00000000ull
+
+#define RX_BUFFER_GROUP 1
+
+typedef struct uring_writer {
+	int fd;
+	unsigned char *buf[2];
+	unsigned fill; /* fill level of the active buffer */
+	int active; /* index of the buffer which is filled by the application */
+	int inFlight; /* a write of the other buffer is running */
+	unsigned inFlightLen, inFlightDone;
+} uring_writer;
+
+static int ringFd = -1;
+static int rxSocket;
+static unsigned sqEntries, *sqHead, *sqTail, *sqMask, *sqArray;
+static unsigned *cqHead, *cqTail, *cqMask;
+static struct io_uring_sqe *sqes;
+static struct io_uring_cqe *cqes;
+static void *sqRingPtr, *cqRingPtr;
+static size_t sqRingSize, cqRingSize, sqesSize;
+static unsigned toSubmit;
+static unsigned char *rxBuffers;
+static uring_writer writers[URING_MAX_WRITERS];
+static int nWriters;
+static int recvArmed;
+static int recvStopped; /* uringStopReceive() */
+/* Frames which completed while uringWrite() waited for the kernel. They keep
+   their buffer and are given to the callback by the next uringPoll(). A queue,
+   the ones from deferredFirst on are still to be delivered. */
+static struct { unsigned bid; int len; } deferred[URING_RX_BUFFERS];
+static int deferredFirst, nDeferredFrames;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(unsigned submit, unsigned minComplete, unsigned flags, void *arg, size_t argSize) {
+	nUringEnter++;
+	return (int)syscall(__NR_io_uring_enter, ringFd, submit, minComplete, flags, arg, argSize);
+}
+
+static int submitAndWait(unsigned minComplete, int timeoutMs) {
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	int r;
+	memset(&arg, 0, sizeof(arg));
+	ts.tv_sec = timeoutMs / 1000;
+	ts.tv_nsec = (timeoutMs % 1000) * 1000000;
+	arg.sigmask_sz = _NSIG / 8;
+	arg.ts = (uint64_t)(uintptr_t)&ts;
+	r = sys_io_uring_enter(toSubmit, minComplete, (minComplete ? IORING_ENTER_GETEVENTS : 0) | IORING_ENTER_EXT_ARG,
+		&arg, sizeof(arg));
+	if (r >= 0) {
+		toSubmit -= r;
+	} else if ((errno == ETIME) || (errno == EINTR)) {
+		r = 0;
+	}
+	return r;
+}
+
+static struct io_uring_sqe *getSqe(void) {
+	unsigned tail = *sqTail;
+	unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+	struct io_uring_sqe *sqe;
+	if (tail - head >= sqEntries) {
+		/* submission queue is full. Give it to the kernel, and try again. */
+		submitAndWait(0, 0);
+		head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+		if (tail - head >= sqEntries) return NULL;
+	}
+	sqe = &sqes[tail & *sqMask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqArray[tail & *sqMask] = tail & *sqMask;
+	__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+	toSubmit++;
+	return sqe;
+}
+
+static void provideBuffers(unsigned firstBid, unsigned count) {
+	struct io_uring_sqe *sqe = getSqe();
+	if (!sqe) return;
+	sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+	sqe->fd = count;
+	sqe->addr = (uint64_t)(uintptr_t)(rxBuffers + firstBid * URING_RX_BUFFER_SIZE);
+	sqe->len = URING_RX_BUFFER_SIZE;
+	sqe->off = firstBid;
+	sqe->buf_group = RX_BUFFER_GROUP;
+	sqe->user_data = UD_PROVIDE;
+}
+
+static void armRecv(void) {
+	struct io_uring_sqe *sqe = getSqe();
+	if (!sqe) return;
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = rxSocket;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = RX_BUFFER_GROUP;
+	sqe->user_data = UD_RECV;
+	recvArmed = 1;
+	nUringRearm++;
+}
+
+static void startWrite(int w) {
+	uring_writer *wr = &writers[w];
+	struct io_uring_sqe *sqe;
+	unsigned char *data = wr->buf[wr->active ^ 1];
+	sqe = getSqe();
+	if (!sqe) return;
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = wr->fd;
+	sqe->addr = (uint64_t)(uintptr_t)(data + wr->inFlightDone);
+	sqe->len = wr->inFlightLen - wr->inFlightDone;
+	sqe->off = (uint64_t)-1; /* use and advance the file position */
+	sqe->user_data = UD_WRITE | w;
+	wr->inFlight = 1;
+	nUringWrites++;
+}
+
+/* Hands the filled buffer over to the kernel, if the other one is free. */
+static void flushWriter(int w) {
+	uring_writer *wr = &writers[w];
+	if (wr->inFlight || (wr->fill == 0)) return;
+	wr->inFlightLen = wr->fill;
+	wr->inFlightDone = 0;
+	wr->active ^= 1;
+	wr->fill = 0;
+	startWrite(w);
+}
+
+/* The callback may write and so defer more frames, they are appended and
+   delivered in the same loop. */
+static int deliverDeferred(uring_frame_callback onFrame) {
+	int n = 0;
+	while (deferredFirst < nDeferredFrames) {
+		unsigned bid = deferred[deferredFirst].bid;
+		int len = deferred[deferredFirst].len;
+		deferredFirst++;
+		onFrame(rxBuffers + bid * URING_RX_BUFFER_SIZE, len);
+		nUringFrames++;
+		provideBuffers(bid, 1);
+		n++;
+	}
+	deferredFirst = nDeferredFrames = 0;
+	return n;
+}
+
+/* Returns 0 if the queue is full. The delivered ones at its start gave their buffer
+   back, so after moving the rest down there is a place for each buffer. */
+static int deferFrame(unsigned bid, int len) {
+	if ((nDeferredFrames == URING_RX_BUFFERS) && (deferredFirst > 0)) {
+		memmove(deferred, deferred + deferredFirst, (nDeferredFrames - deferredFirst) * sizeof(deferred[0]));
+		nDeferredFrames -= deferredFirst;
+		deferredFirst = 0;
+	}
+	if (nDeferredFrames == URING_RX_BUFFERS) return 0;
+	deferred[nDeferredFrames].bid = bid;
+	deferred[nDeferredFrames].len = len;
+	nDeferredFrames++;
+	return 1;
+}
+
+/* The frame callback may write, and uringWrite() calls us again (without callback)
+   while it waits. So each CQE is taken out of the ring before it is handled, and the
+   head and tail are read again for the next one: the nested call consumes the CQEs
+   behind it, and defers their frames. */
+static int processCompletions(uring_frame_callback onFrame) {
+	int nFrames = 0;
+	for (;;) {
+		unsigned head = *cqHead;
+		struct io_uring_cqe c, *cqe = &c;
+		uint64_t kind;
+		if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) break;
+		c = cqes[head & *cqMask];
+		__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+		kind = cqe->user_data & UD_KIND_MASK;
+		if (kind == UD_RECV) {
+			if (cqe->flags & IORING_CQE_F_BUFFER) {
+				unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+				if ((cqe->res > 0) && onFrame) {
+					if (nDeferredFrames > deferredFirst) nFrames += deliverDeferred(onFrame); /* they are older */
+					onFrame(rxBuffers + bid * URING_RX_BUFFER_SIZE, cqe->res);
+					nFrames++;
+					nUringFrames++;
+					provideBuffers(bid, 1); /* give the buffer back to the kernel */
+				} else if ((cqe->res > 0) && deferFrame(bid, cqe->res)) {
+					/* no callback here (uringWrite), the buffer stays with us until uringPoll() */
+					nUringDeferred++;
+				} else {
+					if (cqe->res > 0) nUringRxDropped++;
+					provideBuffers(bid, 1);
+				}
+			}
+			if (!(cqe->flags & IORING_CQE_F_MORE)) {
+				/* The multishot ended, e.g. because all buffers were in use (ENOBUFS). */
+				recvArmed = 0;
+			}
+		} else if (kind == UD_WRITE) {
+			int w = cqe->user_data & 0xff;
+			uring_writer *wr = &writers[w];
+			wr->inFlight = 0;
+			if (cqe->res > 0) {
+				wr->inFlightDone += cqe->res;
+				if (wr->inFlightDone < wr->inFlightLen) startWrite(w); /* short write, continue */
+			} else if (cqe->res < 0) {
+				fprintf(stderr, "io_uring write failed: %s\n", strerror(-cqe->res));
+			}
+		}
+	}
+	return nFrames;
+}
+
+int uringInit(int rxFd) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	ringFd = sys_io_uring_setup(URING_ENTRIES, &p);
+	if (ringFd < 0) return -1;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+		close(ringFd);
+		ringFd = -1;
+		return -2; /* kernel too old */
+	}
+	sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (cqRingSize > sqRingSize) sqRingSize = cqRingSize;
+	cqRingSize = sqRingSize;
+	sqRingPtr = mmap(0, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+	if (sqRingPtr == MAP_FAILED) {
+		close(ringFd);
+		ringFd = -1;
+		return -3;
+	}
+	cqRingPtr = sqRingPtr;
+	sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = mmap(0, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		munmap(sqRingPtr, sqRingSize);
+		close(ringFd);
+		ringFd = -1;
+		return -3;
+	}
+	sqEntries = p.sq_entries;
+	sqHead = (unsigned *)((char *)sqRingPtr + p.sq_off.head);
+	sqTail = (unsigned *)((char *)sqRingPtr + p.sq_off.tail);
+	sqMask = (unsigned *)((char *)sqRingPtr + p.sq_off.ring_mask);
+	sqArray = (unsigned *)((char *)sqRingPtr + p.sq_off.array);
+	cqHead = (unsigned *)((char *)cqRingPtr + p.cq_off.head);
+	cqTail = (unsigned *)((char *)cqRingPtr + p.cq_off.tail);
+	cqMask = (unsigned *)((char *)cqRingPtr + p.cq_off.ring_mask);
+	cqes = (struct io_uring_cqe *)((char *)cqRingPtr + p.cq_off.cqes);
+
+	rxBuffers = malloc(URING_RX_BUFFERS * URING_RX_BUFFER_SIZE);
+	if (!rxBuffers) {
+		uringExit();
+		return -4;
+	}
+	rxSocket = rxFd;
+	provideBuffers(0, URING_RX_BUFFERS);
+	armRecv();
+	/* Check that the kernel accepts the multishot recv. Older kernels
+	   complete it immediately with -EINVAL. */
+	if (submitAndWait(0, 0) < 0) {
+		uringExit();
+		return -5;
+	}
+	usleep(1000);
+	{
+		unsigned head = *cqHead;
+		unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			struct io_uring_cqe *cqe = &cqes[head & *cqMask];
+			if (cqe->res == -EINVAL) {
+				uringExit();
+				return -6;
+			}
+		}
+	}
+	uringActive = 1;
+	return 0;
+}
+
+int uringWriterOpen(int fd) {
+	uring_writer *wr;
+	if (!uringActive || (nWriters >= URING_MAX_WRITERS)) return -1;
+	wr = &writers[nWriters];
+	memset(wr, 0, sizeof(*wr));
+	wr->buf[0] = malloc(URING_WRITE_BUFFER_SIZE);
+	wr->buf[1] = malloc(URING_WRITE_BUFFER_SIZE);
+	if (!wr->buf[0] || !wr->buf[1]) {
+		free(wr->buf[0]);
+		free(wr->buf[1]);
+		return -1;
+	}
+	wr->fd = fd;
+	return nWriters++;
+}
+
+void uringWrite(int w, const void *data, unsigned len) {
+	uring_writer *wr = &writers[w];
+	while (len > 0) {
+		unsigned n = URING_WRITE_BUFFER_SIZE - wr->fill;
+		if (n == 0) {
+			/* Both buffers are full. We have to wait for the kernel. */
+			nUringWriteWaits++;
+			while (wr->inFlight) {
+				if (submitAndWait(1, 100) < 0) return;
+				processCompletions(NULL); /* frames which arrive here are deferred */
+			}
+			flushWriter(w);
+			continue;
+		}
+		if (n > len) n = len;
+		memcpy(wr->buf[wr->active] + wr->fill, data, n);
+		wr->fill += n;
+		data = (const unsigned char *)data + n;
+		len -= n;
+	}
+}
+
+int uringPoll(int timeoutMs, uring_frame_callback onFrame) {
+	int w, r;
+	for (w = 0; w < nWriters; w++) flushWriter(w);
+	if (!recvArmed && !recvStopped) armRecv();
+	r = submitAndWait((nDeferredFrames > deferredFirst) ? 0 : 1, timeoutMs);
+	if (r < 0) return r;
+	r = deliverDeferred(onFrame); /* they are older than the ones in the queue */
+	return r + processCompletions(onFrame);
+}
+
+int uringStopReceive(uring_frame_callback onFrame) {
+	struct io_uring_sqe *sqe;
+	int n = 0, tries = 0;
+	recvStopped = 1;
+	if (ringFd < 0) return 0;
+	n = deliverDeferred(onFrame);
+	if (recvArmed) {
+		sqe = getSqe();
+		if (!sqe) return -1;
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = UD_RECV;
+		sqe->user_data = UD_CANCEL;
+	}
+	/* the multishot recv ends with a completion without IORING_CQE_F_MORE */
+	while (recvArmed && (tries++ < 100)) {
+		int r = submitAndWait(1, 10);
+		if (r < 0) return r;
+		n += deliverDeferred(onFrame);
+		n += processCompletions(onFrame);
+	}
+	return recvArmed ? -1 : n;
+}
+
+void uringResumeReceive(void) {
+	recvStopped = 0;
+}
+
+void uringExit(void) {
+	int w, pending;
+	if (ringFd >= 0) {
+		/* write everything which is still in the buffers */
+		do {
+			pending = 0;
+			for (w = 0; w < nWriters; w++) {
+				flushWriter(w);
+				if (writers[w].inFlight || writers[w].fill) pending = 1;
+			}
+			if (pending) {
+				if (submitAndWait(1, 100) < 0) break;
+				processCompletions(NULL);
+			}
+		} while (pending);
+		nUringRxDropped += nDeferredFrames - deferredFirst; /* nobody takes them any more */
+		deferredFirst = nDeferredFrames = 0;
+		munmap(sqes, sqesSize);
+		munmap(sqRingPtr, sqRingSize);
+		close(ringFd);
+		ringFd = -1;
+	}
+	for (w = 0; w < nWriters; w++) {
+		free(writers[w].buf[0]);
+		free(writers[w].buf[1]);
+	}
+	nWriters = 0;
+	free(rxBuffers);
+	rxBuffers = NULL;
+	uringActive = 0;
+}
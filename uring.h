@@ -0,0 +1,53 @@
+/* io_uring backend for reception and file writing
+ *
+ * Instead of poll() + recvfrom() per frame and a blocking fprintf() + fflush()
+ * per log line, we use one io_uring:
+ *   - The receive socket is read with a multishot recv. The kernel picks the
+ *     receive buffers out of a group of provided buffers, so one submission
+ *     delivers frames as long as buffers are available.
+ *   - Log and capture files are written by queued write operations. Each file
+ *     has a double buffer: the application fills one buffer, while the other
+ *     one is written by the kernel. Only one write per file is in flight, so
+ *     the order of the data is kept.
+ * One io_uring_enter() per main loop iteration submits everything and collects
+ * all completions, so under load there are nearly no syscalls per frame.
+ *
+ * We talk to the kernel directly with the syscalls, liburing is not needed.
+ * If the kernel does not support io_uring or one of the needed features (multishot
+ * recv needs Linux 6.0), uringInit() fails and the caller uses the poll() loop.
+ */
+
+#ifndef URING_HEADER
+#define URING_HEADER
+
+#include <stdint.h>
+
+#define URING_ENTRIES 64 /* size of the submission queue */
+#define URING_RX_BUFFERS 64 /* number of provided receive buffers */
+#define URING_RX_BUFFER_SIZE 4096 /* larger frames are truncated */
+#define URING_MAX_WRITERS 4
+#define URING_WRITE_BUFFER_SIZE (256*1024) /* per writer, two of them */
+
+typedef void (*uring_frame_callback)(unsigned char *frame, int len);
+
+extern int uringActive; /* 1 if the io_uring backend is in use */
+extern uint32_t nUringEnter, nUringFrames, nUringWrites, nUringRearm, nUringWriteWaits;
+/* frames which completed while uringWrite() waited, delivered later; and the
+   ones which were lost because even the deferred list was full (or at exit) */
+extern uint32_t nUringDeferred, nUringRxDropped;
+
+int uringInit(int rxFd); /* 0 on success, negative if io_uring is not usable */
+int uringWriterOpen(int fd); /* returns a writer handle, or -1 */
+void uringWrite(int writer, const void *data, unsigned len);
+/* Submits the queued operations and waits up to timeoutMs for completions.
+   For each received frame, the callback is called. Returns the number of
+   received frames, or negative on fatal errors. */
+int uringPoll(int timeoutMs, uring_frame_callback onFrame);
+/* Cancels the receiving, and calls the callback for the frames which the kernel
+   has already put into the buffers. The next frames stay in the socket. Returns
+   the number of frames, or negative on errors. */
+int uringStopReceive(uring_frame_callback onFrame);
+void uringResumeReceive(void);
+void uringExit(void); /* writes all pending data and releases the ring */
+
+#endif
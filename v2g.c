@@ -0,0 +1,308 @@
+/* Decoding of the IPv6 traffic after SLAC: SDP and V2G, see v2g.h */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <netinet/if_ether.h>
+
+#include "v2g.h"
+
+#define IPV6_HEADER_LEN 40
+#define IPPROTO_HOPOPTS_ 0
+#define IPPROTO_TCP_ 6
+#define IPPROTO_UDP_ 17
+#define IPPROTO_ROUTING_ 43
+#define IPPROTO_FRAGMENT_ 44
+#define IPPROTO_DSTOPTS_ 60
+
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_RST 0x04
+#define TCP_ACK 0x10
+
+typedef struct tcp_stream {
+	uint8_t inUse;
+	uint8_t synced; /* nextSeq is valid */
+	uint8_t fromPev; /* the direction from the TCP client (PEV) to the server (EVSE) */
+	uint8_t directionKnown;
+	uint8_t srcIp[16], dstIp[16];
+	uint16_t srcPort, dstPort;
+	uint32_t nextSeq;
+	uint32_t lastUse;
+	int schema; /* negotiated with the supportedAppProtocol handshake */
+	int nOffered; /* the SchemaIDs which the client offered */
+	uint8_t offeredSchemaId[EXI_MAX_APP_PROTOCOLS];
+	int offeredSchema[EXI_MAX_APP_PROTOCOLS];
+	uint32_t fill;
+	uint8_t buf[V2G_STREAM_BUFFER_SIZE];
+} tcp_stream;
+
+uint32_t nV2gIpv6Frames, nV2gSdp, nV2gMessages, nV2gDecodeErrors, nV2gTcpGaps, nV2gStreamOverflows;
+static tcp_stream streams[V2G_MAX_STREAMS];
+static uint32_t useCounter;
+static v2g_event_callback eventCallback;
+
+void v2gSetEventCallback(v2g_event_callback cb) {
+	eventCallback = cb;
+}
+
+static uint16_t get16(const uint8_t *p) {
+	return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static uint32_t get32(const uint8_t *p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static int isV2gtpHeader(const uint8_t *p) {
+	return (p[0] == V2GTP_VERSION) && (p[1] == (uint8_t)~V2GTP_VERSION);
+}
+
+static void report(v2g_event *ev) {
+	if (eventCallback) eventCallback(ev);
+}
+
+/*********************************************************************/
+/* SDP */
+
+static void processSdp(const struct ethhdr *eh, const uint8_t *p, int len) {
+	v2g_event ev;
+	uint16_t payloadType;
+	uint32_t payloadLen;
+	if ((len < V2GTP_HEADER_LEN) || !isV2gtpHeader(p)) return;
+	payloadType = get16(p + 2);
+	payloadLen = get32(p + 4);
+	if (payloadLen > (uint32_t)(len - V2GTP_HEADER_LEN)) return;
+	p += V2GTP_HEADER_LEN;
+	memset(&ev, 0, sizeof(ev));
+	ev.srcMac = eh->h_source;
+	ev.dstMac = eh->h_dest;
+	if ((payloadType == V2GTP_PAYLOAD_SDP_REQ) && (payloadLen >= 2)) {
+		ev.kind = V2G_EVENT_SDP_REQ;
+		ev.fromPev = 1;
+		ev.security = p[0];
+		ev.transport = p[1];
+	} else if ((payloadType == V2GTP_PAYLOAD_SDP_RES) && (payloadLen >= 20)) {
+		ev.kind = V2G_EVENT_SDP_RES;
+		memcpy(ev.seccAddress, p, 16);
+		ev.seccPort = get16(p + 16);
+		ev.security = p[18];
+		ev.transport = p[19];
+	} else {
+		return;
+	}
+	nV2gSdp++;
+	report(&ev);
+}
+
+/*********************************************************************/
+/* TCP reassembly */
+
+static tcp_stream *findStream(const uint8_t *srcIp, const uint8_t *dstIp, uint16_t srcPort, uint16_t dstPort, int create) {
+	int i, oldest = 0;
+	tcp_stream *s;
+	for (i = 0; i < V2G_MAX_STREAMS; i++) {
+		s = &streams[i];
+		if (s->inUse && (s->srcPort == srcPort) && (s->dstPort == dstPort) &&
+		    (memcmp(s->srcIp, srcIp, 16) == 0) && (memcmp(s->dstIp, dstIp, 16) == 0)) {
+			s->lastUse = ++useCounter;
+			return s;
+		}
+	}
+	if (!create) return NULL;
+	for (i = 0; i < V2G_MAX_STREAMS; i++) {
+		if (!streams[i].inUse) break;
+		if (streams[i].lastUse < streams[oldest].lastUse) oldest = i;
+	}
+	if (i == V2G_MAX_STREAMS) i = oldest;
+	s = &streams[i];
+	s->inUse = 1;
+	s->synced = 0;
+	s->directionKnown = 0;
+	s->fromPev = 0;
+	s->schema = EXI_SCHEMA_UNKNOWN;
+	s->nOffered = 0;
+	s->fill = 0;
+	memcpy(s->srcIp, srcIp, 16);
+	memcpy(s->dstIp, dstIp, 16);
+	s->srcPort = srcPort;
+	s->dstPort = dstPort;
+	s->lastUse = ++useCounter;
+	return s;
+}
+
+static int schemaOfNamespace(const char *ns) {
+	if (strstr(ns, "din:70121")) return EXI_SCHEMA_DIN;
+	if (strstr(ns, "iso:15118:2:2013")) return EXI_SCHEMA_ISO1;
+	return EXI_SCHEMA_UNKNOWN;
+}
+
+static void processV2gtpMessage(tcp_stream *s, const struct ethhdr *eh, const uint8_t *msg, uint32_t len) {
+	exi_decoded exi;
+	v2g_event ev;
+	tcp_stream *reverse;
+	int i;
+	if ((len < V2GTP_HEADER_LEN) || (get16(msg + 2) != V2GTP_PAYLOAD_EXI)) return;
+	memset(&ev, 0, sizeof(ev));
+	ev.srcMac = eh->h_source;
+	ev.dstMac = eh->h_dest;
+	ev.v2gtpLength = len;
+	ev.exi = &exi;
+	msg += V2GTP_HEADER_LEN;
+	len -= V2GTP_HEADER_LEN;
+	/* The first bit after the EXI header tells us the grammar: the root event
+	   code of the handshake is 0 or 1 (2 bits), the one of V2G_Message is 76 or 77 (7 bits). */
+	if ((len < 2) || (exiDecode(msg, len, !(msg[1] & 0x80), s->schema, &exi) < 0)) {
+		nV2gDecodeErrors++;
+		ev.kind = V2G_EVENT_UNDECODED;
+		ev.fromPev = s->fromPev;
+		report(&ev);
+		return;
+	}
+	nV2gMessages++;
+	ev.kind = V2G_EVENT_EXI;
+	reverse = findStream(s->dstIp, s->srcIp, s->dstPort, s->srcPort, 0);
+	if (exi.kind == EXI_DECODED_APPHAND_REQ) {
+		s->fromPev = 1;
+		s->directionKnown = 1;
+		s->nOffered = exi.nAppProtocols;
+		for (i = 0; i < exi.nAppProtocols; i++) {
+			s->offeredSchemaId[i] = exi.appProtocol[i].schemaId;
+			s->offeredSchema[i] = schemaOfNamespace(exi.appProtocol[i].protocolNamespace);
+		}
+	} else if ((exi.kind == EXI_DECODED_APPHAND_RES) && exi.schemaIdPresent && reverse) {
+		/* The EVSE selected one of the offered schemas. This is valid for both directions. */
+		s->fromPev = 0;
+		s->directionKnown = 1;
+		for (i = 0; i < reverse->nOffered; i++) {
+			if (reverse->offeredSchemaId[i] == exi.schemaId) {
+				s->schema = reverse->schema = reverse->offeredSchema[i];
+			}
+		}
+	} else if ((exi.kind == EXI_DECODED_V2G_MESSAGE) && !s->directionKnown && (exi.bodyType >= 0)) {
+		/* we missed the connection setup. The name tells the direction. */
+		size_t n = strlen(exi.name);
+		s->fromPev = (n > 3) && (strcmp(exi.name + n - 3, "Req") == 0);
+		s->directionKnown = 1;
+	}
+	ev.fromPev = s->fromPev;
+	report(&ev);
+}
+
+/* Takes the complete V2GTP messages out of the stream buffer. */
+static void extractMessages(tcp_stream *s, const struct ethhdr *eh) {
+	uint32_t payloadLen, msgLen;
+	while (s->fill >= V2GTP_HEADER_LEN) {
+		if (!isV2gtpHeader(s->buf)) {
+			/* lost the message boundaries (gap or we joined in the middle): wait for a new start */
+			s->fill = 0;
+			return;
+		}
+		/* compare before adding, a length near 2^32 would wrap */
+		payloadLen = get32(s->buf + 4);
+		if (payloadLen > V2G_STREAM_BUFFER_SIZE - V2GTP_HEADER_LEN) {
+			nV2gStreamOverflows++;
+			s->fill = 0;
+			s->synced = 0;
+			return;
+		}
+		msgLen = V2GTP_HEADER_LEN + payloadLen;
+		if (s->fill < msgLen) return; /* wait for more segments */
+		processV2gtpMessage(s, eh, s->buf, msgLen);
+		s->fill -= msgLen;
+		memmove(s->buf, s->buf + msgLen, s->fill);
+	}
+}
+
+static void appendToStream(tcp_stream *s, const uint8_t *data, uint32_t len) {
+	if (s->fill + len > V2G_STREAM_BUFFER_SIZE) {
+		nV2gStreamOverflows++;
+		s->fill = 0;
+		if (len > V2G_STREAM_BUFFER_SIZE) return;
+	}
+	memcpy(s->buf + s->fill, data, len);
+	s->fill += len;
+}
+
+static void processTcp(const struct ethhdr *eh, const uint8_t *ip6, const uint8_t *p, int len) {
+	tcp_stream *s;
+	uint16_t srcPort, dstPort;
+	uint32_t seq, headerLen, payloadLen, skip;
+	uint8_t flags;
+	if (len < 20) return;
+	srcPort = get16(p);
+	dstPort = get16(p + 2);
+	seq = get32(p + 4);
+	headerLen = (p[12] >> 4) * 4;
+	flags = p[13];
+	if ((headerLen < 20) || ((int)headerLen > len)) return;
+	payloadLen = len - headerLen;
+	s = findStream(ip6 + 8, ip6 + 24, srcPort, dstPort, (flags & TCP_SYN) || (payloadLen > 0));
+	if (!s) return;
+	if (flags & TCP_RST) {
+		s->inUse = 0;
+		return;
+	}
+	if (flags & TCP_SYN) {
+		s->nextSeq = seq + 1;
+		s->synced = 1;
+		s->fill = 0;
+		s->fromPev = !(flags & TCP_ACK); /* the PEV is the client */
+		s->directionKnown = 1;
+	}
+	if (payloadLen > 0) {
+		p += headerLen;
+		if (!s->synced) {
+			s->nextSeq = seq;
+			s->synced = 1;
+			s->fill = 0;
+		}
+		if ((int32_t)(seq - s->nextSeq) > 0) {
+			/* segment(s) lost. Continue with this one, the header check finds the next message start. */
+			nV2gTcpGaps++;
+			s->fill = 0;
+			s->nextSeq = seq;
+		}
+		skip = s->nextSeq - seq; /* retransmitted part, which we already have */
+		if ((int32_t)skip >= 0 && skip < payloadLen) {
+			appendToStream(s, p + skip, payloadLen - skip);
+			s->nextSeq = seq + payloadLen;
+			extractMessages(s, eh);
+		}
+	}
+	if (flags & TCP_FIN) s->inUse = 0;
+}
+
+/*********************************************************************/
+
+void v2gProcessIpv6Frame(const unsigned char *frame, int len) {
+	const struct ethhdr *eh = (const struct ethhdr *)frame;
+	const uint8_t *ip6 = frame + sizeof(struct ethhdr);
+	const uint8_t *p, *end;
+	uint8_t nextHeader;
+	uint16_t payloadLen;
+	nV2gIpv6Frames++;
+	len -= sizeof(struct ethhdr);
+	if ((len < IPV6_HEADER_LEN) || ((ip6[0] >> 4) != 6)) return;
+	payloadLen = get16(ip6 + 4);
+	if (payloadLen > len - IPV6_HEADER_LEN) return; /* truncated */
+	end = ip6 + IPV6_HEADER_LEN + payloadLen; /* ignore the ethernet padding */
+	nextHeader = ip6[6];
+	p = ip6 + IPV6_HEADER_LEN;
+	/* skip the extension headers */
+	while ((nextHeader == IPPROTO_HOPOPTS_) || (nextHeader == IPPROTO_ROUTING_) || (nextHeader == IPPROTO_DSTOPTS_)) {
+		if (p + 8 > end) return;
+		nextHeader = p[0];
+		p += (p[1] + 1) * 8;
+	}
+	if ((nextHeader == IPPROTO_FRAGMENT_) || (p > end)) return; /* V2G does not use fragments */
+	if (nextHeader == IPPROTO_UDP_) {
+		if (end - p < 8) return;
+		if ((get16(p) == V2G_UDP_SDP_PORT) || (get16(p + 2) == V2G_UDP_SDP_PORT)) {
+			processSdp(eh, p + 8, end - p - 8);
+		}
+	} else if (nextHeader == IPPROTO_TCP_) {
+		processTcp(eh, ip6, p, end - p);
+	}
+}
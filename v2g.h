@@ -0,0 +1,58 @@
+/* Decoding of the IPv6 traffic after SLAC: SDP and V2G (ISO15118-2 / DIN70121)
+ *
+ *  - SECC Discovery Protocol: UDP port 15118, V2GTP payload types 0x9000/0x9001
+ *  - V2G over TCP: the TCP segments are reassembled per direction of each connection,
+ *    and the V2GTP messages (payload type 0x8001, EXI) are given to the EXI decoder.
+ * The first message on a connection is the supportedAppProtocol handshake, all
+ * further ones are V2G_Messages in the negotiated schema.
+ *
+ * All state is in fixed tables, there is no allocation on the receive path.
+ * Each decoded message is reported through the callback, together with the
+ * MAC addresses, so that the caller can correlate it with the SLAC session.
+ */
+
+#ifndef V2G_HEADER
+#define V2G_HEADER
+
+#include <stdint.h>
+#include "exi.h"
+
+#define V2G_UDP_SDP_PORT 15118
+#define V2GTP_HEADER_LEN 8
+#define V2GTP_VERSION 0x01
+#define V2GTP_PAYLOAD_EXI 0x8001
+#define V2GTP_PAYLOAD_SDP_REQ 0x9000
+#define V2GTP_PAYLOAD_SDP_RES 0x9001
+
+#define V2G_MAX_STREAMS 16 /* TCP connection directions which are tracked at the same time */
+#define V2G_STREAM_BUFFER_SIZE 8192 /* the largest V2G messages (certificates) have some kB */
+
+enum {
+	V2G_EVENT_SDP_REQ,
+	V2G_EVENT_SDP_RES,
+	V2G_EVENT_EXI, /* look into the exi_decoded */
+	V2G_EVENT_UNDECODED
+};
+
+typedef struct v2g_event {
+	int kind;
+	const uint8_t *srcMac;
+	const uint8_t *dstMac;
+	int fromPev; /* 1 if the PEV is the sender */
+	/* SDP */
+	uint8_t security, transport;
+	uint8_t seccAddress[16];
+	uint16_t seccPort;
+	/* V2G */
+	const exi_decoded *exi;
+	uint32_t v2gtpLength;
+} v2g_event;
+
+typedef void (*v2g_event_callback)(const v2g_event *ev);
+
+extern uint32_t nV2gIpv6Frames, nV2gSdp, nV2gMessages, nV2gDecodeErrors, nV2gTcpGaps, nV2gStreamOverflows;
+
+void v2gSetEventCallback(v2g_event_callback cb);
+void v2gProcessIpv6Frame(const unsigned char *frame, int len);
+
+#endif